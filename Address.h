@@ -0,0 +1,37 @@
+#ifndef ADDRESS_H
+#define ADDRESS_H
+
+#include <string>
+
+using namespace std;
+
+/*
+    Address of an array element as the tree symbol + disp + base + index * scale
+    operand() folds it into the single x86 memory operand that computes it
+    An empty base with a symbol and no index is RIP-relative, with an index the symbol is
+    used as an absolute displacement (the generated code is linked with -no-pie)
+*/
+class Address {
+   public:
+    string symbol;  // .data/.bss array, empty for stack arrays and parameters
+    long disp;
+    string base;    // "%rbp", the pointer of an array parameter, or empty
+    string index;   // 64 bit register holding the sign extended index, or empty
+    int scale;
+
+    string operand() const {
+        string d = symbol;
+        if (disp != 0 || (symbol.empty() && base.empty() && index.empty())) {
+            d += (!symbol.empty() && disp > 0 ? "+" : "") + to_string(disp);
+        }
+        if (base.empty() && index.empty()) {
+            return d + "(%rip)";
+        }
+        if (index.empty()) {
+            return d + "(" + base + ")";
+        }
+        return d + "(" + base + ", " + index + ", " + to_string(scale) + ")";
+    }
+};
+
+#endif
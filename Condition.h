@@ -0,0 +1,25 @@
+#ifndef CONDITION_H
+#define CONDITION_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+    Parsed condition of an if or for statement
+    Either a single comparison "lhs op rhs" or a &&, || or ! over sub-conditions
+*/
+class Condition {
+   public:
+    string op;                   // "<", "<=", ">", ">=", "==", "!=", "&&", "||" or "!"
+    string lhs;                  // comparands, only used when op is a comparator
+    string rhs;
+    vector<Condition> operands;  // sub-conditions of &&, || and !
+
+    bool is_comparison() const {
+        return op != "&&" && op != "||" && op != "!";
+    }
+};
+
+#endif
@@ -9,6 +9,43 @@
 
 using namespace std;
 
+/*
+    Bookkeeping for one open { } block (if body, for loop) inside a function.
+    Lets the block's locals go out of scope at the closing } so their stack
+    slots can be handed out again to the next sibling block.
+*/
+class BlockScope {
+   public:
+    int addr_offset;                 // next free stack slot when the block was opened
+    vector<string> declared;         // names declared inside the block
+    map<string, Variable> shadowed;  // outer variables hidden by a declaration in the block
+};
+
+/*
+    Where a for loop's code landed in assembly_instructions, for --cost-report.
+    begin is the loop label, [begin, end) runs once per iteration, [latch, end) is the increment
+    and the loop test.
+*/
+class LoopInfo {
+   public:
+    string header;    // the for(...) source line
+    size_t begin;
+    size_t latch;
+    size_t end;
+    long trip_count;  // -1 when it is neither constant nor in the --profile-use profile
+};
+
+/*
+    An if body the --profile-use profile found unlikely, [begin, end) of assembly_instructions.
+    It is moved behind the function's code once the function is translated.
+*/
+class ColdBlock {
+   public:
+    size_t begin;
+    size_t end;
+    bool never_run;  // goes to .text.unlikely
+};
+
 class Function {
    public:
     string return_type;
@@ -16,7 +53,13 @@ class Function {
     vector<string> sourceCode;
     map<string, Variable> variables;
     vector<string> assembly_instructions;
+    vector<BlockScope> block_scopes;
+    vector<string> break_labels;    // where "break;" jumps to, innermost switch/for last
+    vector<string> break_counters;  // --instrument counter a "break;" out of each of them adds 1 to
+    vector<LoopInfo> loops;         // innermost loops first
+    vector<ColdBlock> cold_blocks;  // innermost blocks first
 
+    int frame_size;  // deepest stack slot ever handed out, in bytes below %rbp
     bool is_leaf_function;
 };
 
@@ -0,0 +1,177 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+    Accumulated wall time of one phase or handler type
+    total includes nested timers, self excludes them
+*/
+class TimerTotals {
+   public:
+    long calls = 0;
+    double total = 0;
+    double self = 0;
+};
+
+/*
+    Compile time instrumentation enabled by --stats
+    Keeps per phase (load, translate, write) and per handler type timings along
+    with named counters, and reports them as a table or as JSON
+    --time-passes alone times just the optimization passes
+*/
+class Stats {
+   public:
+    bool enabled = false;
+    bool time_passes = false;
+    vector<string> phase_order;  // report phases in the order they first finished
+    map<string, TimerTotals> phases;
+    map<string, TimerTotals> handlers;
+    map<string, TimerTotals> passes;
+    vector<string> counter_order;
+    map<string, long> counters;
+    vector<double> child_time;  // time spent in nested timers, one entry per active timer
+
+    void count(const string name, long n = 1) {
+        if (!enabled) {
+            return;
+        }
+        if (counters.count(name) == 0) {
+            counter_order.push_back(name);
+        }
+        counters[name] += n;
+    }
+
+    /*
+        Add another collector's timings and counters to this one, used to total up batch worker threads
+    */
+    void merge(const Stats &other) {
+        for (auto const &name : other.phase_order) {
+            if (phases.count(name) == 0) {
+                phase_order.push_back(name);
+            }
+            add(phases[name], other.phases.at(name));
+        }
+        for (auto const &h : other.handlers) {
+            add(handlers[h.first], h.second);
+        }
+        for (auto const &p : other.passes) {
+            add(passes[p.first], p.second);
+        }
+        for (auto const &name : other.counter_order) {
+            count(name, other.counters.at(name));
+        }
+    }
+
+    string summary() const {
+        string out;
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%-14s %8s %12s %12s\n", "phase", "calls", "total_ms", "self_ms");
+        out += buf;
+        for (auto const &name : phase_order) {
+            out += timer_row(name, phases.at(name));
+        }
+        snprintf(buf, sizeof(buf), "\n%-14s %8s %12s %12s\n", "handler", "calls", "total_ms", "self_ms");
+        out += buf;
+        for (auto const &h : handlers) {
+            out += timer_row(h.first, h.second);
+        }
+        snprintf(buf, sizeof(buf), "\n%-22s %12s\n", "counter", "value");
+        out += buf;
+        for (auto const &name : counter_order) {
+            snprintf(buf, sizeof(buf), "%-22s %12ld\n", name.c_str(), counters.at(name));
+            out += buf;
+        }
+        return out;
+    }
+
+    string json() const {
+        string out = "{\"phases\": {";
+        for (size_t i = 0; i < phase_order.size(); ++i) {
+            out += (i > 0 ? ", " : "") + timer_json(phase_order[i], phases.at(phase_order[i]));
+        }
+        out += "}, \"handlers\": {";
+        bool first = true;
+        for (auto const &h : handlers) {
+            out += (first ? "" : ", ") + timer_json(h.first, h.second);
+            first = false;
+        }
+        out += "}, \"counters\": {";
+        for (size_t i = 0; i < counter_order.size(); ++i) {
+            out += (i > 0 ? ", " : "") + ("\"" + counter_order[i] + "\": ") + to_string(counters.at(counter_order[i]));
+        }
+        out += "}}\n";
+        return out;
+    }
+
+    static string timer_row(const string name, const TimerTotals &t) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%-14s %8ld %12.3f %12.3f\n", name.c_str(), t.calls, t.total * 1000, t.self * 1000);
+        return buf;
+    }
+
+   private:
+    static void add(TimerTotals &into, const TimerTotals &t) {
+        into.calls += t.calls;
+        into.total += t.total;
+        into.self += t.self;
+    }
+
+    static string timer_json(const string name, const TimerTotals &t) {
+        char buf[160];
+        snprintf(buf, sizeof(buf), "\"%s\": {\"calls\": %ld, \"total_ms\": %.3f, \"self_ms\": %.3f}", name.c_str(),
+                 t.calls, t.total * 1000, t.self * 1000);
+        return buf;
+    }
+};
+
+/*
+    Times the enclosing scope into totals[name]
+    Does nothing (not even reading the clock) unless stats are enabled, or this is a pass
+    and passes are timed
+*/
+class ScopedTimer {
+   public:
+    ScopedTimer(Stats &stats, map<string, TimerTotals> &totals, const string name)
+        : stats(stats), totals(totals), name(name), active(stats.enabled || (stats.time_passes && &totals == &stats.passes)) {
+        if (active) {
+            stats.child_time.push_back(0);
+            start = chrono::steady_clock::now();
+        }
+    }
+
+    ~ScopedTimer() {
+        if (!active) {
+            return;
+        }
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        double nested = stats.child_time.back();
+        stats.child_time.pop_back();
+        if (!stats.child_time.empty()) {
+            stats.child_time.back() += elapsed;
+        }
+
+        TimerTotals &t = totals[name];
+        if (t.calls == 0 && &totals == &stats.phases) {
+            stats.phase_order.push_back(name);
+        }
+        t.calls++;
+        t.total += elapsed;
+        t.self += elapsed - nested;
+    }
+
+   private:
+    Stats &stats;
+    map<string, TimerTotals> &totals;
+    string name;
+    bool active;
+    chrono::steady_clock::time_point start;
+};
+
+#endif
@@ -9,19 +9,22 @@ class Variable {
    public:
     string name;
     string type;
-    int value;
+    long value;
     int addr_offset;
     bool is_param;
+    string label;  // symbol in .data/.bss for file scope and static variables, empty for stack variables
+    int columns;   // row length of a 2d array m[R][C], whose elements are the flat m[0] to m[R * C - 1]; 0 otherwise
 
-    Variable(string n, string t, int v, int a, bool is_p = false);
+    Variable(string n, string t, long v, int a, bool is_p = false);
 };
 
-Variable::Variable(string n, string t, int v, int a, bool is_p) {
+inline Variable::Variable(string n, string t, long v, int a, bool is_p) {
     name = n;
     type = t;
     value = v;
     addr_offset = a;
     is_param = is_p;
+    columns = 0;
 }
 
 #endif
@@ -0,0 +1,167 @@
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <sstream>
+
+#include "main.h"
+
+using namespace std;
+
+/*
+    Read a manifest with one "<input> <output>" pair per line
+    Blank lines and lines starting with # are skipped, malformed lines are added to errors
+*/
+vector<BatchJob> read_manifest(const string manifest_fn, vector<string> &errors) {
+    vector<BatchJob> batch;
+    ifstream manifest(manifest_fn);
+    if (manifest.fail()) {
+        errors.push_back(manifest_fn + ": cannot open manifest");
+        return batch;
+    }
+
+    int line_count = 0;
+    vector<string> lines = loadStream(manifest, line_count);
+    for (int i = 0; i < line_count; ++i) {
+        if (lines[i].empty() || lines[i][0] == '#') {
+            continue;
+        }
+
+        istringstream fields(lines[i]);
+        BatchJob job;
+        string extra;
+        if (!(fields >> job.input_fn >> job.output_fn) || (fields >> extra)) {
+            errors.push_back(manifest_fn + ":" + to_string(i + 1) + ": expected \"<input> <output>\"");
+            continue;
+        }
+        batch.push_back(job);
+    }
+
+    return batch;
+}
+
+/*
+    Compile one loaded job
+    The assembly is built in memory first, so a file that fails to translate leaves no partial output
+*/
+void compile_job(BatchJob &job, bool emit_gas, bool emit_obj) {
+    istringstream input(job.source);
+    ostringstream out;
+    try {
+        compile_source(input, out, emit_gas, emit_obj);
+    } catch (const exception &e) {
+        job.error = string("translation failed: ") + e.what();
+        return;
+    }
+
+    ofstream output(job.output_fn, ios::out | ios::trunc | ios::binary);
+    output << out.str();
+    if (output.fail()) {
+        job.error = "cannot write " + job.output_fn;
+    }
+}
+
+/*
+    Compile every file of a manifest in this process
+    A reader thread loads sources ahead of the workers through a bounded queue, so reading the next
+    inputs overlaps with compiling the current ones. Each worker thread has its own copy of the
+    translation state (the thread_local globals in main.cpp). A file that can't be read, translated
+    or written is reported at the end and the rest of the batch carries on.
+    Returns 0 when every file compiled, 1 otherwise
+*/
+int run_batch(const string manifest_fn, int jobs, bool emit_gas, bool emit_obj, Stats &total_stats) {
+    vector<string> errors;
+    vector<BatchJob> batch = read_manifest(manifest_fn, errors);
+
+    mutex lock;
+    condition_variable changed;
+    deque<size_t> ready;  // loaded jobs waiting for a worker
+    bool reading_done = false;
+    const size_t max_ready = 2 * jobs;
+
+    auto merge_stats = [&]() {
+        lock_guard<mutex> guard(lock);
+        total_stats.merge(stats);
+    };
+
+    thread reader([&]() {
+        stats.enabled = total_stats.enabled;
+        stats.time_passes = total_stats.time_passes;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            BatchJob &job = batch[i];
+            {
+                ScopedTimer timer(stats, stats.phases, "load");
+                ifstream input(job.input_fn);
+                if (input.fail()) {
+                    job.error = "cannot open input";
+                } else {
+                    ostringstream text;
+                    text << input.rdbuf();
+                    job.source = text.str();
+                }
+            }
+
+            unique_lock<mutex> guard(lock);
+            changed.wait(guard, [&]() { return ready.size() < max_ready; });
+            ready.push_back(i);
+            changed.notify_all();
+        }
+
+        {
+            lock_guard<mutex> guard(lock);
+            reading_done = true;
+            changed.notify_all();
+        }
+        merge_stats();
+    });
+
+    vector<thread> workers;
+    for (int w = 0; w < jobs; ++w) {
+        workers.push_back(thread([&]() {
+            stats.enabled = total_stats.enabled;
+            stats.time_passes = total_stats.time_passes;
+            while (true) {
+                size_t i;
+                {
+                    unique_lock<mutex> guard(lock);
+                    changed.wait(guard, [&]() { return !ready.empty() || reading_done; });
+                    if (ready.empty()) {
+                        break;
+                    }
+                    i = ready.front();
+                    ready.pop_front();
+                    changed.notify_all();
+                }
+
+                BatchJob &job = batch[i];
+                if (job.error.empty()) {
+                    compile_job(job, emit_gas, emit_obj);
+                }
+                if (!job.error.empty()) {
+                    stats.count("failed_files");
+                }
+                string().swap(job.source);
+            }
+            merge_stats();
+        }));
+    }
+
+    reader.join();
+    for (auto &w : workers) {
+        w.join();
+    }
+
+    int compiled = 0;
+    for (auto const &job : batch) {
+        if (job.error.empty()) {
+            compiled++;
+        } else {
+            errors.push_back(job.input_fn + ": " + job.error);
+        }
+    }
+    for (auto const &e : errors) {
+        cerr << "error: " << e << endl;
+    }
+    cout << "Compiled " << compiled << " of " << batch.size() << " files with " << jobs << " workers." << endl;
+
+    return errors.empty() ? 0 : 1;
+}
@@ -0,0 +1,27 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+#include <vector>
+
+#include "Stats.h"
+
+using namespace std;
+
+/*
+    One input/output pair of a batch manifest
+    source is filled in by the reader thread and released once the file is compiled
+*/
+class BatchJob {
+   public:
+    string input_fn;
+    string output_fn;
+    string source;
+    string error;  // empty when the file compiled
+};
+
+vector<BatchJob> read_manifest(const string manifest_fn, vector<string> &errors);
+void compile_job(BatchJob &job, bool emit_gas, bool emit_obj);
+int run_batch(const string manifest_fn, int jobs, bool emit_gas, bool emit_obj, Stats &total_stats);
+
+#endif
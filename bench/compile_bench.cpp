@@ -0,0 +1,175 @@
+/*
+    Compile throughput benchmark driver
+
+    For each size in the sweep, generates a synthetic program with gen_source, runs
+    ./main on it a few times and reports the best wall time as lines/sec and
+    functions/sec along with the peak RSS of the compiler process.
+    With --as, it also times getting an object file both ways: --emit=gas followed by that
+    assembler, and --emit=obj on its own.
+
+    ./compile_bench [--main PATH] [--gen PATH] [--repeat R] [--workdir DIR]
+                    [--sizes FxL,FxL,...] [--mix decl,arith,array,loop,if,call] [--as PATH]
+
+    A size FxL is F functions of L statements each.
+*/
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct RunResult {
+    bool ok;
+    double seconds;
+    long peak_rss_kb;
+};
+
+/*
+    Run a command with stdout/stderr discarded, timing it and reading its peak RSS from wait4
+*/
+RunResult run_command(const vector<string> &args) {
+    vector<char *> argv;
+    for (auto const &a : args) {
+        argv.push_back(const_cast<char *>(a.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    auto start = chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+
+    int status = 0;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    auto end = chrono::steady_clock::now();
+
+    RunResult r;
+    r.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    r.seconds = chrono::duration<double>(end - start).count();
+    r.peak_rss_kb = usage.ru_maxrss;
+    return r;
+}
+
+int count_lines(const string &fn) {
+    ifstream in(fn);
+    string line;
+    int n = 0;
+    while (getline(in, line)) {
+        n++;
+    }
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    string main_path = "./main";
+    string gen_path = "./bench/gen_source";
+    string workdir = "/tmp";
+    string sizes = "10x25,20x50,40x50,40x100";
+    string mix = "";
+    string as_path = "";
+    int repeat = 3;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string arg = argv[i];
+        string val = argv[i + 1];
+        if (arg == "--main") {
+            main_path = val;
+        } else if (arg == "--gen") {
+            gen_path = val;
+        } else if (arg == "--repeat") {
+            repeat = stoi(val);
+        } else if (arg == "--workdir") {
+            workdir = val;
+        } else if (arg == "--sizes") {
+            sizes = val;
+        } else if (arg == "--mix") {
+            mix = val;
+        } else if (arg == "--as") {
+            as_path = val;
+        } else {
+            cerr << "unknown option " << arg << endl;
+            return 1;
+        }
+    }
+
+    printf("%10s %8s %8s %12s %14s %14s %12s", "functions", "stmts", "lines", "best_ms", "lines/sec", "functions/sec", "peak_rss_kb");
+    if (!as_path.empty()) {
+        printf(" %12s %12s", "gas+as_ms", "obj_ms");
+    }
+    printf("\n");
+
+    stringstream ss(sizes);
+    string size;
+    bool all_ok = true;
+    while (getline(ss, size, ',')) {
+        string functions = size.substr(0, size.find("x"));
+        string stmts = size.substr(size.find("x") + 1);
+
+        string src_fn = workdir + "/bench_" + size + ".cpp";
+        string out_fn = workdir + "/bench_" + size + ".s";
+        string obj_fn = workdir + "/bench_" + size + ".o";
+
+        vector<string> gen_args = {gen_path, "--functions", functions, "--lines", stmts, "--out", src_fn};
+        if (!mix.empty()) {
+            gen_args.push_back("--mix");
+            gen_args.push_back(mix);
+        }
+        if (!run_command(gen_args).ok) {
+            cerr << "generating " << src_fn << " failed" << endl;
+            return 1;
+        }
+        int lines = count_lines(src_fn);
+
+        double best = 1e30;
+        long peak_rss = 0;
+        bool ok = true;
+        for (int r = 0; r < repeat; ++r) {
+            RunResult res = run_command({main_path, src_fn, out_fn});
+            ok = ok && res.ok;
+            best = min(best, res.seconds);
+            peak_rss = max(peak_rss, res.peak_rss_kb);
+        }
+
+        // an object through the assembler, then straight from the compiler
+        double best_gas = 1e30;
+        double best_obj = 1e30;
+        for (int r = 0; !as_path.empty() && r < repeat; ++r) {
+            RunResult text = run_command({main_path, "--emit=gas", src_fn, out_fn});
+            RunResult assembled = run_command({as_path, out_fn, "-o", obj_fn});
+            RunResult direct = run_command({main_path, "--emit=obj", src_fn, obj_fn});
+            ok = ok && text.ok && assembled.ok && direct.ok;
+            best_gas = min(best_gas, text.seconds + assembled.seconds);
+            best_obj = min(best_obj, direct.seconds);
+        }
+
+        if (!ok) {
+            printf("%10s %8s %8d %12s\n", functions.c_str(), stmts.c_str(), lines, "FAILED");
+            all_ok = false;
+            continue;
+        }
+
+        printf("%10s %8s %8d %12.2f %14.0f %14.0f %12ld", functions.c_str(), stmts.c_str(), lines, best * 1000,
+               lines / best, stoi(functions) / best, peak_rss);
+        if (!as_path.empty()) {
+            printf(" %12.2f %12.2f", best_gas * 1000, best_obj * 1000);
+        }
+        printf("\n");
+    }
+
+    return all_ok ? 0 : 1;
+}
@@ -0,0 +1,245 @@
+/*
+    Synthetic source generator for the compile throughput benchmark
+
+    Writes a program in the subset ./main understands (see README "Source Code Style
+    Requirements"): N functions of roughly M statements each, followed by a main that
+    calls some of them. The statement mix is configurable so individual handlers can be
+    stressed.
+
+    ./gen_source [--functions N] [--lines M] [--seed S] [--array-size K]
+                 [--mix decl,arith,array,loop,if,call] [--out FILE]
+
+    --mix takes relative weights, e.g. --mix 1,4,2,1,1,1
+*/
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+enum StatementKind { DECL, ARITH, ARRAY, LOOP, IF, CALL, NUM_KINDS };
+
+struct GenOptions {
+    int functions = 10;
+    int lines = 50;
+    int array_size = 64;
+    unsigned seed = 1;
+    vector<int> mix = {2, 5, 2, 1, 1, 1};
+    string out_fn = "-";
+};
+
+class Generator {
+   public:
+    Generator(const GenOptions &o) : opts(o), rng(o.seed) {}
+
+    void generate(ostream &out);
+
+   private:
+    GenOptions opts;
+    mt19937 rng;
+
+    vector<string> vars;       // int variables visible at function level
+    vector<string> loop_vars;  // loop variables of the enclosing for loops
+    int num_vars = 0;
+    int num_loops = 0;
+    int lines_left = 0;
+    int function_idx = 0;
+
+    int pick(int n) {
+        return uniform_int_distribution<int>(0, n - 1)(rng);
+    }
+
+    string any_var() {
+        return vars[pick(vars.size())];
+    }
+
+    string operand() {
+        if (pick(4) == 0) {
+            return to_string(pick(100));
+        }
+        return any_var();
+    }
+
+    string index() {
+        if (!loop_vars.empty() && pick(3) != 0) {
+            return loop_vars[pick(loop_vars.size())];
+        }
+        return to_string(pick(opts.array_size));
+    }
+
+    StatementKind pick_kind(int depth);
+    void statement(ostream &out, int depth);
+    void block(ostream &out, int depth, int count);
+    void function(ostream &out);
+    void main_function(ostream &out);
+};
+
+StatementKind Generator::pick_kind(int depth) {
+    vector<int> weights = opts.mix;
+    if (depth > 0) {
+        weights[DECL] = 0;  // new variables only at function level so they stay in scope
+    }
+    if (depth >= 3) {
+        weights[LOOP] = weights[IF] = 0;
+    }
+    if (function_idx == 0) {
+        weights[CALL] = 0;
+    }
+
+    int total = 0;
+    for (int w : weights) {
+        total += w;
+    }
+    if (total == 0) {
+        return ARITH;
+    }
+
+    int r = pick(total);
+    for (int k = 0; k < NUM_KINDS; ++k) {
+        if (r < weights[k]) {
+            return (StatementKind)k;
+        }
+        r -= weights[k];
+    }
+    return ARITH;
+}
+
+void Generator::statement(ostream &out, int depth) {
+    string indent(depth + 1, '\t');
+    const char *ops[3] = {"+", "-", "*"};
+    lines_left--;
+
+    switch (pick_kind(depth)) {
+        case DECL: {
+            string name = "v" + to_string(num_vars++);
+            out << indent << "int " << name << " = " << any_var() << " " << ops[pick(3)] << " " << operand() << ";\n";
+            vars.push_back(name);
+            break;
+        }
+        case ARITH:
+            out << indent << any_var() << " = " << any_var() << " " << ops[pick(3)] << " " << operand() << ";\n";
+            break;
+        case ARRAY:
+            if (pick(2) == 0) {
+                out << indent << any_var() << " = tbl[" << index() << "];\n";
+            } else {
+                out << indent << "tbl[" << index() << "] = " << any_var() << ";\n";
+            }
+            break;
+        case LOOP: {
+            string i = "i" + to_string(num_loops++);
+            out << indent << "for(int " << i << " = 0; " << i << " < " << (2 + pick(opts.array_size - 2)) << "; " << i << " = " << i << " + 1){\n";
+            loop_vars.push_back(i);
+            block(out, depth + 1, 1 + pick(4));
+            loop_vars.pop_back();
+            out << indent << "}\n";
+            break;
+        }
+        case IF:
+            if (pick(3) == 0) {
+                out << indent << "if (" << any_var() << " < " << operand() << " && " << any_var() << " != " << operand() << "){\n";
+            } else {
+                out << indent << "if (" << any_var() << " < " << operand() << "){\n";
+            }
+            block(out, depth + 1, 1 + pick(3));
+            out << indent << "}\n";
+            break;
+        case CALL:
+            out << indent << any_var() << " = f" << pick(function_idx) << "(" << any_var() << ", " << any_var() << ");\n";
+            break;
+        default:
+            break;
+    }
+}
+
+void Generator::block(ostream &out, int depth, int count) {
+    for (int k = 0; k < count && lines_left > 0; ++k) {
+        statement(out, depth);
+    }
+}
+
+void Generator::function(ostream &out) {
+    // parameters keep single letter names, the parameter handling relies on them
+    out << "int f" << function_idx << "(int a, int b) {\n";
+
+    vars = {"a", "b"};
+    num_vars = 0;
+    num_loops = 0;
+
+    out << "\tint tbl[" << opts.array_size << "] = {";
+    for (int k = 0; k < opts.array_size; ++k) {
+        out << (k ? ", " : "") << pick(1000);
+    }
+    out << "};\n";
+
+    lines_left = opts.lines;
+    while (lines_left > 0) {
+        statement(out, 0);
+    }
+
+    out << "\treturn " << any_var() << ";\n";
+    out << "}\n\n";
+}
+
+void Generator::main_function(ostream &out) {
+    out << "int main() {\n";
+    out << "\tint a = 1, b = 2;\n";
+    for (int k = 0; k < opts.functions && k < 16; ++k) {
+        out << "\ta = f" << pick(opts.functions) << "(a, b);\n";
+    }
+    out << "\treturn 0;\n";
+    out << "}\n";
+}
+
+void Generator::generate(ostream &out) {
+    for (function_idx = 0; function_idx < opts.functions; ++function_idx) {
+        function(out);
+    }
+    main_function(out);
+}
+
+int main(int argc, char *argv[]) {
+    GenOptions opts;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        string val = i + 1 < argc ? argv[i + 1] : "";
+
+        if (arg == "--functions") {
+            opts.functions = stoi(val);
+        } else if (arg == "--lines") {
+            opts.lines = stoi(val);
+        } else if (arg == "--seed") {
+            opts.seed = stoul(val);
+        } else if (arg == "--array-size") {
+            opts.array_size = max(4, stoi(val));
+        } else if (arg == "--mix") {
+            opts.mix.clear();
+            stringstream ss(val);
+            string w;
+            while (getline(ss, w, ',')) {
+                opts.mix.push_back(stoi(w));
+            }
+            opts.mix.resize(NUM_KINDS, 0);
+        } else if (arg == "--out") {
+            opts.out_fn = val;
+        } else {
+            cerr << "unknown option " << arg << endl;
+            return 1;
+        }
+        i++;
+    }
+
+    Generator gen(opts);
+    if (opts.out_fn == "-") {
+        gen.generate(cout);
+    } else {
+        ofstream out(opts.out_fn);
+        gen.generate(out);
+    }
+
+    return 0;
+}
@@ -0,0 +1,22 @@
+int sum(int a[1000], int n) {
+	int s = 0;
+	for(int i = 0; i < n; i++){
+		s = s + a[i];
+	}
+	return s;
+}
+
+int main() {
+	int a[1000];
+	for(int i = 0; i < 1000; i++){
+		a[i] = i;
+	}
+	int total = 0;
+	int s = 0;
+	for(int r = 0; r < 200000; r++){
+		s = sum(a, 1000);
+		total = total + s;
+		total = total * 3;
+	}
+	return total;
+}
@@ -0,0 +1,14 @@
+int main() {
+	int count = 0;
+	int x = 7;
+	for(int i = 0; i < 10000; i++){
+		for(int j = 0; j < 3000; j++){
+			x = x * 13;
+			x = x + j;
+			if (x < 0){
+				count = count + 1;
+			}
+		}
+	}
+	return count;
+}
@@ -0,0 +1,21 @@
+int mix(int a, int b, int c, int d, int e, int f, int g, int h, int k) {
+	int s = a + b;
+	s = s * c;
+	s = s - d;
+	s = s + e;
+	s = s * f;
+	s = s + g;
+	s = s - h;
+	s = s * k;
+	return s;
+}
+
+int main() {
+	int acc = 1;
+	int t = 0;
+	for(int i = 0; i < 20000000; i++){
+		t = mix(acc, i, 3, 4, i, 6, acc, 8, 9);
+		acc = acc + t;
+	}
+	return acc;
+}
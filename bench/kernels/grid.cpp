@@ -0,0 +1,42 @@
+int main() {
+	int g[64][64];
+	int h[64][64];
+	int up = 0;
+	int down = 0;
+	int left = 0;
+	int right = 0;
+	int v = 0;
+	int total = 0;
+	for(int i = 0; i < 64; i++){
+		for(int j = 0; j < 64; j++){
+			v = i * 31;
+			v = v + j;
+			g[i][j] = v;
+			h[i][j] = 0;
+		}
+	}
+	for(int r = 0; r < 200; r++){
+		for(int i = 1; i < 63; i++){
+			for(int j = 1; j < 63; j++){
+				up = i - 1;
+				down = i + 1;
+				left = j - 1;
+				right = j + 1;
+				v = g[up][j] + g[down][j];
+				v = v + g[i][left];
+				v = v + g[i][right];
+				v = v - g[i][j];
+				h[i][j] = v;
+			}
+		}
+		for(int i = 1; i < 63; i++){
+			for(int j = 1; j < 63; j++){
+				v = h[i][j];
+				g[i][j] = v;
+			}
+		}
+		total = total * 3;
+		total = total + g[31][17];
+	}
+	return total;
+}
@@ -0,0 +1,40 @@
+int classify(int a, int b, int c) {
+	int r = 0;
+	if (a > b && b > c){
+		r = r + 1;
+	}
+	if (a < 0 || c < 0){
+		r = r + 2;
+	}
+	if (!(a == c)){
+		r = r + 4;
+	}
+	if (a >= 100 && b >= 100 || c == 7 || c == a){
+		r = r + 8;
+	}
+	if (!(a < b) && !(b < c) || a == 0){
+		r = r + 16;
+	}
+	return r;
+}
+
+int main() {
+	int seed = 11;
+	int a = 0;
+	int b = 0;
+	int c = 0;
+	int r = 0;
+	int total = 0;
+	for(int i = 0; i < 3000000; i++){
+		seed = seed * 1103515245;
+		seed = seed + 12345;
+		a = seed * 3;
+		b = seed * 7;
+		b = b + i;
+		c = i - 500;
+		r = classify(a, b, c);
+		total = total * 3;
+		total = total + r;
+	}
+	return total;
+}
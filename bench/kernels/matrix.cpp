@@ -0,0 +1,43 @@
+int main() {
+	int a[1600];
+	int b[1600];
+	int c[1600];
+	int s = 0;
+	int x = 0;
+	int y = 0;
+	int ai = 0;
+	int bi = 0;
+	int ci = 0;
+	int total = 0;
+	for(int i = 0; i < 1600; i++){
+		a[i] = i;
+		x = i * 3;
+		b[i] = x - 7;
+	}
+	for(int r = 0; r < 50; r++){
+		for(int i = 0; i < 40; i++){
+			for(int j = 0; j < 40; j++){
+				s = r;
+				for(int k = 0; k < 40; k++){
+					ai = i * 40;
+					ai = ai + k;
+					bi = k * 40;
+					bi = bi + j;
+					x = a[ai];
+					y = b[bi];
+					x = x * y;
+					s = s + x;
+				}
+				ci = i * 40;
+				ci = ci + j;
+				c[ci] = s;
+			}
+		}
+		for(int i = 0; i < 1600; i++){
+			x = c[i];
+			total = total + x;
+			total = total * 3;
+		}
+	}
+	return total;
+}
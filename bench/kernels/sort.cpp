@@ -0,0 +1,46 @@
+int sort(int a[2000], int n) {
+	int m = 0;
+	int k = 0;
+	int x = 0;
+	int y = 0;
+	for(int i = 0; i < n; i++){
+		m = n - i;
+		m = m - 1;
+		for(int j = 0; j < m; j++){
+			k = j + 1;
+			x = a[j];
+			y = a[k];
+			if (x > y){
+				a[j] = y;
+				a[k] = x;
+			}
+		}
+	}
+	return 0;
+}
+
+int main() {
+	int a[2000];
+	int seed = 12345;
+	int ordered = 0;
+	int k = 0;
+	int x = 0;
+	int y = 0;
+	for(int r = 0; r < 5; r++){
+		for(int i = 0; i < 2000; i++){
+			seed = seed * 1103515245;
+			seed = seed + 12345;
+			a[i] = seed;
+		}
+		sort(a, 2000);
+		for(int i = 0; i < 1999; i++){
+			k = i + 1;
+			x = a[i];
+			y = a[k];
+			if (x <= y){
+				ordered = ordered + 1;
+			}
+		}
+	}
+	return ordered;
+}
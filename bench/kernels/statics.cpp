@@ -0,0 +1,24 @@
+int tally(int x, int weight) {
+	static int seen = 0;
+	static int calls = 0;
+	int r = x * weight;
+	seen = seen + r;
+	calls = calls + 1;
+	r = seen - calls;
+	return r;
+}
+
+int main() {
+	int k = 0;
+	int r = 0;
+	int total = 0;
+	for(int i = 0; i < 3000000; i++){
+		r = tally(1, 2);
+		total = total + r;
+	}
+	k = total;
+	k = k * 7;
+	r = tally(k, 1);
+	r = r - k;
+	return r;
+}
@@ -0,0 +1,53 @@
+int main() {
+	int seed = 7;
+	int op = 0;
+	int acc = 1;
+	int hits = 0;
+	for(int i = 0; i < 2000000; i++){
+		seed = seed * 1103515245;
+		seed = seed + 12345;
+		op = op + 5;
+		if (op >= 8){
+			op = op - 8;
+		}
+		switch (op) {
+			case 0:
+				acc = acc + i;
+				break;
+			case 1:
+				acc = acc - 3;
+				break;
+			case 2:
+				acc = acc * 3;
+				break;
+			case 3:
+				acc = acc + seed;
+				break;
+			case 4:
+				acc = acc - i;
+				break;
+			case 5:
+				acc = acc * 5;
+				break;
+			default:
+				acc = acc + 1;
+				break;
+		}
+		switch (op) {
+			case 1:
+				hits = hits + 1;
+				break;
+			case 100:
+				hits = hits + 2;
+				break;
+			case 1000:
+				hits = hits + 3;
+				break;
+			case 10000:
+				hits = hits + 4;
+				break;
+		}
+	}
+	acc = acc + hits;
+	return acc;
+}
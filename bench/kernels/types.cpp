@@ -0,0 +1,48 @@
+int calls = 0;
+long wide = 1;
+short table[16] = {3, -5, 7, 11, -13, 17, 19, -23, 29, 31, -37, 41, 43, -47, 53, 59};
+char bytes[16];
+
+int step(int x) {
+	static int seen = 0;
+	seen = seen + x;
+	calls = calls + 1;
+	return seen;
+}
+
+int main() {
+	char c = 0;
+	short s = 0;
+	long l = 0;
+	int k = 0;
+	int t = 0;
+	int r = 0;
+	for(int i = 0; i < 16; i++){
+		c = i * 9;
+		bytes[i] = c;
+	}
+	for(int i = 0; i < 1500000; i++){
+		k = k + 1;
+		if (k >= 16){
+			k = 0;
+		}
+		s = table[k];
+		c = bytes[k];
+		t = s * c;
+		s = s + t;
+		c = c + 5;
+		bytes[k] = c;
+		l = l * 3;
+		l = l + t;
+		wide = wide + l;
+		r = step(s);
+	}
+	r = r + calls;
+	if (wide > 0){
+		r = r + 1;
+	}
+	if (l < 0){
+		r = r + 2;
+	}
+	return r;
+}
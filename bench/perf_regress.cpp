@@ -0,0 +1,325 @@
+/*
+    Generated code quality regression check
+
+    For each source, translates it with ./main --emit=gas and the --flags given, and records
+        instructions   static count of emitted instructions (no labels, directives or comments)
+        frame_bytes    stack frame bytes, the deepest -N(%rbp) offset summed over all functions
+        exit           exit status of the program, built with gcc -no-pie
+        cycles         best of --repeat runs, from perf_event_open (user mode CPU cycles of the
+                       program) or, where hardware counters aren't available, rdtsc around the run
+    and compares them with the baseline file. A program fails when its exit status changed, its
+    instruction count or frame size grew by more than --static-threshold percent, or its cycles
+    grew by more than --cycle-threshold percent. Programs below --min-cycles are too short for the
+    cycle check and only get the static ones.
+
+    ./perf_regress [--main PATH] [--flags "-O2 ..."] [--baseline FILE] [--repeat R] [--static-threshold PCT]
+                   [--cycle-threshold PCT] [--min-cycles N] [--no-cycles] [--update] source.cpp ...
+
+    --update rewrites the baseline from this run instead of comparing. Each set of --flags has
+    its own baseline file, make perf-regress keeps one per optimization level.
+*/
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct Measurement {
+    long instructions = 0;
+    long frame_bytes = 0;
+    int exit_status = -1;
+    long long cycles = 0;
+};
+
+/*
+    Run a command found on the PATH with stdout/stderr discarded
+    Returns its exit status or -1 when it didn't exit
+*/
+int run_command(const vector<string> &args) {
+    vector<char *> argv;
+    for (auto const &a : args) {
+        argv.push_back(const_cast<char *>(a.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/*
+    Run a program once and count its cycles
+    The child waits on a pipe until the counter is attached, and the counter starts at its exec.
+    Sets exit_status and returns the cycle count, using rdtsc when perf_event_open isn't allowed
+*/
+long long run_counted(const string &program, int &exit_status, bool &used_perf) {
+    int go[2];
+    if (pipe(go) < 0) {
+        return 0;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(go[1]);
+        char c;
+        if (read(go[0], &c, 1) != 1) {
+            _exit(127);
+        }
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        execl(program.c_str(), program.c_str(), (char *)nullptr);
+        _exit(127);
+    }
+    close(go[0]);
+
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    int counter = syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+    used_perf = counter >= 0;
+
+    unsigned long long start = __rdtsc();
+    if (write(go[1], "x", 1) != 1) {
+        kill(pid, SIGKILL);
+    }
+    close(go[1]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    unsigned long long end = __rdtsc();
+    exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+
+    long long cycles = end - start;
+    if (used_perf) {
+        long long count = 0;
+        if (read(counter, &count, sizeof(count)) == sizeof(count)) {
+            cycles = count;
+        }
+        close(counter);
+    }
+    return cycles;
+}
+
+/*
+    Count the instructions and the frame bytes of a --emit=gas listing
+*/
+void measure_listing(const string &asm_fn, Measurement &m) {
+    ifstream in(asm_fn);
+    string line;
+    long deepest = 0;  // deepest -N(%rbp) of the current function
+    while (getline(in, line)) {
+        size_t first = line.find_first_not_of(" \t");
+        if (first == string::npos) {
+            continue;
+        }
+        line = line.substr(first);
+        if (line[0] == '#' || line[0] == '.') {
+            continue;
+        }
+        if (line.back() == ':') {
+            // a function starts at any label that isn't a local .L label
+            m.frame_bytes += deepest;
+            deepest = 0;
+            continue;
+        }
+
+        m.instructions++;
+        for (size_t pos = line.find("(%rbp)"); pos != string::npos; pos = line.find("(%rbp)", pos + 1)) {
+            size_t num = line.find_last_not_of("0123456789", pos - 1);
+            if (num != string::npos && num < pos - 1 && line[num] == '-') {
+                deepest = max(deepest, stol(line.substr(num + 1, pos - num - 1)));
+            }
+        }
+    }
+    m.frame_bytes += deepest;
+}
+
+/*
+    Read a baseline file with one "<source> <instructions> <frame_bytes> <exit> <cycles>" per line
+*/
+map<string, Measurement> read_baseline(const string &fn) {
+    map<string, Measurement> baseline;
+    ifstream in(fn);
+    string line;
+    while (getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        istringstream fields(line);
+        string source;
+        Measurement m;
+        if (fields >> source >> m.instructions >> m.frame_bytes >> m.exit_status >> m.cycles) {
+            baseline[source] = m;
+        }
+    }
+    return baseline;
+}
+
+double percent_change(double base, double now) {
+    return base == 0 ? (now == 0 ? 0 : 100) : (now - base) * 100 / base;
+}
+
+int main(int argc, char *argv[]) {
+    string main_path = "./main";
+    string baseline_fn = "bench/perf_baseline_O0.txt";
+    vector<string> flags;
+    string workdir = "/tmp";
+    int repeat = 5;
+    double static_threshold = 0;
+    double cycle_threshold = 15;
+    long long min_cycles = 10000000;
+    bool measure_cycles = true;
+    bool update = false;
+    vector<string> sources;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool has_val = i + 1 < argc;
+        if (arg == "--update") {
+            update = true;
+        } else if (arg == "--no-cycles") {
+            measure_cycles = false;
+        } else if (arg == "--main" && has_val) {
+            main_path = argv[++i];
+        } else if (arg == "--flags" && has_val) {
+            istringstream words(argv[++i]);
+            string flag;
+            while (words >> flag) {
+                flags.push_back(flag);
+            }
+        } else if (arg == "--baseline" && has_val) {
+            baseline_fn = argv[++i];
+        } else if (arg == "--workdir" && has_val) {
+            workdir = argv[++i];
+        } else if (arg == "--repeat" && has_val) {
+            repeat = stoi(argv[++i]);
+        } else if (arg == "--static-threshold" && has_val) {
+            static_threshold = stod(argv[++i]);
+        } else if (arg == "--cycle-threshold" && has_val) {
+            cycle_threshold = stod(argv[++i]);
+        } else if (arg == "--min-cycles" && has_val) {
+            min_cycles = stoll(argv[++i]);
+        } else if (arg.find("--") == 0) {
+            cerr << "unknown option " << arg << endl;
+            return 1;
+        } else {
+            sources.push_back(arg);
+        }
+    }
+
+    map<string, Measurement> baseline = read_baseline(baseline_fn);
+    vector<pair<string, Measurement>> results;
+    bool used_perf = false;
+    bool all_ok = true;
+
+    string command = main_path + " --emit=gas";
+    for (auto const &f : flags) {
+        command += " " + f;
+    }
+    printf("%s, baseline %s\n", command.c_str(), baseline_fn.c_str());
+    printf("%-28s %14s %12s %10s %18s %8s\n", "source", "instructions", "frame_bytes", "exit", "cycles", "change");
+    for (auto const &src : sources) {
+        string base = workdir + "/perf_regress." + to_string(getpid());
+        Measurement m;
+        vector<string> translate = {main_path, "--emit=gas"};
+        translate.insert(translate.end(), flags.begin(), flags.end());
+        translate.push_back(src);
+        translate.push_back(base + ".s");
+        if (run_command(translate) != 0 ||
+            run_command({"gcc", "-no-pie", base + ".s", "-o", base + ".bin"}) != 0) {
+            printf("%-28s %14s\n", src.c_str(), "BUILD FAILED");
+            all_ok = false;
+            continue;
+        }
+        measure_listing(base + ".s", m);
+
+        for (int r = 0; r < (measure_cycles ? repeat : 1); ++r) {
+            int status;
+            long long cycles = run_counted(base + ".bin", status, used_perf);
+            m.exit_status = status;
+            if (measure_cycles && (m.cycles == 0 || cycles < m.cycles)) {
+                m.cycles = cycles;
+            }
+        }
+        unlink((base + ".s").c_str());
+        unlink((base + ".bin").c_str());
+        results.push_back(make_pair(src, m));
+
+        auto found = baseline.find(src);
+        if (update || found == baseline.end()) {
+            printf("%-28s %14ld %12ld %10d %18lld %8s\n", src.c_str(), m.instructions, m.frame_bytes, m.exit_status, m.cycles,
+                   update ? "" : "NEW");
+            continue;
+        }
+
+        const Measurement &b = found->second;
+        vector<string> failures;
+        if (m.exit_status != b.exit_status) {
+            failures.push_back("exit " + to_string(b.exit_status) + " -> " + to_string(m.exit_status));
+        }
+        if (percent_change(b.instructions, m.instructions) > static_threshold) {
+            failures.push_back("instructions " + to_string(b.instructions) + " -> " + to_string(m.instructions));
+        }
+        if (percent_change(b.frame_bytes, m.frame_bytes) > static_threshold) {
+            failures.push_back("frame_bytes " + to_string(b.frame_bytes) + " -> " + to_string(m.frame_bytes));
+        }
+        double cycle_change = percent_change(b.cycles, m.cycles);
+        if (measure_cycles && b.cycles >= min_cycles && cycle_change > cycle_threshold) {
+            failures.push_back("cycles " + to_string(b.cycles) + " -> " + to_string(m.cycles));
+        }
+
+        char change[32] = "";
+        if (measure_cycles && b.cycles > 0) {
+            snprintf(change, sizeof(change), "%+.1f%%", cycle_change);
+        }
+        printf("%-28s %14ld %12ld %10d %18lld %8s %s\n", src.c_str(), m.instructions, m.frame_bytes, m.exit_status, m.cycles, change,
+               failures.empty() ? "" : "REGRESSED");
+        for (auto const &f : failures) {
+            printf("    %s\n", f.c_str());
+        }
+        all_ok = all_ok && failures.empty();
+    }
+    if (measure_cycles) {
+        printf("cycles from %s\n", used_perf ? "perf_event_open" : "rdtsc (no hardware counters)");
+    }
+
+    if (update) {
+        ofstream out(baseline_fn, ios::out | ios::trunc);
+        out << "# generated by bench/perf_regress --update: source instructions frame_bytes exit cycles\n";
+        for (auto const &r : results) {
+            const Measurement &m = r.second;
+            out << r.first << " " << m.instructions << " " << m.frame_bytes << " " << m.exit_status << " " << m.cycles << "\n";
+        }
+        cout << "Wrote " << results.size() << " baselines to " << baseline_fn << endl;
+    }
+
+    return all_ok ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+#!/bin/bash
+#
+# Native code benchmark
+#
+# Translates each source with ./main --emit=gas, assembles and links the result with the
+# local toolchain, builds the same source with g++ -O0 and -O2, runs all three and reports
+# their exit status and best wall time. The exit statuses have to agree, so every run is
+# also a check that the generated code computes the same result as gcc.
+#
+#   bench/run_native.sh [-m path/to/main] [-r repeat] [-f "main flags"]... [source.cpp ...]
+#
+# Each -f builds the source with ./main again with those flags, so one run compares them,
+# e.g. -f "-O2 -fno-schedule" -f "-O2" -f "-O2 -mtune=atom".
+# Defaults to the kernels in bench/kernels. Jump tables are absolute addresses, so the
+# generated code is linked with -no-pie. g++ builds use -fwrapv because the generated code
+# wraps on signed overflow.
+
+MAIN=./main
+REPEAT=3
+FLAGS=()
+while getopts "m:r:f:" opt; do
+    case $opt in
+        m) MAIN=$OPTARG ;;
+        r) REPEAT=$OPTARG ;;
+        f) FLAGS+=("$OPTARG") ;;
+        *) exit 2 ;;
+    esac
+done
+shift $((OPTIND - 1))
+if [ ${#FLAGS[@]} -eq 0 ]; then
+    FLAGS=("")
+fi
+
+SOURCES=("$@")
+if [ ${#SOURCES[@]} -eq 0 ]; then
+    SOURCES=(bench/kernels/*.cpp)
+fi
+
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+# run_best <binary>, sets STATUS to the exit status and BEST to the best wall time in ms
+run_best() {
+    BEST=
+    for ((r = 0; r < REPEAT; r++)); do
+        local start=$(date +%s%N)
+        "$1" > /dev/null
+        STATUS=$?
+        local end=$(date +%s%N)
+        local us=$(((end - start) / 1000))
+        if [ -z "$BEST" ] || [ $us -lt $BEST ]; then
+            BEST=$us
+        fi
+    done
+    BEST=$(printf "%d.%03d" $((BEST / 1000)) $((BEST % 1000)))
+}
+
+failed=0
+printf "%-28s %-24s %6s %12s\n" "source" "build" "exit" "best_ms"
+for src in "${SOURCES[@]}"; do
+    name=$(basename "$src" .cpp)
+
+    builds=()
+    for ((f = 0; f < ${#FLAGS[@]}; f++)); do
+        # word splitting of the flags is intended
+        if ! "$MAIN" --emit=gas ${FLAGS[$f]} "$src" "$WORKDIR/$name.s" > /dev/null ||
+            ! gcc -no-pie "$WORKDIR/$name.s" -o "$WORKDIR/$name.main$f"; then
+            printf "%-28s %-24s %6s\n" "$src" "main ${FLAGS[$f]}" "BUILD FAILED"
+            failed=1
+            continue
+        fi
+        builds+=("main$f")
+    done
+    g++ -fwrapv -O0 -x c++ "$src" -o "$WORKDIR/$name.O0" || failed=1
+    g++ -fwrapv -O2 -x c++ "$src" -o "$WORKDIR/$name.O2" || failed=1
+
+    expected=
+    for build in "${builds[@]}" O0 O2; do
+        run_best "$WORKDIR/$name.$build"
+        label="gcc-$build"
+        if [ "${build#main}" != "$build" ]; then
+            label=$(echo "main ${FLAGS[${build#main}]}" | sed 's/ *$//')
+        fi
+        note=
+        if [ -z "$expected" ]; then
+            expected=$STATUS
+        elif [ "$STATUS" != "$expected" ]; then
+            note="MISMATCH"
+            failed=1
+        fi
+        printf "%-28s %-24s %6s %12s %s\n" "$src" "$label" "$STATUS" "$BEST" "$note"
+    done
+done
+
+exit $failed
@@ -0,0 +1,181 @@
+/*
+    Compile server latency benchmark
+
+    Starts ./main --serve on a temporary socket and measures the latency of compiling one source
+    per request four ways:
+        server, kept connection   one connection reused for every request
+        server, new connection    connect, request, close
+        client binary             fork/exec of ./client per request
+        main binary               fork/exec of ./main per request (no server)
+    and prints the p50/p99/mean latency of each.
+
+    ./serve_bench [--main PATH] [--client PATH] [--source FILE] [--requests N] [--socket PATH]
+*/
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../protocol.h"
+
+using namespace std;
+
+/*
+    Run a command with stdout/stderr discarded and wait for it, returns true on exit status 0
+*/
+bool run_command(const vector<string> &args) {
+    vector<char *> argv;
+    for (auto const &a : args) {
+        argv.push_back(const_cast<char *>(a.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int connect_to(const string &socket_path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool round_trip(int fd, const string &source) {
+    uint32_t status;
+    string reply;
+    return write_message(fd, 0, source) && read_message(fd, status, reply) && status == SERVE_OK;
+}
+
+/*
+    Time requests calls of one request, returns the latencies in ms or an empty vector on failure
+*/
+vector<double> measure(int requests, function<bool()> request) {
+    vector<double> ms;
+    for (int i = 0; i < requests; ++i) {
+        auto start = chrono::steady_clock::now();
+        if (!request()) {
+            return vector<double>();
+        }
+        ms.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    }
+    return ms;
+}
+
+void report(const string &mode, vector<double> ms) {
+    if (ms.empty()) {
+        printf("%-26s %10s\n", mode.c_str(), "FAILED");
+        return;
+    }
+    sort(ms.begin(), ms.end());
+    double mean = 0;
+    for (double m : ms) {
+        mean += m / ms.size();
+    }
+    size_t p99 = min(ms.size() - 1, ms.size() * 99 / 100);
+    printf("%-26s %10.3f %10.3f %10.3f\n", mode.c_str(), ms[ms.size() / 2], ms[p99], mean);
+}
+
+int main(int argc, char *argv[]) {
+    string main_path = "./main";
+    string client_path = "./client";
+    string source_fn = "test1.cpp";
+    string socket_path = "/tmp/serve_bench." + to_string(getpid()) + ".sock";
+    int requests = 200;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string arg = argv[i];
+        string val = argv[i + 1];
+        if (arg == "--main") {
+            main_path = val;
+        } else if (arg == "--client") {
+            client_path = val;
+        } else if (arg == "--source") {
+            source_fn = val;
+        } else if (arg == "--requests") {
+            requests = stoi(val);
+        } else if (arg == "--socket") {
+            socket_path = val;
+        } else {
+            cerr << "unknown option " << arg << endl;
+            return 1;
+        }
+    }
+
+    ifstream input(source_fn);
+    if (input.fail()) {
+        cerr << "Failed to open " << source_fn << endl;
+        return 1;
+    }
+    stringstream source;
+    source << input.rdbuf();
+    string out_fn = socket_path + ".s";
+
+    pid_t server = fork();
+    if (server == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        execl(main_path.c_str(), main_path.c_str(), ("--serve=" + socket_path).c_str(), (char *)nullptr);
+        _exit(127);
+    }
+
+    int fd = -1;
+    for (int tries = 0; tries < 200 && fd < 0; ++tries) {
+        usleep(10000);
+        fd = connect_to(socket_path);
+    }
+    if (fd < 0) {
+        cerr << "Server did not come up on " << socket_path << endl;
+        kill(server, SIGTERM);
+        return 1;
+    }
+
+    printf("%d requests of %s\n", requests, source_fn.c_str());
+    printf("%-26s %10s %10s %10s\n", "mode", "p50_ms", "p99_ms", "mean_ms");
+
+    report("server, kept connection", measure(requests, [&]() { return round_trip(fd, source.str()); }));
+    close(fd);
+
+    report("server, new connection", measure(requests, [&]() {
+               int conn = connect_to(socket_path);
+               bool ok = conn >= 0 && round_trip(conn, source.str());
+               close(conn);
+               return ok;
+           }));
+
+    report("client binary", measure(requests, [&]() { return run_command({client_path, socket_path, source_fn, out_fn}); }));
+    report("main binary", measure(requests, [&]() { return run_command({main_path, source_fn, out_fn}); }));
+
+    kill(server, SIGTERM);
+    waitpid(server, nullptr, 0);
+    unlink(out_fn.c_str());
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include <map>
+#include <set>
+
+#include "cfg.h"
+
+using namespace std;
+
+bool is_label_line(const string &s) {
+    return !s.empty() && s[0] != '#' && s.back() == ':';
+}
+
+/*
+    Instructions are the lines that aren't empty, comments, directives or labels
+*/
+bool is_instruction_line(const string &s) {
+    return !s.empty() && s[0] != '#' && s[0] != '.' && s.back() != ':';
+}
+
+string opcode_of(const string &ins) {
+    return ins.substr(0, ins.find(' '));
+}
+
+/*
+    Split an instruction's operands on the commas outside of parentheses
+    "movl %edx, -20(%rbp, %rax, 4)" gives "%edx" and "-20(%rbp, %rax, 4)"
+*/
+vector<string> operands_of(const string &ins) {
+    vector<string> operands;
+    if (ins.find(' ') == string::npos) {
+        return operands;
+    }
+    operands.push_back("");
+    int depth = 0;
+    for (char c : ins.substr(ins.find(' ') + 1)) {
+        depth += c == '(' ? 1 : c == ')' ? -1 : 0;
+        if (c == ',' && depth == 0) {
+            operands.push_back("");
+        } else if (c != ' ' || depth > 0) {
+            operands.back() += c;
+        }
+    }
+    for (auto &op : operands) {
+        // "-20(%rbp, %rax, 4)" keeps its inner spaces, but not leading ones
+        op.erase(0, op.find_first_not_of(' '));
+    }
+    return operands;
+}
+
+/*
+    Split code into basic blocks and link them by its jumps and fall throughs
+    The labels a jump table lists (".quad .L5") are marked address_taken, as the indirect
+    jump through the table doesn't name them
+*/
+vector<BasicBlock> build_cfg(const vector<string> &code) {
+    vector<BasicBlock> blocks;
+    map<string, int> block_of_label;
+    set<string> table_labels;
+
+    bool start_new = true;
+    for (size_t i = 0; i < code.size(); ++i) {
+        const string &s = code[i];
+        if (is_label_line(s)) {
+            start_new = true;
+        }
+        if (start_new && (is_label_line(s) || is_instruction_line(s))) {
+            if (!blocks.empty()) {
+                blocks.back().end = i;
+            }
+            BasicBlock b;
+            b.begin = i;
+            b.end = code.size();
+            b.address_taken = false;
+            blocks.push_back(b);
+            start_new = false;
+        } else if (blocks.empty()) {
+            continue;
+        }
+        if (is_label_line(s)) {
+            block_of_label[s.substr(0, s.size() - 1)] = blocks.size() - 1;
+        } else if (s.find(".quad ") == 0) {
+            table_labels.insert(s.substr(6));
+        } else if (is_instruction_line(s)) {
+            string op = opcode_of(s);
+            start_new = op[0] == 'j' || op == "ret";
+        }
+    }
+
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        // the last instruction of the block decides where it goes
+        string last = "";
+        for (size_t i = blocks[b].begin; i < blocks[b].end; ++i) {
+            if (is_instruction_line(code[i])) {
+                last = code[i];
+            }
+        }
+        string op = opcode_of(last);
+        bool falls_through = op != "ret" && op != "jmp";
+        if (!last.empty() && op[0] == 'j' && last.find('*') == string::npos) {
+            auto target = block_of_label.find(last.substr(last.rfind(' ') + 1));
+            if (target != block_of_label.end()) {
+                blocks[b].succs.push_back(target->second);
+            }
+        }
+        if (falls_through && b + 1 < blocks.size()) {
+            blocks[b].succs.push_back(b + 1);
+        }
+        for (int s : blocks[b].succs) {
+            blocks[s].preds.push_back(b);
+        }
+    }
+    for (auto const &label : table_labels) {
+        if (block_of_label.count(label)) {
+            blocks[block_of_label[label]].address_taken = true;
+        }
+    }
+    return blocks;
+}
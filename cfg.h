@@ -0,0 +1,29 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+    A basic block of a translated function, [begin, end) of its assembly_instructions.
+    Blocks start at labels and after jumps and returns; comments and directives belong to
+    whichever block they sit in.
+*/
+class BasicBlock {
+   public:
+    size_t begin;
+    size_t end;
+    vector<int> succs;
+    vector<int> preds;
+    bool address_taken;  // a jump table entry, also entered from an indirect jump
+};
+
+bool is_label_line(const string &s);
+bool is_instruction_line(const string &s);
+string opcode_of(const string &ins);
+vector<string> operands_of(const string &ins);
+vector<BasicBlock> build_cfg(const vector<string> &code);
+
+#endif
@@ -0,0 +1,83 @@
+/*
+    Client for the --serve compile server
+
+    ./client [--emit=gas|--emit=obj] <socket> <source file> <output file>
+
+    Sends the source to the server listening on socket and writes the assembly or object it
+    returns to the output file. Use - for the source or output to read stdin or write stdout.
+*/
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "protocol.h"
+
+using namespace std;
+
+int main(int argc, char *argv[]) {
+    uint32_t flags = 0;
+    vector<string> file_args;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--emit=gas") {
+            flags = (flags | SERVE_EMIT_GAS) & ~SERVE_EMIT_OBJ;
+        } else if (arg == "--emit=obj") {
+            flags |= SERVE_EMIT_GAS | SERVE_EMIT_OBJ;
+        } else if (arg == "--emit=listing") {
+            flags &= ~(SERVE_EMIT_GAS | SERVE_EMIT_OBJ);
+        } else {
+            file_args.push_back(arg);
+        }
+    }
+    if (file_args.size() != 3) {
+        cerr << "usage: client [--emit=gas|--emit=obj] <socket> <source file> <output file>" << endl;
+        return 2;
+    }
+
+    stringstream source;
+    if (file_args[1] == "-") {
+        source << cin.rdbuf();
+    } else {
+        ifstream input(file_args[1]);
+        if (input.fail()) {
+            cerr << "Failed to open " << file_args[1] << endl;
+            return 1;
+        }
+        source << input.rdbuf();
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, file_args[0].c_str(), sizeof(addr.sun_path) - 1);
+    if (fd < 0 || connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+        cerr << "Cannot connect to " << file_args[0] << ": " << strerror(errno) << endl;
+        return 1;
+    }
+
+    uint32_t status;
+    string reply;
+    if (!write_message(fd, flags, source.str()) || !read_message(fd, status, reply)) {
+        cerr << "Lost connection to " << file_args[0] << endl;
+        return 1;
+    }
+    close(fd);
+
+    if (status != SERVE_OK) {
+        cerr << file_args[1] << ": " << reply << endl;
+        return 1;
+    }
+    if (file_args[2] == "-") {
+        cout << reply;
+    } else {
+        ofstream output(file_args[2], ios::out | ios::trunc | ios::binary);
+        output << reply;
+    }
+    return 0;
+}
@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <vector>
+
+#include "cost.h"
+
+using namespace std;
+
+// latency, reciprocal throughput and uops of the register forms of the opcodes the handlers emit,
+// roughly those of a recent Intel core; memory operands are added on top by instruction_cost
+const map<string, InstructionCost> opcode_costs = {
+    {"mov", {1, 0.25, 1}}, {"movs", {1, 0.5, 1}}, {"movz", {1, 0.5, 1}}, {"lea", {1, 0.5, 1}},
+    {"add", {1, 0.25, 1}}, {"sub", {1, 0.25, 1}}, {"and", {1, 0.25, 1}}, {"or", {1, 0.25, 1}},
+    {"xor", {1, 0.25, 1}}, {"neg", {1, 0.25, 1}}, {"not", {1, 0.25, 1}}, {"inc", {1, 0.25, 1}},
+    {"dec", {1, 0.25, 1}}, {"sal", {1, 0.5, 1}}, {"sar", {1, 0.5, 1}}, {"shl", {1, 0.5, 1}},
+    {"shr", {1, 0.5, 1}}, {"cmp", {1, 0.25, 1}}, {"test", {1, 0.25, 1}}, {"set", {1, 0.5, 1}},
+    {"cmov", {1, 0.5, 1}}, {"imul", {3, 1, 1}}, {"idiv", {26, 6, 10}}, {"div", {26, 6, 10}},
+    {"cltd", {1, 1, 1}}, {"cltq", {1, 0.5, 1}}, {"cqto", {1, 1, 2}}, {"j", {1, 0.5, 1}},
+    {"jmp", {1, 1, 1}}, {"push", {1, 1, 1}}, {"pop", {1, 0.5, 1}}, {"call", {3, 2, 2}},
+    {"ret", {2, 1, 1}}, {"leave", {3, 1, 2}}};
+
+const InstructionCost load_cost = {4, 0.5, 1};  // L1 hit or store forwarding, two load ports; -mtune sets the latency
+const InstructionCost store_cost = {1, 1, 1};   // one store port
+const long assumed_trip_count = 10;             // weight of loops whose trip count isn't constant
+
+// the -mtune targets, "generic" being the opcode table as it is
+const vector<TuneModel> tune_models = {
+    {"generic", {}, 4, 4},
+    {"skylake", {{"idiv", 26}, {"div", 26}}, 5, 4},
+    {"znver3", {{"idiv", 12}, {"div", 12}, {"cqto", 1}}, 4, 6},
+    {"atom", {{"imul", 5}, {"idiv", 38}, {"div", 38}, {"cmov", 2}, {"leave", 4}}, 3, 2},
+};
+
+// the -mtune target, set once before anything is translated
+const TuneModel *tune = &tune_models[0];
+
+/*
+    Picks the -mtune target by name, returns false when there is no such target
+*/
+bool set_tune(const string name) {
+    for (auto const &t : tune_models) {
+        if (t.name == name) {
+            tune = &t;
+            return true;
+        }
+    }
+    return false;
+}
+
+const TuneModel &current_tune() {
+    return *tune;
+}
+
+/*
+    Helper function to look up the cost of an opcode, ignoring its size suffix
+    The -mtune target's latency replaces the table's
+*/
+InstructionCost opcode_cost(const string opcode) {
+    string base = opcode;
+    if (!opcode_costs.count(base)) {
+        base = opcode.substr(0, opcode.size() - 1);
+        for (auto const &prefix : {"movs", "movz", "set", "cmov", "j"}) {
+            if (opcode.find(prefix) == 0) {
+                base = prefix;
+            }
+        }
+    }
+    if (!opcode_costs.count(base)) {
+        return {1, 0.25, 1};
+    }
+    InstructionCost cost = opcode_costs.at(base);
+    auto tuned = tune->latencies.find(base);
+    if (tuned != tune->latencies.end()) {
+        cost.latency = tuned->second;
+    }
+    return cost;
+}
+
+/*
+    Estimate one instruction from its opcode and its memory operands
+    Reading memory adds a load, writing it adds a store uop, "addl $1, -4(%rbp)" does both
+*/
+InstructionCost instruction_cost(const string ins) {
+    string opcode = ins.substr(0, ins.find(' '));
+    InstructionCost cost = opcode_cost(opcode);
+    if (opcode.find("lea") == 0 || ins.find(' ') == string::npos) {
+        return cost;
+    }
+
+    // split the operands on the commas outside of parentheses
+    vector<string> operands(1);
+    int depth = 0;
+    for (char c : ins.substr(ins.find(' ') + 1)) {
+        depth += c == '(' ? 1 : c == ')' ? -1 : 0;
+        if (c == ',' && depth == 0) {
+            operands.push_back("");
+        } else if (c != ' ') {
+            operands.back() += c;
+        }
+    }
+
+    bool is_mov = opcode.find("mov") == 0 || opcode.find("set") == 0 || opcode.find("pop") == 0;
+    bool src_mem = operands.front().find('(') != string::npos;
+    bool dest_mem = operands.back().find('(') != string::npos;
+    bool reads = (operands.size() > 1 && src_mem) || (dest_mem && !is_mov);
+    bool writes = dest_mem && opcode.find("cmp") != 0 && opcode.find("test") != 0 && opcode.find("push") != 0 &&
+                  opcode.find("idiv") != 0 && opcode.find("imul") != 0 && opcode.find("call") != 0 && opcode[0] != 'j';
+
+    // the load and store run on their own ports, so they only add to the throughput when they are
+    // the bottleneck of the instruction
+    if (reads) {
+        cost.latency += tune->load_latency;
+        cost.throughput = max(cost.throughput, load_cost.throughput);
+        cost.uops += load_cost.uops;
+    }
+    if (writes) {
+        cost.throughput = max(cost.throughput, store_cost.throughput);
+        cost.uops += store_cost.uops;
+    }
+    return cost;
+}
+
+/*
+    Helper function to find the row of a loop's for line, from the rows of the lines before its start
+    -O2 schedules a "#source" marker along with the instruction after it, so the for line's marker
+    may come before the statements ahead of the loop and the row at its start be one of theirs
+*/
+int header_row(const vector<string> &code, const vector<int> &row_at, const LoopInfo &loop) {
+    string marker = "#" + loop.header;
+    for (size_t i = min(loop.begin, code.size()); i-- > 0;) {
+        if (code[i] == marker) {
+            return row_at[i];
+        }
+    }
+    return row_at[loop.begin];
+}
+
+/*
+    Estimate the cost of a translated function and attribute it to the source lines
+    Every instruction is charged to the "#source" marker before it, except a loop's increment and
+    test, which go to the marker of its for line. Instructions inside loops are weighted by the product of the
+    trip counts of the loops around them. Cycles assume the core overlaps independent statements,
+    so each instruction costs its reciprocal throughput; the sum of the latencies, as if nothing
+    overlapped, is given as an upper bound for the whole function.
+*/
+string cost_report(const Function &f) {
+    const vector<string> &code = f.assembly_instructions;
+
+    vector<double> weight(code.size(), 1);
+    vector<int> latch_loop(code.size(), -1);
+    for (size_t l = 0; l < f.loops.size(); ++l) {
+        const LoopInfo &loop = f.loops[l];
+        long trips = loop.trip_count >= 0 ? loop.trip_count : assumed_trip_count;
+        for (size_t i = loop.begin; i < loop.end && i < code.size(); ++i) {
+            weight[i] *= trips;
+            if (i >= loop.latch && latch_loop[i] < 0) {
+                latch_loop[i] = l;  // loops are recorded innermost first
+            }
+        }
+    }
+
+    class Row {
+       public:
+        string source;
+        double cycles = 0;
+        double uops = 0;
+        double runs = 0;
+    };
+    vector<Row> rows;
+    vector<int> row_at(code.size(), -1);  // source line each instruction is charged to
+    double total_cycles = 0;
+    double total_latency = 0;
+    double total_uops = 0;
+
+    for (size_t i = 0; i < code.size(); ++i) {
+        const string &s = code[i];
+        if (!s.empty() && s[0] == '#') {
+            if (s != "# }") {
+                rows.push_back(Row());
+                rows.back().source = s.substr(1);
+            }
+        }
+        row_at[i] = (int)rows.size() - 1;
+        if (s.empty() || s[0] == '#' || s[0] == '.' || s.back() == ':') {
+            continue;
+        }
+
+        int r = latch_loop[i] >= 0 ? header_row(code, row_at, f.loops[latch_loop[i]]) : row_at[i];
+        if (r < 0) {
+            continue;
+        }
+        InstructionCost cost = instruction_cost(s);
+        rows[r].cycles += cost.throughput * weight[i];
+        rows[r].uops += cost.uops * weight[i];
+        rows[r].runs = max(rows[r].runs, weight[i]);
+        total_cycles += cost.throughput * weight[i];
+        total_latency += cost.latency * weight[i];
+        total_uops += cost.uops * weight[i];
+    }
+
+    string out;
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s: %.0f cycles (at most %.0f), %.0f uops (estimated)\n", f.function_name.c_str(),
+             total_cycles, total_latency, total_uops);
+    out += buf;
+    snprintf(buf, sizeof(buf), "%14s %14s %12s %6s  %s\n", "cycles", "uops", "runs", "%", "source");
+    out += buf;
+    for (auto const &row : rows) {
+        snprintf(buf, sizeof(buf), "%14.0f %14.0f %12.0f %6.1f  %s\n", row.cycles, row.uops, row.runs,
+                 total_cycles > 0 ? row.cycles * 100 / total_cycles : 0, row.source.c_str());
+        out += buf;
+    }
+
+    if (!f.loops.empty()) {
+        snprintf(buf, sizeof(buf), "%14s %14s %12s %6s  %s\n", "loop cycles", "uops", "trips", "%", "loop");
+        out += buf;
+        for (auto const &loop : f.loops) {
+            double cycles = 0;
+            double uops = 0;
+            for (size_t i = loop.begin; i < loop.end && i < code.size(); ++i) {
+                const string &s = code[i];
+                if (s.empty() || s[0] == '#' || s[0] == '.' || s.back() == ':') {
+                    continue;
+                }
+                InstructionCost cost = instruction_cost(s);
+                cycles += cost.throughput * weight[i];
+                uops += cost.uops * weight[i];
+            }
+            string trips = loop.trip_count >= 0 ? to_string(loop.trip_count) : "~" + to_string(assumed_trip_count);
+            snprintf(buf, sizeof(buf), "%14.0f %14.0f %12s %6.1f  %s\n", cycles, uops, trips.c_str(),
+                     total_cycles > 0 ? cycles * 100 / total_cycles : 0, loop.header.c_str());
+            out += buf;
+        }
+    }
+    out += "\n";
+    return out;
+}
@@ -0,0 +1,42 @@
+#ifndef COST_H
+#define COST_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Function.h"
+
+using namespace std;
+
+/*
+    Estimated cost of one instruction: its latency and reciprocal throughput in cycles,
+    and its fused domain uops
+*/
+class InstructionCost {
+   public:
+    double latency;
+    double throughput;
+    double uops;
+};
+
+/*
+    The -mtune latencies of a microarchitecture, where they differ from the opcode table's, and
+    how many instructions it starts per cycle
+*/
+class TuneModel {
+   public:
+    string name;
+    map<string, double> latencies;  // by opcode without its size suffix
+    double load_latency;
+    int issue_width;
+};
+
+extern const vector<TuneModel> tune_models;
+
+bool set_tune(const string name);
+const TuneModel &current_tune();
+InstructionCost instruction_cost(const string ins);
+string cost_report(const Function &f);
+
+#endif
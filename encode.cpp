@@ -0,0 +1,897 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+#include "encode.h"
+#include "gvn.h"
+#include "util.h"
+
+using namespace std;
+
+/*
+    Opcode of an SSE instruction and of its VEX or EVEX form
+    load is the opcode that writes the ModRM reg operand, store the one that reads it, -1 for none
+*/
+class VectorOpcode {
+   public:
+    int prefix;  // 0x66, 0xF3 or 0xF2
+    int map;     // 1 for 0F, 2 for 0F 38, 3 for 0F 3A
+    int load;
+    int store;
+    bool w;
+};
+
+// the general purpose registers in encoding order, with their 8, 4, 2 and 1 byte names
+const vector<vector<string>> register_numbers = {
+    {"rax", "eax", "ax", "al"},     {"rcx", "ecx", "cx", "cl"},     {"rdx", "edx", "dx", "dl"},
+    {"rbx", "ebx", "bx", "bl"},     {"rsp", "esp", "sp", "spl"},    {"rbp", "ebp", "bp", "bpl"},
+    {"rsi", "esi", "si", "sil"},    {"rdi", "edi", "di", "dil"},    {"r8", "r8d", "r8w", "r8b"},
+    {"r9", "r9d", "r9w", "r9b"},    {"r10", "r10d", "r10w", "r10b"}, {"r11", "r11d", "r11w", "r11b"},
+    {"r12", "r12d", "r12w", "r12b"}, {"r13", "r13d", "r13w", "r13b"}, {"r14", "r14d", "r14w", "r14b"},
+    {"r15", "r15d", "r15w", "r15b"}};
+
+/*
+    Helper function to index every general purpose register name by its number and width, so an
+    operand is one lookup rather than a scan of the names
+*/
+map<string, pair<int, int>> general_register_table() {
+    const int widths[4] = {8, 4, 2, 1};
+    map<string, pair<int, int>> table;
+    for (size_t n = 0; n < register_numbers.size(); ++n) {
+        for (int w = 0; w < 4; ++w) {
+            table["%" + register_numbers[n][w]] = {(int)n, widths[w]};
+        }
+    }
+    return table;
+}
+const map<string, pair<int, int>> general_registers = general_register_table();
+
+// condition codes by their suffix, with the aliases gas takes
+const map<string, int> condition_codes = {
+    {"o", 0},   {"no", 1},  {"b", 2},    {"c", 2},  {"nae", 2}, {"ae", 3},  {"nb", 3},  {"nc", 3},
+    {"e", 4},   {"z", 4},   {"ne", 5},   {"nz", 5}, {"be", 6},  {"na", 6},  {"a", 7},   {"nbe", 7},
+    {"s", 8},   {"ns", 9},  {"p", 10},   {"pe", 10}, {"np", 11}, {"po", 11}, {"l", 12},  {"nge", 12},
+    {"ge", 13}, {"nl", 13}, {"le", 14},  {"ng", 14}, {"g", 15},  {"nle", 15}};
+
+// instructions without operands
+const map<string, vector<unsigned char>> fixed_encodings = {
+    {"ret", {0xC3}},          {"leave", {0xC9}},        {"nop", {0x90}},          {"cltq", {0x48, 0x98}},
+    {"cqto", {0x48, 0x99}},   {"cltd", {0x99}},         {"cwtl", {0x98}},         {"cpuid", {0x0F, 0xA2}},
+    {"ud2", {0x0F, 0x0B}},    {"xgetbv", {0x0F, 0x01, 0xD0}}, {"vzeroupper", {0xC5, 0xF8, 0x77}},
+    {"stosb", {0xAA}},        {"stosw", {0x66, 0xAB}},  {"stosl", {0xAB}},        {"stosq", {0x48, 0xAB}},
+    {"movsb", {0xA4}},        {"movsw", {0x66, 0xA5}},  {"movsl", {0xA5}},        {"movsq", {0x48, 0xA5}}};
+
+// the arithmetic group in opcode order, which is also their ModRM /digit under 0x80 to 0x83
+const vector<string> alu_opcodes = {"add", "or", "adc", "sbb", "and", "sub", "xor", "cmp"};
+
+// /digit of the one operand instructions under 0xF6 and 0xF7, and of the shifts under 0xC0 to 0xD3
+const map<string, int> unary_digits = {{"not", 2}, {"neg", 3}, {"mul", 4}, {"div", 6}, {"idiv", 7}};
+const map<string, int> shift_digits = {{"rol", 0}, {"ror", 1}, {"rcl", 2}, {"rcr", 3},
+                                       {"shl", 4}, {"sal", 4}, {"shr", 5}, {"sar", 7}};
+
+// the opcodes that take a b, w, l or q size suffix
+const vector<string> sized_opcodes = {"mov", "add", "or",  "adc", "sbb", "and", "sub", "xor", "cmp",  "test",
+                                      "lea", "imul", "not", "neg", "mul", "div", "idiv", "inc", "dec", "rol",
+                                      "ror", "rcl", "rcr", "shl", "sal", "shr", "sar", "push", "pop"};
+
+// the SSE instructions and the AVX ones, which are named by their SSE name with a leading v
+const map<string, VectorOpcode> vector_opcodes = {
+    {"movd", {0x66, 1, 0x6E, 0x7E, false}},     {"movq", {0x66, 1, 0x6E, 0x7E, true}},
+    {"movdqa", {0x66, 1, 0x6F, 0x7F, false}},   {"movdqu", {0xF3, 1, 0x6F, 0x7F, false}},
+    {"movdqa32", {0x66, 1, 0x6F, 0x7F, false}}, {"movdqu32", {0xF3, 1, 0x6F, 0x7F, false}},
+    {"paddd", {0x66, 1, 0xFE, -1, false}},      {"psubd", {0x66, 1, 0xFA, -1, false}},
+    {"pand", {0x66, 1, 0xDB, -1, false}},       {"pandn", {0x66, 1, 0xDF, -1, false}},
+    {"por", {0x66, 1, 0xEB, -1, false}},        {"pxor", {0x66, 1, 0xEF, -1, false}},
+    {"pandd", {0x66, 1, 0xDB, -1, false}},      {"pandnd", {0x66, 1, 0xDF, -1, false}},
+    {"pord", {0x66, 1, 0xEB, -1, false}},       {"pxord", {0x66, 1, 0xEF, -1, false}},
+    {"pcmpeqd", {0x66, 1, 0x76, -1, false}},    {"pcmpgtd", {0x66, 1, 0x66, -1, false}},
+    {"pshufd", {0x66, 1, 0x70, -1, false}},     {"pmulld", {0x66, 2, 0x40, -1, false}},
+    {"pmaxsd", {0x66, 2, 0x3D, -1, false}},     {"pminsd", {0x66, 2, 0x39, -1, false}},
+    {"pbroadcastd", {0x66, 2, 0x58, -1, false}}, {"pblendvb", {0x66, 3, 0x4C, -1, false}},
+    {"pblendmd", {0x66, 2, 0x64, -1, false}}};
+
+// the ones that only exist as AVX, and of those the ones that only have an AVX-512 (EVEX) encoding
+const set<string> avx_opcodes = {"pbroadcastd", "pblendvb"};
+const set<string> evex_opcodes = {"movdqa32", "movdqu32", "pandd", "pandnd", "pord", "pxord", "pblendmd"};
+
+bool fits_byte(long v) {
+    return v >= -128 && v <= 127;
+}
+
+/*
+    Helper function to read an immediate as the instruction sees it, sign extended from its width
+*/
+long immediate_value(long v, int width) {
+    return width == 1 ? (signed char)v : width == 2 ? (short)v : width == 4 ? (int)v : v;
+}
+
+/*
+    Helper function to read a register name like "%eax" or "%ymm3" into out
+*/
+bool parse_register_operand(const string &name, Operand &out) {
+    auto general = general_registers.find(name);
+    if (general != general_registers.end()) {
+        out.kind = 'r';
+        out.reg = general->second.first;
+        out.width = general->second.second;
+        out.rex_byte = out.width == 1 && out.reg >= 4 && out.reg < 8;
+        return true;
+    }
+    const char *prefixes[4] = {"%xmm", "%ymm", "%zmm", "%k"};
+    const int widths[4] = {16, 32, 64, 0};
+    for (int r = 0; r < 4; ++r) {
+        size_t length = r == 3 ? 2 : 4;
+        if (name.size() <= length || name.size() > length + 2 || name.compare(0, length, prefixes[r]) != 0) {
+            continue;
+        }
+        int number = 0;
+        for (size_t i = length; i < name.size(); ++i) {
+            if (!isdigit(name[i])) {
+                return false;
+            }
+            number = number * 10 + (name[i] - '0');
+        }
+        out.kind = widths[r] ? 'r' : 'k';
+        out.reg = number;
+        out.width = widths[r];
+        return number < (out.kind == 'r' ? 32 : 8);
+    }
+    return false;
+}
+
+/*
+    Helper function to read a displacement or immediate: a number, a symbol, or a symbol plus or
+    minus a number
+*/
+bool parse_value(const string &s, string &symbol, long &value) {
+    symbol = "";
+    value = 0;
+    size_t number = 0;
+    if (!s.empty() && !isdigit(s[0]) && s[0] != '-' && s[0] != '+') {
+        number = min(s.find_first_of("+-"), s.size());
+        symbol = s.substr(0, number);
+    }
+    if (number < s.size()) {
+        char *end;
+        value = strtoll(s.c_str() + number, &end, 0);
+        return *end == '\0' && end != s.c_str() + number;
+    }
+    return true;
+}
+
+/*
+    Helper function to copy s from begin up to end without the whitespace around it
+*/
+string trimmed(const string &s, size_t begin, size_t end) {
+    const char *space = " \t\n\r\f\v";
+    begin = min(s.find_first_not_of(space, begin), end);
+    return begin == end ? "" : s.substr(begin, s.find_last_not_of(space, end - 1) + 1 - begin);
+}
+
+/*
+    Split the operands of an instruction at the commas that aren't inside parentheses or braces
+*/
+vector<string> split_operands(const string &ops) {
+    vector<string> out;
+    out.reserve(3);
+    size_t start = 0;
+    int depth = 0;
+    // jumps from one bracket or comma to the next, the end of ops acting as a last comma
+    for (size_t i = ops.find_first_of(",(){}"); start <= ops.size(); i = ops.find_first_of(",(){}", i + 1)) {
+        i = min(i, ops.size());
+        char c = i < ops.size() ? ops[i] : ',';
+        depth += (c == '(' || c == '{') - (c == ')' || c == '}');
+        if (c == ',' && (depth == 0 || i == ops.size())) {
+            string operand = trimmed(ops, start, i);
+            if (i < ops.size() || !operand.empty() || !out.empty()) {
+                out.push_back(move(operand));
+            }
+            start = i + 1;
+        }
+    }
+    return out;
+}
+
+/*
+    Read one AT&T operand into out
+    Returns false for what the encoder doesn't know
+*/
+bool parse_operand(const string &text, Operand &out) {
+    out.kind = 0;
+    out.reg = -1;
+    out.width = 0;
+    out.rex_byte = false;
+    out.mask = 0;
+    out.value = 0;
+    out.symbol = "";
+    out.base = -1;
+    out.index = -1;
+    out.scale = 1;
+    out.rip = false;
+    out.indirect = false;
+
+    string op = trimmed(text, 0, text.size());
+    if (!op.empty() && op[0] == '*') {
+        out.indirect = true;
+        op.erase(0, 1);
+    }
+    if (op.empty()) {
+        return false;
+    }
+    if (op[0] == '$') {
+        out.kind = 'i';
+        return parse_value(op.substr(1), out.symbol, out.value);
+    }
+    if (op[0] == '%') {
+        size_t brace = op.find('{');
+        if (brace != string::npos) {
+            Operand mask;
+            if (op.back() != '}' || !parse_register_operand(op.substr(brace + 1, op.size() - brace - 2), mask) ||
+                mask.kind != 'k' || mask.reg == 0) {
+                return false;
+            }
+            out.mask = mask.reg;
+            op = op.substr(0, brace);
+        }
+        return parse_register_operand(op, out);
+    }
+
+    size_t paren = op.find('(');
+    if (paren == string::npos) {
+        // a jump or call target, or an absolute address
+        out.kind = out.indirect ? 'm' : 'l';
+        return parse_value(op, out.symbol, out.value) && !out.symbol.empty();
+    }
+    out.kind = 'm';
+    if (op.back() != ')' || !parse_value(op.substr(0, paren), out.symbol, out.value)) {
+        return false;
+    }
+    // base, index and scale, split without a vector as nearly every instruction has one
+    if (paren + 2 == op.size()) {
+        return false;
+    }
+    string parts[3];
+    size_t count = 0;
+    for (size_t start = paren + 1; start < op.size(); ++count) {
+        size_t comma = min(op.find(',', start), op.size() - 1);
+        if (count == 3) {
+            return false;
+        }
+        parts[count] = trimmed(op, start, comma);
+        start = comma + 1;
+    }
+    Operand reg;
+    if (parts[0] == "%rip" && count == 1) {
+        out.rip = true;
+    } else if (!parts[0].empty()) {
+        if (!parse_register_operand(parts[0], reg) || reg.kind != 'r' || reg.width != 8) {
+            return false;
+        }
+        out.base = reg.reg;
+    }
+    if (count > 1) {
+        if (!parse_register_operand(parts[1], reg) || reg.kind != 'r' || reg.width != 8 || reg.reg == 4) {
+            return false;
+        }
+        out.index = reg.reg;
+    }
+    if (count > 2) {
+        if (parts[2] != "1" && parts[2] != "2" && parts[2] != "4" && parts[2] != "8") {
+            return false;
+        }
+        out.scale = stoi(parts[2]);
+    }
+    return true;
+}
+
+void append_value(Encoding &e, long value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        e.bytes.push_back(value >> (8 * i) & 0xff);
+    }
+}
+
+/*
+    Helper function to append an immediate, leaving a fixup of type when it is a symbol's address
+*/
+void append_immediate(Encoding &e, const Operand &imm, int bytes, int type = R_X86_64_32S) {
+    if (imm.symbol.empty()) {
+        append_value(e, imm.value, bytes);
+    } else {
+        e.fixups.push_back({e.bytes.size(), imm.symbol, imm.value, type});
+        append_value(e, 0, bytes);
+    }
+}
+
+/*
+    Helper function to append the 32 bit displacement of a memory operand
+    A %rip relative one counts from the end of the instruction, past the immediate that follows it
+*/
+void append_displacement(Encoding &e, const Operand &rm, int imm_bytes) {
+    if (rm.symbol.empty()) {
+        append_value(e, rm.value, 4);
+    } else if (rm.rip) {
+        e.fixups.push_back({e.bytes.size(), rm.symbol, rm.value - 4 - imm_bytes, R_X86_64_PC32});
+        append_value(e, 0, 4);
+    } else {
+        e.fixups.push_back({e.bytes.size(), rm.symbol, rm.value, R_X86_64_32S});
+        append_value(e, 0, 4);
+    }
+}
+
+/*
+    Helper function to append the ModRM byte for reg (a register number or an opcode's /digit) and
+    the register or memory operand rm, with the SIB byte and displacement a memory operand needs
+    A displacement that is a multiple of disp_scale small enough to fit a byte once divided by it
+    takes one byte, the compressed disp8 of EVEX
+*/
+void append_modrm(Encoding &e, int reg, const Operand &rm, int imm_bytes, int disp_scale = 1) {
+    if (rm.kind != 'm') {
+        e.bytes.push_back(0xC0 | (reg & 7) << 3 | (rm.reg & 7));
+        return;
+    }
+    if (rm.rip) {
+        e.bytes.push_back((reg & 7) << 3 | 5);
+        append_displacement(e, rm, imm_bytes);
+        return;
+    }
+
+    // no base is a disp32 in the SIB byte, and %rbp or %r13 as the base always take a displacement
+    int mod = 2;
+    if (rm.base < 0) {
+        mod = 0;
+    } else if (!rm.symbol.empty()) {
+        mod = 2;
+    } else if (rm.value == 0 && (rm.base & 7) != 5) {
+        mod = 0;
+    } else if (rm.value % disp_scale == 0 && fits_byte(rm.value / disp_scale)) {
+        mod = 1;
+    }
+    bool sib = rm.base < 0 || rm.index >= 0 || (rm.base & 7) == 4;
+    e.bytes.push_back(mod << 6 | (reg & 7) << 3 | (sib ? 4 : rm.base & 7));
+    if (sib) {
+        int scale = rm.scale == 8 ? 3 : rm.scale == 4 ? 2 : rm.scale == 2 ? 1 : 0;
+        e.bytes.push_back(scale << 6 | (rm.index < 0 ? 4 : rm.index & 7) << 3 | (rm.base < 0 ? 5 : rm.base & 7));
+    }
+    if (mod == 1) {
+        e.bytes.push_back(rm.value / disp_scale & 0xff);
+    } else if (mod == 2 || rm.base < 0) {
+        append_displacement(e, rm, imm_bytes);
+    }
+}
+
+/*
+    Helper function to get the REX.R, REX.X and REX.B bits for the registers past the first eight
+*/
+int rex_bits(int reg, const Operand &rm) {
+    int rex = (reg >> 3 & 1) << 2;
+    if (rm.kind == 'm') {
+        rex |= (rm.index >= 0 ? rm.index >> 3 & 1 : 0) << 1;
+        rex |= rm.base >= 0 ? rm.base >> 3 & 1 : 0;
+    } else {
+        rex |= rm.reg >> 3 & 1;
+    }
+    return rex;
+}
+
+/*
+    Helper function to encode an instruction with a ModRM: its operand size prefix, the mandatory
+    prefix of an SSE instruction, a REX prefix when it needs one, the opcode and the ModRM of reg and rm
+    force_rex is for %sil and the like, which are %dh and the like without a REX
+*/
+void encode_modrm_instruction(Encoding &e, int width, const vector<int> &opcode, int reg, const Operand &rm,
+                              int imm_bytes, bool force_rex, int prefix = 0) {
+    if (width == 2) {
+        e.bytes.push_back(0x66);
+    }
+    if (prefix) {
+        e.bytes.push_back(prefix);
+    }
+    int rex = (width == 8 ? 8 : 0) | rex_bits(reg, rm);
+    if (rex || force_rex) {
+        e.bytes.push_back(0x40 | rex);
+    }
+    for (int b : opcode) {
+        e.bytes.push_back(b);
+    }
+    append_modrm(e, reg, rm, imm_bytes);
+}
+
+/*
+    Helper function to encode an instruction that has its register in the low bits of the opcode
+*/
+void encode_register_opcode(Encoding &e, int width, int opcode, int reg, bool force_rex) {
+    if (width == 2) {
+        e.bytes.push_back(0x66);
+    }
+    int rex = (width == 8 ? 8 : 0) | (reg >> 3 & 1);
+    if (rex || force_rex) {
+        e.bytes.push_back(0x40 | rex);
+    }
+    e.bytes.push_back(opcode + (reg & 7));
+}
+
+/*
+    Helper function to encode the accumulator form of an arithmetic instruction with an immediate,
+    which has no ModRM
+*/
+void encode_accumulator(Encoding &e, int width, int opcode, const Operand &imm) {
+    if (width == 2) {
+        e.bytes.push_back(0x66);
+    } else if (width == 8) {
+        e.bytes.push_back(0x48);
+    }
+    e.bytes.push_back(width == 1 ? opcode : opcode + 1);
+    append_immediate(e, imm, min(width, 4));
+}
+
+int vector_prefix_bits(int prefix) {
+    return prefix == 0x66 ? 1 : prefix == 0xF3 ? 2 : prefix == 0xF2 ? 3 : 0;
+}
+
+/*
+    Helper function to encode an AVX instruction: its two or three byte VEX prefix, the opcode and the
+    ModRM. vvvv is the source register the ModRM has no room for, 0 for none.
+*/
+void encode_vex(Encoding &e, const VectorOpcode &code, int opcode, int length, int reg, int vvvv, const Operand &rm,
+                int imm_bytes) {
+    int rex = rex_bits(reg, rm);
+    int r = rex >> 2 & 1, x = rex >> 1 & 1, b = rex & 1;
+    int tail = (~vvvv & 15) << 3 | length << 2 | vector_prefix_bits(code.prefix);
+    if (!x && !b && !code.w && code.map == 1) {
+        e.bytes.push_back(0xC5);
+        e.bytes.push_back(!r << 7 | tail);
+    } else {
+        e.bytes.push_back(0xC4);
+        e.bytes.push_back(!r << 7 | !x << 6 | !b << 5 | code.map);
+        e.bytes.push_back(code.w << 7 | tail);
+    }
+    e.bytes.push_back(opcode);
+    append_modrm(e, reg, rm, imm_bytes);
+}
+
+/*
+    Helper function to encode an AVX-512 instruction: its EVEX prefix, with the write mask of the
+    destination, the opcode and the ModRM. A memory operand's byte displacement is scaled by disp_scale.
+*/
+void encode_evex(Encoding &e, const VectorOpcode &code, int opcode, int length, int reg, int vvvv, const Operand &rm,
+                 int mask, int imm_bytes, int disp_scale) {
+    int x = rm.kind == 'm' ? (rm.index >= 0 ? rm.index >> 3 & 1 : 0) : rm.reg >> 4 & 1;
+    int b = rm.kind == 'm' ? (rm.base >= 0 ? rm.base >> 3 & 1 : 0) : rm.reg >> 3 & 1;
+    e.bytes.push_back(0x62);
+    e.bytes.push_back(!(reg >> 3 & 1) << 7 | !x << 6 | !b << 5 | !(reg >> 4 & 1) << 4 | code.map);
+    e.bytes.push_back(code.w << 7 | (~vvvv & 15) << 3 | 4 | vector_prefix_bits(code.prefix));
+    e.bytes.push_back(length << 5 | !(vvvv >> 4 & 1) << 3 | mask);
+    e.bytes.push_back(opcode);
+    append_modrm(e, reg, rm, imm_bytes, rm.kind == 'm' ? disp_scale : 1);
+}
+
+/*
+    Helper function to encode an SSE, AVX or AVX-512 instruction
+    The AT&T operands are the sources then the destination: the last source goes in the ModRM's
+    r/m, a middle one in VEX.vvvv, and vpblendvb's leading mask in the high bits of an immediate.
+    AVX-512 is used for %zmm registers, masks and the instructions that have nothing else.
+*/
+bool encode_vector(const string &op, vector<Operand> ops, Encoding &e) {
+    bool avx = op[0] == 'v' && vector_opcodes.count(op.substr(1));
+    string name = avx ? op.substr(1) : op;
+    auto found = vector_opcodes.find(name);
+    if (found == vector_opcodes.end() || (!avx && (avx_opcodes.count(name) || evex_opcodes.count(name)))) {
+        return false;
+    }
+    VectorOpcode code = found->second;
+
+    Operand imm;
+    bool has_imm = !ops.empty() && ops[0].kind == 'i';
+    if (has_imm) {
+        imm = ops[0];
+        ops.erase(ops.begin());
+    }
+    if (ops.size() < 2 || ops.size() > (avx ? 4u : 2u) || (has_imm && name != "pshufd")) {
+        return false;
+    }
+
+    bool evex = evex_opcodes.count(name);
+    bool general = false;
+    int width = 16;
+    for (auto const &o : ops) {
+        if (o.kind == 'r' && o.width >= 16) {
+            width = max(width, o.width);
+            evex = evex || o.reg > 15;
+        }
+        evex = evex || o.kind == 'k' || o.mask;
+        general = general || (o.kind == 'r' && o.width <= 8);
+        if (o.kind != 'r' && o.kind != 'k' && o.kind != 'm') {
+            return false;
+        }
+    }
+    evex = (evex || width == 64) && avx;
+    if (width == 64 && !evex) {
+        return false;
+    }
+    int length = width == 64 ? 2 : width == 32 ? 1 : 0;
+
+    // movd and movq move between a vector register and a general purpose one or memory
+    bool scalar = name == "movd" || name == "movq" || name == "pbroadcastd";
+    if ((name == "movq" && !general) || (general && !scalar)) {
+        return false;
+    }
+    int opcode = code.load;
+    int disp_scale = scalar ? (code.w ? 8 : 4) : width;
+    if (name == "pbroadcastd" && general) {
+        if (!evex) {
+            return false;
+        }
+        opcode = 0x7C;
+    }
+
+    Operand dst = ops.back();
+    Operand rm;
+    int reg, vvvv = 0, is4 = -1;
+    if (ops.size() == 2) {
+        if (dst.kind == 'k' || (dst.kind == 'r' && dst.width >= 16)) {
+            reg = dst.reg;
+            rm = ops[0];
+        } else if (code.store >= 0 && ops[0].kind == 'r') {
+            opcode = code.store;
+            reg = ops[0].reg;
+            rm = dst;
+        } else {
+            return false;
+        }
+    } else {
+        if (dst.kind == 'm' || ops[ops.size() - 2].kind == 'm') {
+            return false;
+        }
+        reg = dst.reg;
+        vvvv = ops[ops.size() - 2].reg;
+        rm = ops[ops.size() - 3];
+        if (ops.size() == 4) {
+            if (name != "pblendvb" || ops[0].kind != 'r') {
+                return false;
+            }
+            is4 = ops[0].reg;
+            rm = ops[1];
+        } else if (name == "pblendvb") {
+            return false;
+        }
+    }
+    if (rm.kind == 'k' || (!evex && (reg > 15 || vvvv > 15))) {
+        return false;
+    }
+
+    int imm_bytes = has_imm || is4 >= 0 ? 1 : 0;
+    if (evex) {
+        encode_evex(e, code, opcode, length, reg, vvvv, rm, dst.mask, imm_bytes, disp_scale);
+    } else if (avx) {
+        encode_vex(e, code, opcode, length, reg, vvvv, rm, imm_bytes);
+    } else {
+        vector<int> bytes = {0x0F};
+        if (code.map > 1) {
+            bytes.push_back(code.map == 2 ? 0x38 : 0x3A);
+        }
+        bytes.push_back(opcode);
+        encode_modrm_instruction(e, code.w ? 8 : 4, bytes, reg, rm, imm_bytes, false, code.prefix);
+    }
+    if (has_imm) {
+        e.bytes.push_back(imm.value & 0xff);
+    } else if (is4 >= 0) {
+        e.bytes.push_back(is4 << 4);
+    }
+    return true;
+}
+
+/*
+    Helper function to encode one instruction from its opcode and parsed operands
+    Returns false for one the encoder doesn't know
+*/
+bool encode_operation(const string &op, const vector<Operand> &ops, Encoding &e) {
+    auto fixed = ops.empty() ? fixed_encodings.find(op) : fixed_encodings.end();
+    if (fixed != fixed_encodings.end()) {
+        e.bytes = fixed->second;
+        return true;
+    }
+    for (auto const &o : ops) {
+        if (o.kind == 'k' || (o.kind == 'r' && o.width >= 16)) {
+            return encode_vector(op, ops, e);
+        }
+    }
+    if (op[0] == 'v' || (vector_opcodes.count(op) && op != "movq")) {
+        return encode_vector(op, ops, e);
+    }
+
+    // jumps to labels are left to the object writer
+    if (op == "jmp" || (op[0] == 'j' && condition_codes.count(op.substr(1)))) {
+        if (ops.size() != 1) {
+            return false;
+        }
+        if (ops[0].kind == 'l') {
+            e.branch = ops[0].symbol;
+            e.addend = ops[0].value;
+            e.condition = op == "jmp" ? -1 : condition_codes.at(op.substr(1));
+            return true;
+        }
+        if (op != "jmp" || !ops[0].indirect) {
+            return false;
+        }
+        encode_modrm_instruction(e, 4, {0xFF}, 4, ops[0], 0, false);
+        return true;
+    }
+    if (op == "movabsq") {
+        // always the 10 byte form with a full 64 bit immediate
+        if (ops.size() != 2 || ops[0].kind != 'i' || ops[1].kind != 'r' || ops[1].width != 8) {
+            return false;
+        }
+        encode_register_opcode(e, 8, 0xB8, ops[1].reg, false);
+        append_immediate(e, ops[0], 8, R_X86_64_64);
+        return true;
+    }
+    if (op == "call" || op == "callq") {
+        if (ops.size() != 1) {
+            return false;
+        }
+        if (ops[0].kind == 'l') {
+            e.bytes.push_back(0xE8);
+            e.fixups.push_back({e.bytes.size(), ops[0].symbol, ops[0].value - 4, R_X86_64_PLT32});
+            append_value(e, 0, 4);
+            return true;
+        }
+        if (!ops[0].indirect) {
+            return false;
+        }
+        encode_modrm_instruction(e, 4, {0xFF}, 2, ops[0], 0, false);
+        return true;
+    }
+
+    // anything else named without parentheses is an absolute address
+    bool force_rex = false;
+    for (auto const &o : ops) {
+        if (o.kind == 'l') {
+            vector<Operand> absolute = ops;
+            for (auto &a : absolute) {
+                a.kind = a.kind == 'l' ? 'm' : a.kind;
+            }
+            return encode_operation(op, absolute, e);
+        }
+        if (o.indirect) {
+            return false;
+        }
+        force_rex = force_rex || o.rex_byte;
+    }
+
+    if (op.compare(0, 3, "set") == 0 && condition_codes.count(op.substr(3))) {
+        if (ops.size() != 1 || (ops[0].kind == 'r' && ops[0].width != 1) || ops[0].kind == 'i') {
+            return false;
+        }
+        encode_modrm_instruction(e, 1, {0x0F, 0x90 + condition_codes.at(op.substr(3))}, 0, ops[0], 0, force_rex);
+        return true;
+    }
+    if (op.compare(0, 4, "cmov") == 0) {
+        string cc = op.substr(4);
+        if (!condition_codes.count(cc) && !cc.empty() && suffix_width(cc.back())) {
+            cc.pop_back();
+        }
+        if (!condition_codes.count(cc) || ops.size() != 2 || ops[1].kind != 'r' || ops[1].width < 2 ||
+            ops[0].kind == 'i') {
+            return false;
+        }
+        encode_modrm_instruction(e, ops[1].width, {0x0F, 0x40 + condition_codes.at(cc)}, ops[1].reg, ops[0], 0, false);
+        return true;
+    }
+
+    // movsbl, movzwl, movslq and the like
+    if (op.size() == 6 && (op.compare(0, 4, "movs") == 0 || op.compare(0, 4, "movz") == 0) &&
+        suffix_width(op[4]) && suffix_width(op[5]) > suffix_width(op[4])) {
+        int from = suffix_width(op[4]);
+        if (ops.size() != 2 || ops[1].kind != 'r' || ops[0].kind == 'i' || (from == 4 && op[3] == 'z')) {
+            return false;
+        }
+        vector<int> opcode = {0x63};
+        if (from < 4) {
+            opcode = {0x0F, (op[3] == 's' ? 0xBE : 0xB6) + (from == 2 ? 1 : 0)};
+        }
+        encode_modrm_instruction(e, suffix_width(op[5]), opcode, ops[1].reg, ops[0], 0, force_rex);
+        return true;
+    }
+
+    string base;
+    int width = 0;
+    if (!split_opcode(op, sized_opcodes, base, width)) {
+        base = op;
+        for (auto const &o : ops) {
+            if (o.kind == 'r') {
+                width = o.width;
+            }
+        }
+    }
+    if (!width) {
+        return false;
+    }
+    for (auto const &o : ops) {
+        if (o.kind == 'i' && !o.symbol.empty() && width < 4) {
+            return false;
+        }
+    }
+    int imm_bytes = min(width, 4);
+    int wide = width == 1 ? 0 : 1;  // opcodes come in pairs, the byte one and the rest
+
+    if (ops.size() == 2 && ops[1].kind != 'i') {
+        const Operand &src = ops[0];
+        const Operand &dst = ops[1];
+        long v = immediate_value(src.value, width);
+        auto alu = find(alu_opcodes.begin(), alu_opcodes.end(), base);
+        if (alu != alu_opcodes.end()) {
+            int digit = alu - alu_opcodes.begin();
+            if (src.kind == 'i') {
+                if (width != 1 && src.symbol.empty() && fits_byte(v)) {
+                    encode_modrm_instruction(e, width, {0x83}, digit, dst, 1, force_rex);
+                    e.bytes.push_back(v & 0xff);
+                } else if (dst.kind == 'r' && dst.reg == 0) {
+                    encode_accumulator(e, width, digit * 8 + 4, src);
+                } else {
+                    encode_modrm_instruction(e, width, {0x80 + wide}, digit, dst, imm_bytes, force_rex);
+                    append_immediate(e, src, imm_bytes);
+                }
+            } else if (src.kind == 'r') {
+                encode_modrm_instruction(e, width, {digit * 8 + wide}, src.reg, dst, 0, force_rex);
+            } else if (dst.kind == 'r') {
+                encode_modrm_instruction(e, width, {digit * 8 + 2 + wide}, dst.reg, src, 0, force_rex);
+            } else {
+                return false;
+            }
+            return true;
+        }
+        if (base == "test") {
+            if (src.kind == 'i' && dst.kind == 'r' && dst.reg == 0) {
+                encode_accumulator(e, width, 0xA8, src);
+            } else if (src.kind == 'i') {
+                encode_modrm_instruction(e, width, {0xF6 + wide}, 0, dst, imm_bytes, force_rex);
+                append_immediate(e, src, imm_bytes);
+            } else if (src.kind == 'r' || dst.kind == 'r') {
+                const Operand &reg = src.kind == 'r' ? src : dst;
+                encode_modrm_instruction(e, width, {0x84 + wide}, reg.reg, src.kind == 'r' ? dst : src, 0, force_rex);
+            } else {
+                return false;
+            }
+            return true;
+        }
+        if (base == "mov") {
+            if (src.kind == 'i' && dst.kind == 'r' && width == 8 && (!src.symbol.empty() || v == (int)v)) {
+                encode_modrm_instruction(e, 8, {0xC7}, 0, dst, 4, false);
+                append_immediate(e, src, 4);
+            } else if (src.kind == 'i' && dst.kind == 'r') {
+                encode_register_opcode(e, width, wide ? 0xB8 : 0xB0, dst.reg, force_rex);
+                append_immediate(e, src, width, width == 8 ? R_X86_64_64 : R_X86_64_32);
+            } else if (src.kind == 'i') {
+                encode_modrm_instruction(e, width, {0xC6 + wide}, 0, dst, imm_bytes, force_rex);
+                append_immediate(e, src, imm_bytes);
+            } else if (src.kind == 'r') {
+                encode_modrm_instruction(e, width, {0x88 + wide}, src.reg, dst, 0, force_rex);
+            } else if (dst.kind == 'r') {
+                encode_modrm_instruction(e, width, {0x8A + wide}, dst.reg, src, 0, force_rex);
+            } else {
+                return false;
+            }
+            return true;
+        }
+        if (base == "lea" && src.kind == 'm' && dst.kind == 'r' && width > 1) {
+            encode_modrm_instruction(e, width, {0x8D}, dst.reg, src, 0, false);
+            return true;
+        }
+        if (base == "imul" && src.kind != 'i' && dst.kind == 'r' && width > 1) {
+            encode_modrm_instruction(e, width, {0x0F, 0xAF}, dst.reg, src, 0, false);
+            return true;
+        }
+        if (shift_digits.count(base)) {
+            int digit = shift_digits.at(base);
+            if (src.kind == 'i' && src.symbol.empty() && src.value == 1) {
+                encode_modrm_instruction(e, width, {0xD0 + wide}, digit, dst, 0, force_rex);
+            } else if (src.kind == 'i' && src.symbol.empty()) {
+                encode_modrm_instruction(e, width, {0xC0 + wide}, digit, dst, 1, force_rex);
+                e.bytes.push_back(src.value & 0xff);
+            } else if (src.kind == 'r' && src.reg == 1 && src.width == 1) {
+                encode_modrm_instruction(e, width, {0xD2 + wide}, digit, dst, 0, force_rex);
+            } else {
+                return false;
+            }
+            return true;
+        }
+    }
+
+    // imul $n, src, dst, and imul $n, dst for short
+    if (base == "imul" && (ops.size() == 3 || ops.size() == 2) && ops[0].kind == 'i' && ops.back().kind == 'r' &&
+        width > 1 && ops[0].symbol.empty()) {
+        const Operand &src = ops[ops.size() - 2];
+        long v = immediate_value(ops[0].value, width);
+        if (fits_byte(v)) {
+            encode_modrm_instruction(e, width, {0x6B}, ops.back().reg, src, 1, false);
+            e.bytes.push_back(v & 0xff);
+        } else {
+            encode_modrm_instruction(e, width, {0x69}, ops.back().reg, src, imm_bytes, false);
+            append_immediate(e, ops[0], imm_bytes);
+        }
+        return true;
+    }
+
+    if (ops.size() != 1 || ops[0].kind == 'k') {
+        return false;
+    }
+    const Operand &o = ops[0];
+    if ((unary_digits.count(base) || base == "imul" || base == "inc" || base == "dec") && o.kind != 'i') {
+        if (base == "inc" || base == "dec") {
+            encode_modrm_instruction(e, width, {0xFE + wide}, base == "dec", o, 0, force_rex);
+        } else {
+            encode_modrm_instruction(e, width, {0xF6 + wide}, base == "imul" ? 5 : unary_digits.at(base), o, 0, force_rex);
+        }
+        return true;
+    }
+    if (shift_digits.count(base) && o.kind != 'i') {
+        encode_modrm_instruction(e, width, {0xD0 + wide}, shift_digits.at(base), o, 0, force_rex);
+        return true;
+    }
+    // push and pop are 8 bytes without a REX.W
+    if (base == "push" && o.kind == 'i') {
+        if (o.symbol.empty() && fits_byte(o.value)) {
+            e.bytes.push_back(0x6A);
+            e.bytes.push_back(o.value & 0xff);
+        } else {
+            e.bytes.push_back(0x68);
+            append_immediate(e, o, 4);
+        }
+        return true;
+    }
+    if ((base == "push" || base == "pop") && o.kind == 'r' && (o.width == 8 || o.width == 2)) {
+        encode_register_opcode(e, o.width == 2 ? 2 : 4, base == "push" ? 0x50 : 0x58, o.reg, false);
+        return true;
+    }
+    if ((base == "push" || base == "pop") && o.kind == 'm') {
+        encode_modrm_instruction(e, width == 2 ? 2 : 4, {base == "push" ? 0xFF : 0x8F}, base == "push" ? 6 : 0, o, 0, false);
+        return true;
+    }
+    return false;
+}
+
+/*
+    Encode one AT&T instruction as gas would
+    Throws for the ones the encoder doesn't know, which --emit=gas can still assemble
+*/
+Encoding encode_instruction(const string &ins) {
+    size_t begin = min(ins.find_first_not_of(" \t"), ins.size());
+    size_t space = min(ins.find_first_of(" \t", begin), ins.size());
+    string op = ins.substr(begin, space - begin);
+    string rest = ins.substr(space);
+
+    Encoding e;
+    e.bytes.reserve(16);
+    e.addend = 0;
+    e.condition = -1;
+    if (op == "rep") {
+        // after the operand size prefix, where gas puts it
+        e = encode_instruction(rest);
+        e.bytes.insert(e.bytes.begin() + (e.bytes[0] == 0x66), 0xF3);
+        for (auto &f : e.fixups) {
+            f.offset++;
+        }
+        return e;
+    }
+
+    vector<Operand> ops;
+    ops.reserve(3);
+    for (auto const &s : split_operands(rest)) {
+        Operand o;
+        if (!parse_operand(s, o)) {
+            string text = ins;
+            trim(text);
+            throw runtime_error("cannot encode `" + text + "`: unknown operand " + s);
+        }
+        ops.push_back(move(o));
+    }
+    if (op.empty() || !encode_operation(op, ops, e)) {
+        string text = ins;
+        trim(text);
+        throw runtime_error("cannot encode `" + text + "`");
+    }
+    return e;
+}
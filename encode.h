@@ -0,0 +1,68 @@
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// the x86-64 ELF relocations the encoder and the object writer use
+const int R_X86_64_64 = 1;
+const int R_X86_64_PC32 = 2;
+const int R_X86_64_PLT32 = 4;
+const int R_X86_64_32 = 10;
+const int R_X86_64_32S = 11;
+
+/*
+    One operand of an AT&T instruction
+    Registers are numbered as the encoding numbers them, %rax 0 to %r15 15 and %xmm0 0 up
+*/
+class Operand {
+   public:
+    char kind;      // 'r' register, 'k' mask register, 'i' immediate, 'm' memory, 'l' jump or call target
+    int reg;        // of 'r' and 'k'
+    int width;      // bytes of 'r': 1 to 8 general purpose, 16 to 64 vector
+    bool rex_byte;  // %spl, %bpl, %sil or %dil, which only exist with a REX prefix
+    int mask;       // the {%kN} after a vector register, 0 for none
+    long value;     // of 'i', the displacement of 'm', the addend of 'l'
+    string symbol;  // of 'i', 'm' and 'l', "" for none
+    int base;       // of 'm', -1 for none
+    int index;      // of 'm', -1 for none
+    int scale;
+    bool rip;       // sym(%rip)
+    bool indirect;  // *op of jmp and call
+};
+
+/*
+    A field of an instruction that holds a symbol's address, filled in by the object writer once the
+    symbol is placed or left to the linker as a relocation
+*/
+class Fixup {
+   public:
+    size_t offset;  // of the field from the start of the bytes it is in
+    string symbol;
+    long addend;    // PC32 and PLT32 ones count back from the end of the field to the next instruction
+    int type;       // R_X86_64_*
+};
+
+/*
+    The machine code of one instruction
+    A jmp or jcc to a label has no bytes: the object writer picks its rel8 or rel32 form once it knows
+    how far the label is
+*/
+class Encoding {
+   public:
+    vector<unsigned char> bytes;
+    vector<Fixup> fixups;
+    string branch;  // target label of a jmp or jcc, "" otherwise
+    long addend;    // of the target label
+    int condition;  // condition code of a jcc, -1 for a jmp
+};
+
+bool fits_byte(long v);
+bool parse_value(const string &s, string &symbol, long &value);
+bool parse_operand(const string &op, Operand &out);
+vector<string> split_operands(const string &ops);
+Encoding encode_instruction(const string &ins);
+
+#endif
@@ -0,0 +1,619 @@
+#include <algorithm>
+#include <climits>
+#include <vector>
+
+#include "cfg.h"
+#include "gvn.h"
+
+using namespace std;
+
+// the general purpose registers by family, with their 8, 4, 2 and 1 byte names
+const vector<vector<string>> register_names = {
+    {"rax", "eax", "ax", "al"},     {"rbx", "ebx", "bx", "bl"},     {"rcx", "ecx", "cx", "cl"},
+    {"rdx", "edx", "dx", "dl"},     {"rsi", "esi", "si", "sil"},    {"rdi", "edi", "di", "dil"},
+    {"rbp", "ebp", "bp", "bpl"},    {"rsp", "esp", "sp", "spl"},    {"r8", "r8d", "r8w", "r8b"},
+    {"r9", "r9d", "r9w", "r9b"},    {"r10", "r10d", "r10w", "r10b"}, {"r11", "r11d", "r11w", "r11b"},
+    {"r12", "r12d", "r12w", "r12b"}, {"r13", "r13d", "r13w", "r13b"}, {"r14", "r14d", "r14w", "r14b"},
+    {"r15", "r15d", "r15w", "r15b"}};
+const int register_widths[4] = {8, 4, 2, 1};
+
+// what a call may change besides memory
+const vector<string> caller_saved = {"rax", "rcx", "rdx", "rsi", "rdi", "r8", "r9", "r10", "r11"};
+
+// the arithmetic the pass understands, and which of it doesn't care about operand order
+const vector<string> binary_opcodes = {"add", "sub", "imul", "and", "or", "xor", "sal", "sar", "shl", "shr"};
+const vector<string> commutative_opcodes = {"add", "imul", "and", "or", "xor"};
+const vector<string> unary_opcodes = {"neg", "not", "inc", "dec"};
+
+// rounds of the fixed point iteration before falling back to numbering each block on its own
+const int max_rounds = 32;
+
+int suffix_width(char c) {
+    return c == 'b' ? 1 : c == 'w' ? 2 : c == 'l' ? 4 : c == 'q' ? 8 : 0;
+}
+
+bool parse_register(const string op, string &family, int &width) {
+    if (op.empty() || op[0] != '%') {
+        return false;
+    }
+    for (auto const &names : register_names) {
+        for (int w = 0; w < 4; ++w) {
+            if (op.substr(1) == names[w]) {
+                family = names[0];
+                width = register_widths[w];
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+string register_name(const string family, int width) {
+    for (auto const &names : register_names) {
+        if (names[0] == family) {
+            for (int w = 0; w < 4; ++w) {
+                if (register_widths[w] == width) {
+                    return "%" + names[w];
+                }
+            }
+        }
+    }
+    return "";
+}
+
+bool is_memory_operand(const string op) {
+    return op.find('(') != string::npos && op[0] != '*';
+}
+
+/*
+    Helper function to split an opcode like "addl" into its base and operand width
+    Returns false when it isn't base followed by a size suffix
+*/
+bool split_opcode(const string &op, const vector<string> &bases, string &base, int &width) {
+    for (auto const &b : bases) {
+        if (op.size() == b.size() + 1 && op.compare(0, b.size(), b) == 0 && suffix_width(op.back())) {
+            base = b;
+            width = suffix_width(op.back());
+            return true;
+        }
+    }
+    return false;
+}
+
+int extend(ValueTable &values, char kind, int from, int to, int v) {
+    return values.number(string(kind == 's' ? "sext" : "zext") + to_string(from) + ">" + to_string(to) + ":" + to_string(v));
+}
+
+void kill_register(ValueState &state, const string family) {
+    auto it = state.regs.lower_bound(family + ":");
+    while (it != state.regs.end() && it->first.compare(0, family.size() + 1, family + ":") == 0) {
+        it = state.regs.erase(it);
+    }
+}
+
+/*
+    Helper function to record that a register now holds v
+    Its other widths are gone, except that a 4 byte write zero extends into the 8 byte register
+*/
+void write_register(ValueTable &values, ValueState &state, const string family, int width, int v) {
+    kill_register(state, family);
+    state.regs[family + ":" + to_string(width)] = v;
+    if (width == 4) {
+        state.regs[family + ":8"] = extend(values, 'z', 4, 8, v);
+    }
+}
+
+/*
+    Helper function to check that a register already holds v, as a write of width would leave it
+*/
+bool register_holds(ValueTable &values, ValueState &state, const string family, int width, int v) {
+    auto found = state.regs.find(family + ":" + to_string(width));
+    if (found == state.regs.end() || found->second != v) {
+        return false;
+    }
+    if (width == 4) {
+        auto wide = state.regs.find(family + ":8");
+        return wide != state.regs.end() && wide->second == extend(values, 'z', 4, 8, v);
+    }
+    return true;
+}
+
+/*
+    Helper function to find a register of the given width that holds v, "" when there is none
+*/
+string register_holding(ValueState &state, int v, int width) {
+    for (auto const &r : state.regs) {
+        string family = r.first.substr(0, r.first.find(':'));
+        if (r.second == v && stoi(r.first.substr(r.first.find(':') + 1)) == width && family != "rsp" && family != "rbp") {
+            return register_name(family, width);
+        }
+    }
+    return "";
+}
+
+/*
+    Helper function to get a register's value number
+    One nobody knows the value of gets a number of its own, named by where it was first read
+*/
+int read_register(ValueTable &values, ValueState &state, const string family, int width, size_t at) {
+    string key = family + ":" + to_string(width);
+    auto found = state.regs.find(key);
+    if (found != state.regs.end()) {
+        return found->second;
+    }
+    int v = values.number("in" + to_string(at) + ":" + key);
+    state.regs[key] = v;
+    return v;
+}
+
+/*
+    Helper function to work out the address of a memory operand, as a key of ValueState::mem
+    without the width, and what kind of location it is
+*/
+string memory_address(ValueTable &values, ValueState &state, const string op, size_t at, MemoryValue &where) {
+    string disp = op.substr(0, op.find('('));
+    vector<string> parts(1);
+    for (char c : op.substr(op.find('(') + 1, op.rfind(')') - op.find('(') - 1)) {
+        if (c == ',') {
+            parts.push_back("");
+        } else if (c != ' ') {
+            parts.back() += c;
+        }
+    }
+    string base = parts[0];
+    string index = parts.size() > 1 ? parts[1] : "";
+    string scale = parts.size() > 2 ? parts[2] : "1";
+
+    where.disp = 0;
+    string family;
+    int width;
+    string base_key = base;
+    if (base == "%rbp") {
+        where.kind = index.empty() ? 's' : 'x';
+        where.disp = disp.empty() ? 0 : stol(disp);
+    } else {
+        where.kind = 'o';
+        if (parse_register(base, family, width)) {
+            base_key = to_string(read_register(values, state, family, 8, at));
+        }
+    }
+    string index_key = "";
+    if (parse_register(index, family, width)) {
+        index_key = to_string(read_register(values, state, family, 8, at));
+    }
+    return string(1, where.kind) + ":" + base_key + ":" + disp + ":" + index_key + ":" + scale;
+}
+
+/*
+    Helper function to get the value number of an instruction's operand, loading it when it is
+    memory nobody knows the contents of
+*/
+int read_operand(ValueTable &values, ValueState &state, const string op, int width, size_t at) {
+    string family;
+    int reg_width;
+    if (op[0] == '$') {
+        return values.number("c" + op.substr(1));
+    } else if (parse_register(op, family, reg_width)) {
+        return read_register(values, state, family, reg_width, at);
+    } else if (is_memory_operand(op)) {
+        MemoryValue where;
+        string key = memory_address(values, state, op, at, where) + ":" + to_string(width);
+        auto found = state.mem.find(key);
+        if (found != state.mem.end()) {
+            return found->second.value;
+        }
+        where.width = width;
+        where.value = values.number("ld" + to_string(at) + ":" + key);
+        state.mem[key] = where;
+        return where.value;
+    }
+    return values.number("?" + to_string(at) + ":" + op);
+}
+
+/*
+    Helper function to record a store of v to a memory operand, forgetting what it may overwrite
+    A local array can be indexed anywhere from its start up to %rbp, other memory could be
+    anything reachable through a pointer
+*/
+void store_memory(ValueTable &values, ValueState &state, const string op, int width, int v, size_t at) {
+    MemoryValue where;
+    string key = memory_address(values, state, op, at, where) + ":" + to_string(width);
+    for (auto it = state.mem.begin(); it != state.mem.end();) {
+        const MemoryValue &m = it->second;
+        bool overwritten;
+        if (where.kind == 's') {
+            overwritten = (m.kind == 's' && m.disp < where.disp + width && where.disp < m.disp + m.width) ||
+                          (m.kind == 'x' && m.disp < where.disp + width);
+        } else if (where.kind == 'x') {
+            overwritten = m.kind == 'x' || (m.kind == 's' && m.disp + m.width > where.disp);
+        } else {
+            overwritten = m.kind == 'o';
+        }
+        it = overwritten ? state.mem.erase(it) : next(it);
+    }
+    where.width = width;
+    where.value = v;
+    state.mem[key] = where;
+}
+
+/*
+    Helper function to forget what a call may change: the caller saved registers, memory that
+    isn't in this frame, and the frame from the lowest local array whose address was taken up
+*/
+void clobber_call(ValueState &state, long escape_floor) {
+    for (auto const &family : caller_saved) {
+        kill_register(state, family);
+    }
+    for (auto it = state.mem.begin(); it != state.mem.end();) {
+        const MemoryValue &m = it->second;
+        bool clobbered = m.kind != 's' || m.disp + m.width > escape_floor;
+        it = clobbered ? state.mem.erase(it) : next(it);
+    }
+}
+
+/*
+    Helper function to check whether the flags an instruction sets may still be read, by a
+    conditional jump, set or cmov before the next instruction that sets them again
+*/
+bool flags_live(const vector<string> &code, size_t at) {
+    for (size_t i = at + 1; i < code.size(); ++i) {
+        if (is_label_line(code[i])) {
+            return true;
+        }
+        if (!is_instruction_line(code[i])) {
+            continue;
+        }
+        string op = opcode_of(code[i]);
+        string base;
+        int width;
+        if ((op[0] == 'j' && op != "jmp") || op.find("set") == 0 || op.find("cmov") == 0) {
+            return true;
+        }
+        if (op == "jmp" || op == "ret" || op == "call" || op.find("cmp") == 0 || op.find("test") == 0 ||
+            split_opcode(op, binary_opcodes, base, width) || split_opcode(op, unary_opcodes, base, width)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+/*
+    Helper function to check that the upper half of a register written with a 4 byte mov is
+    written again before anything reads it, so the mov's zero extension doesn't matter
+*/
+bool upper_half_dead(const vector<string> &code, size_t at, const string family) {
+    string wide = register_name(family, 8);
+    string narrow = register_name(family, 4);
+    for (size_t i = at + 1; i < code.size(); ++i) {
+        if (is_label_line(code[i])) {
+            return false;
+        }
+        if (!is_instruction_line(code[i])) {
+            continue;
+        }
+        string op = opcode_of(code[i]);
+        vector<string> ops = operands_of(code[i]);
+        if (op == "cltq" && family == "rax") {
+            return true;
+        }
+        if (code[i].find(wide) != string::npos || op[0] == 'j' || op == "call" || op == "ret" || op == "cqto" ||
+            op == "cltq") {
+            return false;
+        }
+        if (!ops.empty() && ops.back() == narrow && op.back() == 'l' && op.find("cmp") != 0 && op.find("test") != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    Helper function to carry state over one instruction
+    With rewrite set, it is pointed at a cheaper instruction that does the same thing, or at ""
+    when the instruction does nothing the state doesn't already know
+*/
+void number_instruction(ValueTable &values, ValueState &state, const vector<string> &code, size_t at, long escape_floor,
+                        string *rewrite) {
+    const string &ins = code[at];
+    string op = opcode_of(ins);
+    vector<string> ops = operands_of(ins);
+    string base, family;
+    int width, reg_width;
+
+    if ((op == "movb" || op == "movw" || op == "movl" || op == "movq") && ops.size() == 2) {
+        width = suffix_width(op.back());
+        int v = read_operand(values, state, ops[0], width, at);
+        if (parse_register(ops[1], family, reg_width)) {
+            bool holds = register_holds(values, state, family, width, v) ||
+                         (width == 4 && state.regs.count(family + ":4") && state.regs[family + ":4"] == v &&
+                          upper_half_dead(code, at, family));
+            if (holds) {
+                if (rewrite) *rewrite = "";
+                return;
+            }
+            string held = is_memory_operand(ops[0]) ? register_holding(state, v, width) : "";
+            if (rewrite && !held.empty() && held != ops[1]) *rewrite = op + " " + held + ", " + ops[1];
+            write_register(values, state, family, width, v);
+        } else if (is_memory_operand(ops[1])) {
+            MemoryValue where;
+            auto found = state.mem.find(memory_address(values, state, ops[1], at, where) + ":" + to_string(width));
+            if (found != state.mem.end() && found->second.value == v) {
+                if (rewrite) *rewrite = "";
+                return;
+            }
+            store_memory(values, state, ops[1], width, v, at);
+        } else {
+            state = ValueState();
+        }
+
+    } else if (op.size() == 6 && (op.find("movs") == 0 || op.find("movz") == 0) && suffix_width(op[4]) &&
+               suffix_width(op[5]) && ops.size() == 2 && parse_register(ops[1], family, reg_width)) {
+        // movslq, movsbl, movzbl ...
+        int from = suffix_width(op[4]);
+        int to = suffix_width(op[5]);
+        int v = read_operand(values, state, ops[0], from, at);
+        int r = extend(values, op[3], from, to, v);
+        if (register_holds(values, state, family, to, r)) {
+            if (rewrite) *rewrite = "";
+            return;
+        }
+        string held = is_memory_operand(ops[0]) ? register_holding(state, v, from) : "";
+        if (rewrite && !held.empty()) *rewrite = op + " " + held + ", " + ops[1];
+        write_register(values, state, family, to, r);
+        state.regs[family + ":" + to_string(from)] = v;
+
+    } else if (op == "cltq") {
+        int v = read_register(values, state, "rax", 4, at);
+        int r = extend(values, 's', 4, 8, v);
+        if (register_holds(values, state, "rax", 8, r)) {
+            if (rewrite) *rewrite = "";
+            return;
+        }
+        write_register(values, state, "rax", 8, r);
+        state.regs["rax:4"] = v;
+
+    } else if (op == "cltd") {
+        int v = read_register(values, state, "rax", 4, at);
+        write_register(values, state, "rdx", 4, values.number("cltd:" + to_string(v)));
+
+    } else if ((op == "leal" || op == "leaq") && ops.size() == 2 && is_memory_operand(ops[0]) &&
+               parse_register(ops[1], family, reg_width)) {
+        width = suffix_width(op.back());
+        MemoryValue where;
+        int r = values.number("lea:" + memory_address(values, state, ops[0], at, where));
+        if (register_holds(values, state, family, width, r)) {
+            if (rewrite) *rewrite = "";
+            return;
+        }
+        string held = register_holding(state, r, width);
+        if (rewrite && !held.empty()) *rewrite = string("mov") + op.back() + " " + held + ", " + ops[1];
+        write_register(values, state, family, width, r);
+
+    } else if ((split_opcode(op, binary_opcodes, base, width) && ops.size() == 2) ||
+               (base == "imul" && ops.size() == 3) || (split_opcode(op, unary_opcodes, base, width) && ops.size() == 1)) {
+        /*
+            "op src, dst" computes dst op src, "imull $k, src, dst" src * k, "op dst" op dst.
+            A memory source some register already holds is read from the register, and a result
+            some register already holds is copied from it when nothing reads the flags.
+        */
+        string dst = ops.back();
+        string src = ops.size() == 1 ? "" : ops[0];
+        string first = ops.size() == 3 ? ops[1] : dst;
+        int a = read_operand(values, state, first, width, at);
+        string expr = base + to_string(width) + ":" + to_string(a);
+        if (!src.empty()) {
+            int b = read_operand(values, state, src, width, at);
+            bool commutes = find(commutative_opcodes.begin(), commutative_opcodes.end(), base) != commutative_opcodes.end();
+            expr = base + to_string(width) + ":" + to_string(commutes ? min(a, b) : a) + "," + to_string(commutes ? max(a, b) : b);
+            string held = is_memory_operand(src) ? register_holding(state, b, width) : "";
+            if (!held.empty()) {
+                src = held;
+            }
+        }
+        if (ops.size() == 3 && is_memory_operand(first)) {
+            string held = register_holding(state, a, width);
+            if (!held.empty()) {
+                first = held;
+            }
+        }
+        int r = values.number(expr);
+
+        if (parse_register(dst, family, reg_width)) {
+            string held = flags_live(code, at) ? "" : register_holding(state, r, width);
+            if (!held.empty() && held != dst) {
+                if (rewrite) *rewrite = string("mov") + op.back() + " " + held + ", " + dst;
+            } else if (rewrite) {
+                *rewrite = op + " " + (src.empty() ? "" : src + ", ") + (ops.size() == 3 ? first + ", " : "") + dst;
+            }
+            write_register(values, state, family, width, r);
+        } else if (is_memory_operand(dst)) {
+            if (rewrite) *rewrite = op + " " + (src.empty() ? "" : src + ", ") + dst;
+            store_memory(values, state, dst, width, r, at);
+        } else {
+            state = ValueState();
+        }
+
+    } else if ((op.find("cmp") == 0 || op.find("test") == 0) && ops.size() == 2 && suffix_width(op.back())) {
+        width = suffix_width(op.back());
+        for (auto &operand : ops) {
+            int v = read_operand(values, state, operand, width, at);
+            string held = is_memory_operand(operand) ? register_holding(state, v, width) : "";
+            if (!held.empty()) {
+                operand = held;
+            }
+        }
+        if (rewrite) *rewrite = op + " " + ops[0] + ", " + ops[1];
+
+    } else if (op[0] == 'j' || op == "ret") {
+        // jumps and returns only end the block
+
+    } else if (op.find("set") == 0 && ops.size() == 1 && parse_register(ops[0], family, reg_width)) {
+        write_register(values, state, family, 1, values.number("set" + to_string(at)));
+
+    } else if (op == "call") {
+        clobber_call(state, escape_floor);
+
+    } else if (op == "pushq") {
+        kill_register(state, "rsp");
+
+    } else if (op == "popq" && parse_register(ops[0], family, reg_width)) {
+        kill_register(state, family);
+        kill_register(state, "rsp");
+
+    } else if (op.find("idiv") == 0 || op.find("div") == 0) {
+        kill_register(state, "rax");
+        kill_register(state, "rdx");
+
+    } else {
+        // anything else may change anything
+        state = ValueState();
+    }
+}
+
+/*
+    Helper function to merge what the predecessors of a block know at its start
+    A register or memory location they disagree on gets a phi number of the block
+*/
+ValueState merge_states(ValueTable &values, const vector<const ValueState *> &preds, int block) {
+    ValueState merged;
+    if (preds.empty()) {
+        return merged;
+    }
+    string phi = "phi" + to_string(block) + ":";
+    for (auto const &r : preds[0]->regs) {
+        bool known = true;
+        bool same = true;
+        for (size_t p = 1; p < preds.size() && known; ++p) {
+            auto found = preds[p]->regs.find(r.first);
+            known = found != preds[p]->regs.end();
+            same = same && known && found->second == r.second;
+        }
+        if (known) {
+            merged.regs[r.first] = same ? r.second : values.number(phi + r.first);
+        }
+    }
+    for (auto const &m : preds[0]->mem) {
+        bool known = true;
+        bool same = true;
+        for (size_t p = 1; p < preds.size() && known; ++p) {
+            auto found = preds[p]->mem.find(m.first);
+            known = found != preds[p]->mem.end();
+            same = same && known && found->second.value == m.second.value;
+        }
+        if (known) {
+            merged.mem[m.first] = m.second;
+            if (!same) {
+                merged.mem[m.first].value = values.number(phi + m.first);
+            }
+        }
+    }
+    return merged;
+}
+
+bool same_state(const ValueState &a, const ValueState &b) {
+    if (a.regs != b.regs || a.mem.size() != b.mem.size()) {
+        return false;
+    }
+    for (auto i = a.mem.begin(), j = b.mem.begin(); i != a.mem.end(); ++i, ++j) {
+        if (i->first != j->first || i->second.value != j->second.value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+    Global value numbering of a translated function, for -O1
+    Every value a register or memory location holds gets a number; equal numbers are equal
+    values, whatever path led there. The numbers are SSA names of the values: each instruction
+    that computes something new defines one, and where paths with different numbers for a
+    location meet, the location gets a phi number of the block. The numbers at the start of each
+    block are iterated to a fixed point over the control flow graph, starting from the optimistic
+    guess that loop back edges change nothing.
+    With them, loads, stores, extensions, address computations and arithmetic whose result is
+    already where it should go are removed, and memory operands and results some register holds
+    are read from that register instead.
+    Returns how many instructions were removed or rewritten
+*/
+int value_numbering(Function &f1) {
+    vector<string> &code = f1.assembly_instructions;
+    vector<BasicBlock> blocks = build_cfg(code);
+    ValueTable values;
+
+    // a call can write to the local arrays whose address was passed to it
+    long escape_floor = LONG_MAX;
+    for (auto const &s : code) {
+        if (opcode_of(s) == "leaq" && s.find("(%rbp)") != string::npos) {
+            string disp = operands_of(s)[0];
+            disp = disp.substr(0, disp.find('('));
+            escape_floor = min(escape_floor, disp.empty() ? 0 : stol(disp));
+        }
+    }
+
+    vector<ValueState> entry(blocks.size());
+    vector<ValueState> exit(blocks.size());
+    vector<bool> visited(blocks.size(), false);
+    bool converged = false;
+    for (int round = 0; round < max_rounds && !converged; ++round) {
+        converged = true;
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            vector<const ValueState *> preds;
+            if (b > 0 && !blocks[b].address_taken) {
+                for (int p : blocks[b].preds) {
+                    if (visited[p]) {
+                        preds.push_back(&exit[p]);
+                    }
+                }
+            }
+            ValueState in = merge_states(values, preds, b);
+            if (visited[b] && same_state(in, entry[b])) {
+                continue;
+            }
+            converged = false;
+            entry[b] = in;
+            for (size_t i = blocks[b].begin; i < blocks[b].end; ++i) {
+                if (is_instruction_line(code[i])) {
+                    number_instruction(values, in, code, i, escape_floor, nullptr);
+                }
+            }
+            exit[b] = in;
+            visited[b] = true;
+        }
+    }
+
+    int changed = 0;
+    vector<bool> removed(code.size(), false);
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        // without a fixed point, each block is numbered on its own
+        ValueState state = converged ? entry[b] : ValueState();
+        for (size_t i = blocks[b].begin; i < blocks[b].end; ++i) {
+            if (!is_instruction_line(code[i])) {
+                continue;
+            }
+            string rewrite = code[i];
+            number_instruction(values, state, code, i, escape_floor, &rewrite);
+            if (rewrite != code[i]) {
+                changed++;
+                removed[i] = rewrite.empty();
+                code[i] = rewrite.empty() ? code[i] : rewrite;
+            }
+        }
+    }
+
+    vector<size_t> kept_before(code.size() + 1, 0);
+    vector<string> kept;
+    for (size_t i = 0; i < code.size(); ++i) {
+        kept_before[i] = kept.size();
+        if (!removed[i]) {
+            kept.push_back(code[i]);
+        }
+    }
+    kept_before[code.size()] = kept.size();
+    for (auto &loop : f1.loops) {
+        loop.begin = kept_before[loop.begin];
+        loop.latch = kept_before[loop.latch];
+        loop.end = kept_before[loop.end];
+    }
+    code.swap(kept);
+    return changed;
+}
@@ -0,0 +1,65 @@
+#ifndef GVN_H
+#define GVN_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Function.h"
+
+using namespace std;
+
+/*
+    What a memory location is known to hold, and enough about where it is to tell which
+    stores may overwrite it
+*/
+class MemoryValue {
+   public:
+    int value;
+    char kind;  // 's' a -N(%rbp) slot, 'x' indexed off %rbp (a local array), 'o' anything else
+    long disp;  // %rbp offset of 's' and 'x' locations
+    int width;
+};
+
+/*
+    The value numbers held by registers and memory at one point of a function.
+    Registers are keyed by family and width, "rax:4" is %eax; memory by its address, made
+    of the value numbers of its base and index registers.
+*/
+class ValueState {
+   public:
+    map<string, int> regs;
+    map<string, MemoryValue> mem;
+};
+
+/*
+    Hands out value numbers, the same one for the same expression of value numbers
+*/
+class ValueTable {
+   public:
+    map<string, int> numbers;
+
+    int number(const string expr) {
+        auto found = numbers.find(expr);
+        if (found != numbers.end()) {
+            return found->second;
+        }
+        int n = numbers.size();
+        numbers[expr] = n;
+        return n;
+    }
+};
+
+// the arithmetic that reads and writes its destination, "add" to "shr", and the one operand
+// "neg" to "dec", shared by value numbering and the scheduler
+extern const vector<string> binary_opcodes;
+extern const vector<string> unary_opcodes;
+
+int suffix_width(char c);
+bool split_opcode(const string &op, const vector<string> &bases, string &base, int &width);
+bool parse_register(const string op, string &family, int &width);
+string register_name(const string family, int width);
+bool flags_live(const vector<string> &code, size_t at);
+int value_numbering(Function &f1);
+
+#endif
@@ -0,0 +1,532 @@
+#include <algorithm>
+#include <set>
+
+#include "ipcp.h"
+#include "main.h"
+
+using namespace std;
+
+// at most this many specialized clones per file, of functions of at most clone_max_lines lines
+const int clone_budget = 8;
+const size_t clone_max_lines = 100;
+
+// a call site is hot enough for a clone when it runs this often, or when one of its constants
+// becomes a loop bound of the callee; a loop without a constant trip count counts as this many
+const long clone_min_weight = 10;
+const long unknown_trip_count = 10;
+
+/*
+    Helper function to replace every whole word occurrence of name in a line
+*/
+string replace_name(const string line, const string name, const string value) {
+    string out;
+    size_t i = 0;
+    while (i < line.size()) {
+        bool starts = line.compare(i, name.size(), name) == 0 && (i == 0 || !is_name_char(line[i - 1]));
+        if (starts && (i + name.size() == line.size() || !is_name_char(line[i + name.size()]))) {
+            out += value;
+            i += name.size();
+        } else {
+            out += line[i++];
+        }
+    }
+    return out;
+}
+
+/*
+    Helper function to join strings with ", "
+*/
+string join_list(const vector<string> &items) {
+    string out;
+    for (size_t i = 0; i < items.size(); ++i) {
+        out += (i > 0 ? ", " : "") + items[i];
+    }
+    return out;
+}
+
+/*
+    Helper function to split a declaration's declarators on the commas outside of { }
+    "int a = 1, e[3] = {5, 6, 7}" gives "a = 1" and "e[3] = {5, 6, 7}"
+*/
+vector<string> declarators_of(const string s) {
+    vector<string> out(1);
+    int depth = 0;
+    for (char c : s.substr(s.find(' ') + 1)) {
+        depth += c == '{' ? 1 : c == '}' ? -1 : 0;
+        if (c == ',' && depth == 0) {
+            out.push_back("");
+        } else {
+            out.back() += c;
+        }
+    }
+    trim_vector(out);
+    return out;
+}
+
+/*
+    Helper function to get the names a declaration (without its ';') declares
+*/
+vector<string> declared_names(string s) {
+    vector<string> names;
+    if (s.find("static ") == 0) {
+        s = s.substr(7);
+    }
+    if (!is_declaration(s + ";")) {
+        return names;
+    }
+    for (auto const &d : declarators_of(s)) {
+        string name = d.substr(0, d.find(" = "));
+        names.push_back(name.substr(0, name.find('[')));
+    }
+    return names;
+}
+
+/*
+    Helper function to get the names a statement or for header assigns, steps or declares
+*/
+vector<string> written_names(const string line) {
+    vector<string> parts;
+    if (line.empty()) {
+        return parts;
+    }
+    if (line.find("for") == 0) {
+        vector<string> tokens = split(substr_between_indices(line, line.find("(") + 1, line.rfind(")")), "; ");
+        parts.push_back(tokens[0]);
+        parts.push_back(tokens.back());
+    } else {
+        parts.push_back(line.back() == ';' ? line.substr(0, line.size() - 1) : line);
+    }
+
+    vector<string> names;
+    for (string p : parts) {
+        trim(p);
+        vector<string> declared = declared_names(p);
+        if (!declared.empty()) {
+            names.insert(names.end(), declared.begin(), declared.end());
+        } else if (p.size() > 2 && (p.substr(p.size() - 2) == "++" || p.substr(p.size() - 2) == "--")) {
+            names.push_back(p.substr(0, p.size() - 2));
+        } else if (is_substr(p, " = ")) {
+            names.push_back(p.substr(0, p.find(" = ")));
+        }
+    }
+    return names;
+}
+
+/*
+    Helper function to tell a call statement the way common_instruction_handler_dispatcher does
+*/
+bool is_call_statement(const string line) {
+    return line.find("static") != 0 && !is_declaration(line) && line.find("if") != 0 && line.find("for") != 0 &&
+           line.find("switch") != 0 && line.find("return") != 0 && line != "break;" && is_function_call(line);
+}
+
+/*
+    Helper function to split a function header line into its return type, name and parameters
+*/
+FunctionHeader parse_header(const string line, size_t at) {
+    FunctionHeader h;
+    h.return_type = line.substr(0, line.find(' '));
+    h.name = substr_between_indices(line, line.find(' ') + 1, line.find('('));
+    h.line = at;
+    string params = substr_between_indices(line, line.find('(') + 1, line.find(')'));
+    trim(params);
+    if (!params.empty()) {
+        h.params = split(params, ", ");
+        trim_vector(h.params);
+    }
+    return h;
+}
+
+/*
+    Helper function to get the name of an int parameter, "" for other types and arrays
+*/
+string int_param_name(const string param) {
+    if (param.find("int ") != 0 || is_array_accessor(param)) {
+        return "";
+    }
+    return param.substr(4);
+}
+
+/*
+    Return if a parameter can be replaced by its value in the function: nothing in the body
+    assigns it or declares a variable hiding it
+*/
+bool is_read_only(const vector<string> &source, const FunctionHeader &h, const string name) {
+    for (size_t i = h.line + 1; i < source.size(); ++i) {
+        vector<string> written = written_names(source[i]);
+        if (find(written.begin(), written.end(), name) != written.end()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+    Return if a function declares a static local, which a clone would get its own copy of rather
+    than share with the function
+*/
+bool has_static_local(const vector<string> &source, const FunctionHeader &h) {
+    for (size_t i = h.line + 1; i < source.size(); ++i) {
+        if (source[i].find("static ") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    Helper function to find the int locals that keep the constant they are declared with:
+    declared once, with an immediate, in the function's outermost block, and never written
+    Maps each to its value and the line it is declared on
+*/
+map<string, pair<string, size_t>> constant_locals(const vector<string> &source, const FunctionHeader &h) {
+    map<string, pair<string, size_t>> candidates;
+    map<string, int> writes;
+    int depth = 1;
+    for (size_t i = h.line + 1; i < source.size(); ++i) {
+        const string &line = source[i];
+        if (depth == 1 && line.find("int ") == 0 && is_declaration(line)) {
+            for (auto const &d : declarators_of(line.substr(0, line.size() - 1))) {
+                vector<string> parts = split(d, " = ");
+                if (parts.size() == 2 && is_immediate(parts[1])) {
+                    candidates[parts[0]] = {parts[1], i};
+                }
+            }
+        }
+        for (auto const &name : written_names(line)) {
+            writes[name]++;
+        }
+        depth += count(line.begin(), line.end(), '{') - count(line.begin(), line.end(), '}');
+    }
+
+    map<string, pair<string, size_t>> constants;
+    for (auto const &c : candidates) {
+        bool is_param = false;
+        for (auto const &p : h.params) {
+            is_param = is_param || int_param_name(p) == c.first;
+        }
+        if (writes[c.first] == 1 && !is_param) {
+            constants.insert(c);
+        }
+    }
+    return constants;
+}
+
+/*
+    Build the call graph of the functions read from a file
+    A call's weight multiplies the trip counts of the for loops around it
+*/
+CallGraph build_call_graph(const vector<vector<string>> &functions) {
+    CallGraph g;
+    for (size_t f = 0; f < functions.size(); ++f) {
+        FunctionHeader h;
+        for (size_t i = 0; i < functions[f].size(); ++i) {
+            if (is_function_header(functions[f][i])) {
+                h = parse_header(functions[f][i], i);
+                g.function_of_name[h.name] = f;
+                break;
+            }
+        }
+        g.headers.push_back(h);
+    }
+
+    for (size_t f = 0; f < functions.size(); ++f) {
+        const FunctionHeader &h = g.headers[f];
+        if (h.name.empty()) {
+            continue;
+        }
+        const vector<string> &source = functions[f];
+        auto constants = constant_locals(source, h);
+
+        vector<long> weights = {1};
+        for (size_t i = h.line + 1; i < source.size(); ++i) {
+            const string &line = source[i];
+            if (line.empty()) {
+                continue;
+            }
+            if (line == "}") {
+                if (weights.size() > 1) {
+                    weights.pop_back();
+                }
+                continue;
+            }
+            if (line.back() == '{') {
+                long trips = 1;
+                if (line.find("for") == 0) {
+                    trips = constant_trip_count(split(substr_between_indices(line, line.find("(") + 1, line.rfind(")")), "; "));
+                    trips = trips < 0 ? unknown_trip_count : trips;
+                }
+                const long most = 1000000000000L;
+                weights.push_back(trips > 0 && weights.back() > most / trips ? most : weights.back() * trips);
+                continue;
+            }
+            if (!is_call_statement(line)) {
+                continue;
+            }
+
+            CallSite site;
+            site.caller = f;
+            site.line = i;
+            site.weight = weights.back();
+            string call = line;
+            if (is_substr(line, " = ")) {
+                site.dest = line.substr(0, line.find(" = "));
+                call = line.substr(line.find(" = ") + 3);
+            }
+            site.callee = call.substr(0, call.find("("));
+            trim(site.callee);
+            string args = substr_between_indices(call, call.find("(") + 1, call.rfind(")"));
+            trim(args);
+            if (!args.empty()) {
+                site.args = split(args, ",");
+                trim_vector(site.args);
+            }
+            for (auto const &a : site.args) {
+                auto known = constants.find(a);
+                if (is_immediate(a)) {
+                    site.constants.push_back(a);
+                } else if (known != constants.end() && known->second.second < i) {
+                    site.constants.push_back(known->second.first);
+                } else {
+                    site.constants.push_back("");
+                }
+            }
+            g.sites.push_back(site);
+        }
+    }
+    return g;
+}
+
+/*
+    Helper function to rewrite a call statement to call name without the arguments at drop
+*/
+string rewrite_call(const CallSite &site, const string name, const vector<size_t> &drop) {
+    vector<string> args;
+    for (size_t a = 0; a < site.args.size(); ++a) {
+        if (find(drop.begin(), drop.end(), a) == drop.end()) {
+            args.push_back(site.args[a]);
+        }
+    }
+    return (site.dest.empty() ? "" : site.dest + " = ") + name + "(" + join_list(args) + ");";
+}
+
+/*
+    Helper function to copy a function's header and body with the parameters at drop replaced
+    by the constants given for them, and the function renamed
+*/
+vector<string> specialize(const vector<string> &source, const FunctionHeader &h, const string name, const vector<size_t> &drop,
+                          const vector<string> &constants) {
+    vector<string> params;
+    for (size_t p = 0; p < h.params.size(); ++p) {
+        if (find(drop.begin(), drop.end(), p) == drop.end()) {
+            params.push_back(h.params[p]);
+        }
+    }
+    vector<string> out;
+    out.push_back(h.return_type + " " + name + "(" + join_list(params) + ") {");
+    for (size_t i = h.line + 1; i < source.size(); ++i) {
+        string line = source[i];
+        for (size_t p : drop) {
+            line = replace_name(line, int_param_name(h.params[p]), constants[p]);
+        }
+        out.push_back(line);
+    }
+    return out;
+}
+
+/*
+    Helper function to name the constants a clone of h is made for, "f(3, , 5)", so calls
+    passing the same ones share it
+*/
+string clone_key(const FunctionHeader &h, const vector<size_t> &drop, const vector<string> &constants) {
+    string key = h.name + "(";
+    for (size_t p = 0; p < h.params.size(); ++p) {
+        bool use = find(drop.begin(), drop.end(), p) != drop.end();
+        key += (p > 0 ? ", " : "") + (use ? constants[p] : "");
+    }
+    return key + ")";
+}
+
+/*
+    Return if a function is a clone made by propagate_constants, which only its file calls
+*/
+bool is_clone(const string name) {
+    return is_substr(name, ".constprop.");
+}
+
+/*
+    Helper function to put the clones made in a round after the function each was made from
+    Later functions go first, so the indices of earlier ones stay valid
+*/
+void insert_clones(vector<vector<string>> &functions, vector<pair<size_t, vector<string>>> &made) {
+    stable_sort(made.begin(), made.end(), [](const pair<size_t, vector<string>> &a, const pair<size_t, vector<string>> &b) {
+        return a.first < b.first;
+    });
+    for (auto it = made.rbegin(); it != made.rend(); ++it) {
+        functions.insert(functions.begin() + it->first + 1, it->second);
+    }
+}
+
+/*
+    Propagate constant arguments across the calls of a file, for -O1
+    When every call in the file passes the same constant for a parameter the function never
+    writes, the calls go to a clone of it with the constant substituted and the parameter
+    dropped, "f.constprop.0". Otherwise a hot call with constant arguments gets such a clone.
+    There are up to clone_budget clones, those for hot calls of functions of at most
+    clone_max_lines lines, and calls passing the same constants share one. Every function of the file is exported, so the
+    original keeps its symbol and parameters for callers in other files; a clone is local to the
+    file and is specialized in place. Either way the handlers see immediates, so arithmetic and
+    comparisons on them fold and loops bounded by them get a constant trip count. Repeats while
+    it finds something, since a substituted body can make the arguments of its own calls constant.
+    A function with a static local is left alone, its clones would each have their own.
+    Returns the number of parameters propagated, clones is set to the number of clones made.
+*/
+int propagate_constants(vector<vector<string>> &functions, int &clones) {
+    int propagated = 0;
+    clones = 0;
+    map<string, string> clone_of_constants;  // "f(3, , 5)" to the clone made for it
+    for (int round = 0; round < 4; ++round) {
+        CallGraph g = build_call_graph(functions);
+
+        // the calls of every function defined in the file, none if one passes the wrong number of arguments
+        map<string, vector<const CallSite *>> calls;
+        set<string> mismatched;
+        for (auto const &site : g.sites) {
+            auto f = g.function_of_name.find(site.callee);
+            if (f == g.function_of_name.end()) {
+                continue;
+            }
+            if (site.args.size() != g.headers[f->second].params.size()) {
+                mismatched.insert(site.callee);
+            }
+            calls[site.callee].push_back(&site);
+        }
+        for (auto const &name : mismatched) {
+            calls.erase(name);
+        }
+
+        bool changed = false;
+        vector<pair<size_t, vector<string>>> made;  // clones and the function each goes after
+        for (auto const &entry : calls) {
+            size_t f = g.function_of_name.at(entry.first);
+            const FunctionHeader &h = g.headers[f];
+            if (h.name == "main" || has_static_local(functions[f], h)) {
+                continue;
+            }
+            vector<size_t> drop;
+            vector<string> constants(h.params.size());
+            for (size_t p = 0; p < h.params.size(); ++p) {
+                string value = entry.second[0]->constants[p];
+                for (auto const *site : entry.second) {
+                    value = site->constants[p] == value ? value : "";
+                }
+                string name = int_param_name(h.params[p]);
+                if (!value.empty() && !name.empty() && is_read_only(functions[f], h, name)) {
+                    drop.push_back(p);
+                    constants[p] = value;
+                }
+            }
+            if (drop.empty()) {
+                continue;
+            }
+
+            // a clone is rewritten in place, an exported function keeps its parameters for
+            // callers in other files and gets a clone with them substituted
+            bool in_place = is_clone(h.name);
+            bool new_clone = false;
+            string name = h.name;
+            if (!in_place) {
+                string key = clone_key(h, drop, constants);
+                auto found = clone_of_constants.find(key);
+                if (found == clone_of_constants.end()) {
+                    if (clones >= clone_budget) {
+                        continue;
+                    }
+                    found = clone_of_constants.insert({key, h.name + ".constprop." + to_string(clones++)}).first;
+                    new_clone = true;
+                }
+                name = found->second;
+            }
+
+            // recursive calls are rewritten in the copy, the others in place
+            vector<string> body = specialize(functions[f], h, name, drop, constants);
+            for (auto const *site : entry.second) {
+                string call = rewrite_call(*site, name, drop);
+                if (site->caller == f && (in_place || new_clone)) {
+                    for (size_t p : drop) {
+                        call = replace_name(call, int_param_name(h.params[p]), constants[p]);
+                    }
+                    body[site->line - h.line] = call;
+                } else {
+                    functions[site->caller][site->line] = call;
+                }
+            }
+            if (in_place) {
+                functions[f].resize(h.line);
+                functions[f].insert(functions[f].end(), body.begin(), body.end());
+            } else if (new_clone) {
+                made.push_back({f, body});
+            }
+            propagated += in_place || new_clone ? drop.size() : 0;
+            changed = true;
+        }
+        if (changed) {
+            // the call graph is stale
+            insert_clones(functions, made);
+            continue;
+        }
+
+        // hottest calls first, each gets a clone while the budget lasts
+        vector<const CallSite *> hot;
+        for (auto const &entry : calls) {
+            for (auto const *site : entry.second) {
+                hot.push_back(site);
+            }
+        }
+        stable_sort(hot.begin(), hot.end(), [](const CallSite *a, const CallSite *b) {
+            return a->weight > b->weight;
+        });
+
+        for (auto const *site : hot) {
+            size_t f = g.function_of_name.at(site->callee);
+            const FunctionHeader &h = g.headers[f];
+            if (h.name == "main" || site->caller == f || functions[f].size() - h.line > clone_max_lines ||
+                has_static_local(functions[f], h)) {
+                continue;
+            }
+            vector<size_t> drop;
+            bool bounds_loop = false;
+            for (size_t p = 0; p < h.params.size(); ++p) {
+                string name = int_param_name(h.params[p]);
+                if (!site->constants[p].empty() && !name.empty() && is_read_only(functions[f], h, name)) {
+                    drop.push_back(p);
+                    for (size_t i = h.line + 1; i < functions[f].size(); ++i) {
+                        const string &line = functions[f][i];
+                        bounds_loop = bounds_loop || (line.find("for") == 0 && mentions(line, name));
+                    }
+                }
+            }
+            if (drop.empty() || (site->weight < clone_min_weight && !bounds_loop)) {
+                continue;
+            }
+
+            string key = clone_key(h, drop, site->constants);
+            auto found = clone_of_constants.find(key);
+            if (found == clone_of_constants.end()) {
+                if (clones >= clone_budget) {
+                    continue;
+                }
+                string name = h.name + ".constprop." + to_string(clones++);
+                made.push_back({f, specialize(functions[f], h, name, drop, site->constants)});
+                found = clone_of_constants.insert({key, name}).first;
+            }
+            functions[site->caller][site->line] = rewrite_call(*site, found->second, drop);
+            changed = true;
+        }
+        insert_clones(functions, made);
+        if (!changed) {
+            break;
+        }
+    }
+    return propagated;
+}
@@ -0,0 +1,50 @@
+#ifndef IPCP_H
+#define IPCP_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+    A call statement of the file, an edge of the -O1 call graph
+    constants holds the value of each argument that is a known int constant, "" for the others
+*/
+class CallSite {
+   public:
+    size_t caller;  // index of the calling function's source
+    size_t line;    // index of the call statement in it
+    string callee;
+    string dest;    // "x" of "x = f(a, b);", empty for a plain call
+    vector<string> args;
+    vector<string> constants;
+    long weight;    // static estimate of how often it runs, the trip counts of the loops around it
+};
+
+/*
+    A function defined in the file: its header line in its source and its parameter declarations
+*/
+class FunctionHeader {
+   public:
+    string return_type;
+    string name;
+    size_t line;
+    vector<string> params;  // "int a", "int e[3]"
+};
+
+/*
+    The functions read from a file and the calls between them
+*/
+class CallGraph {
+   public:
+    map<string, size_t> function_of_name;  // index into the file's function sources
+    vector<FunctionHeader> headers;        // one per source, name is empty for one without a function
+    vector<CallSite> sites;
+};
+
+CallGraph build_call_graph(const vector<vector<string>> &functions);
+bool is_clone(const string name);
+int propagate_constants(vector<vector<string>> &functions, int &clones);
+
+#endif
@@ -0,0 +1,370 @@
+#include <cctype>
+#include <map>
+#include <set>
+
+#include "loopnest.h"
+#include "main.h"
+
+using namespace std;
+
+/*
+    The cache model of the tiler, in bytes: a strided reference of the inner loop touches a new
+    cache line every iteration, and those lines have to stay in l1 until the next iteration of
+    the outer loop comes back for their neighbouring elements; a tile of every array the nest
+    references has to fit in l2
+*/
+const int l1_bytes = 32768;
+const int l2_bytes = 262144;
+const int cache_line_bytes = 64;
+
+// largest and smallest tile edge, in iterations
+const int max_tile = 64;
+const int min_tile = 8;
+
+/*
+    Helper function to get the operands of a statement "dest = a op b;": its variables,
+    immediates and array elements, dest first
+*/
+vector<string> statement_operands(const string line) {
+    vector<string> out;
+    for (auto const &token : split(line.substr(0, line.size() - 1), " ")) {
+        if (!token.empty() && (is_name_char(token[0]) || (token.size() > 1 && token[0] == '-' && isdigit(token[1])))) {
+            out.push_back(token);
+        }
+    }
+    return out;
+}
+
+/*
+    Helper function to record the arrays a declaration line declares, and into scalars the
+    variables it declares that live only as long as the function
+*/
+void record_declaration(string line, bool is_static, map<string, ArrayShape> &arrays, set<string> &scalars) {
+    if (line.find("static ") == 0) {
+        line = line.substr(7);
+        is_static = true;
+    }
+    if (!is_declaration(line)) {
+        return;
+    }
+    string type = line.substr(0, line.find(" "));
+    string decl = substr_between_indices(line, line.find(" ") + 1, line.size() - 1);
+    string first = decl.substr(0, decl.find(" = "));
+    if (is_array_accessor(first)) {
+        ArrayShape shape;
+        string name;
+        int count = array_declarator(first, name, shape.columns);
+        shape.rows = shape.columns > 0 ? count / shape.columns : count;
+        shape.element_size = type_size(type);
+        shape.is_param = false;
+        shape.is_static = is_static;
+        arrays[name] = shape;
+        scalars.erase(name);
+        return;
+    }
+    vector<string> declarators = split(decl, ",");
+    trim_vector(declarators);
+    for (auto const &d : declarators) {
+        string name = d.substr(0, d.find(" = "));
+        arrays.erase(name);
+        if (is_static) {
+            scalars.erase(name);
+        } else {
+            scalars.insert(name);
+        }
+    }
+}
+
+/*
+    Helper function to record the parameters of a function header
+*/
+void record_parameters(const string header, map<string, ArrayShape> &arrays, set<string> &scalars) {
+    vector<string> params = split(substr_between_indices(header, header.find("(") + 1, header.find(")")), ",");
+    trim_vector(params);
+    for (auto const &param : params) {
+        if (param.find(" ") == string::npos) {
+            continue;
+        }
+        string name = param.substr(param.find(" ") + 1);
+        if (!is_array_accessor(name)) {
+            scalars.insert(name);
+            arrays.erase(name);
+            continue;
+        }
+        ArrayShape shape;
+        int count = array_declarator(name, name, shape.columns);
+        shape.rows = shape.columns > 0 ? count / shape.columns : count;
+        shape.element_size = type_size(param.substr(0, param.find(" ")));
+        shape.is_param = true;
+        shape.is_static = false;
+        arrays[name] = shape;
+        scalars.erase(name);
+    }
+}
+
+/*
+    Matches the perfect loop nest starting at source[line]
+    Neither loop's start or bound may be the other's index, so the nest is rectangular
+*/
+bool match_loop_nest(const vector<string> &source, size_t line, LoopNest &nest) {
+    nest.line = line;
+    nest.index.assign(2, "");
+    nest.start.assign(2, "");
+    nest.bound.assign(2, "");
+    nest.body.clear();
+    if (line + 1 >= source.size() || !match_loop_header(source[line], nest.index[0], nest.start[0], nest.bound[0]) ||
+        !match_loop_header(source[line + 1], nest.index[1], nest.start[1], nest.bound[1])) {
+        return false;
+    }
+    size_t end = line + 2;
+    for (; end < source.size() && source[end] != "}"; ++end) {
+        const string &s = source[end];
+        vector<string> tokens = split(s, " ");
+        if (s.back() != ';' || is_declaration(s) || s.find_first_of("(){}") != string::npos || tokens.size() < 3 ||
+            tokens[1] != "=") {
+            return false;
+        }
+        nest.body.push_back(s);
+    }
+    if (nest.body.empty() || end + 1 >= source.size() || source[end + 1] != "}" || nest.index[0] == nest.index[1]) {
+        return false;
+    }
+    for (int d = 0; d < 2; ++d) {
+        if (!is_invariant_operand(nest.start[d], nest.index[d]) || nest.start[d] == nest.index[1 - d] ||
+            nest.bound[d] == nest.index[1 - d]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+    Helper function to check that a nest computes the same with its loops swapped, or tiled
+    Only elements of arrays and scalars private to one iteration may be written. Every reference
+    to a written array has the same subscripts, at least one of them a loop index, so the
+    iterations that touch one element keep their order in any order of the loops, and no other
+    array the nest references may be the same array. A private scalar is set before it is read
+    in the body and used nowhere else in the function. Every subscript is a loop index, an
+    immediate or a variable the nest doesn't write.
+*/
+bool is_permutable_nest(const LoopNest &nest, const vector<string> &source, const map<string, ArrayShape> &arrays,
+                        const set<string> &scalars) {
+    set<string> written_scalars;
+    map<string, string> written_arrays;  // subscripts of each, as written
+    for (auto const &s : nest.body) {
+        string dest = statement_operands(s)[0];
+        if (is_array_accessor(dest)) {
+            written_arrays[dest.substr(0, dest.find("["))] = dest.substr(dest.find("["));
+        } else if (!written_scalars.count(dest)) {
+            vector<string> operands = statement_operands(s);
+            for (size_t k = 1; k < operands.size(); ++k) {
+                if (operands[k] == dest) {
+                    return false;
+                }
+            }
+            if (!scalars.count(dest) || dest == nest.index[0] || dest == nest.index[1]) {
+                return false;
+            }
+            for (auto const &earlier : nest.body) {
+                if (&earlier == &s) {
+                    break;
+                }
+                if (mentions(earlier, dest)) {
+                    return false;
+                }
+            }
+            written_scalars.insert(dest);
+        }
+    }
+
+    size_t end = nest.line + 2 + nest.body.size() + 1;
+    for (size_t i = 0; i < source.size(); ++i) {
+        if (i >= nest.line && i <= end) {
+            continue;
+        }
+        for (auto const &name : written_scalars) {
+            if (mentions(source[i], name) &&
+                !(is_declaration(source[i]) && source[i].find(" " + name) == source[i].find(" ") &&
+                  !mentions(source[i].substr(source[i].find("=") + 1), name))) {
+                return false;
+            }
+        }
+    }
+    for (int d = 0; d < 2; ++d) {
+        if (written_scalars.count(nest.start[d]) || written_scalars.count(nest.bound[d])) {
+            return false;
+        }
+    }
+
+    for (auto const &s : nest.body) {
+        for (auto const &operand : statement_operands(s)) {
+            if (!is_array_accessor(operand)) {
+                continue;
+            }
+            string name = operand.substr(0, operand.find("["));
+            vector<string> subscripts = array_subscripts(operand);
+            if (!arrays.count(name) || (int)subscripts.size() != (arrays.at(name).columns > 0 ? 2 : 1)) {
+                return false;
+            }
+            for (auto const &sub : subscripts) {
+                if (sub != nest.index[0] && sub != nest.index[1] &&
+                    (!is_invariant_operand(sub, "") || written_scalars.count(sub))) {
+                    return false;
+                }
+            }
+            if (written_arrays.count(name)) {
+                bool has_index = false;
+                for (auto const &sub : subscripts) {
+                    has_index = has_index || sub == nest.index[0] || sub == nest.index[1];
+                }
+                if (!has_index || operand.substr(operand.find("[")) != written_arrays.at(name)) {
+                    return false;
+                }
+            }
+            for (auto const &w : written_arrays) {
+                const ArrayShape &x = arrays.at(w.first);
+                const ArrayShape &y = arrays.at(name);
+                if (w.first != name && ((x.is_param && (y.is_param || y.is_static)) || (y.is_param && x.is_static))) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/*
+    Helper function to score how well the body walks memory with index as the inner loop:
+    1 for every reference it steps an element at a time, -1 for every one it steps a row at a
+    time, which strided counts
+*/
+int unit_stride_score(const LoopNest &nest, const string index, int &strided) {
+    int score = 0;
+    strided = 0;
+    for (auto const &s : nest.body) {
+        for (auto const &operand : statement_operands(s)) {
+            if (!is_array_accessor(operand)) {
+                continue;
+            }
+            vector<string> subscripts = array_subscripts(operand);
+            if (subscripts.size() == 2 && subscripts[0] == index) {
+                score--;
+                strided++;
+            } else if (subscripts.back() == index) {
+                score++;
+            }
+        }
+    }
+    return score;
+}
+
+/*
+    Helper function to get the source of a nest with both loops tiled by tile iterations
+    "for (int i = 0; i < 100; i++) {" becomes a loop over the tiles,
+    "for (int i.tile = 0; i.tile < 100; i.tile = i.tile + 32) {" setting "i.end" to where the
+    tile ends, 100 at most, and "for (int i = i.tile; i < i.end; i++) {" inside the loop of the
+    inner index's tiles
+*/
+vector<string> tiled_nest(const LoopNest &nest, int tile) {
+    vector<string> out;
+    for (int d = 0; d < 2; ++d) {
+        string t = nest.index[d] + ".tile";
+        string end = nest.index[d] + ".end";
+        out.push_back("for (int " + t + " = " + nest.start[d] + "; " + t + " < " + nest.bound[d] + "; " + t + " = " + t +
+                      " + " + to_string(tile) + ") {");
+        out.push_back("int " + end + " = " + t + " + " + to_string(tile) + ";");
+        if ((stol(nest.bound[d]) - stol(nest.start[d])) % tile != 0) {
+            out.push_back("if (" + end + " > " + nest.bound[d] + ") {");
+            out.push_back(end + " = " + nest.bound[d] + ";");
+            out.push_back("}");
+        }
+    }
+    for (int d = 0; d < 2; ++d) {
+        out.push_back("for (int " + nest.index[d] + " = " + nest.index[d] + ".tile; " + nest.index[d] + " < " +
+                      nest.index[d] + ".end; " + nest.index[d] + "++) {");
+    }
+    out.insert(out.end(), nest.body.begin(), nest.body.end());
+    out.insert(out.end(), 4, "}");
+    return out;
+}
+
+/*
+    Optimize the perfect two loop nests of a file's functions, the interchange pass or, with tile
+    set, the tile pass
+    When the inner index is the row of more references than the outer one, walking arrays a row
+    at a time, interchange swaps the loops so more of them walk a row an element at a time. When
+    some reference steps a row at a time and the trip counts are constants, so many rows that
+    their cache lines don't stay in l1 until the outer loop comes back for the next column, tile
+    tiles both loops: square tiles of up to max_tile iterations, small enough that the lines of
+    one tile's column fit in half of l1 and its elements in half of l2.
+    Returns the number of nests changed
+*/
+int optimize_loop_nests(vector<vector<string>> &functions, bool tile) {
+    int changed = 0;
+    map<string, ArrayShape> globals;
+    set<string> no_scalars;
+    for (auto &source : functions) {
+        size_t header = 0;
+        while (header < source.size() && !is_function_header(source[header])) {
+            record_declaration(source[header++], true, globals, no_scalars);
+        }
+        if (header == source.size()) {
+            continue;
+        }
+        map<string, ArrayShape> arrays = globals;
+        set<string> scalars;
+        record_parameters(source[header], arrays, scalars);
+        for (size_t i = header + 1; i < source.size(); ++i) {
+            record_declaration(source[i], false, arrays, scalars);
+        }
+
+        for (size_t line = header + 1; line < source.size(); ++line) {
+            LoopNest nest;
+            if (!match_loop_nest(source, line, nest) || !is_permutable_nest(nest, source, arrays, scalars)) {
+                continue;
+            }
+            int outer_strided;
+            int inner_strided;
+            int outer_score = unit_stride_score(nest, nest.index[0], outer_strided);
+            int inner_score = unit_stride_score(nest, nest.index[1], inner_strided);
+            if (!tile) {
+                if (outer_score > inner_score) {
+                    swap(source[line], source[line + 1]);
+                    changed++;
+                }
+                continue;
+            }
+
+            if (inner_strided == 0 || !is_immediate(nest.start[0]) || !is_immediate(nest.bound[0]) ||
+                !is_immediate(nest.start[1]) || !is_immediate(nest.bound[1])) {
+                continue;
+            }
+            long outer_trips = stol(nest.bound[0]) - stol(nest.start[0]);
+            long inner_trips = stol(nest.bound[1]) - stol(nest.start[1]);
+            set<string> referenced;
+            int element_bytes = 0;
+            for (auto const &s : nest.body) {
+                for (auto const &operand : statement_operands(s)) {
+                    string name = operand.substr(0, operand.find("["));
+                    if (is_array_accessor(operand) && referenced.insert(name).second) {
+                        element_bytes += arrays.at(name).element_size;
+                    }
+                }
+            }
+            int edge = max_tile;
+            while (edge > min_tile && (edge * cache_line_bytes * inner_strided > l1_bytes / 2 ||
+                                       (long)edge * edge * element_bytes > l2_bytes / 2)) {
+                edge /= 2;
+            }
+            if (inner_trips * cache_line_bytes * inner_strided <= l1_bytes / 2 || outer_trips <= edge || inner_trips <= edge) {
+                continue;
+            }
+            vector<string> tiles = tiled_nest(nest, edge);
+            source.erase(source.begin() + line, source.begin() + line + nest.body.size() + 4);
+            source.insert(source.begin() + line, tiles.begin(), tiles.end());
+            line += tiles.size() - 1;
+            changed++;
+        }
+    }
+    return changed;
+}
@@ -0,0 +1,38 @@
+#ifndef LOOPNEST_H
+#define LOOPNEST_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+    An array a function can see, from its declaration: "int m[R][C]" has R rows of C columns,
+    "int e[N]" N rows and no columns
+*/
+class ArrayShape {
+   public:
+    int rows;
+    int columns;
+    int element_size;
+    bool is_param;
+    bool is_static;  // file scope or static local, in .data / .bss
+};
+
+/*
+    A perfect nest of two counting loops, "for (int i = a; i < b; i++) {" directly around
+    "for (int j = c; j < d; j++) {" around statements only, at source[line]
+    index, start and bound are { outer, inner }
+*/
+class LoopNest {
+   public:
+    size_t line;
+    vector<string> index;
+    vector<string> start;
+    vector<string> bound;
+    vector<string> body;
+};
+
+int optimize_loop_nests(vector<vector<string>> &functions, bool tile);
+
+#endif
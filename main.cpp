@@ -2,12 +2,63 @@
 
 using namespace std;
 
-vector<Function> functions;
-int label_num = 2;
+// translation state of the file being compiled, one copy per batch worker thread
+thread_local map<string, Variable> global_variables;
+thread_local vector<string> data_section;  // initialized file scope and static variables
+thread_local vector<string> bss_section;   // zero initialized file scope and static variables
+thread_local int label_num = 2;
+thread_local int static_var_num = 0;
+thread_local vector<string> profile_sites;  // "<function> <kind> <source line>" of each --instrument counter
+thread_local map<string, size_t> profile_seen;  // --profile-use sites of each key looked up so far
+thread_local Stats stats;
+thread_local const VectorIsa *target_isa = nullptr;  // vector target of the function being translated
+thread_local set<string> dispatched_functions;      // --multiversion functions, called through name.dispatch
+thread_local set<string> long_functions;            // functions returning a long, whose result fills %rax
+
+// where an --instrument build writes its counters when it exits, empty when not instrumenting
+string profile_path = "";
+
+// counts of the --profile-use profile by "<function> <kind> <source line>", in the order the sites
+// were made; each "if" also gets a "skipped" count, how often its body was skipped
+map<string, vector<long>> profile_counts;
+
+// with a profile, for loops with a straight line body that ran at least this many iterations,
+// at least unroll_min_trips per run, get their body repeated 2 or 4 times
+const long unroll_min_iterations = 1000;
+const long unroll_min_trips = 4;
+
+// --isa translates every function for one vector target; --multiversion translates the functions
+// with an element-wise loop for each of vector_isas and picks one when the program runs
+const VectorIsa *forced_isa = nullptr;
+bool multiversion = false;
+
+// switch statements with at least this many cases, covering at least this fraction
+// of their value range, are compiled to a jump table instead of a compare tree
+// a range of more than switch_table_max_range values always gets the compare tree
+const int switch_table_min_cases = 4;
+const long long switch_table_max_range = 65536;
+double switch_density_threshold = 0.4;
+
+// mapping of all comparators and the jump taken when the comparison holds / fails
+const map<string, string> comparators_jump_if_true = {
+    {"<", "jl"}, {">", "jg"}, {"<=", "jle"}, {">=", "jge"}, {"==", "je"}, {"!=", "jne"}};
+const map<string, string> comparators_jump_if_false = {
+    {"<", "jge"}, {">", "jle"}, {"<=", "jg"}, {">=", "jl"}, {"==", "jne"}, {"!=", "je"}};
+const map<string, string> comparators_set_if_true = {
+    {"<", "setl"}, {">", "setg"}, {"<=", "setle"}, {">=", "setge"}, {"==", "sete"}, {"!=", "setne"}};
+// comparator to use when the comparands trade places, a < b is b > a
+const map<string, string> comparators_swapped = {
+    {"<", ">"}, {">", "<"}, {"<=", ">="}, {">=", "<="}, {"==", "=="}, {"!=", "!="}};
 
 string register_for_argument_32[6] = {"edi", "esi", "edx", "ecx", "r8d", "r9d"};
 string register_for_argument_64[6] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
 
+// 8, 16 and 64 bit names of the 32 bit registers the handlers work with
+const map<string, vector<string>> register_sizes = {
+    {"%eax", {"%al", "%ax", "%rax"}}, {"%edx", {"%dl", "%dx", "%rdx"}}, {"%ecx", {"%cl", "%cx", "%rcx"}},
+    {"%esi", {"%sil", "%si", "%rsi"}}, {"%edi", {"%dil", "%di", "%rdi"}},
+    {"%r8d", {"%r8b", "%r8w", "%r8"}}, {"%r9d", {"%r9b", "%r9w", "%r9"}}};
+
 /*
     Helper function to debug a string and its size
 */
@@ -18,8 +69,8 @@ void view_var(string s) {
 /*
     Helper function to print a function's instructions and variables
 */
-void view_function(Function f1, bool show_vars) {
-    for (auto x : f1.assembly_instructions) {
+void view_function(const Function &f1, bool show_vars) {
+    for (auto const &x : f1.assembly_instructions) {
         cout << x << endl;
     }
 
@@ -31,64 +82,87 @@ void view_function(Function f1, bool show_vars) {
 }
 
 /*
-    Helper function used to create a modifed variable map that only includes
-    arr[0] if the first 6 parameters has arrays
+    Helper function to get the size in bytes of a variable type
+    Array parameters ("intptr", "charptr", ...) are pointers
 */
-map<string, Variable> actual_function_params(map<string, Variable> vars) {
-    map<string, Variable> params;
-    int counter = 0;
-
-    for (auto v : vars) {
-        string var_name = v.first;
-        if (is_array_accessor(var_name) && (var_name[var_name.find("[") + 1] != '0') && counter <= 6) {
-            continue;
-        }
-        counter++;
-
-        params.insert(v);
+int type_size(const string type) {
+    if (type == "char") {
+        return 1;
+    } else if (type == "short") {
+        return 2;
+    } else if (type == "long" || is_substr(type, "ptr")) {
+        return 8;
     }
-
-    return params;
+    return 4;
 }
 
 /*
-    Helper function to handle instructions related to loading values from parameters onto the stack
+    Helper function to get the type of the elements an array parameter points to
 */
-map<string, Variable> variable_handler(string input_str, int &addr_offset) {
-    map<string, Variable> out;
-    auto var_tokens = split(input_str, ", ");
-    for (auto c : var_tokens) {
-        if (is_array_accessor(c)) {
-            /*
-            Split line by = and then by the [] to parse the name, size and values
-        */
-            c = split(c, " ")[1];
-
-            auto temp = split(c, "\\[");  // [ needs to be escaped with \ and then that \ needs to be escaped for C++ complier
-            string array_name = temp[0];
-
-            int array_size = stoi(temp[1].substr(0, temp[1].size() - 1));
+string element_type(const string type) {
+    return is_substr(type, "ptr") ? type.substr(0, type.find("ptr")) : type;
+}
 
-            for (int i = array_size - 1; i >= 0; --i) {
-                string name = array_name + "[" + to_string(i) + "]";
-                int arr_addr_offset = addr_offset - (i * 4);
+/*
+    Helper function to get the instruction suffix for an operand size in bytes
+*/
+string size_suffix(int size) {
+    switch (size) {
+        case 1:
+            return "b";
+        case 2:
+            return "w";
+        case 8:
+            return "q";
+    }
+    return "l";
+}
 
-                Variable var(name, "intptr", 0, arr_addr_offset, true);
-                out.insert(pair<string, Variable>(name, var));
-            }
-            addr_offset -= (array_size * 4);
-        } else {
-            auto tmp = split(c, " ");
-            string var_type = tmp[0];
-            string var_name = tmp[1];
+/*
+    Helper function to get the 8/16/32/64 bit name of a register given by its 32 bit name
+*/
+string sized_register(const string reg, int size) {
+    if (size == 4 || register_sizes.count(reg) == 0) {
+        return reg;
+    }
+    return register_sizes.at(reg)[size == 1 ? 0 : size == 2 ? 1 : 2];
+}
 
-            Variable var(var_name, var_type, 0, addr_offset, true);
-            out.insert(pair<string, Variable>(var_name, var));
-            addr_offset -= 4;
-        }
+/*
+    Helper function to get the instruction loading a variable of the given type into a register of
+    width bytes, 4 or 8
+    Narrower types are sign extended, a long loaded into a 32 bit register is read through its low half
+*/
+string load_instruction(const string type, int width) {
+    int size = type_size(type);
+    if (width == 8) {
+        return size == 1 ? "movsbq" : size == 2 ? "movswq" : size == 4 ? "movslq" : "movq";
     }
+    if (size == 1) {
+        return "movsbl";
+    } else if (size == 2) {
+        return "movswl";
+    }
+    return "movl";
+}
 
-    return out;
+/*
+    Return if code line declares variables, e.g. "int a = 0;" or "char c[2] = {1, 2};"
+*/
+bool is_declaration(const string line) {
+    return (line.find("int ") == 0 || line.find("char ") == 0 || line.find("short ") == 0 || line.find("long ") == 0) && line.back() == ';';
+}
+
+/*
+    Helper function to hand out a stack slot of size bytes aligned to align
+    addr_offset is where the next 4 byte variable would go (4 bytes below the last used byte),
+    the returned offset is the lowest byte of the new slot
+*/
+int allocate_stack_slot(int &addr_offset, int size, int align) {
+    int used = -(addr_offset + 4) + size;
+    used = (used + align - 1) / align * align;
+    addr_offset = -used - 4;
+    return -used;
 }
 
 /*
@@ -101,7 +175,7 @@ string add_mov_instruction(string src, string dest, int size) {
             out = "movb ";
             break;
         case 16:
-            out = "movs ";
+            out = "movw ";
             break;
         case 32:
             out = "movl ";
@@ -121,14 +195,15 @@ string add_mov_instruction(string src, string dest, int size) {
     test(a, b, c, d, e, f, g, h);
 */
 bool is_function_call(string line) {
-    return (is_substr(line, "(") && !is_substr(line, "+") && !is_substr(line, "-") && !is_substr(line, "*"));
+    return is_substr(line, "(") && !is_arithmetic_line(line);
 }
 
 /*
     Returns if +,-,* are in the string, aka code has arithmetic instructions
 */
 bool is_arithmetic_line(const string s) {
-    return is_substr(s, "+") || is_substr(s, "-") || is_substr(s, "*");
+    // operators are written with spaces around them, so "a = -5" is a plain assignment
+    return is_substr(s, "++") || is_substr(s, "--") || is_substr(s, " + ") || is_substr(s, " - ") || is_substr(s, " * ");
 }
 
 /*
@@ -140,12 +215,198 @@ bool is_param_var(const string s, Function &f1) {
     }
 
     string lookup_str = s;
-    if (is_array_accessor_dynamic(s)) {
+    if (is_array_accessor(s)) {
         string arr_name = s.substr(0, s.find("["));
 
         lookup_str = arr_name + "[0]";
     }
-    return f1.variables.at(lookup_str).is_param;
+    return lookup_variable(lookup_str, f1).is_param;
+}
+
+/*
+    Return if code line is a function definition header
+    Example:
+    int test(int a, int b) {
+*/
+bool is_function_header(const string line) {
+    bool has_return_type = line.find("int") == 0 || line.find("void") == 0 || line.find("char") == 0 || line.find("short") == 0 || line.find("long") == 0;
+    return has_return_type && line.find("{") == line.length() - 1;
+}
+
+/*
+    Helper function to look up a variable by name
+    Locals and parameters hide file scope variables of the same name
+*/
+Variable &lookup_variable(const string s, Function &f1) {
+    if (f1.variables.count(s) > 0) {
+        return f1.variables.at(s);
+    }
+    return global_variables.at(s);
+}
+
+/*
+    Return if a variable is visible from the function
+*/
+bool has_variable(const string s, Function &f1) {
+    return f1.variables.count(s) > 0 || global_variables.count(s) > 0;
+}
+
+/*
+    Helper function to get the memory operand of a variable
+    Stack variables are addressed off %rbp, variables in .data/.bss are RIP-relative
+    with addr_offset as the byte offset from the symbol
+*/
+string variable_operand(const Variable &v) {
+    if (v.label.empty()) {
+        return to_string(v.addr_offset) + "(%rbp)";
+    }
+    if (v.addr_offset == 0) {
+        return v.label + "(%rip)";
+    }
+    return v.label + "+" + to_string(v.addr_offset) + "(%rip)";
+}
+
+/*
+    Helper function to get the memory operand of a variable by name
+*/
+string var_location(const string s, Function &f1) {
+    return variable_operand(lookup_variable(s, f1));
+}
+
+/*
+    Helper function to get the type of the elements of the array indexed by s
+*/
+string array_element_type(const string s, Function &f1) {
+    return element_type(lookup_variable(s.substr(0, s.find("[")) + "[0]", f1).type);
+}
+
+/*
+    Helper function to get the subscripts of an array element, {"i", "2"} for m[i][2]
+*/
+vector<string> array_subscripts(const string s) {
+    vector<string> out;
+    for (size_t open = s.find("["); open != string::npos; open = s.find("[", open + 1)) {
+        out.push_back(substr_between_indices(s, open + 1, s.find("]", open)));
+    }
+    return out;
+}
+
+/*
+    Helper function to read an array declarator, "e[3]" or "m[2][3]", into its name and row
+    length (0 unless it is 2d), returning its element count
+*/
+int array_declarator(const string d, string &name, int &columns) {
+    name = d.substr(0, d.find("["));
+    vector<string> dims = array_subscripts(d);
+    columns = dims.size() == 2 ? stoi(dims[1]) : 0;
+    return dims.size() == 2 ? stoi(dims[0]) * columns : stoi(dims[0]);
+}
+
+/*
+    Helper function to read an array initializer into the values of the elements it sets
+    "{1, 2, 3}" in order, a 2d array's "{{1, 2}, {3}}" row by row with each short row zero filled
+*/
+vector<string> array_initializer(const string init, int columns) {
+    string inner = init.substr(1, init.size() - 2);  // removes { and }
+    vector<string> values;
+    if (!is_substr(inner, "{")) {
+        values = split(inner, ",");
+        trim_vector(values);
+        return values;
+    }
+    for (size_t open = inner.find("{"); open != string::npos; open = inner.find("{", open + 1)) {
+        vector<string> row = split(substr_between_indices(inner, open + 1, inner.find("}", open)), ",");
+        trim_vector(row);
+        row.resize(columns, "0");
+        values.insert(values.end(), row.begin(), row.end());
+    }
+    return values;
+}
+
+/*
+    Helper function to sign extend an int, short or char index variable into a 64 bit register
+*/
+void move_index_into_register(const string s, const string reg, Function &f1) {
+    Variable &index = lookup_variable(s, f1);
+    int size = type_size(index.type);
+    string extend = size == 1 ? "movsbq" : size == 2 ? "movswq" : "movslq";
+    f1.assembly_instructions.push_back(extend + " " + variable_operand(index) + ", " + reg);
+}
+
+/*
+    Helper function to select the address of an array element
+    Matches the address tree of s, symbol + disp + base + index * scale, to the one memory
+    operand computing it, and pushes only the parts an operand can't hold: a variable index,
+    sign extended into index_reg, and the pointer held by an array parameter, into base_reg
+    (%r10 by default, it never holds a call argument, so arguments can be loaded in any order)
+
+    a[i]    movslq  -4(%rbp), %rax          -48(%rbp, %rax, 4)
+    a[2]                                    -40(%rbp)
+    g[i]    movslq  -4(%rbp), %rax          g(, %rax, 4)
+    g[2]                                    g+8(%rip)
+    e[i]    movslq  -4(%rbp), %rax
+            movq    -40(%rbp), %r10         (%r10, %rax, 4)
+    e[2]    movq    -40(%rbp), %r10         8(%r10)
+
+    An element of a 2d array m[R][C] is element row * C + column of the flat array, with a
+    variable row scaled by C in a register, %r11 when the column is a variable too
+
+    m[i][j] movslq  -8(%rbp), %rax
+            movslq  -4(%rbp), %r11
+            imulq   $3, %r11, %r11
+            addq    %r11, %rax              -48(%rbp, %rax, 4)
+    m[1][j] movslq  -8(%rbp), %rax          -36(%rbp, %rax, 4)
+*/
+Address element_address(const string s, const string index_reg, Function &f1, const string base_reg) {
+    string arr_name = s.substr(0, s.find("["));
+    vector<string> subscripts = array_subscripts(s);
+    string arr_index = subscripts[0];
+    Variable &arr_zero = lookup_variable(arr_name + "[0]", f1);
+    if (subscripts.size() == 2) {
+        string row = subscripts[0];
+        string column = subscripts[1];
+        if (is_int(row) && is_int(column)) {
+            return element_address(arr_name + "[" + to_string(stoi(row) * arr_zero.columns + stoi(column)) + "]",
+                                   index_reg, f1, base_reg);
+        }
+        Address a = element_address(arr_name + "[0]", index_reg, f1, base_reg);
+        a.disp += ((is_int(row) ? stoi(row) * arr_zero.columns : 0) + (is_int(column) ? stoi(column) : 0)) * a.scale;
+        if (!is_int(column)) {
+            move_index_into_register(column, index_reg, f1);
+        }
+        if (!is_int(row)) {
+            string row_reg = is_int(column) ? index_reg : "%r11";
+            move_index_into_register(row, row_reg, f1);
+            f1.assembly_instructions.push_back("imulq $" + to_string(arr_zero.columns) + ", " + row_reg + ", " + row_reg);
+            if (row_reg != index_reg) {
+                f1.assembly_instructions.push_back("addq " + row_reg + ", " + index_reg);
+            }
+        }
+        a.index = index_reg;
+        return a;
+    }
+
+    Address a;
+    a.scale = type_size(element_type(arr_zero.type));
+    if (arr_zero.is_param) {
+        a.disp = is_int(arr_index) ? stoi(arr_index) * a.scale : 0;
+        a.base = base_reg;
+    } else {
+        // every element of an array declared here is a variable of its own
+        const Variable &v = is_int(arr_index) ? lookup_variable(s, f1) : arr_zero;
+        a.symbol = v.label;
+        a.disp = v.addr_offset;
+        a.base = v.label.empty() ? "%rbp" : "";
+    }
+
+    if (!is_int(arr_index)) {
+        move_index_into_register(arr_index, index_reg, f1);
+        a.index = index_reg;
+    }
+    if (arr_zero.is_param) {
+        f1.assembly_instructions.push_back("movq " + variable_operand(arr_zero) + ", " + base_reg);
+    }
+    return a;
 }
 
 /*
@@ -161,77 +422,96 @@ void move_immediate_val_into_register(const string s, const string reg, Function
     Pushes required assembly instructions
 */
 void move_var_val_into_register(const string s, const string reg, Function &f1) {
-    f1.assembly_instructions.push_back("movl " + to_string(f1.variables.at(s).addr_offset) + "(%rbp), " + reg);
+    f1.assembly_instructions.push_back(load_instruction(lookup_variable(s, f1).type) + " " + var_location(s, f1) + ", " + reg);
 }
 
 /*
     Helper function to handle code like a[0] and a[f] which accesses array elements
-    Pushes required assembly instructions to get that value into specified register
+    Pushes required assembly instructions to get that value into specified register,
+    a variable index goes through %rax
 */
 void move_arr_val_into_register(const string s, const string reg, Function &f1) {
-    string arr_name = s.substr(0, s.find("["));
-    string arr_index = substr_between_indices(s, s.find("[") + 1, s.find("]"));
+    string load = load_instruction(array_element_type(s, f1));
+    f1.assembly_instructions.push_back(load + " " + element_address(s, "%rax", f1).operand() + ", " + reg);
+}
 
-    if (is_int(arr_index)) {
-        /*
-            a[immediate]
-            meaning this should be in f1.variables
-        */
-        f1.assembly_instructions.push_back("movl " + to_string(f1.variables.at(s).addr_offset) + "(%rbp), " + reg);
-    } else {
-        /*
-            a[var]
-        */
-        // move arr_index into eax
-        f1.assembly_instructions.push_back("movl " + to_string(f1.variables.at(arr_index).addr_offset) + "(%rbp), %eax");
-        f1.assembly_instructions.push_back("cltq");
-        // get where arr_name[0] is
-        string arr_start_offset = to_string(f1.variables.at(arr_name + "[0]").addr_offset);
-        f1.assembly_instructions.push_back("movl " + arr_start_offset + "(%rbp, %rax, 4), " + reg);
+/*
+    Helper function to get a 32 bit operand for a variable or array element
+    int variables and int array elements are used straight from memory, a variable index
+    going through %rcx; other sizes are loaded into scratch first
+*/
+string int_operand(const string s, const string scratch, Function &f1) {
+    if (is_array_accessor(s)) {
+        string type = array_element_type(s, f1);
+        string location = element_address(s, "%rcx", f1).operand();
+        if (type_size(type) == 4) {
+            return location;
+        }
+        f1.assembly_instructions.push_back(load_instruction(type) + " " + location + ", " + scratch);
+        return scratch;
     }
+    if (type_size(lookup_variable(s, f1).type) == 4) {
+        return var_location(s, f1);
+    }
+    move_var_val_into_register(s, scratch, f1);
+    return scratch;
 }
 
 /*
-    Helper function to handle code like a[0] and a[f] which accesses array elements
-    This function is only used when the array is a function parameter
-    Pushes required assembly instructions to get that value into specified register
-
-    f = d + x[i]
-    leaq    0(,%rax,4), %rdx
-    movq    -40(%rbp), %rax
-    addq    %rdx, %rax
-    movl    (%rax), %edx
+    Helper function to load an operand into a 64 bit register for long arithmetic
+    Narrower variables and array elements are sign extended, with a variable index going through
+    the register itself; immediates beyond 32 bits need movabsq
+*/
+void move_long_operand_into_register(const string s, const string reg, Function &f1) {
+    if (is_immediate(s)) {
+        f1.assembly_instructions.push_back((fits_int(s) ? "movq $" : "movabsq $") + s + ", " + reg);
+    } else if (is_array_accessor(s)) {
+        string location = element_address(s, reg, f1).operand();
+        f1.assembly_instructions.push_back(load_instruction(array_element_type(s, f1), 8) + " " + location + ", " + reg);
+    } else {
+        f1.assembly_instructions.push_back(load_instruction(lookup_variable(s, f1).type, 8) + " " + var_location(s, f1) + ", " + reg);
+    }
+}
 
-    f = d + x[0]
-    movq    -40(%rbp), %rax
-    movl    (%rax), %edx
+/*
+    Helper function to get a 64 bit operand, the long counterpart of int_operand
+    long variables and array elements are used straight from memory, a variable index going through
+    %rcx; narrower ones and immediates beyond 32 bits are loaded into scratch first
+*/
+string long_operand(const string s, const string scratch, Function &f1) {
+    if (is_immediate(s) && fits_int(s)) {
+        return "$" + s;
+    }
+    if (!is_immediate(s) && is_long_operand(s, f1)) {
+        return is_array_accessor(s) ? element_address(s, "%rcx", f1).operand() : var_location(s, f1);
+    }
+    move_long_operand_into_register(s, scratch, f1);
+    return scratch;
+}
 
-    f = d + x[2]
-    movq    -40(%rbp), %rax
-    addq    $8, %rax
-    movl    (%rax), %edx
+/*
+    Helper function to move any operand (immediate, variable or array element) into a register
 */
-void move_param_arr_val_into_register(const string s, const string reg, Function &f1) {
-    string arr_name = s.substr(0, s.find("["));
-    string arr_index = substr_between_indices(s, s.find("[") + 1, s.find("]"));
-    string arr_zero_index = to_string(f1.variables.at(arr_name + "[0]").addr_offset);
-
-    if (is_array_accessor_dynamic(s)) {
-        move_var_val_into_register(arr_index, "%eax", f1);
-        f1.assembly_instructions.push_back("cltq");
-        f1.assembly_instructions.push_back("leaq 0(,%rax,4), %rdx");
-        f1.assembly_instructions.push_back("movq " + arr_zero_index + "(%rbp), %rax");
-        f1.assembly_instructions.push_back("addq %rdx, %rax");
+void move_operand_into_register(const string s, const string reg, Function &f1) {
+    if (is_immediate(s)) {
+        move_immediate_val_into_register(s, reg, f1);
+    } else if (is_array_accessor(s)) {
+        move_arr_val_into_register(s, reg, f1);
     } else {
-        f1.assembly_instructions.push_back("movq " + arr_zero_index + "(%rbp), %rax");
-
-        if (arr_index != "0") {
-            string addq_amt = "$" + to_string(stoi(arr_index) * 4);
-            f1.assembly_instructions.push_back("addq " + addq_amt + ", %rax");
-        }
+        move_var_val_into_register(s, reg, f1);
     }
+}
 
-    f1.assembly_instructions.push_back("movl (%rax), %" + reg);
+/*
+    Helper function to get the size and memory operand of a destination
+    A variable index of an array element goes through %rcx, which no stored value is in
+*/
+pair<int, string> store_location(const string dest, Function &f1) {
+    if (is_array_accessor(dest)) {
+        int size = type_size(array_element_type(dest, f1));
+        return {size, element_address(dest, "%rcx", f1).operand()};
+    }
+    return {type_size(lookup_variable(dest, f1).type), var_location(dest, f1)};
 }
 
 /*
@@ -239,265 +519,859 @@ void move_param_arr_val_into_register(const string s, const string reg, Function
     Pushes required assembly instrucitons to move immediate value into specified destination
 */
 void store_immedaite_val(const string dest, const string val, Function &f1) {
-    if (is_array_accessor_dynamic(dest)) {
-        /*
-            storing in array via variable
-        */
-        string arr_name = dest.substr(0, dest.find("["));
-        string arr_index = substr_between_indices(dest, dest.find("[") + 1, dest.find("]"));
-
-        f1.assembly_instructions.push_back("movl " + to_string(f1.variables.at(arr_index).addr_offset) + "(%rbp), %eax");
-        f1.assembly_instructions.push_back("cltq");
-        // get where arr_name[0] is
-        string arr_start_offset = to_string(f1.variables.at(arr_name + "[0]").addr_offset);
-        f1.assembly_instructions.push_back("movl $" + val + ", " + arr_start_offset + "(%rbp, %rax, 4)");
-    } else {
-        /*
-            storing in variable or static array (a[0])
-        */
-        f1.assembly_instructions.push_back("movl $" + val + ", " + to_string(f1.variables.at(dest).addr_offset) + "(%rbp)");
+    auto location = store_location(dest, f1);
+    if (location.first == 8 && !fits_int(val)) {
+        // a move to memory only takes a 32 bit immediate
+        f1.assembly_instructions.push_back("movabsq $" + val + ", %rdx");
+        f1.assembly_instructions.push_back("movq %rdx, " + location.second);
+        return;
     }
+    f1.assembly_instructions.push_back(add_mov_instruction("$" + truncated_immediate(val, location.first), location.second, location.first * 8));
 }
 
 /*
     Helper function to move register value into a specified destionation
     Pushes required assembly instrucitons to move register value into specified destination
+    reg is given by its 32 bit name; is_long says the value fills all 64 bits of it
 */
-void store_reg_val(const string dest, const string reg, Function &f1) {
-    if (is_array_accessor_dynamic(dest)) {
-        /*
-            storing in array via variable
-        */
-        string arr_name = dest.substr(0, dest.find("["));
-        string arr_index = substr_between_indices(dest, dest.find("[") + 1, dest.find("]"));
-
-        f1.assembly_instructions.push_back("movl " + to_string(f1.variables.at(arr_index).addr_offset) + "(%rbp), %eax");
-        f1.assembly_instructions.push_back("cltq");
-        // get where arr_name[0] is
-        string arr_start_offset = to_string(f1.variables.at(arr_name + "[0]").addr_offset);
-        f1.assembly_instructions.push_back("movl " + reg + ", " + arr_start_offset + "(%rbp, %rax, 4)");
-    } else {
-        /*
-            storing in variable or static array (a[0])
-        */
-        f1.assembly_instructions.push_back("movl " + reg + ", " + to_string(f1.variables.at(dest).addr_offset) + "(%rbp)");
+void store_reg_val(const string dest, const string reg, Function &f1, bool is_long) {
+    auto location = store_location(dest, f1);
+    if (location.first == 8 && !is_long) {
+        // 32 bit result into a long, sign extend first
+        f1.assembly_instructions.push_back("movslq " + reg + ", " + sized_register(reg, 8));
     }
+    f1.assembly_instructions.push_back(add_mov_instruction(sized_register(reg, location.first), location.second, location.first * 8));
 }
 
 /*
-    Helper function to handle code like thing1 comparator thing2
-    Pushes required assembly instructions for comparison
+    Helper function to split a condition into tokens
+    Comparands like a[i] or -3 stay whole, operators and parentheses become their own tokens
 */
-void comparison_handler(string &s, Function &f1, bool jump_if_false) {
-    // mapping of all comparators and their associated assembly command
-    map<string, string> comparators_jump_if_true;
-    comparators_jump_if_true.insert(pair<string, string>("<", "jge"));
-    comparators_jump_if_true.insert(pair<string, string>(">", "jle"));
-    comparators_jump_if_true.insert(pair<string, string>("<=", "jg"));
-    comparators_jump_if_true.insert(pair<string, string>(">=", "jl"));
-    comparators_jump_if_true.insert(pair<string, string>("==", "jne"));
-    comparators_jump_if_true.insert(pair<string, string>("!=", "je"));
-
-    map<string, string> comparators_jump_if_false;
-    comparators_jump_if_false.insert(pair<string, string>("<", "jle"));
-    comparators_jump_if_false.insert(pair<string, string>(">", "jge"));
-    comparators_jump_if_false.insert(pair<string, string>("<=", "jl"));
-    comparators_jump_if_false.insert(pair<string, string>(">=", "jg"));
-    comparators_jump_if_false.insert(pair<string, string>("==", "je"));
-    comparators_jump_if_false.insert(pair<string, string>("!=", "jne"));
-
-    auto comparators = jump_if_false ? comparators_jump_if_true : comparators_jump_if_false;
+vector<string> tokenize_condition(const string s) {
+    vector<string> tokens;
+    size_t i = 0;
+    while (i < s.size()) {
+        if (isspace(s[i])) {
+            i++;
+            continue;
+        }
 
-    auto tokens = split(s, " ");
-    trim_vector(tokens);
-    string l_comp = tokens[0];
-    string r_comp = tokens[2];
-    string comp = tokens[1];
+        string two = s.substr(i, 2);
+        if (two == "&&" || two == "||" || two == "<=" || two == ">=" || two == "==" || two == "!=") {
+            tokens.push_back(two);
+            i += 2;
+        } else if (s[i] == '(' || s[i] == ')' || s[i] == '!' || s[i] == '<' || s[i] == '>') {
+            tokens.push_back(string(1, s[i]));
+            i++;
+        } else {
+            size_t end = i;
+            while (end < s.size() && !isspace(s[end]) && string("()!<>=&|").find(s[end]) == string::npos) {
+                end++;
+            }
+            tokens.push_back(s.substr(i, end - i));
+            i = end;
+        }
+    }
+    return tokens;
+}
 
-    for (auto const &c : comparators) {
-        string comparator = c.first;
-        string command = c.second;
+/*
+    Recursive descent over the condition tokens
+        or_expr    := and_expr ("||" and_expr)*
+        and_expr   := unary ("&&" unary)*
+        unary      := "!" unary | "(" or_expr ")" | comparand [comparator comparand]
+    A comparand on its own is true when it isn't 0
+*/
+Condition parse_unary_condition(vector<string> &tokens, size_t &pos) {
+    Condition c;
+    if (tokens[pos] == "!") {
+        pos++;
+        c.op = "!";
+        c.operands.push_back(parse_unary_condition(tokens, pos));
+    } else if (tokens[pos] == "(") {
+        pos++;
+        c = parse_or_condition(tokens, pos);
+        pos++;  // ")"
+    } else {
+        c.lhs = tokens[pos++];
+        if (pos < tokens.size() && comparators_jump_if_true.count(tokens[pos]) > 0) {
+            c.op = tokens[pos++];
+            c.rhs = tokens[pos++];
+        } else {
+            c.op = "!=";
+            c.rhs = "0";
+        }
+    }
+    return c;
+}
 
-        if (is_substr(s, comparator)) {
-            string label_instruction = ".L" + to_string(label_num);
+Condition parse_and_condition(vector<string> &tokens, size_t &pos) {
+    Condition c = parse_unary_condition(tokens, pos);
+    if (pos < tokens.size() && tokens[pos] == "&&") {
+        Condition all;
+        all.op = "&&";
+        all.operands.push_back(c);
+        while (pos < tokens.size() && tokens[pos] == "&&") {
+            pos++;
+            all.operands.push_back(parse_unary_condition(tokens, pos));
+        }
+        return all;
+    }
+    return c;
+}
 
-            if (is_array_accessor(l_comp) || is_array_accessor(r_comp)) {
-                /*
-                    Handles where one of the comparands is accessing an array
-                    - array array
-                    - array var
-                    - array immediate
-                    - var array
-                    - immediate array
-                */
-                if (is_array_accessor(l_comp) && is_array_accessor(r_comp)) {
-                    // array array
-                    move_arr_val_into_register(l_comp, "%edx", f1);
-                    move_arr_val_into_register(r_comp, "%eax", f1);
-
-                    f1.assembly_instructions.push_back("cmpl %eax, %edx");
-                } else if (is_array_accessor(l_comp)) {
-                    move_arr_val_into_register(l_comp, "%eax", f1);
-                    if (is_int(r_comp)) {
-                        // array immediate
-                        r_comp = "$" + r_comp;
-                    } else {
-                        // array var
-                        r_comp = to_string(f1.variables.at(r_comp).addr_offset) + "(%rbp)";
-                    }
-                    /*
-                        reverse the comparands here to ensure that the map holds
-                        godbolt shows c[f] < a as
-                            cmpl %eax, -4(%rbp)
-                            jle .L3
-                        but we want it as:
-                            cmpl -4(%rbp), %eax
-                            jge .L3
-                    */
-                    f1.assembly_instructions.push_back("cmpl " + r_comp + ", %eax");
-                } else if (is_array_accessor(r_comp)) {
-                    move_arr_val_into_register(r_comp, "%eax", f1);
-                    if (is_int(l_comp)) {
-                        // immediate array
-                        l_comp = "$" + l_comp;
-                    } else {
-                        // var array
-                        l_comp = to_string(f1.variables.at(l_comp).addr_offset) + "(%rbp)";
-                    }
-
-                    f1.assembly_instructions.push_back("cmpl %eax, " + l_comp);
-                }
-            } else if (is_int(l_comp) || is_int(r_comp)) {
-                /*
-                    Handles where one of the comparands is an immediate and none are arrays
-                    - immediate immediate
-                    - immediate var
-                    - var immedaite
-                */
-                if (is_int(l_comp) && is_int(r_comp)) {
-                    /*
-                        Doesn't handle case of when both are immediates
-                    */
-                } else if (is_int(l_comp)) {
-                    r_comp = to_string(f1.variables.at(r_comp).addr_offset) + "(%rbp)";
-
-                    f1.assembly_instructions.push_back("cmpl $" + l_comp + ", " + r_comp);
-                } else {
-                    l_comp = to_string(f1.variables.at(l_comp).addr_offset) + "(%rbp)";
+Condition parse_or_condition(vector<string> &tokens, size_t &pos) {
+    Condition c = parse_and_condition(tokens, pos);
+    if (pos < tokens.size() && tokens[pos] == "||") {
+        Condition any;
+        any.op = "||";
+        any.operands.push_back(c);
+        while (pos < tokens.size() && tokens[pos] == "||") {
+            pos++;
+            any.operands.push_back(parse_and_condition(tokens, pos));
+        }
+        return any;
+    }
+    return c;
+}
 
-                    f1.assembly_instructions.push_back("cmpl $" + r_comp + ", " + l_comp);
-                }
-            } else {
-                /*
-                    Else case is if both comparands are variables(non-array)
-                    - var var
-                */
-                l_comp = to_string(f1.variables.at(l_comp).addr_offset) + "(%rbp)";
-                r_comp = to_string(f1.variables.at(r_comp).addr_offset) + "(%rbp)";
+Condition parse_condition(const string s) {
+    vector<string> tokens = tokenize_condition(s);
+    size_t pos = 0;
+    return parse_or_condition(tokens, pos);
+}
 
-                f1.assembly_instructions.push_back("movl " + l_comp + ", %eax");
-                f1.assembly_instructions.push_back("cmpl " + r_comp + ", %eax");
-            }
+/*
+    Return if string is an immediate, including negative ones
+*/
+bool is_immediate(const string s) {
+    return !s.empty() && (is_int(s) || (s[0] == '-' && s.size() > 1 && is_int(s.substr(1))));
+}
 
-            f1.assembly_instructions.push_back(command + " " + label_instruction);
-        }
+/*
+    Helper function to read an immediate, which may be too big for an int but has to fit a long
+*/
+long literal_value(const string s) {
+    try {
+        return stol(s);
+    } catch (const out_of_range &) {
+        throw runtime_error("integer literal " + s + " does not fit in a long");
     }
 }
 
 /*
-    Create a function object, get function return type and function name
+    Return if an immediate fits the 32 bits of an instruction's immediate operand
 */
-void function_handler(vector<string> source, int loc, int max_len) {
-    Function f1;
-    string head = source[loc];
-    f1.return_type = head.substr(0, head.find(' '));  // get return type
-    string tempstr = head.substr(head.find(' ') + 1, head.length());
-    f1.function_name = tempstr.substr(0, tempstr.find('('));  // get fxn name
-    f1.assembly_instructions.push_back(f1.function_name + ":");
-    f1.assembly_instructions.push_back("#" + substr_between_indices(source[loc], 0, source[loc].find(")") + 1));
-    f1.assembly_instructions.push_back("pushq %rbp");
-    f1.assembly_instructions.push_back("movq %rsp, %rbp");
-    f1.is_leaf_function = true;
+bool fits_int(const string s) {
+    long v = literal_value(s);
+    return v >= INT_MIN && v <= INT_MAX;
+}
 
-    // Get parameter list and read parameter values from registers
+/*
+    Helper function to get an immediate as a store of size bytes keeps it, wrapped like C's
+    conversion to the narrower type
+*/
+string truncated_immediate(const string s, int size) {
+    long v = literal_value(s);
+    return to_string(size == 1 ? (long)(signed char)v : size == 2 ? (long)(short)v : size == 4 ? (long)(int)v : v);
+}
 
-    int addr_offset = -4;
-    tempstr = tempstr.substr(tempstr.find('(') + 1, tempstr.length() - f1.function_name.length() - 3);
-    string parameter_str = tempstr.substr(tempstr.find('(') + 1, tempstr.find('('));
-    parameter_str.pop_back();
-    if (parameter_str.length() > 0) {
-        int number_of_parameter = 0;
+/*
+    Return if an operand makes arithmetic or a comparison 64 bits wide: a long variable or array
+    element, or an immediate too big for an int
+*/
+bool is_long_operand(const string s, Function &f1) {
+    if (is_immediate(s)) {
+        return !fits_int(s);
+    }
+    return (is_array_accessor(s) ? array_element_type(s, f1) : lookup_variable(s, f1).type) == "long";
+}
 
-        // variable_handler makes variable for e[0], e[1], e[2], increaseing number of parameters
-        f1.variables = variable_handler(parameter_str, addr_offset);
+/*
+    Return if a comparison only reads plain variables and immediates
+    Those can be evaluated unconditionally, so && and || over them don't need branches
+*/
+bool is_pure_comparison(const Condition &c) {
+    if (!c.is_comparison() || (is_immediate(c.lhs) && is_immediate(c.rhs))) {
+        return false;
+    }
+    return !is_array_accessor(c.lhs) && !is_array_accessor(c.rhs);
+}
 
-        for (auto &varpair : f1.variables) {
-            Variable var = varpair.second;
+/*
+    Helper function to set the flags for lhs comparator rhs
+    Returns the comparator the flags have to be tested with, which is mirrored when
+    the comparands had to be swapped to get an immediate on the right
+    reg is the scratch register the left comparand is loaded into when it can't be
+    compared in memory; an int right comparand is used straight from memory
+*/
+string compare_operands(string lhs, string comp, string rhs, Function &f1, const string reg) {
+    if (is_immediate(lhs)) {
+        swap(lhs, rhs);
+        comp = comparators_swapped.at(comp);
+    }
 
-            if (var.name.size() > 1 && var.name.substr(1) != "[0]" && number_of_parameter <= 6)
-                continue;  // i.e., 'e[1]' doesn't need to be dealt with separately.
+    if (is_long_operand(lhs, f1) || is_long_operand(rhs, f1)) {
+        // a long on either side compares all 64 bits, the other side sign extended
+        string reg64 = sized_register(reg, 8);
+        if (is_immediate(rhs) && fits_int(rhs)) {
+            f1.assembly_instructions.push_back("cmpq $" + rhs + ", " + long_operand(lhs, reg64, f1));
+        } else {
+            move_long_operand_into_register(lhs, reg64, f1);
+            f1.assembly_instructions.push_back("cmpq " + long_operand(rhs, "%rsi", f1) + ", " + reg64);
+        }
+    } else if (is_immediate(rhs)) {
+        // array immediate, var immediate
+        f1.assembly_instructions.push_back("cmpl $" + rhs + ", " + int_operand(lhs, reg, f1));
+    } else {
+        // array array, var array, array var, var var
+        move_operand_into_register(lhs, reg, f1);
+        f1.assembly_instructions.push_back("cmpl " + int_operand(rhs, "%esi", f1) + ", " + reg);
+    }
+    return comp;
+}
 
-            number_of_parameter++;
-            // First 6 parameters <- registers
-            if (number_of_parameter <= 6) {
-                if (var.type == "int") {
-                    // this parameter is a 32 bits variable
-                    f1.assembly_instructions.push_back(add_mov_instruction("%" + register_for_argument_32[number_of_parameter - 1], to_string(var.addr_offset) + "(%rbp)", 32));
-                } else {
-                    // this parameter is a 64 bits variable
-                    f1.assembly_instructions.push_back(add_mov_instruction("%" + register_for_argument_64[number_of_parameter - 1], to_string(var.addr_offset) + "(%rbp)", 64));
-                }
-                // other than the first 6, the rest need to reset their offset
-                // 16 = return address + saved %rbp
-            } else {
-                f1.variables.at(varpair.first).addr_offset = 16 + (number_of_parameter - 6 - 1) * 4;
+/*
+    Helper function to evaluate a comparison of two immediates at compile time
+*/
+bool fold_comparison(const Condition &c) {
+    long l = literal_value(c.lhs);
+    long r = literal_value(c.rhs);
+    if (c.op == "<") return l < r;
+    if (c.op == "<=") return l <= r;
+    if (c.op == ">") return l > r;
+    if (c.op == ">=") return l >= r;
+    if (c.op == "==") return l == r;
+    return l != r;
+}
+
+/*
+    Helper function to push the branches for a condition
+    Jumps to target when the condition evaluates to jump_if_true, falls through otherwise.
+    && and || are short-circuited with every sub-condition branching straight to the
+    final target; only a sub-condition that decides the opposite outcome early jumps
+    to a local label past the rest.
+*/
+void branch_on_condition(const Condition &c, const string target, bool jump_if_true, Function &f1) {
+    if (c.op == "!") {
+        branch_on_condition(c.operands[0], target, !jump_if_true, f1);
+        return;
+    }
 
-                addr_offset += 4;
+    if (c.is_comparison()) {
+        if (is_immediate(c.lhs) && is_immediate(c.rhs)) {
+            if (fold_comparison(c) == jump_if_true) {
+                f1.assembly_instructions.push_back("jmp " + target);
             }
+            return;
         }
+
+        string comp = compare_operands(c.lhs, c.op, c.rhs, f1);
+        auto &jumps = jump_if_true ? comparators_jump_if_true : comparators_jump_if_false;
+        f1.assembly_instructions.push_back(jumps.at(comp) + " " + target);
+        return;
     }
 
-    // Go through each instruction
+    bool is_and = c.op == "&&";
 
-    loc++;  // go to next source code line
-    bool next_function = false;
-    while (loc < max_len) {
-        if ((source[loc].find("int") == 0 || source[loc].find("void") == 0) && source[loc].find("{") == source[loc].length() - 1) {
-            // start with a new function
-            next_function = true;
-            break;
-        } else if (source[loc] == "}") {
-            loc++;
-        } else {
-            // line is not function call or function end
-            // send to common handler dispatcher
-            common_instruction_handler_dispatcher(source, loc, max_len, f1, addr_offset);
-        }
+    bool all_pure = c.operands.size() <= 4;
+    for (auto const &sub : c.operands) {
+        all_pure = all_pure && is_pure_comparison(sub);
     }
-
-    if (f1.is_leaf_function == false && f1.variables.size() > 0) {
-        int last_offset = 0 - (--(f1.variables.end()))->second.addr_offset;
-        // if last offset is not divisible by 16, then do 16 bytes address alignment: multiples of 16
-        if (last_offset % 16 != 0) {
-            last_offset = ceil((float)last_offset / 16) * 16;
+    if (all_pure) {
+        /*
+            cmpl    $0, -4(%rbp)
+            setg    %al
+            movl    -8(%rbp), %ecx
+            cmpl    -12(%rbp), %ecx
+            setl    %dl
+            andb    %dl, %al
+            testb   %al, %al
+            jne     target
+        */
+        for (size_t i = 0; i < c.operands.size(); ++i) {
+            const Condition &sub = c.operands[i];
+            string comp = compare_operands(sub.lhs, sub.op, sub.rhs, f1, "%ecx");
+            if (i == 0) {
+                f1.assembly_instructions.push_back(comparators_set_if_true.at(comp) + " %al");
+            } else {
+                f1.assembly_instructions.push_back(comparators_set_if_true.at(comp) + " %dl");
+                f1.assembly_instructions.push_back((is_and ? "andb" : "orb") + string(" %dl, %al"));
+            }
         }
-        f1.assembly_instructions.insert(f1.assembly_instructions.begin() + 3, "subq $" + to_string(last_offset) + ",%rsp");
+        f1.assembly_instructions.push_back("testb %al, %al");
+        f1.assembly_instructions.push_back((jump_if_true ? "jne " : "je ") + target);
+        return;
     }
 
-    functions.push_back(f1);
-    if (next_function == true) {
-        function_handler(source, loc, max_len);
+    if (is_and != jump_if_true) {
+        // (a && b) false or (a || b) true: any sub-condition alone decides the jump
+        for (auto const &sub : c.operands) {
+            branch_on_condition(sub, target, jump_if_true, f1);
+        }
+    } else {
+        // (a && b) true or (a || b) false: all sub-conditions have to agree
+        string skip_label = ".L" + to_string(label_num++);
+        for (size_t i = 0; i + 1 < c.operands.size(); ++i) {
+            branch_on_condition(c.operands[i], skip_label, !jump_if_true, f1);
+        }
+        branch_on_condition(c.operands.back(), target, jump_if_true, f1);
+        f1.assembly_instructions.push_back(skip_label + ":");
     }
 }
 
 /*
-    According to the instruction type, call the corresponding handler.
+    Helper function to handle conditions like thing1 comparator thing2, combined with &&, || and !
+    Pushes required assembly instructions to jump to target_label when the condition is jump_if_true
 */
-void common_instruction_handler_dispatcher(vector<string> source, int &loc, int max_len, Function &f1, int &addr_offset) {
-    /*
-        code line starts with variable declaration keyword "int" and ends with semicolon
+void comparison_handler(string &s, Function &f1, const string target_label, bool jump_if_true) {
+    branch_on_condition(parse_condition(s), target_label, jump_if_true, f1);
+}
+
+/*
+    Helper function to add a variable to the function's symbol table
+    Records the declaration in the innermost open block so it can be dropped again
+    at the block's closing }, and keeps track of how deep the stack frame has grown
+*/
+void declare_variable(Variable var, Function &f1) {
+    if (!f1.block_scopes.empty()) {
+        BlockScope &scope = f1.block_scopes.back();
+        scope.declared.push_back(var.name);
+
+        if (f1.variables.count(var.name) > 0) {
+            // declaration hides a variable from an outer block
+            scope.shadowed.insert(pair<string, Variable>(var.name, f1.variables.at(var.name)));
+            f1.variables.erase(var.name);
+        }
+    }
+
+    f1.variables.insert(pair<string, Variable>(var.name, var));
+    f1.frame_size = max(f1.frame_size, -var.addr_offset);
+    stats.count("variables");
+}
+
+/*
+    Helper function to open a new block scope (if body, for loop)
+*/
+void open_block_scope(Function &f1, int addr_offset) {
+    BlockScope scope;
+    scope.addr_offset = addr_offset;
+    f1.block_scopes.push_back(scope);
+}
+
+/*
+    Helper function to close the innermost block scope
+    Removes the block's locals, restores any outer variables they shadowed and
+    rewinds addr_offset so a later sibling block reuses the same stack slots
+*/
+void close_block_scope(Function &f1, int &addr_offset) {
+    BlockScope &scope = f1.block_scopes.back();
+
+    for (auto const &name : scope.declared) {
+        f1.variables.erase(name);
+    }
+    for (auto const &v : scope.shadowed) {
+        f1.variables.insert(v);
+    }
+
+    addr_offset = scope.addr_offset;
+    f1.block_scopes.pop_back();
+}
+
+/*
+    Helper function to give a declaration a home in .data or .bss
+    Handles "int a = 1, b;", "int arr[3] = {1, 2, 3};" and "int arr[100];"
+    Pushes the section directives and returns a Variable for each name (and array element) declared
+*/
+vector<Variable> static_storage_allocation(string line, bool is_global_symbol) {
+    vector<Variable> out;
+    remove_ending_semicolon(line);
+    string var_type = line.substr(0, line.find(" "));
+    string decl = line.substr(line.find(" ") + 1);  // drop the type
+    int elem_size = type_size(var_type);
+    string data_directive = elem_size == 1 ? ".byte " : elem_size == 2 ? ".value " : elem_size == 8 ? ".quad " : ".long ";
+
+    vector<string> declarators;
+    if (is_array_accessor(decl)) {
+        declarators.push_back(decl);
+    } else {
+        declarators = split(decl, ",");
+        trim_vector(declarators);
+    }
+
+    for (string d : declarators) {
+        auto tokens = split(d, " = ");
+        trim_vector(tokens);
+
+        string name = tokens[0];
+        int array_size = 1;
+        int columns = 0;
+        vector<string> values;
+
+        if (is_array_accessor(name)) {
+            array_size = array_declarator(tokens[0], name, columns);
+            if (tokens.size() > 1) {
+                values = array_initializer(tokens[1], columns);
+            }
+        } else if (tokens.size() > 1) {
+            values.push_back(tokens[1]);
+        }
+
+        bool all_zero = true;
+        for (auto const &v : values) {
+            if (literal_value(v) != 0) {
+                all_zero = false;
+            }
+        }
+
+        // file scope symbols keep their name, static locals get a unique one like gcc's "count.0"
+        string label = is_global_symbol ? name : name + "." + to_string(static_var_num++);
+        int size = array_size * elem_size;
+
+        vector<string> &section = all_zero ? bss_section : data_section;
+        if (is_global_symbol) {
+            section.push_back(".globl " + label);
+        }
+        section.push_back(".align " + to_string(elem_size));
+        section.push_back(".type " + label + ", @object");
+        section.push_back(".size " + label + ", " + to_string(size));
+        section.push_back(label + ":");
+        if (all_zero) {
+            section.push_back(".zero " + to_string(size));
+        } else {
+            for (auto const &v : values) {
+                section.push_back(data_directive + v);
+            }
+            if ((int)values.size() < array_size) {
+                section.push_back(".zero " + to_string((array_size - values.size()) * elem_size));
+            }
+        }
+
+        if (is_array_accessor(tokens[0])) {
+            for (int i = 0; i < array_size; ++i) {
+                long val = i < (int)values.size() ? literal_value(values[i]) : 0;
+                Variable var(name + "[" + to_string(i) + "]", var_type, val, i * elem_size);
+                var.label = label;
+                var.columns = columns;
+                out.push_back(var);
+            }
+        } else {
+            Variable var(name, var_type, values.empty() ? 0 : literal_value(values[0]), 0);
+            var.label = label;
+            out.push_back(var);
+        }
+    }
+
+    return out;
+}
+
+/*
+    Handle variable declarations outside of any function
+    "static int" at file scope keeps the symbol local to the file
+*/
+void global_variable_handler(string line) {
+    bool is_static = line.find("static ") == 0;
+    if (is_static) {
+        line = line.substr(7);
+    }
+
+    for (auto const &var : static_storage_allocation(line, !is_static)) {
+        global_variables.insert(pair<string, Variable>(var.name, var));
+        stats.count("variables");
+    }
+}
+
+/*
+    Handle static local variable declarations
+    They live in .data/.bss for the whole program and are initialized once at load time,
+    so no instructions are pushed into the function body
+*/
+void static_variable_handler(string line, Function &f1) {
+    for (auto const &var : static_storage_allocation(line.substr(7), false)) {
+        declare_variable(var, f1);
+    }
+}
+
+/*
+    Helper function to collect the .data and .bss sections for the output file
+*/
+vector<string> static_data_instructions() {
+    vector<string> out;
+    if (!data_section.empty()) {
+        out.push_back(".data");
+        out.insert(out.end(), data_section.begin(), data_section.end());
+    }
+    if (!bss_section.empty()) {
+        out.push_back(".bss");
+        out.insert(out.end(), bss_section.begin(), bss_section.end());
+    }
+    return out;
+}
+
+/*
+    Helper function to add an --instrument counter, named in the profile by the function, the kind
+    of site and the source line
+    Returns the counter's operand, or "" when not instrumenting
+*/
+string profile_site(Function &f1, const string kind, const string line) {
+    if (profile_path.empty()) {
+        return "";
+    }
+    profile_sites.push_back(f1.function_name + " " + kind + " " + line);
+    return ".Lprofile_counters+" + to_string(8 * (profile_sites.size() - 1)) + "(%rip)";
+}
+
+/*
+    Helper function to count how often this point of a function runs, for --instrument
+*/
+void profile_counter(Function &f1, const string kind, const string line) {
+    string counter = profile_site(f1, kind, line);
+    if (!counter.empty()) {
+        f1.assembly_instructions.push_back("addq $1, " + counter);
+    }
+}
+
+/*
+    Helper function to build the --instrument counters and the function that dumps them
+    The dump runs from .fini_array when the program exits and writes one
+    "<site> <count> <function> <kind> <source line>" line per counter to $PROFILE_OUT,
+    or to profile_path when that isn't set
+*/
+vector<string> profile_instructions() {
+    vector<string> out;
+    if (profile_sites.empty()) {
+        return out;
+    }
+
+    string sites = to_string(profile_sites.size());
+    vector<string> dump = {
+        ".text",
+        ".Lprofile_dump:",
+        "pushq %rbp",
+        "movq %rsp, %rbp",
+        "pushq %rbx",
+        "pushq %r12",
+        "leaq .Lprofile_env(%rip), %rdi",
+        "call getenv",
+        "testq %rax, %rax",
+        "jne .Lprofile_open",
+        "leaq .Lprofile_path(%rip), %rax",
+        ".Lprofile_open:",
+        "movq %rax, %rdi",
+        "leaq .Lprofile_mode(%rip), %rsi",
+        "call fopen",
+        "testq %rax, %rax",
+        "je .Lprofile_done",
+        "movq %rax, %r12",
+        "movl $0, %ebx",
+        ".Lprofile_next:",
+        "cmpq $" + sites + ", %rbx",
+        "jge .Lprofile_close",
+        "movq %r12, %rdi",
+        "leaq .Lprofile_format(%rip), %rsi",
+        "movq %rbx, %rdx",
+        "leaq .Lprofile_counters(%rip), %rax",
+        "movq (%rax,%rbx,8), %rcx",
+        "leaq .Lprofile_names(%rip), %rax",
+        "movq (%rax,%rbx,8), %r8",
+        "movl $0, %eax",
+        "call fprintf",
+        "addq $1, %rbx",
+        "jmp .Lprofile_next",
+        ".Lprofile_close:",
+        "movq %r12, %rdi",
+        "call fclose",
+        ".Lprofile_done:",
+        "popq %r12",
+        "popq %rbx",
+        "popq %rbp",
+        "ret",
+        ".section .fini_array,\"aw\"",
+        ".align 8",
+        ".quad .Lprofile_dump",
+        ".section .rodata",
+        ".Lprofile_env:",
+        ".string \"PROFILE_OUT\"",
+        ".Lprofile_path:",
+        ".string \"" + profile_path + "\"",
+        ".Lprofile_mode:",
+        ".string \"w\"",
+        ".Lprofile_format:",
+        ".string \"%ld %ld %s\\n\""};
+    out.insert(out.end(), dump.begin(), dump.end());
+
+    out.push_back(".align 8");
+    out.push_back(".Lprofile_names:");
+    for (size_t i = 0; i < profile_sites.size(); ++i) {
+        out.push_back(".quad .Lprofile_name" + to_string(i));
+    }
+    for (size_t i = 0; i < profile_sites.size(); ++i) {
+        string name;
+        for (char c : profile_sites[i]) {
+            if (c == '"' || c == '\\') {
+                name += '\\';
+            }
+            name += c;
+        }
+        out.push_back(".Lprofile_name" + to_string(i) + ":");
+        out.push_back(".string \"" + name + "\"");
+    }
+
+    out.push_back(".bss");
+    out.push_back(".align 8");
+    out.push_back(".Lprofile_counters:");
+    out.push_back(".zero " + to_string(8 * profile_sites.size()));
+    return out;
+}
+
+/*
+    Read a profile written by an --instrument build into profile_counts
+    An if's body was skipped "endif" - "if" times; both sites are made in the order the ifs open and
+    close, so they pair up like brackets
+    Returns false when the file can't be opened
+*/
+bool read_profile(const string fn) {
+    ifstream in(fn);
+    if (in.fail()) {
+        return false;
+    }
+
+    map<string, vector<pair<size_t, long>>> open_ifs;  // "skipped" slot and count of the ifs not closed yet
+    string line;
+    while (getline(in, line)) {
+        istringstream fields(line);
+        long site, count;
+        string function, kind, source;
+        if (!(fields >> site >> count >> function >> kind)) {
+            continue;
+        }
+        getline(fields, source);
+        trim(source);
+
+        profile_counts[function + " " + kind + " " + source].push_back(count);
+        string if_key = function + " " + source;
+        if (kind == "if") {
+            vector<long> &skipped = profile_counts[function + " skipped " + source];
+            open_ifs[if_key].push_back(make_pair(skipped.size(), count));
+            skipped.push_back(0);
+        } else if (kind == "endif" && !open_ifs[if_key].empty()) {
+            pair<size_t, long> opened = open_ifs[if_key].back();
+            open_ifs[if_key].pop_back();
+            profile_counts[function + " skipped " + source][opened.first] = max(0L, count - opened.second);
+        }
+    }
+    return true;
+}
+
+/*
+    Helper function to look up a site of the --profile-use profile by the function, the kind of site
+    and the source line; repeated lines are told apart by the order they are looked up in
+    Returns -1 when there is no profile or it has no such site
+*/
+long profile_count(Function &f1, const string kind, const string line) {
+    if (profile_counts.empty()) {
+        return -1;
+    }
+    string key = f1.function_name + " " + kind + " " + line;
+    size_t n = profile_seen[key]++;
+    auto found = profile_counts.find(key);
+    if (found == profile_counts.end() || n >= found->second.size()) {
+        return -1;
+    }
+    return found->second[n];
+}
+
+/*
+    Helper function to move the if bodies the profile found unlikely behind the rest of the function,
+    those that never ran into .text.unlikely, and to move the loops recorded in them along
+*/
+void move_cold_blocks(Function &f1) {
+    if (f1.cold_blocks.empty()) {
+        return;
+    }
+    vector<string> &code = f1.assembly_instructions;
+
+    // a block nested in another is moved on its own, out of the outer one's code, so the
+    // innermost block an instruction is in owns it; blocks are recorded innermost first
+    vector<int> block_at(code.size(), -1);
+    vector<int> order;  // blocks by where they start
+    bool never_run = false;
+    for (int b = f1.cold_blocks.size() - 1; b >= 0; --b) {
+        for (size_t i = f1.cold_blocks[b].begin; i < f1.cold_blocks[b].end; ++i) {
+            block_at[i] = b;
+        }
+        order.push_back(b);
+        never_run = never_run || f1.cold_blocks[b].never_run;
+    }
+    sort(order.begin(), order.end(), [&](int a, int b) { return f1.cold_blocks[a].begin < f1.cold_blocks[b].begin; });
+
+    // the hot code first, then the bodies that ran rarely, then those that never ran
+    vector<string> moved;
+    vector<size_t> new_index(code.size());
+    for (size_t i = 0; i < code.size(); ++i) {
+        if (block_at[i] < 0) {
+            new_index[i] = moved.size();
+            moved.push_back(code[i]);
+        }
+    }
+    for (bool unlikely : {false, true}) {
+        if (unlikely && never_run) {
+            moved.push_back(".section .text.unlikely,\"ax\",@progbits");
+        }
+        for (int b : order) {
+            if (f1.cold_blocks[b].never_run != unlikely) {
+                continue;
+            }
+            for (size_t i = f1.cold_blocks[b].begin; i < f1.cold_blocks[b].end; ++i) {
+                if (block_at[i] == b) {
+                    new_index[i] = moved.size();
+                    moved.push_back(code[i]);
+                }
+            }
+        }
+    }
+    if (never_run) {
+        moved.push_back(".text");
+    }
+
+    for (auto &loop : f1.loops) {
+        loop.begin = new_index[loop.begin];
+        loop.latch = new_index[loop.latch];
+        loop.end = new_index[loop.end - 1] + 1;
+    }
+    code.swap(moved);
+    f1.cold_blocks.clear();
+}
+
+/*
+    Translate the file scope declarations at the start of source and the function that follows them
+    into f1, get function return type and function name
+    Returns false when source holds no function (the declarations at the end of a file)
+*/
+bool function_handler(vector<string> &source, int loc, int max_len, Function &f1) {
+    // anything between functions is a file scope declaration
+    while (loc < max_len && !is_function_header(source[loc])) {
+        if (is_declaration(source[loc]) || (source[loc].find("static") == 0 && source[loc].back() == ';')) {
+            ScopedTimer timer(stats, stats.handlers, "global");
+            global_variable_handler(source[loc]);
+        }
+        loc++;
+    }
+    if (loc >= max_len) {
+        return false;
+    }
+
+    string head = source[loc];
+    f1.return_type = head.substr(0, head.find(' '));  // get return type
+    string tempstr = head.substr(head.find(' ') + 1, head.length());
+    f1.function_name = tempstr.substr(0, tempstr.find('('));  // get fxn name
+    if (f1.return_type == "long") {
+        long_functions.insert(f1.function_name);
+    }
+    f1.assembly_instructions.push_back(f1.function_name + ":");
+    f1.assembly_instructions.push_back("#" + substr_between_indices(source[loc], 0, source[loc].find(")") + 1));
+    f1.assembly_instructions.push_back("pushq %rbp");
+    f1.assembly_instructions.push_back("movq %rsp, %rbp");
+    f1.is_leaf_function = true;
+    f1.frame_size = 0;
+
+    // Get parameter list and read parameter values from registers
+
+    int addr_offset = -4;
+    string parameter_str = substr_between_indices(tempstr, tempstr.find('(') + 1, tempstr.find(')'));
+    if (parameter_str.length() > 0) {
+        vector<string> params = split(parameter_str, ", ");
+        trim_vector(params);
+
+        for (size_t i = 0; i < params.size(); ++i) {
+            string type = params[i].substr(0, params[i].find(" "));
+            string name = params[i].substr(params[i].find(" ") + 1);
+            int columns = 0;
+            if (is_array_accessor(name)) {
+                // arrays are passed as a pointer to their first element
+                array_declarator(name, name, columns);
+                name += "[0]";
+                type += "ptr";
+            }
+
+            int size = type_size(type);
+            int offset;
+            if (i < 6) {
+                // first 6 parameters arrive in registers, store the 8/16/32/64 bits that hold the parameter
+                offset = allocate_stack_slot(addr_offset, size, size);
+                string reg = sized_register("%" + register_for_argument_32[i], size);
+                f1.assembly_instructions.push_back(add_mov_instruction(reg, to_string(offset) + "(%rbp)", size * 8));
+            } else {
+                // the rest were pushed by the caller, 8 bytes each above the return address and saved %rbp
+                offset = 16 + (i - 6) * 8;
+            }
+            Variable param(name, type, 0, offset, true);
+            param.columns = columns;
+            declare_variable(param, f1);
+        }
+    }
+
+    profile_counter(f1, "entry", substr_between_indices(head, 0, head.find(")") + 1));
+
+    // Go through each instruction
+
+    loc++;  // go to next source code line
+    while (loc < max_len) {
+        if (source[loc] == "}") {
+            // end of the function
+            break;
+        } else {
+            // line is not function call or function end
+            // send to common handler dispatcher
+            common_instruction_handler_dispatcher(source, loc, max_len, f1, addr_offset);
+        }
+    }
+
+    if (!f1.cold_blocks.empty()) {
+        ScopedTimer timer(stats, stats.passes, "hot-cold");
+        move_cold_blocks(f1);
+    }
+
+    if (f1.is_leaf_function == false && f1.frame_size > 0) {
+        int last_offset = f1.frame_size;
+        // if last offset is not divisible by 16, then do 16 bytes address alignment: multiples of 16
+        if (last_offset % 16 != 0) {
+            last_offset = ceil((float)last_offset / 16) * 16;
+        }
+        f1.assembly_instructions.insert(f1.assembly_instructions.begin() + 4, "subq $" + to_string(last_offset) + ",%rsp");
+        for (auto &loop : f1.loops) {
+            loop.begin++;
+            loop.latch++;
+            loop.end++;
+        }
+    }
+
+    run_function_passes(f1);
+
+    stats.count("functions");
+    return true;
+}
+
+/*
+    According to the instruction type, call the corresponding handler.
+*/
+void common_instruction_handler_dispatcher(vector<string> &source, int &loc, int max_len, Function &f1, int &addr_offset) {
+    stats.count("lines_dispatched");
+
+    /*
+        code line starts with "static" and declares a static local variable
+    */
+    if (source[loc].find("static") == 0) {
+        ScopedTimer timer(stats, stats.handlers, "static");
+        f1.assembly_instructions.push_back("#" + source[loc]);
+        static_variable_handler(source[loc], f1);
+        loc++;
+    }
+    /*
+        code line starts with a type keyword ("int", "char", "short", "long") and ends with semicolon
     */
-    if (source[loc].find("int") == 0 && source[loc].find(";") == source[loc].length() - 1) {
+    else if (is_declaration(source[loc])) {
+        ScopedTimer timer(stats, stats.handlers, "declaration");
         f1.assembly_instructions.push_back("#" + source[loc]);
         variable_offset_allocation(source, loc, f1, addr_offset);
         loc++;
@@ -506,6 +1380,7 @@ void common_instruction_handler_dispatcher(vector<string> source, int &loc, int
         code line starts with "if"
     */
     else if (source[loc].find("if") == 0) {
+        ScopedTimer timer(stats, stats.handlers, "if");
         f1.assembly_instructions.push_back("#" + source[loc]);
         IF_statement_handler(source, loc, max_len, f1, addr_offset);
     }
@@ -513,13 +1388,32 @@ void common_instruction_handler_dispatcher(vector<string> source, int &loc, int
         code line starts with "for"
     */
     else if (source[loc].find("for") == 0) {
+        ScopedTimer timer(stats, stats.handlers, "for");
         f1.assembly_instructions.push_back("#" + source[loc]);
         FOR_statement_handler(source, loc, max_len, f1, addr_offset);
     }
+    /*
+        code line starts with "switch"
+    */
+    else if (source[loc].find("switch") == 0) {
+        ScopedTimer timer(stats, stats.handlers, "switch");
+        f1.assembly_instructions.push_back("#" + source[loc]);
+        SWITCH_statement_handler(source, loc, max_len, f1, addr_offset);
+    }
+    /*
+        code line is "break;" out of the innermost switch or for loop
+    */
+    else if (source[loc] == "break;") {
+        ScopedTimer timer(stats, stats.handlers, "break");
+        f1.assembly_instructions.push_back("#" + source[loc]);
+        break_handler(f1);
+        loc++;
+    }
     /*
         code line starts with "return"
     */
     else if (source[loc].find("return") == 0) {
+        ScopedTimer timer(stats, stats.handlers, "return");
         f1.assembly_instructions.push_back("#" + source[loc]);
         return_handler(source[loc], f1);
         loc++;
@@ -528,6 +1422,7 @@ void common_instruction_handler_dispatcher(vector<string> source, int &loc, int
         code line starts with a function
     */
     else if (is_function_call(source[loc])) {
+        ScopedTimer timer(stats, stats.handlers, "call");
         f1.assembly_instructions.push_back("#" + source[loc]);
         function_call_handler(source[loc], f1);
         f1.is_leaf_function = false;
@@ -537,6 +1432,7 @@ void common_instruction_handler_dispatcher(vector<string> source, int &loc, int
         code line has +, -, * and is an arithmetic instruction
     */
     else if (is_arithmetic_line(source[loc])) {
+        ScopedTimer timer(stats, stats.handlers, "arithmetic");
         f1.assembly_instructions.push_back("#" + source[loc]);
         arithmetic_handler(source[loc], f1);
         loc++;
@@ -545,6 +1441,7 @@ void common_instruction_handler_dispatcher(vector<string> source, int &loc, int
         code line is an assignment instruction
     */
     else if (is_substr(source[loc], " = ")) {
+        ScopedTimer timer(stats, stats.handlers, "assignment");
         f1.assembly_instructions.push_back("#" + source[loc]);
         assignment_handler(source[loc], f1);
         loc++;
@@ -563,7 +1460,8 @@ void common_instruction_handler_dispatcher(vector<string> source, int &loc, int
     otherwise it is a primative variable declaration.
 */
 void variable_offset_allocation(vector<string> &source, int &loc, Function &f1, int &addr_offset) {
-    const string var_type = "int";
+    const string var_type = source[loc].substr(0, source[loc].find(" "));
+    const int var_size = type_size(var_type);
 
     if (is_array_accessor(split(source[loc], " = ")[0])) {
         auto tokens = split(source[loc], " = ");
@@ -571,27 +1469,33 @@ void variable_offset_allocation(vector<string> &source, int &loc, Function &f1,
         remove_ending_semicolon_vector(tokens);
 
         string dest = split(tokens[0], " ")[1];
-        string src = tokens[1];
 
-        auto temp = split(dest, "\\[");  // [ needs to be escaped with \ and then that \ needs to be escaped for C++ complier
-        string array_name = temp[0];
+        string array_name;
+        int columns;
+        int array_size = array_declarator(dest, array_name, columns);
 
-        temp[1].pop_back();
-        int array_size = stoi(temp[1]);
+        // "int arr[100];" leaves the elements uninitialized, a short initializer list zero fills the rest
+        bool initialized = tokens.size() > 1;
+        vector<string> array_values;
+        if (initialized) {
+            array_values = array_initializer(tokens[1], columns);
+        }
 
-        auto array_values_str = tokens[1];
-        auto array_values = split(array_values_str.substr(1, array_values_str.size() - 2), ", ");  // removes { and } and splits into int values
+        // elements are laid out upwards from arr[0] so arr[i] is at arr[0] + i * size
+        int arr_zero_offset = allocate_stack_slot(addr_offset, array_size * var_size, var_size);
 
-        for (int i = array_size - 1; i >= 0; --i) {
-            int val = stoi(array_values[i]);
+        for (int i = 0; i < array_size; ++i) {
+            string val = i < (int)array_values.size() ? array_values[i] : "0";
             string name = array_name + "[" + to_string(i) + "]";
-            int arr_addr_offset = addr_offset - (i * 4);
+            int arr_addr_offset = arr_zero_offset + i * var_size;
 
-            Variable var(name, var_type, val, arr_addr_offset);
-            f1.variables.insert(pair<string, Variable>(name, var));
-            f1.assembly_instructions.push_back("movl $" + array_values[i] + ", " + to_string(arr_addr_offset) + "(%rbp)");
+            Variable var(name, var_type, literal_value(val), arr_addr_offset);
+            var.columns = columns;
+            declare_variable(var, f1);
+            if (initialized) {
+                store_immedaite_val(name, val, f1);
+            }
         }
-        addr_offset -= (array_size * 4);
     } else {
         /*
             int a = 0; b = 1; c = 2; d = 3;
@@ -606,114 +1510,519 @@ void variable_offset_allocation(vector<string> &source, int &loc, Function &f1,
             remove_ending_semicolon_vector(tokens);
 
             string var_name = tokens[0];
+            if (tokens.size() == 1) {
+                // "int a;" only needs a slot
+                declare_variable(Variable(var_name, var_type, 0, allocate_stack_slot(addr_offset, var_size, var_size)), f1);
+                continue;
+            }
             string var_value_str = tokens[1];
-            int var_value = is_int(var_value_str) ? stoi(var_value_str) : 0;
-
-            string src = "%eax";
+            long var_value = is_immediate(var_value_str) ? literal_value(var_value_str) : 0;
+            bool is_long = false;
 
-            if (is_arithmetic_line(var_value_str)) {
+            if (is_arithmetic_line(var_value_str) && !is_immediate(var_value_str)) {
                 /*
                     var = arithmetic
                 */
-                arithmetic_handler(s, f1, false);
-            } else if (is_array_accessor(var_value_str)) {
+                is_long = arithmetic_handler(s, f1, false);
+            } else if (!is_immediate(var_value_str) && is_long_operand(var_value_str, f1)) {
                 /*
-                    var = arr[i], var = arr[0]
+                    var = l, all 64 bits of a long
                 */
-                move_arr_val_into_register(var_value_str, "%eax", f1);
-            } else if (is_int(var_value_str)) {
+                move_long_operand_into_register(var_value_str, "%rax", f1);
+                is_long = true;
+            } else if (!is_immediate(var_value_str)) {
                 /*
-                    var = num
+                    var = arr[i], var = arr[0], var = var
                 */
-                src = "$" + var_value_str;
-            } else {
+                move_operand_into_register(var_value_str, "%eax", f1);
+            }
+
+            // the slot is handed out after the initializer so it can still see an outer variable of the same name
+            Variable var(var_name, var_type, var_value, allocate_stack_slot(addr_offset, var_size, var_size));
+            declare_variable(var, f1);
+
+            if (is_immediate(var_value_str)) {
                 /*
-                    var = var
+                    var = num
                 */
-                move_var_val_into_register(var_value_str, "%eax", f1);
+                store_immedaite_val(var_name, var_value_str, f1);
+            } else {
+                store_reg_val(var_name, "%eax", f1, is_long);
             }
+        }
+    }
+}
 
-            f1.assembly_instructions.push_back("movl " + src + ", " + to_string(addr_offset) + "(%rbp)");
+/*
+    Handle if statements
+*/
+void IF_statement_handler(vector<string> &source, int &loc, int max_len, Function &f1, int &addr_offset) {
+    string comparison = substr_between_indices(source[loc], source[loc].find("(") + 1, source[loc].rfind(")"));
+    string end_label = ".L" + to_string(label_num++);
+    string if_line = source[loc];
+
+    // a body the profile says runs less often than it is skipped is jumped to instead, so the
+    // skip falls through; it is moved out of line once the function is done
+    long entered = profile_count(f1, "if", if_line);
+    long skipped = profile_count(f1, "skipped", if_line);
+    bool cold = pass_enabled("hot-cold") && entered >= 0 && skipped >= 0 && (entered == 0 || entered < skipped);
+    ColdBlock block;
+    if (cold) {
+        string body_label = ".L" + to_string(label_num++);
+        comparison_handler(comparison, f1, body_label, true);
+        block.begin = f1.assembly_instructions.size();
+        block.never_run = entered == 0;
+        f1.assembly_instructions.push_back(body_label + ":");
+    } else {
+        comparison_handler(comparison, f1, end_label, false);
+    }
+    profile_counter(f1, "if", if_line);
+    loc++;
+
+    open_block_scope(f1, addr_offset);
+    while (source[loc] != "}") {
+        common_instruction_handler_dispatcher(source, loc, max_len, f1, addr_offset);
+    }
+    close_block_scope(f1, addr_offset);
+
+    if (cold) {
+        f1.assembly_instructions.push_back("jmp " + end_label);
+        block.end = f1.assembly_instructions.size();
+        f1.cold_blocks.push_back(block);
+    }
+    f1.assembly_instructions.push_back("# }");
+    f1.assembly_instructions.push_back(end_label + ":");
+    // runs after the body and when it was skipped, so "endif" - "if" is how often the body was skipped
+    profile_counter(f1, "endif", if_line);
+    loc++;
+}
+
+/*
+    Helper function to get the constant step of a for loop's "i++", "i--" or "i = i + 2"
+    Returns 0 for any other increment
+*/
+long loop_step(const string name, const string inc) {
+    if (inc == name + "++" || inc == "++" + name) {
+        return 1;
+    } else if (inc == name + "--" || inc == "--" + name) {
+        return -1;
+    }
+    vector<string> parts = split(inc, " ");
+    if (parts.size() == 5 && parts[0] == name && parts[1] == "=" && parts[2] == name && is_immediate(parts[4])) {
+        return parts[3] == "+" ? stol(parts[4]) : parts[3] == "-" ? -stol(parts[4]) : 0;
+    }
+    return 0;
+}
+
+/*
+    Helper function to check that the body of the for loop at source[loc] leaves its loop variable
+    alone and has no return, so the variable's first and last values tell how often the body ran
+*/
+bool is_plain_counting_loop(vector<string> &source, int loc, int max_len, const string name) {
+    int depth = 0;
+    for (int i = loc + 1; i < max_len; ++i) {
+        const string &line = source[i];
+        if (line == "}" || (line.find("}") == 0 && line.back() != '{')) {
+            if (depth == 0) {
+                return true;
+            }
+            depth--;
+        } else if (!line.empty() && line.back() == '{' && line.find("}") != 0) {
+            depth++;
+        }
+
+        bool writes = line.find(name + " =") == 0 || line.find(name + "++") == 0 || line.find(name + "--") == 0 ||
+                      line.find("++" + name) == 0 || line.find("--" + name) == 0;
+        bool redeclares = is_declaration(line) && (is_substr(line, " " + name + " ") || is_substr(line, " " + name + ";") ||
+                                                   is_substr(line, " " + name + ","));
+        if (writes || redeclares || line.find("return") == 0) {
+            return false;
+        }
+    }
+    return false;
+}
+
+/*
+    Helper function to work out how often a for loop runs from its "int i = 0", "i < 100" and "i++"
+    Returns -1 unless the start, bound and step are all constants
+*/
+long constant_trip_count(const vector<string> &tokens) {
+    if (tokens.size() != 3) {
+        return -1;
+    }
+    vector<string> init = split(tokens[0], " = ");
+    vector<string> cond = split(tokens[1], " ");
+    if (init.size() != 2 || cond.size() != 3 || !is_immediate(init[1]) || !is_immediate(cond[2])) {
+        return -1;
+    }
+    string name = init[0].substr(init[0].rfind(" ") + 1);
+    if (cond[0] != name) {
+        return -1;
+    }
+
+    long step = loop_step(name, tokens[2]);
+    long start = stol(init[1]);
+    long bound = stol(cond[2]);
+    string comp = cond[1];
+    if (comp == "<=" || comp == ">=") {
+        bound += step > 0 ? 1 : -1;
+        comp = comp.substr(0, 1);
+    }
+    if ((step > 0 && comp == "<") || (step < 0 && comp == ">")) {
+        long distance = bound - start;
+        return distance * step <= 0 ? 0 : (distance + step - (step > 0 ? 1 : -1)) / step;
+    }
+    if (step != 0 && comp == "!=" && (bound - start) % step == 0 && (bound - start) / step >= 0) {
+        return (bound - start) / step;
+    }
+    return -1;
+}
+
+/*
+    Helper function to check that the body of the for loop at source[loc] is straight line code, with
+    no blocks, declarations, breaks or returns, so it can be translated more than once
+*/
+bool is_straight_line_body(vector<string> &source, int loc, int max_len) {
+    for (int i = loc + 1; i < max_len; ++i) {
+        const string &line = source[i];
+        if (line == "}") {
+            return true;
+        }
+        if (line.find("{") != string::npos || line.find("}") != string::npos || is_declaration(line) ||
+            line.find("break") == 0 || line.find("return") == 0 || line.find("case ") == 0 || line.find("default") == 0) {
+            return false;
+        }
+    }
+    return false;
+}
+
+/*
+    Handle for statements
+*/
+void FOR_statement_handler(vector<string> &source, int &loc, int max_len, Function &f1, int &addr_offset) {
+    // at -O1 or for a vector target, a loop that only fills or copies an array is replaced whole
+    VectorLoop fill_copy;
+    if (pass_enabled("fill-copy", target_isa) && match_fill_copy_loop(source, loc, max_len, fill_copy)) {
+        ScopedTimer timer(stats, stats.passes, "fill-copy");
+        if (fill_copy_loop_handler(fill_copy, target_isa ? *target_isa : vector_isas[0], f1)) {
+            f1.assembly_instructions.push_back("# }");
+            loc += 3;
+            return;
+        }
+    }
+
+    string loop_label = ".L" + to_string(label_num++);
+    string end_label = ".L" + to_string(label_num++);
+
+    string line = source[loc];
+    line = substr_between_indices(line, line.find("(") + 1, line.rfind(")"));
+    vector<string> tokens = split(line, "; ");
+
+    // the loop variable and everything declared in the body live in the loop's scope
+    open_block_scope(f1, addr_offset);
+
+    f1.break_labels.push_back("");
+
+    // "loop" / "for" is the average trip count
+    profile_counter(f1, "for", source[loc]);
+
+    vector<string> temp;
+    temp.push_back(tokens[0]);
+    int loc_temp = 0;
+    variable_offset_allocation(temp, loc_temp, f1, addr_offset);
+
+    /*
+        A counter bumped on every iteration costs as much as a small loop body, so when an int loop
+        variable steps by 1 and nothing else writes it, the iterations are counted as its last value
+        minus its first: subtracted once here, added once after the loop, plus 1 for each break.
+    */
+    string var_name = tokens[0].substr(0, tokens[0].find(" = "));
+    var_name = var_name.substr(var_name.rfind(" ") + 1);
+    long step = loop_step(var_name, tokens[2]);
+    string iteration_counter = "";
+    string var_operand = "";
+    if (!profile_path.empty() && (step == 1 || step == -1) && lookup_variable(var_name, f1).type == "int" &&
+        is_plain_counting_loop(source, loc, max_len, var_name)) {
+        iteration_counter = profile_site(f1, "loop", source[loc]);
+        var_operand = var_location(var_name, f1);
+        f1.assembly_instructions.push_back("movslq " + var_operand + ", %rax");
+        f1.assembly_instructions.push_back((step == 1 ? "subq" : "addq") + string(" %rax, ") + iteration_counter);
+    }
+    f1.break_counters.push_back(iteration_counter);
+
+    /*
+        For a vector target, an element-wise loop does most of its iterations a register at a time
+        first, and so does a reduction loop at -O1 and an element-wise one at -O2, with sse2 when
+        there is no target
+    */
+    VectorLoop vector_loop;
+    Reduction reduction;
+    const VectorIsa &isa = target_isa ? *target_isa : vector_isas[0];
+    bool vectorized = false;
+    if (pass_enabled("vectorize", target_isa) && match_vector_loop(source, loc, max_len, vector_loop)) {
+        ScopedTimer timer(stats, stats.passes, "vectorize");
+        vectorized = vector_loop_handler(vector_loop, isa, f1);
+    } else if (pass_enabled("reduce", target_isa) && match_reduction_loop(source, loc, max_len, reduction)) {
+        ScopedTimer timer(stats, stats.passes, "reduce");
+        vectorized = reduction_loop_handler(reduction, isa, f1);
+    }
+    f1.assembly_instructions.push_back("jmp " + end_label);
 
-            Variable var(var_name, var_type, var_value, addr_offset);
-            f1.variables.insert(pair<string, Variable>(var_name, var));
+    LoopInfo loop;
+    loop.header = source[loc];
+    loop.trip_count = constant_trip_count(tokens);
 
-            addr_offset -= 4;
+    /*
+        With a profile, its average trip count stands in for one that isn't constant, and a hot loop
+        with a straight line body gets the body repeated; at -O2 so does one with a constant trip
+        count that didn't just leave its remainder to this loop. Every copy but the last steps and
+        tests the loop variable itself and leaves when the test fails, so any trip count works, and
+        there is one taken jump per 2 or 4 iterations instead of one per iteration.
+    */
+    int unroll = 1;
+    string unroll_pass = "";
+    long runs = profile_count(f1, "for", loop.header);
+    long iterations = profile_count(f1, "loop", loop.header);
+    if (runs > 0 && iterations >= 0) {
+        long trips = iterations / runs;
+        if (loop.trip_count < 0) {
+            loop.trip_count = trips;
         }
+        if (pass_enabled("unroll") && profile_path.empty() && iterations >= unroll_min_iterations &&
+            trips >= unroll_min_trips && is_straight_line_body(source, loc, max_len)) {
+            unroll_pass = "unroll";
+        }
+    } else if (pass_enabled("unroll-const") && profile_path.empty() && !vectorized && loop.trip_count >= unroll_min_trips &&
+               is_straight_line_body(source, loc, max_len)) {
+        unroll_pass = "unroll-const";
+    }
+    if (!unroll_pass.empty()) {
+        unroll = loop.trip_count >= 4 * unroll_min_trips ? 4 : 2;
+        loop.trip_count = (loop.trip_count + unroll - 1) / unroll;
+    }
+    string exit_label = unroll > 1 ? ".L" + to_string(label_num++) : "";
+
+    loop.begin = f1.assembly_instructions.size();
+    f1.assembly_instructions.push_back(loop_label + ":");
+    if (iteration_counter.empty()) {
+        profile_counter(f1, "loop", loop.header);
     }
-}
 
-/*
-    Handle if statements
-*/
-void IF_statement_handler(vector<string> &source, int &loc, int max_len, Function &f1, int &addr_offset) {
-    string comparison = substr_between_indices(source[loc], source[loc].find("(") + 1, source[loc].find(")"));
-    comparison_handler(comparison, f1);
     loc++;
+    int body_loc = loc;
+    for (int copy = 0; copy < unroll; ++copy) {
+        // the copies after the first are the unroll pass's work
+        unique_ptr<ScopedTimer> timer(copy > 0 ? new ScopedTimer(stats, stats.passes, unroll_pass) : nullptr);
+        loc = body_loc;
+        while (source[loc] != "}") {
+            common_instruction_handler_dispatcher(source, loc, max_len, f1, addr_offset);
+        }
+        if (copy + 1 < unroll) {
+            string inc = tokens[2];
+            string test = tokens[1];
+            arithmetic_handler(inc, f1);
+            comparison_handler(test, f1, exit_label, false);
+        }
+    }
 
-    while (source[loc] != "}") {
-        common_instruction_handler_dispatcher(source, loc, max_len, f1, addr_offset);
+    loop.latch = f1.assembly_instructions.size();
+    arithmetic_handler(tokens[2], f1);
+    f1.assembly_instructions.push_back(end_label + ":");
+
+    comparison_handler(tokens[1], f1, loop_label, true);
+    loop.end = f1.assembly_instructions.size();
+    f1.loops.push_back(loop);
+    close_block_scope(f1, addr_offset);
+    if (unroll > 1) {
+        f1.assembly_instructions.push_back(exit_label + ":");
+    }
+
+    // only loops containing a break need a label after them
+    if (!f1.break_labels.back().empty()) {
+        f1.assembly_instructions.push_back(f1.break_labels.back() + ":");
     }
+    f1.break_labels.pop_back();
+    if (!iteration_counter.empty()) {
+        f1.assembly_instructions.push_back("movslq " + var_operand + ", %rax");
+        f1.assembly_instructions.push_back((step == 1 ? "addq" : "subq") + string(" %rax, ") + iteration_counter);
+    }
+    f1.break_counters.pop_back();
 
     f1.assembly_instructions.push_back("# }");
-    f1.assembly_instructions.push_back(".L" + to_string(label_num) + ":");
-    label_num++;
     loc++;
 }
 
 /*
-    Handle for statements
+    Helper function to push a compare tree for the sorted case values cases[lo..hi]
+    Selector is in %eax, every comparison halves the remaining cases
 */
-void FOR_statement_handler(vector<string> &source, int &loc, int max_len, Function &f1, int &addr_offset) {
-    string loop_label = ".L" + to_string(label_num++);
+void switch_compare_tree(vector<pair<int, string>> &cases, int lo, int hi, string default_label, Function &f1) {
+    if (hi - lo + 1 <= 3) {
+        // a few linear compares are cheaper than another level of the tree
+        for (int i = lo; i <= hi; ++i) {
+            f1.assembly_instructions.push_back("cmpl $" + to_string(cases[i].first) + ", %eax");
+            f1.assembly_instructions.push_back("je " + cases[i].second);
+        }
+        f1.assembly_instructions.push_back("jmp " + default_label);
+        return;
+    }
+
+    int mid = (lo + hi) / 2;
+    string upper_label = ".L" + to_string(label_num++);
+
+    f1.assembly_instructions.push_back("cmpl $" + to_string(cases[mid].first) + ", %eax");
+    f1.assembly_instructions.push_back("je " + cases[mid].second);
+    f1.assembly_instructions.push_back("jg " + upper_label);
+    switch_compare_tree(cases, lo, mid - 1, default_label, f1);
+    f1.assembly_instructions.push_back(upper_label + ":");
+    switch_compare_tree(cases, mid + 1, hi, default_label, f1);
+}
+
+/*
+    Handle switch statements
+    Each "case N:" and "default:" line becomes a label. Dense case sets jump through a
+    table of those labels in .rodata, sparse ones go through a balanced compare tree.
+*/
+void SWITCH_statement_handler(vector<string> &source, int &loc, int max_len, Function &f1, int &addr_offset) {
+    string selector = substr_between_indices(source[loc], source[loc].find("(") + 1, source[loc].find(")"));
+    trim(selector);
+
     string end_label = ".L" + to_string(label_num++);
+    string default_label = end_label;
+
+    // find this switch's case lines, skipping the ones of nested switches
+    vector<pair<int, string>> cases;
+    map<int, string> case_line_labels;
+    int depth = 0;
+    for (int i = loc + 1; i < max_len; ++i) {
+        string line = source[i];
+        if (line == "}") {
+            if (depth == 0) {
+                break;
+            }
+            depth--;
+        } else if (!line.empty() && line.back() == '{') {
+            depth++;
+        } else if (depth == 0 && line.find("case ") == 0) {
+            string label = ".L" + to_string(label_num++);
+            string value = substr_between_indices(line, 5, line.find(":"));
+            trim(value);
+
+            cases.push_back(pair<int, string>(stoi(value), label));
+            case_line_labels[i] = label;
+        } else if (depth == 0 && line == "default:") {
+            default_label = ".L" + to_string(label_num++);
+            case_line_labels[i] = default_label;
+        }
+    }
+    sort(cases.begin(), cases.end());
 
-    string line = source[loc];
-    line = substr_between_indices(line, line.find("(") + 1, line.find(")"));
-    vector<string> tokens = split(line, "; ");
+    move_operand_into_register(selector, "%eax", f1);
 
-    vector<string> temp;
-    temp.push_back(tokens[0]);
-    int loc_temp = 0;
-    variable_offset_allocation(temp, loc_temp, f1, addr_offset);
-    f1.assembly_instructions.push_back("jmp " + end_label);
-    f1.assembly_instructions.push_back(loop_label);
+    if (cases.empty()) {
+        f1.assembly_instructions.push_back("jmp " + default_label);
+    } else {
+        long long min_val = cases.front().first;
+        long long range = (long long)cases.back().first - min_val + 1;
+
+        if ((int)cases.size() >= switch_table_min_cases && range <= switch_table_max_range &&
+            cases.size() >= switch_density_threshold * range) {
+            /*
+                subl    $min, %eax
+                cmpl    $(max - min), %eax
+                ja      default
+                jmp     *.Ltable(,%rax,8)
+                subl zero extends into %rax, the unsigned ja also catches selectors below min
+            */
+            string table_label = ".L" + to_string(label_num++);
+
+            if (min_val != 0) {
+                f1.assembly_instructions.push_back("subl $" + to_string(min_val) + ", %eax");
+            }
+            f1.assembly_instructions.push_back("cmpl $" + to_string(range - 1) + ", %eax");
+            f1.assembly_instructions.push_back("ja " + default_label);
+            f1.assembly_instructions.push_back("jmp *" + table_label + "(,%rax,8)");
+
+            f1.assembly_instructions.push_back(".section .rodata");
+            f1.assembly_instructions.push_back(".align 8");
+            f1.assembly_instructions.push_back(table_label + ":");
+            size_t next_case = 0;
+            for (long long v = min_val; v < min_val + range; ++v) {
+                if (cases[next_case].first == v) {
+                    f1.assembly_instructions.push_back(".quad " + cases[next_case].second);
+                    next_case++;
+                } else {
+                    f1.assembly_instructions.push_back(".quad " + default_label);
+                }
+            }
+            f1.assembly_instructions.push_back(".text");
+        } else {
+            switch_compare_tree(cases, 0, cases.size() - 1, default_label, f1);
+        }
+    }
 
     loc++;
+    f1.break_labels.push_back(end_label);
+    f1.break_counters.push_back("");
+    open_block_scope(f1, addr_offset);
+
     while (source[loc] != "}") {
-        common_instruction_handler_dispatcher(source, loc, max_len, f1, addr_offset);
+        if (case_line_labels.count(loc) > 0) {
+            f1.assembly_instructions.push_back("#" + source[loc]);
+            f1.assembly_instructions.push_back(case_line_labels.at(loc) + ":");
+            profile_counter(f1, "case", source[loc]);
+            loc++;
+        } else {
+            common_instruction_handler_dispatcher(source, loc, max_len, f1, addr_offset);
+        }
     }
 
-    arithmetic_handler(tokens[2], f1);
-    f1.assembly_instructions.push_back(end_label);
-
-    // jmp instruction from comparison jumps to the wrong place
-    // need to change it to loop_label
-    comparison_handler(tokens[1], f1, false);
-    f1.assembly_instructions.back().replace(f1.assembly_instructions.back().find("."), 3, loop_label);
+    close_block_scope(f1, addr_offset);
+    f1.break_labels.pop_back();
+    f1.break_counters.pop_back();
 
     f1.assembly_instructions.push_back("# }");
+    f1.assembly_instructions.push_back(end_label + ":");
     loc++;
 }
 
+/*
+    Handle break statements
+    The label of a for loop is only made when one of its breaks needs it
+*/
+void break_handler(Function &f1) {
+    string &target = f1.break_labels.back();
+    if (target.empty()) {
+        target = ".L" + to_string(label_num++);
+    }
+    if (!f1.break_counters.back().empty()) {
+        // the loop variable hasn't stepped past this iteration yet
+        f1.assembly_instructions.push_back("addq $1, " + f1.break_counters.back());
+    }
+    f1.assembly_instructions.push_back("jmp " + target);
+}
+
 /*
     Handle return statements
 */
 void return_handler(string source, Function &f1) {
     // If we return something then we have to move it to %eax
-    if (f1.function_name == "main")
+    string rvalue = source[6] != ';' ? source.substr(7, source.size() - 8) : "";
+    if (f1.function_name == "main" && !is_immediate(rvalue))
         f1.assembly_instructions.push_back("movl $0, %eax");
 
-    if (source[6] != ';') {
-        string rvalue = source.substr(7);
-        rvalue.pop_back();
-
-        if (f1.variables.count(rvalue) > 0) {
-            Variable a = f1.variables.at(rvalue);
-            if (f1.variables.at(rvalue).type == "int")
-                f1.assembly_instructions.push_back(add_mov_instruction(to_string(a.addr_offset) + "(%rbp)", "%eax", 32));
+    if (!rvalue.empty()) {
+        if (f1.return_type == "long" && (is_immediate(rvalue) || has_variable(rvalue, f1))) {
+            // the caller reads all of %rax
+            move_long_operand_into_register(rvalue, "%rax", f1);
+        } else if (is_immediate(rvalue)) {
+            move_immediate_val_into_register(rvalue, "%eax", f1);
+        } else if (has_variable(rvalue, f1)) {
+            Variable a = lookup_variable(rvalue, f1);
+            if (type_size(a.type) <= 4)
+                f1.assembly_instructions.push_back(load_instruction(a.type) + " " + variable_operand(a) + ", %eax");
             else
-                f1.assembly_instructions.push_back(add_mov_instruction(to_string(a.addr_offset) + "(%rbp)", "%rax", 64));
+                f1.assembly_instructions.push_back(add_mov_instruction(variable_operand(a), "%rax", 64));
         }
     }
 
@@ -724,279 +2033,113 @@ void return_handler(string source, Function &f1) {
     f1.assembly_instructions.push_back("ret");
 }
 
+/*
+    Helper function to load one call argument into the register it is passed in
+    Arrays are passed as the address of element 0, array elements go through %eax
+*/
+void load_argument(const string arg, int reg_idx, Function &f1) {
+    string reg32 = reg_idx < 6 ? "%" + register_for_argument_32[reg_idx] : "%eax";
+    string reg64 = reg_idx < 6 ? "%" + register_for_argument_64[reg_idx] : "%rax";
+
+    if (is_immediate(arg) && !fits_int(arg)) {
+        move_long_operand_into_register(arg, reg64, f1);
+    } else if (is_immediate(arg)) {
+        move_immediate_val_into_register(arg, reg32, f1);
+    } else if (has_variable(arg, f1)) {
+        Variable &a = lookup_variable(arg, f1);
+        if (type_size(a.type) <= 4) {
+            f1.assembly_instructions.push_back(load_instruction(a.type) + " " + variable_operand(a) + ", " + reg32);
+        } else {
+            f1.assembly_instructions.push_back(add_mov_instruction(variable_operand(a), reg64, 64));
+        }
+    } else if (has_variable(arg + "[0]", f1)) {
+        Variable &a = lookup_variable(arg + "[0]", f1);
+        if (a.is_param) {
+            // already a pointer
+            f1.assembly_instructions.push_back("movq " + variable_operand(a) + ", " + reg64);
+        } else {
+            f1.assembly_instructions.push_back("leaq " + variable_operand(a) + ", " + reg64);
+        }
+    } else {
+        // a[i], loaded through %eax
+        move_operand_into_register(arg, "%eax", f1);
+        if (reg32 != "%eax") {
+            f1.assembly_instructions.push_back("movl %eax, " + reg32);
+        }
+    }
+}
+
 /*
     Handle other function call statements
+    The first 6 arguments go in registers, the rest are pushed right to left in 8 byte slots
+    with %rsp kept 16 byte aligned at the call
 */
 void function_call_handler(string input_str, Function &f1) {
-    bool assigned = false;
     string dest;
-    string firstparam;
-    string regex_str = " ";
-    auto tokens = split(input_str, regex_str);
+    string callstr = input_str;
     // Check if the line with the function call assigns the returned value
-    if (tokens[1] == "=") {
-        dest = tokens[0];
-        assigned = true;
-    }
-
-    // Get string containing just function call
-    std::string callstr = "";
-    int i = 0;
-    for (auto c : tokens) {
-        if (i < 2 && assigned) {
-            i++;
-            continue;
-        }
-        callstr += c;
+    if (is_substr(input_str, " = ")) {
+        dest = input_str.substr(0, input_str.find(" = "));
+        callstr = input_str.substr(input_str.find(" = ") + 3);
     }
 
     // Get name of function and parameter list
-    std::string name = callstr.substr(0, callstr.find("("));
-    std::string params = callstr.substr(callstr.find("(") + 1);
-    params.pop_back();
-    params.pop_back();  // Get rid of ");"
-
-    // Place first 6 parameters onto stack in reverse order
-    // The first parameter gets saved away in %eax so %rdi can be used to push
-    tokens = split(params, ",");
-    trim_vector(tokens);
-    vector<string> paramsv;
-    for (auto p : tokens) {
-        paramsv.push_back(p);
+    string name = callstr.substr(0, callstr.find("("));
+    string params = substr_between_indices(callstr, callstr.find("(") + 1, callstr.rfind(")"));
+    trim(name);
+    trim(params);
+
+    vector<string> args;
+    if (!params.empty()) {
+        args = split(params, ",");
+        trim_vector(args);
     }
 
-    vector<string> extraArgs;
-
-    i = -1;
-    for (auto p : tokens) {
-        /* If the argument is a non-array variable */
-        if (f1.variables.count(p) > 0) {
-            Variable a = f1.variables.at(p);
-            i++;
-            if (i > 0 && i < 6) {
-                if (a.type == "int")
-                    f1.assembly_instructions.push_back(add_mov_instruction(to_string(a.addr_offset) + "(%rbp)", "%" + register_for_argument_32[i], 32));
-                else
-                    f1.assembly_instructions.push_back(add_mov_instruction(to_string(a.addr_offset) + "(%rbp)", "%" + register_for_argument_64[i], 64));
-            } else if (i == 0) {  // We put the first param in %eax/%rax for now
-                if (a.type == "int") {
-                    f1.assembly_instructions.push_back(add_mov_instruction(to_string(a.addr_offset) + "(%rbp)", "%eax", 32));
-                    firstparam = "%eax";
-                } else {
-                    f1.assembly_instructions.push_back(add_mov_instruction(to_string(a.addr_offset) + "(%rbp)", "%rax", 64));
-                    firstparam = "%rax";
-                }
-            } else {
-                // After the first 6 arguments are placed in registers, the rest are put on the stack
-                // f1.assembly_instructions.push_back(add_mov_instruction(
-                //   to_string(a.addr_offset) + "(%rbp)", "%rdi", 64));
-                // f1.assembly_instructions.push_back("pushq %rdi");
-                extraArgs.insert(extraArgs.begin(), p);
-            }
-        }
-
-        /* If the argument is an array variable */
-        else if (f1.variables.count(p + "[0]") > 0) {  // f1.variables contains p[0]
-            Variable a = f1.variables.at(p + "[0]");
-            i++;
-            if (i > 0 && i < 6) {
-                f1.assembly_instructions.push_back("leaq " + to_string(a.addr_offset) + "(%rbp), " + "%" + register_for_argument_64[i]);
-            } else if (i == 0) {  // We put the first param address in %rax for now
-                f1.assembly_instructions.push_back("leaq " + to_string(a.addr_offset) + "(%rbp), " + "%rax");
-                firstparam = "%rax";
-            } else {
-                // After the first 6 arguments are placed in registers, the rest are put on the stack
-                // f1.assembly_instructions.push_back("leaq " + to_string(a.addr_offset) + "(%rbp), " + "%rdi");
-                // f1.assembly_instructions.push_back("pushq %rdi");
-                extraArgs.insert(extraArgs.begin(), p + "[0]");
-            }
-        }
-
-        /* If the argument is not a variable but a literal (only works for ints) */
-        else {
-            if (i > 0)
-                f1.assembly_instructions.push_back("movl $" + p + ", %" + register_for_argument_32[i]);
-            else if (i == 0) {
-                f1.assembly_instructions.push_back("movl $" + p + ", %eax");
-                firstparam = "%eax";
-            } else
-                // f1.assembly_instructions.push_back("pushq $" + p);
-                extraArgs.insert(extraArgs.begin(), "$" + p);
-        }
-    }
-
-    /* Second loop for extra arguments */
-    for (string ext : extraArgs) {
-        Variable a = f1.variables.at(ext);
-        if (f1.variables.count(ext) > 0) {
-            f1.assembly_instructions.push_back(add_mov_instruction(
-                to_string(a.addr_offset) + "(%rbp)", "%rdi", 64));
-            f1.assembly_instructions.push_back("pushq %rdi");
-        } else if (f1.variables.count(ext + "[0]") > 0) {
-            f1.assembly_instructions.push_back("leaq " + to_string(a.addr_offset) + "(%rbp), " + "%rdi");
-            f1.assembly_instructions.push_back("pushq %rdi");
-        } else {
-            f1.assembly_instructions.push_back("pushq $" + ext);
-        }
+    int stack_args = max(0, (int)args.size() - 6);
+    int stack_bytes = stack_args * 8;
+    if (stack_args % 2 == 1) {
+        f1.assembly_instructions.push_back("subq $8, %rsp");
+        stack_bytes += 8;
+    }
+    for (int i = args.size() - 1; i >= 6; --i) {
+        load_argument(args[i], i, f1);
+        f1.assembly_instructions.push_back("pushq %rax");
+    }
+    for (int i = 0; i < min(6, (int)args.size()); ++i) {
+        load_argument(args[i], i, f1);
     }
 
-    // Put the first parameter back into %edi or %rdi
-    if (firstparam == "%eax")
-        f1.assembly_instructions.push_back("movl %eax, %edi");
-    else
-        f1.assembly_instructions.push_back("movl %rax, %rdi");
-
-    // Call function
-    f1.assembly_instructions.push_back("call " + name);
+    if (dispatched_functions.count(name)) {
+        // straight to the variant once the first call resolved it
+        f1.assembly_instructions.push_back("call *" + name + ".dispatch(%rip)");
+    } else {
+        f1.assembly_instructions.push_back("call " + name);
+    }
 
-    // Move stack pointer
-    f1.assembly_instructions.push_back("addq $16, %rsp");
+    if (stack_bytes > 0) {
+        f1.assembly_instructions.push_back("addq $" + to_string(stack_bytes) + ", %rsp");
+    }
 
     // Assign returned value
-    store_reg_val(dest, "%eax", f1);
+    if (!dest.empty()) {
+        // a clone f.constprop.0 returns what f does
+        store_reg_val(dest, "%eax", f1, long_functions.count(name.substr(0, name.find('.'))) > 0);
+    }
 }
 
 /*
     Handle arithmetic statements
+    Operands are computed in 32 bits, or in 64 when one of them is a long, like C's usual arithmetic
+    conversions; returns if the result left in %eax/%rax is a long
 */
-void arithmetic_handler(string &s, Function &f1, bool store_result) {
-    if (is_substr(s, "++")) {
-        string var = substr_between_indices(s, 0, s.find("++"));
-        if (is_array_accessor_dynamic(var)) {
-            // a[i]++;
-            string arr_name = s.substr(0, s.find("["));
-            string arr_index = substr_between_indices(s, s.find("[") + 1, s.find("]"));
-            string arr_zero = arr_name + "[0]";
-
-            if (is_param_var(var, f1)) {
-                // param[i]++
-                move_param_arr_val_into_register(var, "%edx", f1);
-                f1.assembly_instructions.push_back("addl $1, %edx");
-                f1.assembly_instructions.push_back("movl %edx, (%rax)");
-            } else {
-                move_arr_val_into_register(var, "%eax", f1);
-                f1.assembly_instructions.push_back("leal 1(%rax), %edx");
-                f1.assembly_instructions.push_back("movl " + to_string(f1.variables.at(arr_index).addr_offset) + "(%rbp), %eax");
-                f1.assembly_instructions.push_back("cltq");
-
-                // movl    %edx, -16(%rbp,%rax,4)
-                // -16(%rbp)[4*%rax]
-                f1.assembly_instructions.push_back("movl %edx, " + to_string(f1.variables.at(arr_zero).addr_offset) + "(%rbp, %rax, 4)");
-            }
-        } else if (is_array_accessor(var)) {
-            // a[0]++;
-            string arr_name = s.substr(0, s.find("["));
-            string arr_index = substr_between_indices(s, s.find("[") + 1, s.find("]"));
-            string arr_addr = to_string(f1.variables.at(var).addr_offset);
-
-            if (is_param_var(var, f1)) {
-                if (arr_index == "0") {
-                    /*
-                        param[0]++
-
-                        movq    -40(%rbp), %rax
-                        movl    (%rax), %eax
-                        leal    1(%rax), %edx
-                        movq    -40(%rbp), %rax
-                        movl    %edx, (%rax)
-                    */
-                    f1.assembly_instructions.push_back("movq " + arr_addr + "(%rbp), %rax");
-                    f1.assembly_instructions.push_back("movl (%rax), %eax");
-                    f1.assembly_instructions.push_back("leal 1(%rax), %edx");
-                    f1.assembly_instructions.push_back("movq " + arr_addr + "(%rbp), %rax");
-                } else {
-                    /*
-                        param[2]++
-
-                        movq    -40(%rbp), %rax
-                        addq    $8, %rax
-                        movl    (%rax), %edx
-                        addl    $1, %edx
-                        movl    %edx, (%rax)
-                    */
-                    move_param_arr_val_into_register(var, "%edx", f1);
-                    f1.assembly_instructions.push_back("addl $1, %edx");
-                }
-
-                f1.assembly_instructions.push_back("movl %edx, (%rax)");
-            } else {
-                move_arr_val_into_register(var, "%eax", f1);
-                f1.assembly_instructions.push_back("addl $1, %eax");
-                store_reg_val(var, "%eax", f1);
-            }
-        } else {
-            // i++;
-            f1.assembly_instructions.push_back("addl $1, " + to_string(f1.variables.at(var).addr_offset) + "(%rbp");
-        }
-        store_result = false;
-    } else if (is_substr(s, "--")) {
-        string var = substr_between_indices(s, 0, s.find("--"));
-        if (is_array_accessor_dynamic(var)) {
-            // a[i]--;
-            if (is_param_var(var, f1)) {
-                // param[i]--
-                move_param_arr_val_into_register(var, "%edx", f1);
-                f1.assembly_instructions.push_back("subl $1, %edx");
-                f1.assembly_instructions.push_back("movl %edx, (%rax)");
-            } else {
-                string arr_name = s.substr(0, s.find("["));
-                string arr_index = substr_between_indices(s, s.find("[") + 1, s.find("]"));
-                string arr_zero = arr_name + "[0]";
-
-                move_arr_val_into_register(var, "%eax", f1);
-                f1.assembly_instructions.push_back("leal -1(%rax), %edx");
-                f1.assembly_instructions.push_back("movl " + to_string(f1.variables.at(arr_index).addr_offset) + "(%rbp), %eax");
-                f1.assembly_instructions.push_back("cltq");
-                // movl    %edx, -16(%rbp,%rax,4)
-                // -16(%rbp)[4*%rax]
-                f1.assembly_instructions.push_back("movl %edx, " + to_string(f1.variables.at(arr_zero).addr_offset) + "(%rbp, %rax, 4)");
-            }
-        } else if (is_array_accessor(var)) {
-            // a[0]--;
-            string arr_name = s.substr(0, s.find("["));
-            string arr_index = substr_between_indices(s, s.find("[") + 1, s.find("]"));
-            string arr_addr = to_string(f1.variables.at(var).addr_offset);
-
-            if (is_param_var(var, f1)) {
-                if (arr_index == "0") {
-                    /*
-                        param[0]--
-
-                        movq    -40(%rbp), %rax
-                        movl    (%rax), %eax
-                        leal    1(%rax), %edx
-                        movq    -40(%rbp), %rax
-                        movl    %edx, (%rax)
-                    */
-                    f1.assembly_instructions.push_back("movq " + arr_addr + "(%rbp), %rax");
-                    f1.assembly_instructions.push_back("movl (%rax), %eax");
-                    f1.assembly_instructions.push_back("leal -1(%rax), %edx");
-                    f1.assembly_instructions.push_back("movq " + arr_addr + "(%rbp), %rax");
-                } else {
-                    /*
-                        param[2]--
-
-                        movq    -40(%rbp), %rax
-                        addq    $8, %rax
-                        movl    (%rax), %edx
-                        addl    $1, %edx
-                        movl    %edx, (%rax)
-                    */
-                    move_param_arr_val_into_register(var, "%edx", f1);
-                    f1.assembly_instructions.push_back("subl $1, %edx");
-                }
-
-                f1.assembly_instructions.push_back("movl %edx, (%rax)");
-            } else {
-                move_arr_val_into_register(var, "%eax", f1);
-                f1.assembly_instructions.push_back("subl $1, %eax");
-                store_reg_val(var, "%eax", f1);
-            }
-        } else {
-            // i--;
-            f1.assembly_instructions.push_back("subl $1, " + to_string(f1.variables.at(var).addr_offset) + "(%rbp");
-        }
-        store_result = false;
+bool arithmetic_handler(string &s, Function &f1, bool store_result) {
+    bool is_long = false;
+    if (is_substr(s, "++") || is_substr(s, "--")) {
+        // i++, a[i]--, e[2]++: updated in place, "addl $1, -48(%rbp, %rcx, 4)"
+        bool increment = is_substr(s, "++");
+        string var = substr_between_indices(s, 0, s.find(increment ? "++" : "--"));
+        auto location = store_location(var, f1);
+        f1.assembly_instructions.push_back((increment ? "add" : "sub") + size_suffix(location.first) + " $1, " + location.second);
     } else {
         auto tokens = split(s, " = ");
         trim_vector(tokens);
@@ -1010,379 +2153,55 @@ void arithmetic_handler(string &s, Function &f1, bool store_result) {
         string op = arithmetic_tokens[1];
         string r_val = arithmetic_tokens[2];
 
-        if (is_param_var(l_val, f1) || is_param_var(r_val, f1)) {
-            /*
-                This doesn't deal with if the destination is a parameter value
-                It's different if the destination is e[>0] or e[var]
-            */
-            if (op == "+") {
-                if (is_array_accessor(l_val) || is_array_accessor(r_val)) {
-                    if (is_array_accessor(l_val) && is_array_accessor(r_val)) {
-                        // arr arr
-                        move_param_arr_val_into_register(l_val, "%edx", f1);
-                        move_param_arr_val_into_register(r_val, "%eax", f1);
-
-                        f1.assembly_instructions.push_back("addl %edx, %eax");
-                    } else if (is_array_accessor(l_val)) {
-                        if (is_int(r_val)) {
-                            // arr num
-                            move_param_arr_val_into_register(l_val, "%eax", f1);
-
-                            r_val = "$" + r_val;
-                        } else {
-                            // arr var
-                            move_param_arr_val_into_register(l_val, "%edx", f1);
-                            move_var_val_into_register(r_val, "%eax", f1);
-
-                            r_val = "%edx";
-                        }
-
-                        f1.assembly_instructions.push_back("addl " + r_val + ", %eax");
-                    } else if (is_array_accessor(r_val)) {
-                        if (is_int(l_val)) {
-                            // num arr
-                            move_param_arr_val_into_register(r_val, "%eax", f1);
-
-                            r_val = "$" + r_val;
-                        } else {
-                            // var arr
-                            move_param_arr_val_into_register(r_val, "%edx", f1);
-                            move_var_val_into_register(l_val, "%eax", f1);
-
-                            r_val = "%edx";
-                        }
-
-                        f1.assembly_instructions.push_back("addl " + r_val + ", %eax");
-                    }
-                } else if (is_int(l_val) || is_int(r_val)) {
-                    if (is_int(l_val) && is_int(r_val)) {
-                        /*
-                        Doesn't handle case of when both are immediates
-                    */
-                    } else if (is_int(l_val)) {
-                        // num + var
-                        move_var_val_into_register(r_val, "%eax", f1);
-
-                        f1.assembly_instructions.push_back("addl $" + l_val + ", %eax");
-                    } else if (is_int(r_val)) {
-                        // var + num
-                        move_var_val_into_register(l_val, "%eax", f1);
-
-                        f1.assembly_instructions.push_back("addl $" + r_val + ", %eax");
-                    }
-                } else {
-                    // both operands are varaiables(non-arrays)
-                    move_var_val_into_register(l_val, "%edx", f1);
-                    move_var_val_into_register(r_val, "%eax", f1);
-
-                    f1.assembly_instructions.push_back("addl %edx, %eax");
-                }
-            } else if (op == "-") {
-                if (is_array_accessor(l_val) || is_array_accessor(r_val)) {
-                    if (is_array_accessor(l_val) && is_array_accessor(r_val)) {
-                        // arr arr
-                        move_param_arr_val_into_register(l_val, "%eax", f1);
-                        move_param_arr_val_into_register(r_val, "%edx", f1);
-
-                        f1.assembly_instructions.push_back("subl %eax, %edx");
-                        f1.assembly_instructions.push_back("movl %edx, %eax");
-                    } else if (is_array_accessor(l_val)) {
-                        if (is_int(r_val)) {
-                            // arr num
-                            move_param_arr_val_into_register(l_val, "%eax", f1);
-
-                            r_val = "$" + r_val;
-                        } else {
-                            // arr var
-                            move_param_arr_val_into_register(l_val, "%eax", f1);
-
-                            r_val = to_string(f1.variables.at(r_val).addr_offset) + "(%rbp)";
-                        }
-
-                        f1.assembly_instructions.push_back("subl " + r_val + ", %eax");
-                    } else if (is_array_accessor(r_val)) {
-                        if (is_int(l_val)) {
-                            // num arr
-                            move_param_arr_val_into_register(r_val, "%eax", f1);
-                            move_immediate_val_into_register(l_val, "%edx", f1);
-                        } else {
-                            // var arr
-                            move_param_arr_val_into_register(r_val, "%eax", f1);
-                            move_var_val_into_register(l_val, "%edx", f1);
-                        }
-
-                        f1.assembly_instructions.push_back("subl %eax, %edx");
-                        f1.assembly_instructions.push_back("movl %edx, %eax");
-                    }
-                } else if (is_int(l_val) || is_int(r_val)) {
-                    if (is_int(l_val) && is_int(r_val)) {
-                        /*
-                        Doesn't handle case of when both are immediates
-                    */
-                    } else if (is_int(l_val)) {
-                        // num - var
-                        move_immediate_val_into_register(l_val, "%eax", f1);
-
-                        f1.assembly_instructions.push_back("subl " + to_string(f1.variables.at(r_val).addr_offset) + "(%rbp), %eax");
-                    } else if (is_int(r_val)) {
-                        // var - num
-                        move_var_val_into_register(l_val, "%eax", f1);
-
-                        f1.assembly_instructions.push_back("subl $" + r_val + ", %eax");
-                    }
-                } else {
-                    // both operands are varaiables(non-arrays)
-                    move_var_val_into_register(l_val, "%eax", f1);
-
-                    f1.assembly_instructions.push_back("subl " + to_string(f1.variables.at(r_val).addr_offset) + "(%rbp), %eax");
-                }
-            } else if (op == "*") {
-                if (is_array_accessor(l_val) || is_array_accessor(r_val)) {
-                    if (is_array_accessor(l_val) && is_array_accessor(r_val)) {
-                        // arr arr
-                        move_param_arr_val_into_register(l_val, "%edx", f1);
-                        move_param_arr_val_into_register(r_val, "%eax", f1);
-
-                        f1.assembly_instructions.push_back("imull %edx, %eax");
-                    } else if (is_array_accessor(l_val)) {
-                        if (is_int(r_val)) {
-                            // arr num
-                            move_param_arr_val_into_register(l_val, "%eax", f1);
-
-                            f1.assembly_instructions.push_back("imull $" + r_val + ", %eax, %eax");
-                        } else {
-                            // arr var
-                            move_param_arr_val_into_register(l_val, "%eax", f1);
-
-                            f1.assembly_instructions.push_back("imull " + to_string(f1.variables.at(r_val).addr_offset) + "(%rbp), %eax");
-                        }
-                    } else if (is_array_accessor(r_val)) {
-                        if (is_int(l_val)) {
-                            // num arr
-                            move_param_arr_val_into_register(r_val, "%eax", f1);
-
-                            f1.assembly_instructions.push_back("imull $" + l_val + ", %eax, %eax");
-                        } else {
-                            // var arr
-                            move_param_arr_val_into_register(r_val, "%eax", f1);
-
-                            f1.assembly_instructions.push_back("imull %edx, " + to_string(f1.variables.at(l_val).addr_offset) + "(%rbp)");
-                        }
-                    }
-                } else if (is_int(l_val) || is_int(r_val)) {
-                    if (is_int(l_val) && is_int(r_val)) {
-                        /*
-                        Doesn't handle case of when both are immediates
-                    */
-                    } else if (is_int(l_val)) {
-                        // num - var
-                        move_var_val_into_register(r_val, "%eax", f1);
-
-                        f1.assembly_instructions.push_back("imull $" + l_val + ", %eax, %eax");
-                    } else if (is_int(r_val)) {
-                        // var - num
-                        move_var_val_into_register(l_val, "%eax", f1);
-
-                        f1.assembly_instructions.push_back("imull $" + r_val + ", %eax, %eax");
-                    }
-                } else {
-                    // both operands are varaiables(non-arrays)
-                    move_var_val_into_register(l_val, "%eax", f1);
-
-                    f1.assembly_instructions.push_back("imull " + to_string(f1.variables.at(r_val).addr_offset) + "(%rbp), %eax");
-                }
+        is_long = is_long_operand(l_val, f1) || is_long_operand(r_val, f1);
+        if (is_immediate(l_val) && is_immediate(r_val)) {
+            // both immediates, fold at compile time, wrapping like the instructions would
+            long l = literal_value(l_val);
+            long r = literal_value(r_val);
+            unsigned long result = op == "+" ? (unsigned long)l + r : op == "-" ? (unsigned long)l - r : (unsigned long)l * r;
+            if (is_long) {
+                move_long_operand_into_register(to_string((long)result), "%rax", f1);
+            } else {
+                move_immediate_val_into_register(to_string((int)result), "%eax", f1);
+            }
+        } else if (is_long) {
+            // the same in 64 bits, "imulq $3, -16(%rbp), %rax"
+            if (op != "-" && is_immediate(l_val)) {
+                swap(l_val, r_val);
+            }
+            string instruction = op == "+" ? "addq" : op == "-" ? "subq" : "imulq";
+            if (op == "*" && is_immediate(r_val) && fits_int(r_val)) {
+                f1.assembly_instructions.push_back("imulq $" + r_val + ", " + long_operand(l_val, "%rax", f1) + ", %rax");
+            } else {
+                move_long_operand_into_register(l_val, "%rax", f1);
+                f1.assembly_instructions.push_back(instruction + " " + long_operand(r_val, "%rcx", f1) + ", %rax");
             }
         } else {
-            if (op == "+") {
-                if (is_array_accessor(l_val) || is_array_accessor(r_val)) {
-                    if (is_array_accessor(l_val) && is_array_accessor(r_val)) {
-                        // arr arr
-                        move_arr_val_into_register(l_val, "%edx", f1);
-                        move_arr_val_into_register(r_val, "%eax", f1);
-
-                        f1.assembly_instructions.push_back("addl %edx, %eax");
-                    } else if (is_array_accessor(l_val)) {
-                        if (is_int(r_val)) {
-                            // arr num
-                            move_arr_val_into_register(l_val, "%eax", f1);
-
-                            r_val = "$" + r_val;
-                        } else {
-                            // arr var
-                            move_arr_val_into_register(l_val, "%edx", f1);
-                            move_var_val_into_register(r_val, "%eax", f1);
-
-                            r_val = "%edx";
-                        }
-
-                        f1.assembly_instructions.push_back("addl " + r_val + ", %eax");
-                    } else if (is_array_accessor(r_val)) {
-                        if (is_int(l_val)) {
-                            // num arr
-                            move_arr_val_into_register(r_val, "%eax", f1);
-
-                            r_val = "$" + r_val;
-                        } else {
-                            // var arr
-                            move_arr_val_into_register(r_val, "%edx", f1);
-                            move_var_val_into_register(l_val, "%eax", f1);
-
-                            r_val = "%edx";
-                        }
-
-                        f1.assembly_instructions.push_back("addl " + r_val + ", %eax");
-                    }
-                } else if (is_int(l_val) || is_int(r_val)) {
-                    if (is_int(l_val) && is_int(r_val)) {
-                        /*
-                        Doesn't handle case of when both are immediates
-                    */
-                    } else if (is_int(l_val)) {
-                        // num + var
-                        move_var_val_into_register(r_val, "%eax", f1);
-
-                        f1.assembly_instructions.push_back("addl $" + l_val + ", %eax");
-                    } else if (is_int(r_val)) {
-                        // var + num
-                        move_var_val_into_register(l_val, "%eax", f1);
-
-                        f1.assembly_instructions.push_back("addl $" + r_val + ", %eax");
-                    }
-                } else {
-                    // both operands are varaiables(non-arrays)
-                    move_var_val_into_register(l_val, "%edx", f1);
-                    move_var_val_into_register(r_val, "%eax", f1);
-
-                    f1.assembly_instructions.push_back("addl %edx, %eax");
-                }
-            } else if (op == "-") {
-                if (is_array_accessor(l_val) || is_array_accessor(r_val)) {
-                    if (is_array_accessor(l_val) && is_array_accessor(r_val)) {
-                        // arr arr
-                        move_arr_val_into_register(l_val, "%eax", f1);
-                        move_arr_val_into_register(r_val, "%edx", f1);
-
-                        f1.assembly_instructions.push_back("subl %eax, %edx");
-                        f1.assembly_instructions.push_back("movl %edx, %eax");
-                    } else if (is_array_accessor(l_val)) {
-                        if (is_int(r_val)) {
-                            // arr num
-                            move_arr_val_into_register(l_val, "%eax", f1);
-
-                            r_val = "$" + r_val;
-                        } else {
-                            // arr var
-                            move_arr_val_into_register(l_val, "%eax", f1);
-
-                            r_val = to_string(f1.variables.at(r_val).addr_offset) + "(%rbp)";
-                        }
-
-                        f1.assembly_instructions.push_back("subl " + r_val + ", %eax");
-                    } else if (is_array_accessor(r_val)) {
-                        if (is_int(l_val)) {
-                            // num arr
-                            move_arr_val_into_register(r_val, "%eax", f1);
-                            move_immediate_val_into_register(l_val, "%edx", f1);
-                        } else {
-                            // var arr
-                            move_arr_val_into_register(r_val, "%eax", f1);
-                            move_var_val_into_register(l_val, "%edx", f1);
-                        }
-
-                        f1.assembly_instructions.push_back("subl %eax, %edx");
-                        f1.assembly_instructions.push_back("movl %edx, %eax");
-                    }
-                } else if (is_int(l_val) || is_int(r_val)) {
-                    if (is_int(l_val) && is_int(r_val)) {
-                        /*
-                        Doesn't handle case of when both are immediates
-                    */
-                    } else if (is_int(l_val)) {
-                        // num - var
-                        move_immediate_val_into_register(l_val, "%eax", f1);
-
-                        f1.assembly_instructions.push_back("subl " + to_string(f1.variables.at(r_val).addr_offset) + "(%rbp), %eax");
-                    } else if (is_int(r_val)) {
-                        // var - num
-                        move_var_val_into_register(l_val, "%eax", f1);
-
-                        f1.assembly_instructions.push_back("subl $" + r_val + ", %eax");
-                    }
-                } else {
-                    // both operands are varaiables(non-arrays)
-                    move_var_val_into_register(l_val, "%eax", f1);
-
-                    f1.assembly_instructions.push_back("subl " + to_string(f1.variables.at(r_val).addr_offset) + "(%rbp), %eax");
-                }
-            } else if (op == "*") {
-                if (is_array_accessor(l_val) || is_array_accessor(r_val)) {
-                    if (is_array_accessor(l_val) && is_array_accessor(r_val)) {
-                        // arr arr
-                        move_arr_val_into_register(l_val, "%edx", f1);
-                        move_arr_val_into_register(r_val, "%eax", f1);
-
-                        f1.assembly_instructions.push_back("imull %edx, %eax");
-                    } else if (is_array_accessor(l_val)) {
-                        if (is_int(r_val)) {
-                            // arr num
-                            move_arr_val_into_register(l_val, "%eax", f1);
-
-                            f1.assembly_instructions.push_back("imull $" + r_val + ", %eax, %eax");
-                        } else {
-                            // arr var
-                            move_arr_val_into_register(l_val, "%eax", f1);
-
-                            f1.assembly_instructions.push_back("imull " + to_string(f1.variables.at(r_val).addr_offset) + "(%rbp), %eax");
-                        }
-                    } else if (is_array_accessor(r_val)) {
-                        if (is_int(l_val)) {
-                            // num arr
-                            move_arr_val_into_register(r_val, "%eax", f1);
-
-                            f1.assembly_instructions.push_back("imull $" + l_val + ", %eax, %eax");
-                        } else {
-                            // var arr
-                            move_arr_val_into_register(r_val, "%eax", f1);
-
-                            f1.assembly_instructions.push_back("imull %edx, " + to_string(f1.variables.at(l_val).addr_offset) + "(%rbp)");
-                        }
-                    }
-                } else if (is_int(l_val) || is_int(r_val)) {
-                    if (is_int(l_val) && is_int(r_val)) {
-                        /*
-                        Doesn't handle case of when both are immediates
-                    */
-                    } else if (is_int(l_val)) {
-                        // num - var
-                        move_var_val_into_register(r_val, "%eax", f1);
-
-                        f1.assembly_instructions.push_back("imull $" + l_val + ", %eax, %eax");
-                    } else if (is_int(r_val)) {
-                        // var - num
-                        move_var_val_into_register(l_val, "%eax", f1);
-
-                        f1.assembly_instructions.push_back("imull $" + r_val + ", %eax, %eax");
-                    }
-                } else {
-                    // both operands are varaiables(non-arrays)
-                    move_var_val_into_register(l_val, "%eax", f1);
+            /*
+                The left operand goes into %eax, the right one is used as an immediate or
+                straight from memory; + and * take an immediate left operand on the right
 
-                    f1.assembly_instructions.push_back("imull " + to_string(f1.variables.at(r_val).addr_offset) + "(%rbp), %eax");
-                }
+                a[i] * 3    imull   $3, -48(%rbp, %rcx, 4), %eax
+                x - a[i]    movl    -4(%rbp), %eax
+                            subl    -48(%rbp, %rcx, 4), %eax
+            */
+            if (op != "-" && is_immediate(l_val)) {
+                swap(l_val, r_val);
             }
-        }
-        if (store_result) {
-            string reg;
-            if (is_array_accessor(dest)) {
-                // add move to edx line
-                f1.assembly_instructions.push_back("movl %eax, %edx");
-                reg = "%edx";
+            string instruction = op == "+" ? "addl" : op == "-" ? "subl" : "imull";
+            if (op == "*" && is_immediate(r_val)) {
+                f1.assembly_instructions.push_back("imull $" + r_val + ", " + int_operand(l_val, "%eax", f1) + ", %eax");
             } else {
-                reg = "%eax";
+                move_operand_into_register(l_val, "%eax", f1);
+                string operand = is_immediate(r_val) ? "$" + r_val : int_operand(r_val, "%ecx", f1);
+                f1.assembly_instructions.push_back(instruction + " " + operand + ", %eax");
             }
-            store_reg_val(dest, reg, f1);
+        }
+        if (store_result) {
+            store_reg_val(dest, "%eax", f1, is_long);
         }
     }
+    return is_long;
 }
 
 /*
@@ -1403,10 +2222,14 @@ void assignment_handler(string &s, Function &f1) {
         string arr_name = dest.substr(0, dest.find("["));
         string arr_index = substr_between_indices(dest, dest.find("[") + 1, dest.find("]"));
 
-        if (is_int(src)) {
+        if (is_immediate(src)) {
             // arr[i] = 0
             store_immedaite_val(dest, src, f1);
 
+        } else if (is_long_operand(src, f1)) {
+            // arr[i] = l
+            move_long_operand_into_register(src, "%rdx", f1);
+            store_reg_val(dest, "%edx", f1, true);
         } else if (is_array_accessor(src)) {
             // arr[i] = d[0], arr[i] = d[b]
             move_arr_val_into_register(src, "%edx", f1);
@@ -1417,9 +2240,13 @@ void assignment_handler(string &s, Function &f1) {
             store_reg_val(dest, "%edx", f1);
         }
     } else {
-        if (is_int(src)) {
+        if (is_immediate(src)) {
             // a = 0, arr[0] = 0
             store_immedaite_val(dest, src, f1);
+        } else if (is_long_operand(src, f1)) {
+            // a = l, copies all 64 bits into a long
+            move_long_operand_into_register(src, "%rax", f1);
+            store_reg_val(dest, "%eax", f1, true);
         } else if (is_array_accessor(src)) {
             // a = c[1], a = c[x], arr[0] = c[1], arr[0] = c[x]
             move_arr_val_into_register(src, "%eax", f1);
@@ -1432,30 +2259,419 @@ void assignment_handler(string &s, Function &f1) {
     }
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        cout << "Please proved an input file and output file name. Exitting..." << endl;
-        return 0;
+/*
+    Helper function to wrap a function in the directives GNU as needs to export
+    and size its symbol, used with --emit=gas
+    A -O1 clone is only called from its file, so it stays local
+*/
+vector<string> gas_function_instructions(const Function &f) {
+    vector<string> out;
+    if (!is_clone(f.function_name)) {
+        out.push_back(".globl " + f.function_name);
+    }
+    out.push_back(".type " + f.function_name + ", @function");
+    out.insert(out.end(), f.assembly_instructions.begin(), f.assembly_instructions.end());
+    out.push_back(".size " + f.function_name + ", .-" + f.function_name);
+    return out;
+}
+
+/*
+    Helper function to count the emitted instructions, labels and comments for --stats
+*/
+void count_output_lines(const vector<string> &assembly) {
+    for (auto const &s : assembly) {
+        if (s.empty()) {
+            continue;
+        } else if (s[0] == '#') {
+            stats.count("comments");
+        } else if (s.back() == ':') {
+            stats.count("labels");
+        } else if (s[0] != '.') {
+            stats.count("instructions");
+        }
+    }
+}
+
+/*
+    Helper function to reset the translation state before the next file
+*/
+void reset_compiler_state() {
+    global_variables.clear();
+    data_section.clear();
+    bss_section.clear();
+    label_num = 2;
+    static_var_num = 0;
+    profile_sites.clear();
+    profile_seen.clear();
+    dispatched_functions.clear();
+    long_functions.clear();
+    lane_offsets_used = false;
+}
+
+/*
+    Helper function to read the next function from input into source: the file scope lines before
+    it, its header and its body up to the brace that closes it
+    Returns false once input has no lines left
+*/
+bool read_function(istream &input, vector<string> &source) {
+    source.clear();
+    string line;
+    bool in_function = false;
+    int depth = 0;
+    while (getline(input, line)) {
+        trim(line);
+        source.push_back(line);
+        if (!in_function) {
+            in_function = is_function_header(line);
+        }
+        if (in_function) {
+            depth += count(line.begin(), line.end(), '{') - count(line.begin(), line.end(), '}');
+            if (depth <= 0) {
+                break;
+            }
+        }
+    }
+    stats.count("source_lines", source.size());
+    return !source.empty();
+}
+
+/*
+    Helper function to write lines of assembly to text, or with obj set to assemble them into obj
+    straight from the instruction records, without formatting and splitting a listing
+*/
+void emit_assembly(ostream &text, ObjectFile *obj, const vector<string> &lines, const string &f_name) {
+    if (!obj) {
+        writeAssembly(text, lines, f_name);
+        return;
+    }
+    for (auto const &line : lines) {
+        assemble_line(*obj, line);
+    }
+}
+
+/*
+    Helper function to translate the source of one function and write its assembly to text, or
+    assemble it into obj with --emit=obj
+    header is the line of the function's header when --multiversion translates it once per vector
+    target and calls it through a dispatcher, string::npos otherwise
+*/
+void compile_function(vector<string> &source, size_t header, ostream &text, ObjectFile *obj, bool emit_gas,
+                      ostream *cost_out) {
+    vector<Function> variants(1);
+    {
+        ScopedTimer timer(stats, stats.phases, "translate");
+        target_isa = forced_isa;
+        if (header == string::npos) {
+            if (!function_handler(source, 0, source.size(), variants[0])) {
+                return;
+            }
+        } else {
+            // the file scope declarations before the header are only read once
+            variants.resize(vector_isas.size());
+            for (size_t v = 0; v < vector_isas.size(); ++v) {
+                target_isa = &vector_isas[v];
+                function_handler(source, v == 0 ? 0 : header, source.size(), variants[v]);
+                variants[v].function_name += "." + vector_isas[v].name;
+                variants[v].assembly_instructions[0] = variants[v].function_name + ":";
+            }
+        }
+        target_isa = nullptr;
+    }
+
+    ScopedTimer timer(stats, stats.phases, "write");
+    for (auto const &f1 : variants) {
+        emit_assembly(text, obj, emit_gas ? gas_function_instructions(f1) : f1.assembly_instructions,
+                      f1.function_name);
+        if (stats.enabled) {
+            count_output_lines(f1.assembly_instructions);
+        }
+        if (cost_out) {
+            *cost_out << cost_report(f1);
+        }
+    }
+    if (header != string::npos) {
+        Function dispatcher;
+        dispatcher.function_name = variants[0].function_name.substr(0, variants[0].function_name.rfind("."));
+        dispatcher.assembly_instructions = dispatcher_instructions(dispatcher.function_name);
+        emit_assembly(text, obj, emit_gas ? gas_function_instructions(dispatcher) : dispatcher.assembly_instructions,
+                      dispatcher.function_name);
+        data_section.push_back(".align 8");
+        data_section.push_back(dispatcher.function_name + ".dispatch:");
+        data_section.push_back(".quad " + dispatcher.function_name + ".resolve");
+    }
+}
+
+/*
+    Translate the source read from input and write its assembly to out
+    One function is read, translated and written at a time, so memory is bounded by the largest
+    function and the file scope data rather than by the whole file. Only the source passes and
+    --multiversion, which look at all of the file's functions before translating any, read it whole
+    Starts from a clean state, so it can be called for file after file in one process
+    With cost_out set, the --cost-report of every function is written there
+    With emit_obj the --emit=gas instruction records are assembled as they are translated, and the
+    ELF object is written to out at the end
+*/
+void compile_source(istream &input, ostream &out, bool emit_gas, bool emit_obj, ostream *cost_out) {
+    reset_compiler_state();
+    stats.count("files");
+    ObjectFile object;
+    ObjectFile *obj = emit_obj ? &object : nullptr;
+    emit_gas = emit_gas || emit_obj;
+    streampos start = out.tellp();
+    if (emit_gas) {
+        emit_assembly(out, obj, {".text"}, "");
+    }
+
+    bool dispatch = multiversion && !forced_isa && profile_path.empty() && profile_counts.empty();
+    bool multiversioned = false;
+    if (!dispatch && !source_passes_enabled()) {
+        vector<string> source;
+        while (true) {
+            {
+                ScopedTimer timer(stats, stats.phases, "load");
+                if (!read_function(input, source)) {
+                    break;
+                }
+            }
+            compile_function(source, string::npos, out, obj, emit_gas, cost_out);
+        }
+    } else {
+        vector<vector<string>> functions;
+        {
+            ScopedTimer timer(stats, stats.phases, "load");
+            vector<string> source;
+            while (read_function(input, source)) {
+                functions.push_back(source);
+            }
+        }
+        {
+            ScopedTimer timer(stats, stats.phases, "optimize");
+            run_source_passes(functions);
+        }
+
+        // header line of each function --multiversion translates once per vector target, by source
+        map<size_t, size_t> headers;
+        if (dispatch) {
+            CallGraph graph = build_call_graph(functions);
+            for (size_t i = 0; i < functions.size(); ++i) {
+                if (!graph.headers[i].name.empty() && has_vector_loop(functions[i])) {
+                    headers[i] = graph.headers[i].line;
+                    dispatched_functions.insert(graph.headers[i].name);
+                }
+            }
+            stats.count("multiversioned_functions", headers.size());
+            multiversioned = !headers.empty();
+        }
+
+        for (size_t i = 0; i < functions.size(); ++i) {
+            compile_function(functions[i], headers.count(i) ? headers[i] : string::npos, out, obj, emit_gas,
+                             cost_out);
+        }
+    }
+
+    {
+        ScopedTimer timer(stats, stats.phases, "write");
+        if (multiversioned) {
+            emit_assembly(out, obj, isa_level_instructions(), "");
+        }
+        emit_assembly(out, obj, vector_constant_instructions(), "");
+        emit_assembly(out, obj, static_data_instructions(), "");
+        emit_assembly(out, obj, profile_instructions(), "");
+        if (emit_gas) {
+            // no executable stack
+            emit_assembly(out, obj, {".section .note.GNU-stack,\"\",@progbits"}, "");
+        }
     }
+    if (emit_obj) {
+        ScopedTimer timer(stats, stats.phases, "assemble");
+        write_object(object, out);
+    }
+    if (stats.enabled && start >= 0) {
+        stats.count("bytes_written", out.tellp() - start);
+    }
+}
 
-    string input_fn = argv[1];
-    string output_fn = argv[2];
+int main(int argc, char *argv[]) {
+    vector<string> file_args;
+    string stats_format = "";
+    string manifest_fn = "";
+    string socket_path = "";
+    int jobs = max((int)thread::hardware_concurrency(), 1);  // 0 when the count is unknown
+    bool emit_gas = false;
+    bool emit_obj = false;
+    bool cost = false;
+    bool instrument = false;
+    string instrument_path = "";
+    string profile_use_fn = "";
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg.find("--switch-density=") == 0) {
+            string value = arg.substr(arg.find("=") + 1);
+            char *end;
+            double density = strtod(value.c_str(), &end);
+            if (value.empty() || *end != '\0' || !(density > 0 && density <= 1)) {
+                cerr << "Invalid --switch-density " << value << ", expected a fraction above 0, up to 1" << endl;
+                return 1;
+            }
+            switch_density_threshold = density;
+        } else if (arg.find("-O") == 0) {
+            if (!set_optimize_level(arg.substr(2))) {
+                cerr << "Unknown optimization level " << arg << endl;
+                return 1;
+            }
+        } else if (arg.find("-f") == 0) {
+            bool enabled = arg.find("-fno-") != 0;
+            string pass = arg.substr(enabled ? 2 : 5);
+            if (!set_pass_enabled(pass, enabled)) {
+                cerr << "Unknown pass " << pass << endl;
+                return 1;
+            }
+        } else if (arg.find("-mtune=") == 0) {
+            if (!set_tune(arg.substr(arg.find("=") + 1))) {
+                cerr << "Unknown -mtune target " << arg.substr(arg.find("=") + 1) << endl;
+                return 1;
+            }
+        } else if (arg == "--time-passes") {
+            stats.time_passes = true;
+        } else if (arg.find("--isa=") == 0) {
+            forced_isa = find_isa(arg.substr(arg.find("=") + 1));
+            if (!forced_isa) {
+                cerr << "Unknown --isa target " << arg.substr(arg.find("=") + 1) << endl;
+                return 1;
+            }
+        } else if (arg == "--multiversion") {
+            multiversion = true;
+        } else if (arg == "--stats" || arg == "--stats=text") {
+            stats_format = "text";
+        } else if (arg == "--stats=json") {
+            stats_format = "json";
+        } else if (arg == "--instrument") {
+            instrument = true;
+        } else if (arg.find("--instrument=") == 0) {
+            instrument = true;
+            instrument_path = arg.substr(arg.find("=") + 1);
+        } else if (arg.find("--profile-use=") == 0) {
+            profile_use_fn = arg.substr(arg.find("=") + 1);
+        } else if (arg == "--cost-report") {
+            cost = true;
+        } else if (arg == "--emit=gas") {
+            emit_gas = true;
+            emit_obj = false;
+        } else if (arg == "--emit=obj") {
+            emit_gas = true;
+            emit_obj = true;
+        } else if (arg == "--emit=listing") {
+            emit_gas = false;
+            emit_obj = false;
+        } else if (arg.find("--batch=") == 0) {
+            manifest_fn = arg.substr(arg.find("=") + 1);
+        } else if (arg.find("--serve=") == 0) {
+            socket_path = arg.substr(arg.find("=") + 1);
+        } else if (arg.find("--jobs=") == 0) {
+            string value = arg.substr(arg.find("=") + 1);
+            if (value.empty() || value.size() > 6 || !is_int(value) || stoi(value) < 1) {
+                cerr << "Invalid --jobs " << value << ", expected a number of threads from 1 up" << endl;
+                return 1;
+            }
+            jobs = stoi(value);
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            // "-" alone is stdin or stdout, anything else starting with '-' is an option this build doesn't know
+            cerr << "Unknown option " << arg << endl;
+            return 1;
+        } else {
+            file_args.push_back(arg);
+        }
+    }
+    stats.enabled = !stats_format.empty();
 
-    int max_len = 0;
-    vector<string> source = loadFile(input_fn, max_len);
+    if (!socket_path.empty()) {
+        return run_server(socket_path, jobs);
+    }
 
-    function_handler(source, 0, max_len);
+    if (!manifest_fn.empty()) {
+        Stats total;
+        total.enabled = stats.enabled;
+        total.time_passes = stats.time_passes;
+        int status = run_batch(manifest_fn, jobs, emit_gas, emit_obj, total);
+        if (total.enabled) {
+            cerr << (stats_format == "json" ? total.json() : total.summary());
+        }
+        if (total.time_passes) {
+            cerr << pass_report(total);
+        }
+        return status;
+    }
 
-    cout << "Finished translating file. Outputting to: " << output_fn << endl;
+    if (file_args.size() != 2) {
+        cout << "Please proved an input file and output file name. Exitting..." << endl;
+        return 0;
+    }
 
-    ofstream fileOUT(output_fn, ios::out | ios::trunc);
-    fileOUT.close();
+    // "-" reads the source from stdin or writes the assembly to stdout
+    string input_fn = file_args[0];
+    string output_fn = file_args[1];
+    ostream &log = output_fn == "-" ? cerr : cout;
+
+    ifstream input_file;
+    if (input_fn != "-") {
+        input_file.open(input_fn);
+        if (input_file.fail()) {
+            cerr << "Failed to open " << input_fn << endl;
+            return 1;
+        }
+        log << "Opened " + input_fn + " successfully." << endl;
+    }
+    if (!profile_use_fn.empty() && !read_profile(profile_use_fn)) {
+        cerr << "Failed to open " << profile_use_fn << endl;
+        return 1;
+    }
+    if (instrument) {
+        // by default the profile sits next to the output: out.s -> out.profile
+        profile_path = instrument_path;
+        if (profile_path.empty()) {
+            string base = output_fn == "-" ? "a.out" : output_fn;
+            size_t dot = base.rfind(".");
+            profile_path = (dot == string::npos || dot < base.rfind("/") + 1 ? base : base.substr(0, dot)) + ".profile";
+        }
+    }
 
-    for (Function f : functions) {
-        writeFile(output_fn, f.assembly_instructions, f.function_name);
+    ofstream output_file;
+    if (output_fn != "-") {
+        output_file.open(output_fn, ios::out | ios::trunc | ios::binary);
+        if (output_file.fail()) {
+            cerr << "Failed to open " << output_fn << " for writing" << endl;
+            return 1;
+        }
+    }
+    ostream &out = output_fn == "-" ? cout : output_file;
+
+    // the report goes to stderr like --stats
+    try {
+        compile_source(input_fn == "-" ? cin : input_file, out, emit_gas, emit_obj, cost ? &cerr : nullptr);
+    } catch (const exception &e) {
+        cerr << "Translation failed: " << e.what() << endl;
+        return 1;
+    }
+    // a full disk only shows when the buffered output is written out
+    out.flush();
+    if (output_fn != "-") {
+        output_file.close();
     }
+    if (out.fail()) {
+        cerr << "Failed to write " << output_fn << endl;
+        return 1;
+    }
+
+    log << "Finished translating file. Outputting to: " << output_fn << endl;
+    log << "Finished writing to: " << output_fn << endl;
 
-    cout << "Finished writing to: " << output_fn << endl;
+    if (stats.enabled) {
+        // stats go to stderr so they can be captured apart from the progress messages
+        cerr << (stats_format == "json" ? stats.json() : stats.summary());
+    }
+    if (stats.time_passes) {
+        cerr << pass_report(stats);
+    }
 
     return 0;
 }
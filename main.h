@@ -1,40 +1,125 @@
 #ifndef MAIN_H
 #define MAIN_H
 
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
 #include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "Address.h"
+#include "Condition.h"
 #include "Function.h"
+#include "Stats.h"
 #include "Variable.h"
+#include "batch.h"
+#include "cost.h"
+#include "gvn.h"
+#include "ipcp.h"
+#include "loopnest.h"
+#include "object.h"
+#include "passes.h"
+#include "server.h"
 #include "util.h"
+#include "vectorize.h"
 
 using namespace std;
 
+extern thread_local Stats stats;
+extern thread_local int label_num;
+extern thread_local const VectorIsa *target_isa;
+
 void view_var(string s);
-void view_function(Function f1, bool show_vars);
-map<string, Variable> variable_handler(string input_str, int &addr_offset);
-map<string, Variable> actual_function_params(map<string, Variable> vars);
+void view_function(const Function &f1, bool show_vars);
+int type_size(const string type);
+string element_type(const string type);
+string size_suffix(int size);
+string sized_register(const string reg, int size);
+string load_instruction(const string type, int width = 4);
+bool is_declaration(const string line);
+int allocate_stack_slot(int &addr_offset, int size, int align);
 string add_mov_instruction(string src, string dest, int size);
 bool is_function_call(string line);
+bool is_function_header(const string line);
+Variable &lookup_variable(const string s, Function &f1);
+bool has_variable(const string s, Function &f1);
+string variable_operand(const Variable &v);
+string var_location(const string s, Function &f1);
 bool is_arithmetic_line(const string s);
 bool is_param_var(const string s, Function &f1);
+string array_element_type(const string s, Function &f1);
+vector<string> array_subscripts(const string s);
+int array_declarator(const string d, string &name, int &columns);
+vector<string> array_initializer(const string init, int columns);
+void move_index_into_register(const string s, const string reg, Function &f1);
+Address element_address(const string s, const string index_reg, Function &f1, const string base_reg = "%r10");
 void move_immediate_val_into_register(const string s, const string reg, Function &f1);
 void move_var_val_into_register(const string s, const string reg, Function &f1);
 void move_arr_val_into_register(const string s, const string reg, Function &f1);
-void move_param_arr_val_into_register(const string s, const string reg, Function &f1);
+string int_operand(const string s, const string scratch, Function &f1);
+void move_long_operand_into_register(const string s, const string reg, Function &f1);
+string long_operand(const string s, const string scratch, Function &f1);
+void move_operand_into_register(const string s, const string reg, Function &f1);
+pair<int, string> store_location(const string dest, Function &f1);
 void store_immedaite_val(const string dest, const string val, Function &f1);
-void store_reg_val(const string dest, const string reg, Function &f1);
-void comparison_handler(string &s, Function &f1, bool jump_if_false = true);
+void store_reg_val(const string dest, const string reg, Function &f1, bool is_long = false);
+vector<string> tokenize_condition(const string s);
+Condition parse_unary_condition(vector<string> &tokens, size_t &pos);
+Condition parse_and_condition(vector<string> &tokens, size_t &pos);
+Condition parse_or_condition(vector<string> &tokens, size_t &pos);
+Condition parse_condition(const string s);
+bool is_immediate(const string s);
+long literal_value(const string s);
+bool fits_int(const string s);
+string truncated_immediate(const string s, int size);
+bool is_long_operand(const string s, Function &f1);
+bool is_pure_comparison(const Condition &c);
+string compare_operands(string lhs, string comp, string rhs, Function &f1, const string reg = "%eax");
+bool fold_comparison(const Condition &c);
+void branch_on_condition(const Condition &c, const string target, bool jump_if_true, Function &f1);
+void comparison_handler(string &s, Function &f1, const string target_label, bool jump_if_true = false);
+void declare_variable(Variable var, Function &f1);
+void open_block_scope(Function &f1, int addr_offset);
+void close_block_scope(Function &f1, int &addr_offset);
 
-void function_handler(vector<string> source, int loc, int max_len);
-void common_instruction_handler_dispatcher(vector<string> source, int &loc, int max_len, Function &f1, int &addr_offset);
+bool function_handler(vector<string> &source, int loc, int max_len, Function &f1);
+void common_instruction_handler_dispatcher(vector<string> &source, int &loc, int max_len, Function &f1, int &addr_offset);
+vector<Variable> static_storage_allocation(string line, bool is_global_symbol);
+void global_variable_handler(string line);
+void static_variable_handler(string line, Function &f1);
+vector<string> static_data_instructions();
+string profile_site(Function &f1, const string kind, const string line);
+void profile_counter(Function &f1, const string kind, const string line);
+vector<string> profile_instructions();
+bool read_profile(const string fn);
+long profile_count(Function &f1, const string kind, const string line);
+void move_cold_blocks(Function &f1);
+vector<string> gas_function_instructions(const Function &f);
+void count_output_lines(const vector<string> &assembly);
+void reset_compiler_state();
+bool read_function(istream &input, vector<string> &source);
+void compile_source(istream &input, ostream &out, bool emit_gas, bool emit_obj = false, ostream *cost_out = nullptr);
 void variable_offset_allocation(vector<string> &source, int &loc, Function &f1, int &addr_offset);
 void IF_statement_handler(vector<string> &source, int &loc, int max_len, Function &f1, int &addr_offset);
+long loop_step(const string name, const string inc);
+bool is_plain_counting_loop(vector<string> &source, int loc, int max_len, const string name);
+long constant_trip_count(const vector<string> &tokens);
+bool is_straight_line_body(vector<string> &source, int loc, int max_len);
 void FOR_statement_handler(vector<string> &source, int &loc, int max_len, Function &f1, int &addr_offset);
+void switch_compare_tree(vector<pair<int, string>> &cases, int lo, int hi, string default_label, Function &f1);
+void SWITCH_statement_handler(vector<string> &source, int &loc, int max_len, Function &f1, int &addr_offset);
+void break_handler(Function &f1);
 void return_handler(string source, Function &f1);
+void load_argument(const string arg, int reg_idx, Function &f1);
 void function_call_handler(string source, Function &f1);
-void arithmetic_handler(string &s, Function &f1, bool store_result = true);
+bool arithmetic_handler(string &s, Function &f1, bool store_result = true);
 void assignment_handler(string &s, Function &f1);
 
 #endif
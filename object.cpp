@@ -0,0 +1,618 @@
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include "object.h"
+#include "util.h"
+
+using namespace std;
+
+// the ELF64 constants the writer needs
+const int SHT_PROGBITS = 1;
+const int SHT_SYMTAB = 2;
+const int SHT_STRTAB = 3;
+const int SHT_RELA = 4;
+const int SHT_NOBITS = 8;
+const int SHT_INIT_ARRAY = 14;
+const int SHT_FINI_ARRAY = 15;
+const long SHF_WRITE = 1;
+const long SHF_ALLOC = 2;
+const long SHF_EXECINSTR = 4;
+const long SHF_INFO_LINK = 0x40;
+const int STB_LOCAL = 0;
+const int STB_GLOBAL = 1;
+const int STT_NOTYPE = 0;
+const int STT_OBJECT = 1;
+const int STT_FUNC = 2;
+const int STT_SECTION = 3;
+const int EM_X86_64 = 62;
+const int ET_REL = 1;
+
+// bytes of the ELF header, a section header, a symbol and a relocation
+const int ehdr_size = 64;
+const int shdr_size = 64;
+const int sym_size = 24;
+const int rela_size = 24;
+
+bool fits_int32(long v) {
+    return v >= -2147483648L && v <= 2147483647L;
+}
+
+/*
+    Helper function to find a symbol, making an undefined one the first time it is named
+*/
+ObjectSymbol &object_symbol(ObjectFile &obj, const string &name) {
+    auto found = obj.symbols.find(name);
+    if (found != obj.symbols.end()) {
+        return found->second;
+    }
+    obj.symbol_order.push_back(name);
+    ObjectSymbol &sym = obj.symbols[name];
+    sym.section = -1;
+    sym.fragment = 0;
+    sym.value = 0;
+    sym.global = false;
+    sym.type = STT_NOTYPE;
+    sym.size = 0;
+    sym.size_section = -1;
+    sym.size_fragment = 0;
+    sym.index = -1;
+    return sym;
+}
+
+/*
+    Helper function to switch to a section, adding it the first time
+    Its type and flags come from the name as gas gives them, or from the flags of a .section
+*/
+void switch_section(ObjectFile &obj, const string name, const string flags = "") {
+    for (size_t i = 0; i < obj.sections.size(); ++i) {
+        if (obj.sections[i].name == name) {
+            obj.current = i;
+            return;
+        }
+    }
+    Section s;
+    s.name = name;
+    s.type = SHT_PROGBITS;
+    s.flags = 0;
+    s.entsize = 0;
+    s.align = 1;
+    s.link = 0;
+    s.info = 0;
+    s.index = 0;
+    s.symbol = 0;
+    if (name == ".text") {
+        s.flags = SHF_ALLOC | SHF_EXECINSTR;
+    } else if (name == ".data") {
+        s.flags = SHF_ALLOC | SHF_WRITE;
+    } else if (name == ".bss") {
+        s.type = SHT_NOBITS;
+        s.flags = SHF_ALLOC | SHF_WRITE;
+    } else if (name.compare(0, 7, ".rodata") == 0) {
+        s.flags = SHF_ALLOC;
+    } else if (name == ".init_array" || name == ".fini_array") {
+        s.type = name == ".init_array" ? SHT_INIT_ARRAY : SHT_FINI_ARRAY;
+        s.flags = SHF_ALLOC | SHF_WRITE;
+        s.entsize = 8;
+    }
+    for (char c : flags) {
+        s.flags |= c == 'a' ? SHF_ALLOC : c == 'w' ? SHF_WRITE : c == 'x' ? SHF_EXECINSTR : 0;
+    }
+    obj.sections.push_back(s);
+    obj.current = obj.sections.size() - 1;
+}
+
+Fragment new_fragment() {
+    Fragment f;
+    f.align = 1;
+    f.addend = 0;
+    f.condition = -1;
+    f.long_branch = false;
+    f.offset = 0;
+    f.padding = 0;
+    return f;
+}
+
+/*
+    Helper function to get the fragment new bytes go to, starting one after a branch
+*/
+Fragment &tail_fragment(Section &s) {
+    if (s.fragments.empty() || !s.fragments.back().branch.empty()) {
+        s.fragments.push_back(new_fragment());
+    }
+    return s.fragments.back();
+}
+
+/*
+    Helper function to start a fragment at the current position, for a label to point at
+    Returns its index
+*/
+size_t start_fragment(Section &s) {
+    Fragment &last = tail_fragment(s);
+    if (!last.bytes.empty() || last.align != 1) {
+        s.fragments.push_back(new_fragment());
+    }
+    return s.fragments.size() - 1;
+}
+
+/*
+    Helper function to append bytes and their fixups to the current section
+*/
+void append_bytes(ObjectFile &obj, const vector<unsigned char> &bytes, const vector<Fixup> &fixups) {
+    Fragment &f = tail_fragment(obj.sections[obj.current]);
+    for (auto fixup : fixups) {
+        object_symbol(obj, fixup.symbol);
+        fixup.offset += f.bytes.size();
+        f.fixups.push_back(fixup);
+    }
+    f.bytes.insert(f.bytes.end(), bytes.begin(), bytes.end());
+}
+
+/*
+    Helper function to read the characters of a quoted .string, with its C escapes
+*/
+string unquote(const string s) {
+    if (s.size() < 2 || s[0] != '"' || s.back() != '"') {
+        throw runtime_error("expected a quoted string, got " + s);
+    }
+    string out;
+    for (size_t i = 1; i + 1 < s.size(); ++i) {
+        if (s[i] != '\\' || i + 2 >= s.size()) {
+            out += s[i];
+            continue;
+        }
+        char c = s[++i];
+        if (c >= '0' && c <= '7') {
+            int v = 0;
+            for (int n = 0; n < 3 && i + 1 < s.size() && s[i] >= '0' && s[i] <= '7'; ++n) {
+                v = v * 8 + (s[i++] - '0');
+            }
+            --i;
+            out += (char)v;
+        } else {
+            out += c == 'n' ? '\n' : c == 't' ? '\t' : c == 'r' ? '\r' : c == 'b' ? '\b' : c == 'f' ? '\f' : c;
+        }
+    }
+    return out;
+}
+
+/*
+    Helper function to find where a line's comment starts, skipping a # inside a string
+    Returns the line's size when it has none
+*/
+size_t comment_start(const string &line) {
+    bool quoted = false;
+    for (size_t i = line.find_first_of("\"#"); i != string::npos; i = line.find_first_of("\"#", i + 1)) {
+        if (line[i] == '"' && (i == 0 || line[i - 1] != '\\')) {
+            quoted = !quoted;
+        } else if (line[i] == '#' && !quoted) {
+            return i;
+        }
+    }
+    return line.size();
+}
+
+/*
+    Helper function to handle an assembler directive
+*/
+void assemble_directive(ObjectFile &obj, const string &name, const string &args) {
+    vector<string> values = split_operands(args);
+    Section &s = obj.sections[obj.current];
+    const vector<pair<string, int>> data_widths = {{".byte", 1}, {".short", 2}, {".value", 2}, {".word", 2},
+                                                   {".long", 4}, {".int", 4},   {".quad", 8}};
+    for (auto const &d : data_widths) {
+        if (name != d.first) {
+            continue;
+        }
+        for (auto const &v : values) {
+            Encoding e;
+            string symbol;
+            long value;
+            if (!parse_value(v, symbol, value)) {
+                throw runtime_error("bad value " + v + " for " + name);
+            }
+            if (!symbol.empty()) {
+                if (d.second < 4) {
+                    throw runtime_error("cannot relocate a " + name + " of " + v);
+                }
+                e.fixups.push_back({0, symbol, value, d.second == 8 ? R_X86_64_64 : R_X86_64_32});
+                value = 0;
+            }
+            for (int i = 0; i < d.second; ++i) {
+                e.bytes.push_back(value >> (8 * i) & 0xff);
+            }
+            append_bytes(obj, e.bytes, e.fixups);
+        }
+        return;
+    }
+
+    if (name == ".text" || name == ".data" || name == ".bss") {
+        switch_section(obj, name);
+    } else if (name == ".section") {
+        switch_section(obj, values.at(0), values.size() > 1 ? unquote(values[1]) : "");
+    } else if (name == ".globl" || name == ".global") {
+        for (auto const &v : values) {
+            object_symbol(obj, v).global = true;
+        }
+    } else if (name == ".type") {
+        object_symbol(obj, values.at(0)).type = values.at(1) == "@function" ? STT_FUNC : STT_OBJECT;
+    } else if (name == ".size") {
+        ObjectSymbol &sym = object_symbol(obj, values.at(0));
+        if (values.at(1) == ".-" + values[0]) {
+            sym.size_section = obj.current;
+            sym.size_fragment = start_fragment(s);
+        } else {
+            sym.size = stol(values[1], nullptr, 0);
+        }
+    } else if (name == ".align" || name == ".balign" || name == ".p2align") {
+        long align = name == ".p2align" ? 1L << stol(values.at(0)) : stol(values.at(0));
+        if (align <= 0 || (align & (align - 1))) {
+            throw runtime_error("bad alignment " + args);
+        }
+        Fragment &f = s.fragments[start_fragment(s)];
+        f.align = max(f.align, align);
+        s.align = max(s.align, align);
+    } else if (name == ".zero" || name == ".skip") {
+        append_bytes(obj, vector<unsigned char>(stol(values.at(0)), 0), {});
+    } else if (name == ".string" || name == ".asciz" || name == ".ascii") {
+        string text = unquote(args);
+        vector<unsigned char> bytes(text.begin(), text.end());
+        if (name != ".ascii") {
+            bytes.push_back(0);
+        }
+        append_bytes(obj, bytes, {});
+    } else if (name != ".file" && name != ".ident") {
+        throw runtime_error("unsupported directive " + name);
+    }
+}
+
+/*
+    Assemble one line of a --emit=gas listing into obj
+*/
+void assemble_line(ObjectFile &obj, const string &line) {
+    if (obj.sections.empty()) {
+        // gas always has these
+        switch_section(obj, ".text");
+        switch_section(obj, ".data");
+        switch_section(obj, ".bss");
+        obj.current = 0;
+    }
+    size_t end = comment_start(line);
+    if (end < line.size()) {
+        assemble_line(obj, line.substr(0, end));
+        return;
+    }
+    // an instruction is encoded straight from the line, only labels and directives are copied out
+    size_t begin = line.find_first_not_of(" \t");
+    if (begin == string::npos) {
+        return;
+    }
+    size_t last = line.find_last_not_of(" \t");
+
+    if (line[last] == ':' && line.find_first_of(" \t\"", begin) > last) {
+        string name = line.substr(begin, last - begin);
+        ObjectSymbol &sym = object_symbol(obj, name);
+        if (sym.section >= 0) {
+            throw runtime_error("symbol " + name + " is already defined");
+        }
+        sym.section = obj.current;
+        sym.fragment = start_fragment(obj.sections[obj.current]);
+        return;
+    }
+
+    if (line[begin] == '.') {
+        string s = line.substr(begin, last + 1 - begin);
+        size_t space = s.find_first_of(" \t");
+        string args = space == string::npos ? "" : s.substr(space + 1);
+        trim(args);
+        assemble_directive(obj, s.substr(0, space), args);
+        return;
+    }
+
+    Encoding e = encode_instruction(line);
+    append_bytes(obj, e.bytes, e.fixups);
+    if (!e.branch.empty()) {
+        object_symbol(obj, e.branch);
+        Fragment &f = tail_fragment(obj.sections[obj.current]);
+        f.branch = e.branch;
+        f.addend = e.addend;
+        f.condition = e.condition;
+    }
+}
+
+long symbol_offset(const ObjectFile &obj, const ObjectSymbol &sym) {
+    return obj.sections[sym.section].fragments[sym.fragment].offset;
+}
+
+long branch_size(const Fragment &f) {
+    if (f.branch.empty()) {
+        return 0;
+    }
+    return f.long_branch ? (f.condition < 0 ? 5 : 6) : 2;
+}
+
+/*
+    Helper function to place the fragments of section s
+    Every jump to a label of the same section starts as a rel8 and grows to a rel32 when the label is
+    out of its reach, which can push other labels out of theirs, so sizing repeats until nothing grows.
+    Jumps anywhere else are rel32 with a relocation.
+*/
+void layout_section(ObjectFile &obj, int s) {
+    vector<Fragment> &fragments = obj.sections[s].fragments;
+    for (auto &f : fragments) {
+        if (!f.branch.empty()) {
+            const ObjectSymbol &target = obj.symbols.at(f.branch);
+            f.long_branch = target.section != s || target.global;
+        }
+    }
+    bool grew = true;
+    while (grew) {
+        long offset = 0;
+        for (auto &f : fragments) {
+            f.offset = offset;
+            f.padding = (f.align - offset % f.align) % f.align;
+            offset += f.padding + f.bytes.size() + branch_size(f);
+        }
+        grew = false;
+        for (auto &f : fragments) {
+            if (!f.branch.empty() && !f.long_branch) {
+                long end = f.offset + f.padding + f.bytes.size() + 2;
+                if (!fits_byte(symbol_offset(obj, obj.symbols.at(f.branch)) + f.addend - end)) {
+                    f.long_branch = true;
+                    grew = true;
+                }
+            }
+        }
+    }
+}
+
+/*
+    Helper function to lay out the bytes of section s, filling in the fixups whose symbols it can
+    place itself and turning the rest into relocations
+    A reference to a local symbol is relocated against its section's symbol, as gas does, so only
+    global and undefined symbols need to be in the symbol table for the linker.
+*/
+void emit_section(ObjectFile &obj, int s) {
+    Section &sec = obj.sections[s];
+    vector<pair<long, Fixup>> fixups;
+    for (auto &f : sec.fragments) {
+        sec.data.insert(sec.data.end(), f.padding, sec.flags & SHF_EXECINSTR ? 0x90 : 0);
+        long start = sec.data.size();
+        sec.data.insert(sec.data.end(), f.bytes.begin(), f.bytes.end());
+        for (auto const &x : f.fixups) {
+            fixups.push_back({start + x.offset, x});
+        }
+        if (f.branch.empty()) {
+            continue;
+        }
+        long end = sec.data.size() + branch_size(f);
+        if (f.long_branch) {
+            if (f.condition < 0) {
+                sec.data.push_back(0xE9);
+            } else {
+                sec.data.push_back(0x0F);
+                sec.data.push_back(0x80 + f.condition);
+            }
+            fixups.push_back({(long)sec.data.size(), {0, f.branch, f.addend - 4, R_X86_64_PLT32}});
+            sec.data.insert(sec.data.end(), 4, 0);
+        } else {
+            sec.data.push_back(f.condition < 0 ? 0xEB : 0x70 + f.condition);
+            sec.data.push_back((symbol_offset(obj, obj.symbols.at(f.branch)) + f.addend - end) & 0xff);
+        }
+    }
+
+    for (auto const &p : fixups) {
+        long place = p.first;
+        const Fixup &x = p.second;
+        const ObjectSymbol &sym = obj.symbols.at(x.symbol);
+        bool relative = x.type == R_X86_64_PC32 || x.type == R_X86_64_PLT32;
+        bool local = sym.section >= 0 && !sym.global;
+        long value = local ? symbol_offset(obj, sym) : 0;
+        if (local && relative && sym.section == s) {
+            long v = value + x.addend - place;
+            if (!fits_int32(v)) {
+                throw runtime_error(x.symbol + " is out of reach");
+            }
+            for (int i = 0; i < 4; ++i) {
+                sec.data[place + i] = v >> (8 * i) & 0xff;
+            }
+        } else if (local) {
+            sec.relocations.push_back({place, obj.sections[sym.section].symbol, relative ? R_X86_64_PC32 : x.type,
+                                       value + x.addend});
+        } else {
+            sec.relocations.push_back({place, sym.index, x.type, x.addend});
+        }
+    }
+}
+
+void put(vector<unsigned char> &out, unsigned long value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        out.push_back(value >> (8 * i) & 0xff);
+    }
+}
+
+/*
+    Helper function to add name to a string table, returning its offset
+*/
+long add_string(vector<unsigned char> &table, const string name) {
+    long offset = table.size();
+    table.insert(table.end(), name.begin(), name.end());
+    table.push_back(0);
+    return offset;
+}
+
+/*
+    Lay out obj and write it to out as an ELF64 relocatable object
+    The symbol table has the sections, then the local symbols other than .L labels, then the global
+    and undefined ones, as the format wants the locals first.
+*/
+void write_object(ObjectFile &obj, ostream &out) {
+    if (obj.sections.empty()) {
+        assemble_line(obj, "");
+    }
+    // no executable stack
+    switch_section(obj, ".note.GNU-stack");
+
+    for (size_t i = 0; i < obj.sections.size(); ++i) {
+        obj.sections[i].index = i + 1;
+        obj.sections[i].symbol = i + 1;
+        layout_section(obj, i);
+    }
+
+    Section symtab, strtab;
+    symtab.data.assign(sym_size, 0);
+    strtab.data.push_back(0);
+    for (auto const &sec : obj.sections) {
+        put(symtab.data, 0, 4);
+        put(symtab.data, STB_LOCAL << 4 | STT_SECTION, 1);
+        put(symtab.data, 0, 1);
+        put(symtab.data, sec.index, 2);
+        put(symtab.data, 0, 16);
+    }
+    int count = obj.sections.size() + 1;
+    int first_global = 0;
+    for (int pass = 0; pass < 2; ++pass) {
+        if (pass == 1) {
+            first_global = count;
+        }
+        for (auto const &name : obj.symbol_order) {
+            ObjectSymbol &sym = obj.symbols.at(name);
+            bool global = sym.global || sym.section < 0;
+            if (global != (pass == 1) || (!global && name.compare(0, 2, ".L") == 0)) {
+                continue;
+            }
+            long value = sym.section >= 0 ? symbol_offset(obj, sym) : 0;
+            long size = sym.size;
+            if (sym.size_section >= 0) {
+                size = obj.sections[sym.size_section].fragments[sym.size_fragment].offset - value;
+            }
+            sym.index = count++;
+            put(symtab.data, add_string(strtab.data, name), 4);
+            put(symtab.data, (global ? STB_GLOBAL : STB_LOCAL) << 4 | sym.type, 1);
+            put(symtab.data, 0, 1);
+            put(symtab.data, sym.section >= 0 ? obj.sections[sym.section].index : 0, 2);
+            put(symtab.data, value, 8);
+            put(symtab.data, size, 8);
+        }
+    }
+    for (size_t i = 0; i < obj.sections.size(); ++i) {
+        emit_section(obj, i);
+    }
+
+    // the headers after the sections of the listing: their relocations, the symbols and the names
+    vector<Section> headers = obj.sections;
+    int symtab_index = headers.size() + 1;
+    for (auto const &sec : obj.sections) {
+        if (!sec.relocations.empty()) {
+            symtab_index++;
+        }
+    }
+    for (auto const &sec : obj.sections) {
+        if (sec.relocations.empty()) {
+            continue;
+        }
+        Section rela;
+        rela.name = ".rela" + sec.name;
+        rela.type = SHT_RELA;
+        rela.flags = SHF_INFO_LINK;
+        rela.entsize = rela_size;
+        rela.align = 8;
+        rela.link = symtab_index;
+        rela.info = sec.index;
+        for (auto const &r : sec.relocations) {
+            put(rela.data, r.offset, 8);
+            put(rela.data, (unsigned long)r.symbol << 32 | r.type, 8);
+            put(rela.data, r.addend, 8);
+        }
+        headers.push_back(rela);
+    }
+    symtab.name = ".symtab";
+    symtab.type = SHT_SYMTAB;
+    symtab.flags = 0;
+    symtab.entsize = sym_size;
+    symtab.align = 8;
+    symtab.link = symtab_index + 1;
+    symtab.info = first_global;
+    headers.push_back(symtab);
+    strtab.name = ".strtab";
+    strtab.type = SHT_STRTAB;
+    strtab.flags = 0;
+    strtab.entsize = 0;
+    strtab.align = 1;
+    strtab.link = 0;
+    strtab.info = 0;
+    headers.push_back(strtab);
+    Section shstrtab = strtab;
+    shstrtab.name = ".shstrtab";
+    shstrtab.data.assign(1, 0);
+    headers.push_back(shstrtab);
+
+    vector<long> names;
+    for (auto const &h : headers) {
+        names.push_back(add_string(headers.back().data, h.name));
+    }
+
+    vector<unsigned char> image(ehdr_size, 0);
+    vector<long> offsets;
+    for (auto const &h : headers) {
+        while (image.size() % h.align) {
+            image.push_back(0);
+        }
+        offsets.push_back(image.size());
+        if (h.type != SHT_NOBITS) {
+            image.insert(image.end(), h.data.begin(), h.data.end());
+        }
+    }
+    while (image.size() % 8) {
+        image.push_back(0);
+    }
+    long shoff = image.size();
+    image.insert(image.end(), shdr_size, 0);
+    for (size_t i = 0; i < headers.size(); ++i) {
+        const Section &h = headers[i];
+        put(image, names[i], 4);
+        put(image, h.type, 4);
+        put(image, h.flags, 8);
+        put(image, 0, 8);
+        put(image, offsets[i], 8);
+        put(image, h.data.size(), 8);
+        put(image, h.link, 4);
+        put(image, h.info, 4);
+        put(image, h.align, 8);
+        put(image, h.entsize, 8);
+    }
+
+    vector<unsigned char> ehdr = {0x7F, 'E', 'L', 'F', 2, 1, 1, 0};
+    put(ehdr, 0, 8);
+    put(ehdr, ET_REL, 2);
+    put(ehdr, EM_X86_64, 2);
+    put(ehdr, 1, 4);
+    put(ehdr, 0, 8);
+    put(ehdr, 0, 8);
+    put(ehdr, shoff, 8);
+    put(ehdr, 0, 4);
+    put(ehdr, ehdr_size, 2);
+    put(ehdr, 0, 2);
+    put(ehdr, 0, 2);
+    put(ehdr, shdr_size, 2);
+    put(ehdr, headers.size() + 1, 2);
+    put(ehdr, headers.size(), 2);
+    copy(ehdr.begin(), ehdr.end(), image.begin());
+    out.write((const char *)image.data(), image.size());
+}
+
+/*
+    Assemble a --emit=gas listing and write it to out as an ELF object, for --emit=obj
+    Throws on a line it can't assemble
+*/
+void assemble_object(const string &assembly, ostream &out) {
+    ObjectFile obj;
+    string line;
+    for (size_t start = 0; start < assembly.size();) {
+        size_t end = min(assembly.find('\n', start), assembly.size());
+        line.assign(assembly, start, end - start);
+        assemble_line(obj, line);
+        start = end + 1;
+    }
+    write_object(obj, out);
+}
@@ -0,0 +1,94 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "encode.h"
+
+using namespace std;
+
+/*
+    A run of a section's bytes, ending in the jmp or jcc to a label whose size the layout decides
+    A label always starts a fragment, so its offset is known once the fragments before it are sized
+*/
+class Fragment {
+   public:
+    long align;      // boundary the fragment starts on, 1 for any
+    vector<unsigned char> bytes;
+    vector<Fixup> fixups;  // offsets into bytes
+    string branch;   // "" for none
+    long addend;     // of the branch target
+    int condition;   // of a jcc, -1 for a jmp
+    bool long_branch;
+
+    long offset;     // from the start of the section, padding included
+    long padding;    // before the bytes, to the boundary
+};
+
+/*
+    A relocation for the linker: the place in a section it patches, the symbol table entry it
+    refers to and what it adds
+*/
+class Relocation {
+   public:
+    long offset;
+    int symbol;
+    int type;
+    long addend;
+};
+
+/*
+    An ELF section of the object, its contents as fragments until it is laid out
+*/
+class Section {
+   public:
+    string name;
+    int type;   // SHT_*
+    long flags;  // SHF_*
+    long entsize;
+    long align;
+    int link;  // sh_link and sh_info, for the relocation and symbol sections
+    int info;
+    vector<Fragment> fragments;
+
+    vector<unsigned char> data;
+    vector<Relocation> relocations;
+    int index;  // in the section header table
+    int symbol;  // its own symbol table entry, relocations against local symbols go through it
+};
+
+/*
+    A label or symbol of the object: defined in a section, or only referred to and left to the linker
+*/
+class ObjectSymbol {
+   public:
+    int section;   // -1 when undefined
+    size_t fragment;
+    long value;    // offset in the section once laid out
+    bool global;
+    int type;      // STT_*
+    long size;
+    int size_section;  // where the ".size sym, .-sym" was, -1 for a constant size
+    size_t size_fragment;
+    int index;     // in the symbol table, -1 for the .L labels that stay out of it
+};
+
+/*
+    An object file being assembled from the lines of a --emit=gas listing
+*/
+class ObjectFile {
+   public:
+    vector<Section> sections;
+    unordered_map<string, ObjectSymbol> symbols;  // one lookup per label, branch and fixup
+    vector<string> symbol_order;  // in the order they were first seen, for a stable symbol table
+    int current;  // section the lines go to
+};
+
+void assemble_line(ObjectFile &obj, const string &line);
+void write_object(ObjectFile &obj, ostream &out);
+void assemble_object(const string &assembly, ostream &out);
+
+#endif
@@ -0,0 +1,185 @@
+#include <climits>
+#include <map>
+
+#include "cfg.h"
+#include "main.h"
+#include "passes.h"
+#include "sched.h"
+
+using namespace std;
+
+// every pass, in the order they run within their stage
+const vector<Pass> passes = {
+    {"ipcp", "source", "12s", "propagate constant arguments across calls, cloning hot call sites"},
+    {"interchange", "source", "12s", "swap the loops of a nest that walks its arrays a row at a time"},
+    {"tile", "source", "12", "tile a loop nest whose rows fall out of the cache"},
+    {"fill-copy", "translate", "12s", "replace loops that fill or copy an array"},
+    {"reduce", "translate", "12", "vectorize sum, min and max reductions"},
+    {"vectorize", "translate", "2", "vectorize element-wise loops"},
+    {"unroll", "translate", "012", "repeat the straight line bodies of loops the profile found hot"},
+    {"unroll-const", "translate", "2", "repeat the straight line bodies of loops with a constant trip count"},
+    {"hot-cold", "translate", "012s", "move if bodies the profile found unlikely behind the function"},
+    {"gvn", "function", "12s", "reuse the values registers and stack slots already hold"},
+    {"shrink", "function", "s", "shorter encodings of the same instructions"},
+    {"schedule", "function", "2", "reorder each block's instructions to hide load and multiply latency"},
+};
+
+// the -O level whose pipeline runs, '0', '1', '2' or 's'
+char pipeline = '0';
+
+// -f<pass> and -fno-<pass>, over the pipeline
+map<string, bool> pass_overrides;
+
+/*
+    Picks the pipeline of "-O0", "-O1", "-O2" or "-Os" by the part after the "O"
+    Returns false for any other level
+*/
+bool set_optimize_level(const string level) {
+    if (level.size() != 1 || string("012s").find(level[0]) == string::npos) {
+        return false;
+    }
+    pipeline = level[0];
+    return true;
+}
+
+/*
+    Turns a pass on or off whatever the pipeline, returns false when there is no such pass
+*/
+bool set_pass_enabled(const string name, bool enabled) {
+    for (auto const &p : passes) {
+        if (p.name == name) {
+            pass_overrides[name] = enabled;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    Whether a pass runs: as -f / -fno- said, otherwise when the pipeline has it or by_default is
+    set, which is how a vector target turns on the vector passes at any level
+*/
+bool pass_enabled(const string name, bool by_default) {
+    auto found = pass_overrides.find(name);
+    if (found != pass_overrides.end()) {
+        return found->second;
+    }
+    for (auto const &p : passes) {
+        if (p.name == name) {
+            return by_default || p.levels.find(pipeline) != string::npos;
+        }
+    }
+    return false;
+}
+
+/*
+    Whether -Os asked for the smaller of two ways to translate something
+*/
+bool optimize_for_size() {
+    return pipeline == 's';
+}
+
+/*
+    Whether any source pass is enabled, so the whole file has to be read before translating it
+*/
+bool source_passes_enabled() {
+    return pass_enabled("ipcp") || pass_enabled("interchange") || pass_enabled("tile");
+}
+
+/*
+    Runs the source passes over the lines of a whole file
+*/
+void run_source_passes(vector<vector<string>> &functions) {
+    if (pass_enabled("ipcp")) {
+        ScopedTimer timer(stats, stats.passes, "ipcp");
+        int clones = 0;
+        stats.count("constants_propagated", propagate_constants(functions, clones));
+        stats.count("constprop_clones", clones);
+    }
+    if (pass_enabled("interchange")) {
+        ScopedTimer timer(stats, stats.passes, "interchange");
+        stats.count("interchanged_loops", optimize_loop_nests(functions, false));
+    }
+    if (pass_enabled("tile")) {
+        ScopedTimer timer(stats, stats.passes, "tile");
+        stats.count("tiled_loops", optimize_loop_nests(functions, true));
+    }
+}
+
+/*
+    Runs the function passes over a translated function
+*/
+void run_function_passes(Function &f1) {
+    if (pass_enabled("gvn")) {
+        ScopedTimer timer(stats, stats.passes, "gvn");
+        stats.count("value_numbering_rewrites", value_numbering(f1));
+    }
+    if (pass_enabled("shrink")) {
+        ScopedTimer timer(stats, stats.passes, "shrink");
+        stats.count("shrunk_instructions", shrink_encodings(f1));
+    }
+    if (pass_enabled("schedule")) {
+        ScopedTimer timer(stats, stats.passes, "schedule");
+        int renamed = 0;
+        stats.count("scheduled_instructions", schedule_instructions(f1, renamed));
+        stats.count("renamed_values", renamed);
+    }
+}
+
+/*
+    Rewrites instructions into shorter encodings of the same operation, for -Os
+        movq $5, %rdx       movl $5, %edx       the 32 bit move zero extends, 5 bytes instead of 7
+        cmpl $0, %eax       testl %eax, %eax    sets the same flags, 2 bytes instead of 3
+        addl $1, x          incl x              when nothing reads the flags, inc leaves CF alone
+        movl $0, %eax       xorl %eax, %eax     when nothing reads the flags xor sets, 2 bytes instead of 5
+    Returns the number of instructions rewritten
+*/
+int shrink_encodings(Function &f1) {
+    vector<string> &code = f1.assembly_instructions;
+    int rewritten = 0;
+    for (size_t i = 0; i < code.size(); ++i) {
+        if (!is_instruction_line(code[i])) {
+            continue;
+        }
+        string op = opcode_of(code[i]);
+        vector<string> ops = operands_of(code[i]);
+        if (ops.size() != 2 || ops[0][0] != '$' || !is_immediate(ops[0].substr(1))) {
+            continue;
+        }
+        long imm = stol(ops[0].substr(1));
+        string family;
+        int width;
+        bool reg = parse_register(ops[1], family, width);
+        string shorter;
+        if (op == "movq" && reg && imm >= 0 && imm <= INT_MAX) {
+            shorter = "movl " + ops[0] + ", " + register_name(family, 4);
+        } else if ((op == "cmpl" || op == "cmpq") && reg && imm == 0) {
+            shorter = "test" + op.substr(3) + " " + ops[1] + ", " + ops[1];
+        } else if ((op == "addl" || op == "addq" || op == "subl" || op == "subq") && (imm == 1 || imm == -1) &&
+                   !flags_live(code, i)) {
+            shorter = ((op[0] == 'a') == (imm == 1) ? "inc" : "dec") + op.substr(3) + " " + ops[1];
+        } else if (op == "movl" && reg && imm == 0 && !flags_live(code, i)) {
+            shorter = "xorl " + ops[1] + ", " + ops[1];
+        }
+        if (!shorter.empty()) {
+            code[i] = shorter;
+            rewritten++;
+        }
+    }
+    return rewritten;
+}
+
+/*
+    The --time-passes table: the passes that ran, in pipeline order, with how often and how long
+*/
+string pass_report(const Stats &s) {
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%-14s %8s %12s %12s\n", "pass", "calls", "total_ms", "self_ms");
+    string out = buf;
+    for (auto const &p : passes) {
+        if (s.passes.count(p.name)) {
+            out += Stats::timer_row(p.name, s.passes.at(p.name));
+        }
+    }
+    return out;
+}
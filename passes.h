@@ -0,0 +1,39 @@
+#ifndef PASSES_H
+#define PASSES_H
+
+#include <string>
+#include <vector>
+
+#include "Function.h"
+#include "Stats.h"
+
+using namespace std;
+
+/*
+    An optimization pass, by the name -f<name> / -fno-<name> turn it on or off with
+    stage is where it runs: "source" rewrites the lines of the whole file before any function is
+    translated, "translate" is a choice the handlers make while translating, "function" rewrites
+    a translated function's instructions
+    levels are the -O pipelines that have it, of '0', '1', '2' and 's'
+*/
+class Pass {
+   public:
+    string name;
+    string stage;
+    string levels;
+    string description;
+};
+
+extern const vector<Pass> passes;
+
+bool set_optimize_level(const string level);
+bool set_pass_enabled(const string name, bool enabled);
+bool pass_enabled(const string name, bool by_default = false);
+bool optimize_for_size();
+bool source_passes_enabled();
+void run_source_passes(vector<vector<string>> &functions);
+void run_function_passes(Function &f1);
+int shrink_encodings(Function &f1);
+string pass_report(const Stats &s);
+
+#endif
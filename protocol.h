@@ -0,0 +1,83 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+/*
+    Wire format of the --serve compile server, shared with the client
+
+    request:   u32 flags, u32 length, <length bytes of source>
+    response:  u32 status, u32 length, <length bytes of assembly, or an error message when status != 0>
+
+    Integers are in network byte order. A connection carries any number of requests, one after the other.
+*/
+const uint32_t SERVE_EMIT_GAS = 1;              // request flag, same as --emit=gas
+const uint32_t SERVE_EMIT_OBJ = 2;              // request flag, same as --emit=obj, the body is the object
+const uint32_t SERVE_OK = 0;                    // response status
+const uint32_t SERVE_ERROR = 1;                 // response status, the body is the error message
+const uint32_t SERVE_MAX_MESSAGE = 64u << 20;  // longest source or assembly accepted
+
+/*
+    Helper function to read exactly n bytes, returns false on EOF or error
+*/
+inline bool read_full(int fd, void *buf, size_t n) {
+    char *p = static_cast<char *>(buf);
+    while (n > 0) {
+        ssize_t got = read(fd, p, n);
+        if (got <= 0) {
+            return false;
+        }
+        p += got;
+        n -= got;
+    }
+    return true;
+}
+
+/*
+    Helper function to write exactly n bytes, returns false on error
+*/
+inline bool write_full(int fd, const void *buf, size_t n) {
+    const char *p = static_cast<const char *>(buf);
+    while (n > 0) {
+        ssize_t put = write(fd, p, n);
+        if (put <= 0) {
+            return false;
+        }
+        p += put;
+        n -= put;
+    }
+    return true;
+}
+
+/*
+    Helper function to read one message: its header word (flags or status) and body
+*/
+inline bool read_message(int fd, uint32_t &head, string &body) {
+    uint32_t words[2];
+    if (!read_full(fd, words, sizeof(words))) {
+        return false;
+    }
+    head = ntohl(words[0]);
+    uint32_t length = ntohl(words[1]);
+    if (length > SERVE_MAX_MESSAGE) {
+        return false;
+    }
+    body.resize(length);
+    return length == 0 || read_full(fd, &body[0], length);
+}
+
+/*
+    Helper function to write one message: its header word (flags or status) and body
+*/
+inline bool write_message(int fd, uint32_t head, const string &body) {
+    uint32_t words[2] = {htonl(head), htonl(static_cast<uint32_t>(body.size()))};
+    return write_full(fd, words, sizeof(words)) && write_full(fd, body.data(), body.size());
+}
+
+#endif
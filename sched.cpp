@@ -0,0 +1,572 @@
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <map>
+
+#include "cfg.h"
+#include "cost.h"
+#include "gvn.h"
+#include "sched.h"
+
+using namespace std;
+
+// where a renamed value can go: scratch registers that nothing the handlers emit uses without naming them
+const vector<string> rename_pool = {"r8", "r9", "r10", "r11"};
+
+// the shifts among binary_opcodes, which read one byte of their count and may leave it implied
+const vector<string> shift_opcodes = {"sal", "sar", "shl", "shr"};
+
+// instructions in a region at most, the dependences are quadratic in its size
+const size_t max_region = 256;
+
+// values held in registers at once past which the instructions that end one go first
+const int max_live_values = 6;
+
+/*
+    Helper function to describe a memory operand and note the registers its address reads
+*/
+void access_memory(SchedNode &node, const string op, int width, bool load, bool store) {
+    MemoryAccess m;
+    m.width = width;
+    m.load = load;
+    m.store = store;
+    m.disp = 0;
+    string disp = op.substr(0, op.find('('));
+    vector<string> parts(1);
+    for (char c : op.substr(op.find('(') + 1, op.rfind(')') - op.find('(') - 1)) {
+        if (c == ',') {
+            parts.push_back("");
+        } else if (c != ' ') {
+            parts.back() += c;
+        }
+    }
+    string family;
+    int reg_width;
+    for (size_t p = 0; p < parts.size() && p < 2; ++p) {
+        if (parse_register(parts[p], family, reg_width)) {
+            node.reads.insert(family);
+        }
+    }
+    string base = parts[0];
+    if (base == "%rbp") {
+        m.kind = parts.size() > 1 ? 'x' : 's';
+        m.disp = disp.empty() ? 0 : stol(disp);
+    } else if (base == "%rip" || (base.empty() && !disp.empty() && !isdigit(disp[0]) && disp[0] != '-')) {
+        m.kind = 'g';
+        m.symbol = disp.substr(0, disp.find_first_of("+-"));
+    } else if (base == "%rsp") {
+        m.kind = 'a';
+    } else {
+        m.kind = 'o';
+    }
+    if (load || store) {
+        node.memory.push_back(m);
+    }
+}
+
+/*
+    Helper function to note an operand the instruction reads
+*/
+void use_operand(SchedNode &node, const string op, int width) {
+    string family;
+    int reg_width;
+    if (parse_register(op, family, reg_width)) {
+        node.reads.insert(family);
+    } else if (op.find('(') != string::npos) {
+        access_memory(node, op, width, true, false);
+    }
+}
+
+/*
+    Helper function to note an operand the instruction writes, and reads too when it updates it
+    A write of 1 or 2 bytes keeps the rest of the register, so it reads it as well
+*/
+void define_operand(SchedNode &node, const string op, int width, bool updates) {
+    string family;
+    int reg_width;
+    if (parse_register(op, family, reg_width)) {
+        node.writes.insert(family);
+        if (updates || reg_width < 4) {
+            node.reads.insert(family);
+        }
+    } else if (op.find('(') != string::npos) {
+        access_memory(node, op, width, updates, true);
+    }
+}
+
+/*
+    Work out which registers, flags and memory an instruction reads and writes
+    Returns false for anything the scheduler doesn't move: jumps, calls, the stack, vector
+    instructions, string instructions and whatever else it doesn't know
+*/
+bool describe_instruction(const string ins, SchedNode &node) {
+    node.reads.clear();
+    node.writes.clear();
+    node.implicit.clear();
+    node.memory.clear();
+    node.reads_flags = false;
+    node.writes_flags = false;
+
+    string op = opcode_of(ins);
+    vector<string> ops = operands_of(ins);
+    string family;
+    int width;
+    for (auto const &o : ops) {
+        if (o.empty() || o[0] == '*' || (o[0] == '%' && !parse_register(o, family, width)) ||
+            (o[0] == '%' && (family == "rsp" || family == "rbp"))) {
+            return false;
+        }
+    }
+
+    string base;
+    int w = 8;
+    if (split_opcode(op, {"mov"}, base, w) && ops.size() == 2) {
+        use_operand(node, ops[0], w);
+        define_operand(node, ops[1], w, false);
+    } else if (op.size() == 6 && (op.find("movs") == 0 || op.find("movz") == 0) && suffix_width(op[4]) &&
+               suffix_width(op[5]) && ops.size() == 2) {
+        // movslq, movzbl, ... read one width and write another
+        use_operand(node, ops[0], suffix_width(op[4]));
+        define_operand(node, ops[1], suffix_width(op[5]), false);
+    } else if (split_opcode(op, {"lea"}, base, w) && ops.size() == 2 && ops[0].find('(') != string::npos) {
+        access_memory(node, ops[0], w, false, false);
+        define_operand(node, ops[1], w, false);
+    } else if (split_opcode(op, binary_opcodes, base, w) && ops.size() == 3 && base == "imul") {
+        use_operand(node, ops[1], w);
+        define_operand(node, ops[2], w, false);
+        node.writes_flags = true;
+    } else if (split_opcode(op, binary_opcodes, base, w) && (ops.size() == 2 || ops.size() == 1)) {
+        bool shift = find(shift_opcodes.begin(), shift_opcodes.end(), base) != shift_opcodes.end();
+        if (ops.size() == 2 && (base == "xor" || base == "sub") && ops[0] == ops[1] && ops[0][0] == '%') {
+            // zeroing, which doesn't depend on what the register held
+            define_operand(node, ops[1], w, false);
+        } else {
+            if (ops.size() == 2) {
+                use_operand(node, ops[0], shift ? 1 : w);
+            } else if (!shift) {
+                return false;
+            }
+            define_operand(node, ops.back(), w, true);
+        }
+        // a shift by %cl of 0 leaves the flags as they were
+        node.reads_flags = shift && ops.size() == 2 && ops[0][0] == '%';
+        node.writes_flags = true;
+    } else if ((split_opcode(op, {"cmp"}, base, w) || split_opcode(op, {"test"}, base, w)) && ops.size() == 2) {
+        use_operand(node, ops[0], w);
+        use_operand(node, ops[1], w);
+        node.writes_flags = true;
+    } else if (split_opcode(op, unary_opcodes, base, w) && ops.size() == 1) {
+        define_operand(node, ops[0], w, true);
+        // inc and dec keep the carry flag
+        node.reads_flags = base == "inc" || base == "dec";
+        node.writes_flags = base != "not";
+    } else if (op.find("set") == 0 && ops.size() == 1) {
+        define_operand(node, ops[0], 1, false);
+        node.reads_flags = true;
+    } else if (op.find("cmov") == 0 && ops.size() == 2 && parse_register(ops[1], family, w)) {
+        use_operand(node, ops[0], w);
+        define_operand(node, ops[1], w, true);
+        node.reads_flags = true;
+    } else if ((op == "cltq" || op == "cltd" || op == "cqto") && ops.empty()) {
+        string dest = op == "cltq" ? "rax" : "rdx";
+        node.reads.insert("rax");
+        node.writes.insert(dest);
+        node.implicit = {"rax", dest};
+    } else if ((split_opcode(op, {"idiv"}, base, w) || split_opcode(op, {"div"}, base, w)) && ops.size() == 1) {
+        use_operand(node, ops[0], w);
+        node.reads.insert({"rax", "rdx"});
+        node.writes.insert({"rax", "rdx"});
+        node.implicit = {"rax", "rdx"};
+        node.writes_flags = true;
+    } else {
+        return false;
+    }
+    node.latency = instruction_cost(ins).latency;
+    return true;
+}
+
+/*
+    Helper function to tell whether two memory accesses may touch the same bytes
+    A local array can be indexed anywhere from its start up to %rbp. Pointers and symbols don't
+    reach this frame, except the local arrays from escape_floor up whose address was taken.
+*/
+bool may_overlap(const MemoryAccess &a, const MemoryAccess &b, long escape_floor) {
+    bool a_frame = a.kind == 's' || a.kind == 'x';
+    bool b_frame = b.kind == 's' || b.kind == 'x';
+    if (a.kind == 'a' || b.kind == 'a') {
+        return true;
+    } else if (a_frame && b_frame) {
+        if (a.kind == 's' && b.kind == 's') {
+            return a.disp < b.disp + b.width && b.disp < a.disp + a.width;
+        }
+        const MemoryAccess &slot = a.kind == 's' ? a : b;
+        const MemoryAccess &array = a.kind == 's' ? b : a;
+        return slot.kind == 'x' || slot.disp + slot.width > array.disp;
+    } else if (a_frame || b_frame) {
+        const MemoryAccess &frame = a_frame ? a : b;
+        const MemoryAccess &other = a_frame ? b : a;
+        if (other.kind == 'g') {
+            return false;
+        }
+        return frame.kind == 'x' ? escape_floor != LONG_MAX : frame.disp + frame.width > escape_floor;
+    } else if (a.kind == 'g' && b.kind == 'g') {
+        return a.symbol == b.symbol;
+    }
+    return true;
+}
+
+/*
+    Helper function to rewrite every name of one register family in an instruction to another's
+*/
+string rename_register(const string ins, const string from, const string to) {
+    string out;
+    size_t i = 0;
+    while (i < ins.size()) {
+        if (ins[i] != '%') {
+            out += ins[i++];
+            continue;
+        }
+        size_t j = i + 1;
+        while (j < ins.size() && isalnum(ins[j])) {
+            j++;
+        }
+        string reg = ins.substr(i, j - i);
+        string family;
+        int width;
+        if (parse_register(reg, family, width) && family == from) {
+            reg = register_name(to, width);
+        }
+        out += reg;
+        i = j;
+    }
+    return out;
+}
+
+/*
+    Helper function to move the register values of a region into the free scratch registers
+    A value is the instructions from one that writes a whole register without reading it up to
+    the next such write. Only values written again inside the region move, as they are dead
+    after it, and a free register takes a value when the last one it got has been read for the
+    last time, so the values that overlap get different registers. Statements that each go
+    through %eax can then overlap.
+    Returns how many values were renamed
+*/
+int rename_values(vector<SchedNode> &nodes, const vector<string> &free_regs) {
+    if (free_regs.empty()) {
+        return 0;
+    }
+    class Value {
+       public:
+        string family;
+        vector<int> nodes;
+        bool movable;
+    };
+    vector<Value> values;
+    map<string, int> current;  // family -> its open value
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const SchedNode &n = nodes[i];
+        set<string> touched = n.reads;
+        touched.insert(n.writes.begin(), n.writes.end());
+        for (auto const &family : touched) {
+            if (family == "rbp" || family == "rsp") {
+                continue;
+            }
+            auto open = current.find(family);
+            if (n.writes.count(family) && !n.reads.count(family) && !n.implicit.count(family)) {
+                values.push_back({family, {(int)i}, true});
+                current[family] = values.size() - 1;
+            } else if (open != current.end()) {
+                values[open->second].nodes.push_back(i);
+                values[open->second].movable = values[open->second].movable && !n.implicit.count(family);
+            }
+        }
+    }
+
+    // the values still open at the end of the region may be read after it
+    set<int> still_open;
+    for (auto const &c : current) {
+        still_open.insert(c.second);
+    }
+
+    int renamed = 0;
+    map<string, int> free_after;  // free register -> last node reading the value it got
+    for (auto const &r : free_regs) {
+        free_after[r] = -1;
+    }
+    for (size_t v = 0; v < values.size(); ++v) {
+        const Value &value = values[v];
+        if (!value.movable || still_open.count(v) || value.nodes.size() < 2) {
+            continue;
+        }
+        string to = "";
+        for (auto const &r : free_regs) {
+            if (free_after[r] <= value.nodes.front() && (to.empty() || free_after[r] < free_after[to])) {
+                to = r;
+            }
+        }
+        if (to.empty()) {
+            continue;
+        }
+        free_after[to] = value.nodes.back();
+        for (int i : value.nodes) {
+            string &ins = nodes[i].lines.back();
+            ins = rename_register(ins, value.family, to);
+            describe_instruction(ins, nodes[i]);
+        }
+        renamed++;
+    }
+    return renamed;
+}
+
+void add_dependence(vector<SchedNode> &nodes, int from, int to, double latency) {
+    if (from != to) {
+        nodes[from].succs.push_back({to, latency});
+        nodes[to].preds_left++;
+    }
+}
+
+/*
+    Helper function to link the instructions of a region by what each has to wait for
+    A register or memory result is waited for its latency; a later write to what an earlier
+    instruction reads or writes only has to come after it. The flags are a value only where an
+    instruction reads them: the one that set them and the readers are kept together, and an
+    instruction that sets them can't come in between.
+*/
+void add_dependences(vector<SchedNode> &nodes, long escape_floor, bool flags_live_out) {
+    map<string, int> last_writer;
+    map<string, vector<int>> readers;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        SchedNode &n = nodes[i];
+        for (auto const &r : n.reads) {
+            auto w = last_writer.find(r);
+            if (w != last_writer.end()) {
+                add_dependence(nodes, w->second, i, nodes[w->second].latency);
+                if (find(n.value_preds.begin(), n.value_preds.end(), w->second) == n.value_preds.end()) {
+                    n.value_preds.push_back(w->second);
+                    nodes[w->second].uses_left++;
+                }
+            }
+        }
+        for (auto const &r : n.writes) {
+            for (int reader : readers[r]) {
+                add_dependence(nodes, reader, i, 0);
+            }
+            if (last_writer.count(r)) {
+                add_dependence(nodes, last_writer[r], i, 0);
+            }
+            last_writer[r] = i;
+            readers[r].clear();
+        }
+        for (auto const &r : n.reads) {
+            if (!n.writes.count(r)) {
+                readers[r].push_back(i);
+            }
+        }
+
+        for (size_t j = 0; j < i; ++j) {
+            for (auto const &a : nodes[j].memory) {
+                for (auto const &b : n.memory) {
+                    if ((a.store || b.store) && may_overlap(a, b, escape_floor)) {
+                        add_dependence(nodes, j, i, a.store && b.load ? nodes[j].latency : 0);
+                    }
+                }
+            }
+        }
+    }
+
+    // the flags: each setter with its readers, -1 for the flags the region starts with
+    vector<int> setters;
+    map<int, vector<int>> flag_readers;
+    int setter = -1;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (nodes[i].reads_flags) {
+            flag_readers[setter].push_back(i);
+        }
+        if (nodes[i].writes_flags) {
+            setters.push_back(i);
+            setter = i;
+        }
+    }
+    for (auto const &f : flag_readers) {
+        for (int reader : f.second) {
+            if (f.first >= 0) {
+                add_dependence(nodes, f.first, reader, nodes[f.first].latency);
+            }
+            for (int later : setters) {
+                if (later > reader) {
+                    add_dependence(nodes, reader, later, 0);
+                }
+            }
+        }
+    }
+    for (int s : setters) {
+        bool read = flag_readers.count(s) || (flags_live_out && s == setter);
+        for (int earlier : setters) {
+            if (read && earlier < s) {
+                add_dependence(nodes, earlier, s, 0);
+            }
+        }
+    }
+}
+
+/*
+    Helper function to list schedule one region of a function, lines [begin, end) of its code
+    Every cycle the core starts up to its issue width of the instructions whose inputs are ready,
+    the one with the longest latency path to the end of the region first. With more than
+    max_live_values register values waiting to be read, those that end one go first instead.
+    Comments and blank lines move with the instruction after them, the ones after the last
+    instruction stay at the end.
+    Returns how many instructions changed place
+*/
+int schedule_region(vector<string> &code, size_t begin, size_t end, vector<SchedNode> &nodes,
+                    const vector<string> &free_regs, long escape_floor, int &renamed) {
+    if (nodes.size() < 2) {
+        return 0;
+    }
+    bool flags_out = flags_live(code, end - 1);
+    renamed += rename_values(nodes, free_regs);
+    add_dependences(nodes, escape_floor, flags_out);
+
+    for (int i = nodes.size() - 1; i >= 0; --i) {
+        nodes[i].height = nodes[i].latency;
+        for (auto const &s : nodes[i].succs) {
+            nodes[i].height = max(nodes[i].height, s.second + nodes[s.first].height);
+        }
+        nodes[i].earliest = 0;
+    }
+
+    int width = current_tune().issue_width;
+    vector<int> order;
+    vector<bool> done(nodes.size(), false);
+    double cycle = 0;
+    int issued = 0;
+    int live = 0;
+    while (order.size() < nodes.size()) {
+        int best = -1;
+        int best_delta = 0;
+        double next_cycle = -1;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (done[i] || nodes[i].preds_left > 0) {
+                continue;
+            }
+            if (nodes[i].earliest > cycle) {
+                next_cycle = next_cycle < 0 ? nodes[i].earliest : min(next_cycle, nodes[i].earliest);
+                continue;
+            }
+            int delta = nodes[i].uses_left > 0 ? 1 : 0;
+            for (int p : nodes[i].value_preds) {
+                delta -= nodes[p].uses_left == 1 ? 1 : 0;
+            }
+            bool better;
+            if (best < 0) {
+                better = true;
+            } else if (live >= max_live_values && delta != best_delta) {
+                better = delta < best_delta;
+            } else {
+                better = nodes[i].height > nodes[best].height;
+            }
+            if (better) {
+                best = i;
+                best_delta = delta;
+            }
+        }
+        if (best < 0 || issued >= width) {
+            // nothing can start this cycle
+            cycle = best < 0 && next_cycle > cycle ? next_cycle : cycle + 1;
+            issued = 0;
+            continue;
+        }
+
+        SchedNode &n = nodes[best];
+        done[best] = true;
+        order.push_back(best);
+        issued++;
+        live += n.uses_left > 0 ? 1 : 0;
+        for (int p : n.value_preds) {
+            nodes[p].uses_left--;
+            live -= nodes[p].uses_left == 0 ? 1 : 0;
+        }
+        for (auto const &s : n.succs) {
+            nodes[s.first].preds_left--;
+            nodes[s.first].earliest = max(nodes[s.first].earliest, cycle + s.second);
+        }
+    }
+
+    int moved = 0;
+    size_t at = begin;
+    for (size_t k = 0; k < order.size(); ++k) {
+        moved += order[k] != (int)k ? 1 : 0;
+        for (auto &line : nodes[order[k]].lines) {
+            code[at++].swap(line);
+        }
+    }
+    return moved;
+}
+
+/*
+    Reorder the instructions of each basic block of a translated function to hide the latency of
+    loads, multiplies and divides behind independent work, for the -mtune target
+    A region is a run of instructions the scheduler knows, between labels, directives and the
+    rest, which stay where they are; the starts and latches of loops are region boundaries too,
+    so the positions in Function::loops still hold. The lines of the function don't change in
+    number.
+    Returns how many instructions changed place, and the values moved to other registers in renamed
+*/
+int schedule_instructions(Function &f1, int &renamed) {
+    vector<string> &code = f1.assembly_instructions;
+    set<size_t> boundaries;
+    for (auto const &loop : f1.loops) {
+        boundaries.insert({loop.begin, loop.latch, loop.end});
+    }
+
+    // a scratch register is free when the function doesn't name it at all; "%r8" is in each of
+    // its names
+    vector<string> free_regs;
+    for (auto const &family : rename_pool) {
+        string name = "%" + family;
+        bool named = false;
+        for (size_t i = 0; i < code.size() && !named; ++i) {
+            named = code[i].find(name) != string::npos;
+        }
+        if (!named) {
+            free_regs.push_back(family);
+        }
+    }
+
+    long escape_floor = LONG_MAX;
+    for (auto const &s : code) {
+        if (opcode_of(s) == "leaq" && s.find("(%rbp)") != string::npos) {
+            string disp = operands_of(s)[0];
+            disp = disp.substr(0, disp.find('('));
+            escape_floor = min(escape_floor, disp.empty() ? 0 : stol(disp));
+        }
+    }
+
+    int moved = 0;
+    size_t begin = 0;
+    vector<SchedNode> nodes;
+    vector<string> pending;
+    for (size_t i = 0; i <= code.size(); ++i) {
+        SchedNode n;
+        bool instruction = i < code.size() && is_instruction_line(code[i]);
+        bool stays = i < code.size() && (is_label_line(code[i]) || (!code[i].empty() && code[i][0] == '.') ||
+                                         (instruction && !describe_instruction(code[i], n)));
+        if (i == code.size() || stays || boundaries.count(i) || nodes.size() == max_region) {
+            moved += schedule_region(code, begin, i - pending.size(), nodes, free_regs, escape_floor, renamed);
+            nodes.clear();
+            pending.clear();
+            begin = stays ? i + 1 : i;
+        }
+        if (i == code.size() || stays) {
+            continue;
+        }
+        pending.push_back(code[i]);
+        if (instruction) {
+            n.lines.swap(pending);
+            n.preds_left = 0;
+            n.uses_left = 0;
+            nodes.push_back(n);
+        }
+    }
+    return moved;
+}
@@ -0,0 +1,52 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Function.h"
+
+using namespace std;
+
+/*
+    A memory operand, as much as the scheduler needs to tell whether two of them may overlap
+*/
+class MemoryAccess {
+   public:
+    char kind;      // 's' a -N(%rbp) slot, 'x' indexed off %rbp, 'g' a symbol, 'o' behind a pointer, 'a' anything
+    long disp;      // %rbp offset of 's' and 'x'
+    string symbol;  // of 'g'
+    int width;
+    bool load;
+    bool store;
+};
+
+/*
+    One instruction of a scheduling region, with the comments and blank lines that sat before it
+    Registers are named by family, "rax" for any of %rax, %eax, %ax and %al. The flags are kept
+    apart, as most instructions write them and few read them.
+*/
+class SchedNode {
+   public:
+    vector<string> lines;
+    set<string> reads;
+    set<string> writes;
+    set<string> implicit;  // the registers it uses without naming them, which can't be renamed
+    bool reads_flags;
+    bool writes_flags;
+    vector<MemoryAccess> memory;
+    double latency;
+
+    vector<pair<int, double>> succs;  // node and the cycles it waits for this one
+    int preds_left;
+    double height;                    // longest latency path from here to the end of the region
+    double earliest;
+    vector<int> value_preds;          // the nodes whose register results it reads
+    int uses_left;                    // the nodes yet to read its register results
+};
+
+bool describe_instruction(const string ins, SchedNode &node);
+int schedule_instructions(Function &f1, int &renamed);
+
+#endif
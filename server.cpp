@@ -0,0 +1,163 @@
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <sstream>
+
+#include "main.h"
+#include "protocol.h"
+
+using namespace std;
+
+static char listening_path[sizeof(sockaddr_un::sun_path)];
+
+/*
+    Remove the socket file when the server is stopped with SIGINT/SIGTERM
+*/
+static void stop_server(int) {
+    unlink(listening_path);
+    _exit(0);
+}
+
+/*
+    Compile the source text of one request
+    Returns the assembly or object, or the error message with ok set to false
+*/
+string compile_request(const string &source, bool emit_gas, bool emit_obj, bool &ok) {
+    istringstream input(source);
+    ostringstream out;
+    try {
+        compile_source(input, out, emit_gas, emit_obj);
+    } catch (const exception &e) {
+        ok = false;
+        return string("translation failed: ") + e.what();
+    }
+    ok = true;
+    return out.str();
+}
+
+/*
+    Answer one request waiting on a client connection
+    Returns false when the client hung up or the reply could not be sent
+*/
+bool serve_request(int fd) {
+    uint32_t flags;
+    string source;
+    if (!read_message(fd, flags, source)) {
+        return false;
+    }
+    bool ok;
+    string reply = compile_request(source, flags & SERVE_EMIT_GAS, flags & SERVE_EMIT_OBJ, ok);
+    return write_message(fd, ok ? SERVE_OK : SERVE_ERROR, reply);
+}
+
+/*
+    Run the compile server on a Unix domain socket until it is killed
+    The main thread polls the listening socket and every idle connection. A connection with a
+    request waiting is handed to a fixed pool of jobs worker threads, which answer that one
+    request and hand the connection back, so any number of clients can stay connected and be
+    served in turn. A worker keeps its thread_local translation state and split() regex cache
+    from one request to the next, so only the first request on each worker pays to warm them up
+*/
+int run_server(const string socket_path, int jobs) {
+    if (socket_path.size() >= sizeof(listening_path)) {
+        cerr << "Socket path too long: " << socket_path << endl;
+        return 1;
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path.c_str());
+    unlink(socket_path.c_str());  // left behind by a server that was not stopped cleanly
+    if (listen_fd < 0 || bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 64) < 0) {
+        cerr << "Cannot listen on " << socket_path << ": " << strerror(errno) << endl;
+        return 1;
+    }
+
+    strcpy(listening_path, socket_path.c_str());
+    signal(SIGINT, stop_server);
+    signal(SIGTERM, stop_server);
+    signal(SIGPIPE, SIG_IGN);  // a client hanging up mid-reply must not kill the server
+
+    mutex lock;
+    condition_variable changed;
+    deque<int> ready;  // connections with a request waiting
+    vector<int> idle;  // connections waiting for their next request
+    int wake[2];       // workers write here to make the poll loop pick up returned connections
+    if (pipe(wake) < 0) {
+        cerr << "Cannot create pipe: " << strerror(errno) << endl;
+        return 1;
+    }
+
+    vector<thread> workers;
+    for (int w = 0; w < jobs; ++w) {
+        workers.push_back(thread([&]() {
+            while (true) {
+                int fd;
+                {
+                    unique_lock<mutex> guard(lock);
+                    changed.wait(guard, [&]() { return !ready.empty(); });
+                    fd = ready.front();
+                    ready.pop_front();
+                }
+
+                if (serve_request(fd)) {
+                    lock_guard<mutex> guard(lock);
+                    idle.push_back(fd);
+                } else {
+                    close(fd);
+                }
+                char c = 0;
+                ssize_t woke = write(wake[1], &c, 1);
+                (void)woke;
+            }
+        }));
+    }
+
+    cout << "Listening on " << socket_path << " with " << jobs << " workers." << endl;
+    vector<pollfd> polled;
+    while (true) {
+        polled.clear();
+        polled.push_back({listen_fd, POLLIN, 0});
+        polled.push_back({wake[0], POLLIN, 0});
+        {
+            lock_guard<mutex> guard(lock);
+            for (int fd : idle) {
+                polled.push_back({fd, POLLIN, 0});
+            }
+        }
+
+        if (poll(polled.data(), polled.size(), -1) < 0) {
+            continue;
+        }
+
+        if (polled[1].revents & POLLIN) {
+            char drain[64];
+            ssize_t drained = read(wake[0], drain, sizeof(drain));
+            (void)drained;
+        }
+
+        lock_guard<mutex> guard(lock);
+        if (polled[0].revents & POLLIN) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd >= 0) {
+                idle.push_back(fd);
+            }
+        }
+        for (size_t i = 2; i < polled.size(); ++i) {
+            if (polled[i].revents != 0) {
+                // a request (or a hang up, which the worker notices when the read fails)
+                idle.erase(find(idle.begin(), idle.end(), polled[i].fd));
+                ready.push_back(polled[i].fd);
+                changed.notify_one();
+            }
+        }
+    }
+}
@@ -0,0 +1,12 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+
+using namespace std;
+
+string compile_request(const string &source, bool emit_gas, bool emit_obj, bool &ok);
+bool serve_request(int fd);
+int run_server(const string socket_path, int jobs);
+
+#endif
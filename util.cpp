@@ -6,10 +6,32 @@ using namespace std;
     Helper function which given a string and a delimiter, creates a iterator of the split tokens
     Sourced from: https://stackoverflow.com/questions/14265581/parse-split-a-string-in-c-using-string-delimiter-standard-c
     Need to use longer version bc: https://stackoverflow.com/questions/53582365/regex-token-iterator-attempting-to-reference-a-deleted-function
+    Plain delimiters like ", " are split with find, which gives the same tokens as the regex
+    (an empty last token is dropped unless it is the only one) at a fraction of the cost. Other patterns go through a regex,
+    compiled once per thread
 */
 vector<string> split(const string str, const string regex_str) {
-    regex regexz(regex_str);
-    vector<string> list(sregex_token_iterator(str.begin(), str.end(), regexz, -1), sregex_token_iterator());
+    vector<string> list;
+    if (regex_str.find_first_of("\\^$.|?*+()[]{}") == string::npos) {
+        size_t start = 0;
+        size_t pos;
+        while ((pos = str.find(regex_str, start)) != string::npos) {
+            list.push_back(str.substr(start, pos - start));
+            start = pos + regex_str.size();
+        }
+        if (start < str.size() || list.empty()) {
+            list.push_back(str.substr(start));
+        }
+        return list;
+    }
+
+    static thread_local map<string, regex> cache;
+    auto it = cache.find(regex_str);
+    if (it == cache.end()) {
+        it = cache.insert(make_pair(regex_str, regex(regex_str))).first;
+    }
+    const regex &regexz = it->second;
+    list.assign(sregex_token_iterator(str.begin(), str.end(), regexz, -1), sregex_token_iterator());
     return list;
 }
 
@@ -71,6 +93,28 @@ bool is_substr(const string s1, const string s2) {
     return s1.find(s2) != string::npos;
 }
 
+/*
+    Helper function to tell the characters names are made of, '.' included for the names the
+    passes make, "f.constprop.0" and the tile loops' "i.tile"
+*/
+bool is_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '.';
+}
+
+/*
+    Helper function to check whether a line uses name as a whole word
+*/
+bool mentions(const string line, const string name) {
+    for (size_t i = line.find(name); i != string::npos; i = line.find(name, i + 1)) {
+        bool starts = i == 0 || !is_name_char(line[i - 1]);
+        bool ends = i + name.size() == line.size() || !is_name_char(line[i + name.size()]);
+        if (starts && ends) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /*
     Helper function to determine if a line of code is accessing an array
 */
@@ -95,53 +139,38 @@ bool is_int(const string s) {
 }
 
 /*
-    Helper function to read a file and load all its contents
+    Helper function to read a stream and load all its contents
     line-by-line into a vector.
 */
-vector<string> loadFile(string filename, int &maxlen) {
-    ifstream inputFile;
-    inputFile.open(filename);
+vector<string> loadStream(istream &input, int &maxlen) {
     string inputLine;
-
-    if (inputFile.fail()) {
-        cout << "Failed to open file." << endl;
-    } else {
-        cout << "Opened " + filename + " successfully." << endl;
-    }
-
     vector<string> sourceCode;
-    while (!inputFile.eof()) {
-        getline(inputFile, inputLine);
+    while (getline(input, inputLine)) {
         trim(inputLine);
-        // cout << inputLine << endl;
         sourceCode.push_back(inputLine);
         maxlen++;
     }
 
-    inputFile.close();
-
     return sourceCode;
 }
 
 /*
-    Helper function to write assembly instruction to a file
+    Helper function to write assembly instructions to a stream
     Add tabs before instructiown as spacing
-    Leaves labels as if
+    Leaves labels (and symbol definitions ending with :) as is
     Adds tab between operation and first operand
     Adds 2 tabs for jump instructions
 */
-void writeFile(string filename, vector<string> assembly, string f_name) {
-    ofstream fileOUT(filename, ios::app);  // open filename.txt in append mode
-
+void writeAssembly(ostream &fileOUT, const vector<string> &assembly, string f_name) {
     for (string s : assembly) {
-        if (is_substr(s, f_name) || s.find(".L", 0) == 0) {
+        if ((!f_name.empty() && is_substr(s, f_name)) || s.find(".L", 0) == 0 || s.back() == ':') {
             if (is_substr(s, "#")) {
-                fileOUT << "\t\t" << s <<  endl;
+                fileOUT << "\t\t" << s << "\n";
             } else {
-                fileOUT << s << endl;
+                fileOUT << s << "\n";
             }
         } else if (is_substr(s, "#")) {
-            fileOUT << "\n\t\t" << s <<  endl;
+            fileOUT << "\n\t\t" << s << "\n";
         } else {
             int space_idx = s.find(" ");
             if (space_idx != string::npos) {
@@ -149,12 +178,10 @@ void writeFile(string filename, vector<string> assembly, string f_name) {
                 if (is_substr(s, ".L")) {
                     s.insert(space_idx, 1, '\t');
                 }
-                fileOUT << "\t\t" << s << endl;
+                fileOUT << "\t\t" << s << "\n";
             } else {
-                fileOUT << "\t\t" << s << endl;
+                fileOUT << "\t\t" << s << "\n";
             }
         }
     }
-
-    fileOUT.close();  // close the file
-}
\ No newline at end of file
+}
@@ -3,6 +3,7 @@
 
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <regex>
 #include <string>
 #include <vector>
@@ -16,11 +17,13 @@ void remove_ending_semicolon(string &s);
 void remove_ending_semicolon_vector(vector<string> &vec);
 string substr_between_indices(const string s, int l, int r);
 bool is_substr(const string s1, const string s2);
+bool is_name_char(char c);
+bool mentions(const string line, const string name);
 bool is_array_accessor(const string s);
 bool is_array_accessor_dynamic(const string s);
 bool is_int(const string s);
 
-vector<string> loadFile(string filename, int &maxlen);
-void writeFile(string filename, vector<string> assembly, string f_name);
+vector<string> loadStream(istream &input, int &maxlen);
+void writeAssembly(ostream &fileOUT, const vector<string> &assembly, string f_name);
 
 #endif
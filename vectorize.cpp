@@ -0,0 +1,830 @@
+#include "main.h"
+
+// the targets of --isa and of the function variants --multiversion makes, in the order
+// .Lisa_level ranks them
+const vector<VectorIsa> vector_isas = {{"sse2", 4, "%xmm", "movdqu", false, false},
+                                       {"avx2", 8, "%ymm", "vmovdqu", true, true},
+                                       {"avx512", 16, "%zmm", "vmovdqu32", true, true}};
+
+// fill and copy loops of a constant size up to this many bytes are inlined as moves of whole
+// registers, above it the startup cost of rep stos / rep movs pays off
+const long inline_fill_copy_max_bytes = 256;
+
+// set once an index reduction reads .Llane_offsets, so the file gets a copy
+thread_local bool lane_offsets_used = false;
+
+// lane opcodes of the operators the vectorizer handles
+const map<string, string> vector_opcodes = {{"+", "paddd"}, {"-", "psubd"}, {"*", "pmulld"}};
+
+const VectorIsa *find_isa(const string name) {
+    for (auto const &isa : vector_isas) {
+        if (isa.name == name) {
+            return &isa;
+        }
+    }
+    return nullptr;
+}
+
+/*
+    Helper function to check for "a[i]", an element at the loop index
+*/
+bool is_element_at(const string s, const string index) {
+    return is_array_accessor(s) && s.back() == ']' && substr_between_indices(s, s.find("[") + 1, s.size() - 1) == index;
+}
+
+/*
+    Helper function to check for an immediate or a plain variable other than the loop index
+*/
+bool is_invariant_operand(const string s, const string index) {
+    if (is_immediate(s)) {
+        return true;
+    }
+    if (s.empty() || s == index || isdigit(s[0])) {
+        return false;
+    }
+    for (char c : s) {
+        if (!isalnum(c) && c != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+    Helper function to match "for (int i = start; i < bound; i++) {", start being any expression
+    the loop variable's declaration takes, bound an immediate or a variable
+*/
+bool match_loop_header(const string line, string &index, string &start, string &bound) {
+    if (line.find("for") != 0 || line.find_first_not_of(' ', 3) != line.find('(')) {
+        return false;
+    }
+    vector<string> tokens = split(substr_between_indices(line, line.find("(") + 1, line.rfind(")")), "; ");
+    if (tokens.size() != 3) {
+        return false;
+    }
+    vector<string> init = split(tokens[0], " ");
+    vector<string> test = split(tokens[1], " ");
+    if (init.size() < 4 || init[0] != "int" || init[2] != "=" || test.size() != 3 || test[0] != init[1] ||
+        test[1] != "<" || loop_step(init[1], tokens[2]) != 1 || !is_invariant_operand(test[2], init[1])) {
+        return false;
+    }
+    index = init[1];
+    start = tokens[0].substr(tokens[0].find(" = ") + 3);
+    bound = test[2];
+    return true;
+}
+
+/*
+    Helper function to match a counting loop with a body of one assignment to an element at its
+    index, leaving the tokens of the right hand side in expr
+*/
+bool match_element_loop(const vector<string> &source, int loc, int max_len, VectorLoop &loop, vector<string> &expr) {
+    if (loc + 2 >= max_len || source[loc + 2] != "}" ||
+        !match_loop_header(source[loc], loop.index, loop.start, loop.bound)) {
+        return false;
+    }
+
+    string body = source[loc + 1];
+    size_t eq = body.find(" = ");
+    if (eq == string::npos || body.back() != ';') {
+        return false;
+    }
+    loop.dest = body.substr(0, eq);
+    expr = split(body.substr(eq + 3, body.size() - eq - 4), " ");
+    return is_element_at(loop.dest, loop.index);
+}
+
+/*
+    Matches the source of an element-wise loop, source[loc] being its for line
+    Only the shape is checked here, the types are checked when it is translated
+*/
+bool match_vector_loop(const vector<string> &source, int loc, int max_len, VectorLoop &loop) {
+    vector<string> expr;
+    if (!match_element_loop(source, loc, max_len, loop, expr) || expr.size() != 3 || !vector_opcodes.count(expr[1])) {
+        return false;
+    }
+    loop.lhs = expr[0];
+    loop.op = expr[1];
+    loop.rhs = expr[2];
+    bool lhs_element = is_element_at(loop.lhs, loop.index);
+    bool rhs_element = is_element_at(loop.rhs, loop.index);
+    return (lhs_element || rhs_element) && (lhs_element || is_invariant_operand(loop.lhs, loop.index)) &&
+           (rhs_element || is_invariant_operand(loop.rhs, loop.index));
+}
+
+/*
+    Matches the source of a loop that fills an array with a loop invariant value, "a[i] = 0;", or
+    copies one array to another, "a[i] = b[i];"
+*/
+bool match_fill_copy_loop(const vector<string> &source, int loc, int max_len, VectorLoop &loop) {
+    vector<string> expr;
+    if (!match_element_loop(source, loc, max_len, loop, expr) || expr.size() != 1) {
+        return false;
+    }
+    loop.lhs = expr[0];
+    loop.op = "";
+    loop.rhs = "";
+    return is_invariant_operand(loop.start, loop.index) &&
+           (is_element_at(loop.lhs, loop.index) || is_invariant_operand(loop.lhs, loop.index));
+}
+
+/*
+    Matches the source of a reduction loop, source[loc] being its for line
+*/
+bool match_reduction_loop(const vector<string> &source, int loc, int max_len, Reduction &red) {
+    if (loc + 2 >= max_len || !match_loop_header(source[loc], red.index, red.start, red.bound)) {
+        return false;
+    }
+    string body = source[loc + 1];
+    red.argument = false;
+    red.strict = false;
+
+    // s = s + a[i];
+    if (source[loc + 2] == "}") {
+        vector<string> tokens = split(body, " ");
+        if (tokens.size() != 5 || tokens[1] != "=" || tokens[3] != "+" || body.back() != ';') {
+            return false;
+        }
+        string rhs = tokens[4].substr(0, tokens[4].size() - 1);
+        string element = tokens[2] == tokens[0] ? rhs : rhs == tokens[0] ? tokens[2] : "";
+        red.kind = "sum";
+        red.acc = tokens[0];
+        red.array = element.substr(0, element.find("["));
+        return is_element_at(element, red.index) && is_invariant_operand(red.acc, red.index) &&
+               !is_immediate(red.acc) && red.acc != red.bound;
+    }
+
+    // if (a[i] < m) { m = a[i]; } or if (a[i] < a[k]) { k = i; }, either side of the comparison first
+    if (loc + 4 >= max_len || source[loc + 3] != "}" || source[loc + 4] != "}" || body.find("if") != 0 ||
+        body.find_first_not_of(' ', 2) != body.find('(')) {
+        return false;
+    }
+    const map<string, string> flipped = {{"<", ">"}, {">", "<"}, {"<=", ">="}, {">=", "<="}};
+    vector<string> cond = split(substr_between_indices(body, body.find("(") + 1, body.rfind(")")), " ");
+    vector<string> assign = split(source[loc + 2], " ");
+    if (cond.size() != 3 || !flipped.count(cond[1]) || assign.size() != 3 || assign[1] != "=" ||
+        source[loc + 2].back() != ';') {
+        return false;
+    }
+    if (!is_element_at(cond[0], red.index)) {
+        swap(cond[0], cond[2]);
+        cond[1] = flipped.at(cond[1]);
+    }
+    red.kind = cond[1][0] == '<' ? "min" : "max";
+    red.strict = cond[1].size() == 1;
+    red.array = cond[0].substr(0, cond[0].find("["));
+    red.acc = assign[0];
+    string value = assign[2].substr(0, assign[2].size() - 1);
+    if (!is_element_at(cond[0], red.index) || !is_invariant_operand(red.acc, red.index) || is_immediate(red.acc) ||
+        red.acc == red.bound) {
+        return false;
+    }
+    red.argument = value == red.index;
+    return red.argument ? cond[2] == red.array + "[" + red.acc + "]" : cond[2] == red.acc && value == cond[0];
+}
+
+/*
+    Whether any for loop of a function's source translates differently for each vector target
+*/
+bool has_vector_loop(const vector<string> &source) {
+    VectorLoop loop;
+    Reduction red;
+    for (size_t i = 0; i < source.size(); ++i) {
+        if (match_vector_loop(source, i, source.size(), loop) || match_fill_copy_loop(source, i, source.size(), loop) ||
+            match_reduction_loop(source, i, source.size(), red)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    Helper function to check that an operand of a matched loop is an int array element or a
+    variable of at most 4 bytes
+*/
+bool has_lane_type(const string s, const string index, Function &f1) {
+    if (is_element_at(s, index)) {
+        string arr_zero = s.substr(0, s.find("[")) + "[0]";
+        return has_variable(arr_zero, f1) && array_element_type(s, f1) == "int";
+    }
+    return is_immediate(s) || (has_variable(s, f1) && type_size(lookup_variable(s, f1).type) <= 4);
+}
+
+/*
+    Helper function to copy %eax into every 4 byte lane of a register of the target
+*/
+void broadcast_eax(const string reg, const VectorIsa &isa, Function &f1) {
+    string xmm = "%xmm" + reg.substr(4);
+    if (!isa.vex) {
+        f1.assembly_instructions.push_back("movd %eax, " + xmm);
+        f1.assembly_instructions.push_back("pshufd $0, " + xmm + ", " + xmm);
+    } else if (reg.find("%zmm") == 0) {
+        f1.assembly_instructions.push_back("vpbroadcastd %eax, " + reg);
+    } else {
+        f1.assembly_instructions.push_back("vmovd %eax, " + xmm);
+        f1.assembly_instructions.push_back("vpbroadcastd " + xmm + ", " + reg);
+    }
+}
+
+/*
+    Helper function to copy a loop invariant operand into every lane of a register
+*/
+void broadcast_operand(const string s, const string reg, const VectorIsa &isa, Function &f1) {
+    if (is_immediate(s)) {
+        move_immediate_val_into_register(s, "%eax", f1);
+    } else {
+        move_var_val_into_register(s, "%eax", f1);
+    }
+    broadcast_eax(reg, isa, f1);
+}
+
+/*
+    Helper function to sign extend an immediate or a variable of at most 4 bytes into %rax, %rcx
+    or %rdx
+*/
+void move_sign_extended(const string s, const string reg, Function &f1) {
+    if (is_immediate(s)) {
+        f1.assembly_instructions.push_back("movq $" + s + ", " + reg);
+    } else if (lookup_variable(s, f1).type == "int") {
+        f1.assembly_instructions.push_back("movslq " + var_location(s, f1) + ", " + reg);
+    } else {
+        string reg32 = "%e" + reg.substr(2);
+        move_var_val_into_register(s, reg32, f1);
+        f1.assembly_instructions.push_back("movslq " + reg32 + ", " + reg);
+    }
+}
+
+/*
+    Helper function to compare index + lanes with bound, whether at least lanes iterations are
+    left, as index with bound - lanes in 64 bits so neither side overflows, and jump on it
+    "jle" jumps when there are, "jg" when there aren't
+*/
+void jump_on_lanes_left(const string index, const string bound, int lanes, const string jump, const string label,
+                        Function &f1) {
+    if (is_immediate(bound)) {
+        f1.assembly_instructions.push_back("movq $" + to_string(stol(bound) - lanes) + ", %rdx");
+    } else {
+        move_sign_extended(bound, "%rdx", f1);
+        f1.assembly_instructions.push_back("subq $" + to_string(lanes) + ", %rdx");
+    }
+    f1.assembly_instructions.push_back("movslq " + var_location(index, f1) + ", %rax");
+    f1.assembly_instructions.push_back("cmpq %rdx, %rax");
+    f1.assembly_instructions.push_back(jump + " " + label);
+}
+
+/*
+    Translates the vector part of an element-wise loop, right after its loop variable is set
+    While at least a register's worth of iterations is left, whole registers of elements are
+    computed at once and the loop variable steps by the lane count. The scalar loop that follows
+    does the remaining iterations. Element-wise loops only read and write elements at the loop
+    index, and arrays are either the same array or don't overlap (parameters can only point to the
+    first element of an array), so no alias check is needed.
+    Returns false, translating nothing, when the loop doesn't fit the target
+*/
+bool vector_loop_handler(const VectorLoop &loop, const VectorIsa &isa, Function &f1) {
+    if ((loop.op == "*" && !isa.mulld) || lookup_variable(loop.index, f1).type != "int" ||
+        !has_lane_type(loop.dest, loop.index, f1) || !has_lane_type(loop.lhs, loop.index, f1) ||
+        !has_lane_type(loop.rhs, loop.index, f1) || !has_lane_type(loop.bound, "", f1)) {
+        return false;
+    }
+    vector<string> &code = f1.assembly_instructions;
+    string body_label = ".L" + to_string(label_num++);
+    string test_label = ".L" + to_string(label_num++);
+    string lanes = to_string(isa.lanes);
+    string acc = isa.reg + "0";
+    string opcode = (isa.vex ? "v" : "") + vector_opcodes.at(loop.op);
+
+    // loop invariant operands are broadcast once, the left one to register 6, the right one to 7
+    bool lhs_element = is_element_at(loop.lhs, loop.index);
+    bool rhs_element = is_element_at(loop.rhs, loop.index);
+    if (!lhs_element) {
+        broadcast_operand(loop.lhs, isa.reg + "6", isa, f1);
+    }
+    if (!rhs_element) {
+        broadcast_operand(loop.rhs, isa.reg + "7", isa, f1);
+    }
+    code.push_back("jmp " + test_label);
+
+    code.push_back(body_label + ":");
+    string lhs = isa.reg + "6";
+    if (lhs_element) {
+        code.push_back(isa.move + " " + element_address(loop.lhs, "%rax", f1).operand() + ", " + acc);
+        lhs = acc;
+    }
+    string rhs = isa.reg + "7";
+    if (rhs_element) {
+        rhs = element_address(loop.rhs, "%rax", f1).operand();
+    }
+    if (isa.vex) {
+        // "vpsubd b, a, dst" is dst = a - b, and its memory operand needn't be aligned
+        code.push_back(opcode + " " + rhs + ", " + lhs + ", " + acc);
+    } else {
+        // the sse2 forms are "psubd b, a" a = a - b, with a memory b that must be 16 byte aligned
+        if (lhs != acc) {
+            code.push_back("movdqa " + lhs + ", " + acc);
+        }
+        if (rhs_element) {
+            code.push_back(isa.move + " " + rhs + ", " + isa.reg + "1");
+            rhs = isa.reg + "1";
+        }
+        code.push_back(opcode + " " + rhs + ", " + acc);
+    }
+    code.push_back(isa.move + " " + acc + ", " + element_address(loop.dest, "%rax", f1).operand());
+    code.push_back("addl $" + lanes + ", " + var_location(loop.index, f1));
+
+    code.push_back(test_label + ":");
+    jump_on_lanes_left(loop.index, loop.bound, isa.lanes, "jle", body_label, f1);
+    if (isa.vex) {
+        // no penalty for the sse code of whatever runs next
+        code.push_back("vzeroupper");
+    }
+    stats.count("vectorized_loops");
+    return true;
+}
+
+/*
+    Helper function to check whether two differently named arrays may be the same array
+    An array parameter holds the address of the first element of one of the caller's arrays, so it
+    can be another parameter's array or a file scope or static array, never a local of this function
+*/
+bool may_be_same_array(const string a, const string b, Function &f1) {
+    const Variable &x = lookup_variable(a + "[0]", f1);
+    const Variable &y = lookup_variable(b + "[0]", f1);
+    return (x.is_param && (y.is_param || !y.label.empty())) || (y.is_param && !x.label.empty());
+}
+
+/*
+    Helper function to load the 4 byte pattern of a fill value into %eax, the value repeated in
+    each char or short of it
+*/
+void move_fill_pattern(const string value, int size, Function &f1) {
+    if (is_immediate(value)) {
+        unsigned long v = stol(value);
+        v = size == 1 ? (v & 0xff) * 0x01010101 : size == 2 ? (v & 0xffff) * 0x10001 : v & 0xffffffff;
+        move_immediate_val_into_register(to_string((int)v), "%eax", f1);
+        return;
+    }
+    move_var_val_into_register(value, "%eax", f1);
+    if (size == 1) {
+        f1.assembly_instructions.push_back("movzbl %al, %eax");
+        f1.assembly_instructions.push_back("imull $16843009, %eax, %eax");
+    } else if (size == 2) {
+        f1.assembly_instructions.push_back("movzwl %ax, %eax");
+        f1.assembly_instructions.push_back("imull $65537, %eax, %eax");
+    }
+}
+
+/*
+    Helper function to move bytes [off, off + width) of a fill or copy, through %rax for 1 to 8
+    bytes and through register 0 of the target for 16 or more
+*/
+void move_fill_copy_piece(Address to, Address from, bool copy, long off, int width, const VectorIsa &isa,
+                          Function &f1) {
+    to.disp += off;
+    from.disp += off;
+    string reg;
+    string move;
+    if (width >= 16) {
+        reg = (width == 64 ? "%zmm0" : width == 32 ? "%ymm0" : "%xmm0");
+        move = width == 64 ? "vmovdqu32" : isa.vex ? "vmovdqu" : "movdqu";
+    } else {
+        reg = width == 8 ? "%rax" : width == 4 ? "%eax" : width == 2 ? "%ax" : "%al";
+        move = string("mov") + size_suffix(width);
+    }
+    if (copy) {
+        f1.assembly_instructions.push_back(move + " " + from.operand() + ", " + reg);
+    }
+    f1.assembly_instructions.push_back(move + " " + reg + ", " + to.operand());
+}
+
+/*
+    Helper function to get the address of the element a fill or copy starts at
+    A constant start is added to the address of element 0, it may be the end of the array
+*/
+Address start_address(const string arr, const string start, const string index_reg, const string base_reg,
+                      Function &f1) {
+    if (!is_immediate(start)) {
+        return element_address(arr + "[" + start + "]", index_reg, f1, base_reg);
+    }
+    Address a = element_address(arr + "[0]", index_reg, f1, base_reg);
+    a.disp += stol(start) * a.scale;
+    return a;
+}
+
+/*
+    Translates a fill or copy loop on its own, the loop variable is never set
+    Up to inline_fill_copy_max_bytes of a constant size are moved with the widest registers of the
+    target that fit, the last one overlapping the one before when the size isn't a multiple of it.
+    Others are a rep stos / rep movs of the elements, skipped when the count isn't positive.
+    A copy between arrays that may be the same array is skipped when they are.
+    Returns false, translating nothing, when the element or value types don't fit
+*/
+bool fill_copy_loop_handler(const VectorLoop &loop, const VectorIsa &isa, Function &f1) {
+    string dest = loop.dest.substr(0, loop.dest.find("["));
+    bool copy = is_element_at(loop.lhs, loop.index);
+    string src = copy ? loop.lhs.substr(0, loop.lhs.find("[")) : "";
+    if (!has_variable(dest + "[0]", f1) || !has_lane_type(loop.start, "", f1) || !has_lane_type(loop.bound, "", f1) ||
+        (is_immediate(loop.start) && loop.start[0] == '-')) {
+        return false;
+    }
+    string type = array_element_type(loop.dest, f1);
+    int size = type_size(type);
+    if (size > 4 || (copy && (!has_variable(src + "[0]", f1) || array_element_type(loop.lhs, f1) != type)) ||
+        (!copy && !has_lane_type(loop.lhs, loop.index, f1))) {
+        return false;
+    }
+    stats.count(copy ? "copy_loops" : "fill_loops");
+
+    vector<string> &code = f1.assembly_instructions;
+    bool constant = is_immediate(loop.start) && is_immediate(loop.bound);
+    long count = constant ? max(0L, stol(loop.bound) - stol(loop.start)) : 0;
+    if (dest == src || (constant && count == 0)) {
+        // copies each element onto itself, or runs no iterations
+        return true;
+    }
+    bool check_alias = copy && may_be_same_array(dest, src, f1);
+    string skip_label = check_alias || !constant ? ".L" + to_string(label_num++) : "";
+
+    // at -Os rep stos/movs is always the shorter form
+    if (constant && count * size <= inline_fill_copy_max_bytes && !optimize_for_size()) {
+        long bytes = count * size;
+        Address to = start_address(dest, loop.start, "%rcx", "%r10", f1);
+        Address from = copy ? start_address(src, loop.start, "%rdx", "%r11", f1) : Address();
+        if (check_alias) {
+            // the bases, a parameter's pointer or a file scope array's address
+            string a = to.base;
+            string b = from.base;
+            if (a.empty() || b.empty()) {
+                code.push_back("leaq " + (a.empty() ? to.symbol : from.symbol) + "(%rip), %rax");
+                (a.empty() ? a : b) = "%rax";
+            }
+            code.push_back("cmpq " + a + ", " + b);
+            code.push_back("je " + skip_label);
+        }
+        int width = isa.lanes * 4;
+        while (width > 16 && width > bytes) {
+            width /= 2;
+        }
+        if (bytes >= 16) {
+            if (!copy) {
+                move_fill_pattern(loop.lhs, size, f1);
+                broadcast_eax((width == 64 ? "%zmm0" : width == 32 ? "%ymm0" : "%xmm0"), isa, f1);
+            }
+            for (long off = 0; off + width <= bytes; off += width) {
+                move_fill_copy_piece(to, from, copy, off, width, isa, f1);
+            }
+            if (bytes % width != 0) {
+                move_fill_copy_piece(to, from, copy, bytes - width, width, isa, f1);
+            }
+            if (isa.vex) {
+                code.push_back("vzeroupper");
+            }
+        } else {
+            if (!copy) {
+                move_fill_pattern(loop.lhs, size, f1);
+            }
+            long off = 0;
+            for (int piece = copy ? 8 : 4; piece >= 1; piece /= 2) {
+                for (; off + piece <= bytes; off += piece) {
+                    move_fill_copy_piece(to, from, copy, off, piece, isa, f1);
+                }
+            }
+        }
+    } else {
+        if (constant) {
+            code.push_back("movq $" + to_string(count) + ", %rcx");
+        } else {
+            // bound - start elements, none when that isn't positive
+            move_sign_extended(loop.bound, "%rcx", f1);
+            if (!is_immediate(loop.start)) {
+                move_sign_extended(loop.start, "%rax", f1);
+                code.push_back("subq %rax, %rcx");
+            } else {
+                code.push_back("subq $" + loop.start + ", %rcx");
+            }
+            code.push_back("jle " + skip_label);
+        }
+        code.push_back("leaq " + start_address(dest, loop.start, "%rdx", "%r10", f1).operand() + ", %rdi");
+        if (copy) {
+            code.push_back("leaq " + start_address(src, loop.start, "%rdx", "%r10", f1).operand() + ", %rsi");
+            if (check_alias) {
+                code.push_back("cmpq %rsi, %rdi");
+                code.push_back("je " + skip_label);
+            }
+            code.push_back("rep movs" + size_suffix(size));
+        } else {
+            if (is_immediate(loop.lhs)) {
+                move_immediate_val_into_register(loop.lhs, "%eax", f1);
+            } else {
+                move_var_val_into_register(loop.lhs, "%eax", f1);
+            }
+            code.push_back("rep stos" + size_suffix(size));
+        }
+    }
+    if (!skip_label.empty()) {
+        code.push_back(skip_label + ":");
+    }
+    return true;
+}
+
+/*
+    Helper function to compare the lanes of a > b, into %k1 with avx512 and into register 4
+    otherwise, returning where the mask went
+*/
+string compare_lanes(const string a, const string b, const VectorIsa &isa, Function &f1) {
+    if (!isa.vex) {
+        f1.assembly_instructions.push_back("movdqa " + a + ", %xmm4");
+        f1.assembly_instructions.push_back("pcmpgtd " + b + ", %xmm4");
+        return "%xmm4";
+    }
+    string mask = isa.lanes == 16 ? "%k1" : isa.reg + "4";
+    f1.assembly_instructions.push_back("vpcmpgtd " + b + ", " + a + ", " + mask);
+    return mask;
+}
+
+/*
+    Helper function to set each lane of dst to the lane of when_set where the mask is set and to
+    the lane of when_clear where it isn't
+    sse2 has no blend, so it is (when_set & mask) | (when_clear & ~mask) in registers 8 and 9
+*/
+void blend_lanes(const string mask, const string when_set, const string when_clear, const string dst,
+                 const VectorIsa &isa, Function &f1) {
+    vector<string> &code = f1.assembly_instructions;
+    if (!isa.vex) {
+        code.push_back("movdqa " + mask + ", %xmm8");
+        code.push_back("pand " + when_set + ", %xmm8");
+        code.push_back("movdqa " + mask + ", %xmm9");
+        code.push_back("pandn " + when_clear + ", %xmm9");
+        code.push_back("por %xmm9, %xmm8");
+        code.push_back("movdqa %xmm8, " + dst);
+    } else if (mask == "%k1") {
+        code.push_back("vpblendmd " + when_set + ", " + when_clear + ", " + dst + "{%k1}");
+    } else {
+        code.push_back("vpblendvb " + mask + ", " + when_set + ", " + when_clear + ", " + dst);
+    }
+}
+
+/*
+    Helper function to keep the min or max of the lanes of src and dst in dst
+    src is a register, or memory with the vex forms
+*/
+void min_max_lanes(const string kind, const string src, const string dst, const VectorIsa &isa, Function &f1) {
+    if (isa.vex) {
+        f1.assembly_instructions.push_back("vp" + kind + "sd " + src + ", " + dst + ", " + dst);
+        return;
+    }
+    // pminsd and pmaxsd are SSE4.1
+    string mask = kind == "min" ? compare_lanes(dst, src, isa, f1) : compare_lanes(src, dst, isa, f1);
+    blend_lanes(mask, src, dst, dst, isa, f1);
+}
+
+/*
+    Translates the vector part of a reduction loop, right after its loop variable is set
+    A sum or a min / max keeps two registers of partial results, two independent dependence chains
+    of one add or min per register of elements. The index of the min / max keeps the best value
+    each lane has seen and its index, compares every register of elements with the values and
+    blends the ones it takes into both. Once fewer than a register's worth of iterations are left,
+    the lanes are stored below the stack pointer and reduced to one result that goes back into the
+    variable, and the scalar loop that follows does the remaining iterations.
+    Returns false, translating nothing, when the types don't fit
+*/
+bool reduction_loop_handler(const Reduction &red, const VectorIsa &isa, Function &f1) {
+    if (!has_variable(red.array + "[0]", f1) || array_element_type(red.array + "[0]", f1) != "int" ||
+        !has_variable(red.acc, f1) || lookup_variable(red.acc, f1).type != "int" || !has_lane_type(red.bound, "", f1)) {
+        return false;
+    }
+    vector<string> &code = f1.assembly_instructions;
+    string body_label = ".L" + to_string(label_num++);
+    string test_label = ".L" + to_string(label_num++);
+    string done_label = ".L" + to_string(label_num++);
+    string element = red.array + "[" + red.index + "]";
+    string acc_location = var_location(red.acc, f1);
+    int lanes = isa.lanes;
+    int spill_bytes = 4 * lanes;
+    auto reg = [&isa](int n) { return isa.reg + to_string(n); };
+    // the lanes are stored below %rsp, so it has to be below the locals rather than use the red zone
+    f1.is_leaf_function = false;
+
+    if (!red.argument) {
+        if (red.kind == "sum") {
+            code.push_back(isa.vex ? "vpxor %xmm0, %xmm0, %xmm0" : "pxor %xmm0, %xmm0");
+            code.push_back(isa.vex ? "vpxor %xmm1, %xmm1, %xmm1" : "pxor %xmm1, %xmm1");
+        } else {
+            broadcast_operand(red.acc, reg(0), isa, f1);
+            code.push_back(isa.move + " " + reg(0) + ", " + reg(1));
+        }
+        code.push_back("jmp " + test_label);
+
+        code.push_back(body_label + ":");
+        Address first = element_address(element, "%rax", f1);
+        Address second = first;
+        second.disp += spill_bytes;
+        for (int k = 0; k < 2; ++k) {
+            string src = (k == 0 ? first : second).operand();
+            if (!isa.vex) {
+                code.push_back(isa.move + " " + src + ", " + reg(2 + k));
+                src = reg(2 + k);
+            }
+            if (red.kind == "sum") {
+                code.push_back((isa.vex ? "vpaddd " + src + ", " + reg(k) + ", " : "paddd " + src + ", ") + reg(k));
+            } else {
+                min_max_lanes(red.kind, src, reg(k), isa, f1);
+            }
+        }
+        code.push_back("addl $" + to_string(2 * lanes) + ", " + var_location(red.index, f1));
+        code.push_back(test_label + ":");
+        jump_on_lanes_left(red.index, red.bound, 2 * lanes, "jle", body_label, f1);
+
+        if (red.kind == "sum") {
+            code.push_back(isa.vex ? "vpaddd " + reg(1) + ", " + reg(0) + ", " + reg(0) : "paddd %xmm1, %xmm0");
+        } else {
+            min_max_lanes(red.kind, reg(1), reg(0), isa, f1);
+        }
+        code.push_back("subq $" + to_string(spill_bytes) + ", %rsp");
+        code.push_back(isa.move + " " + reg(0) + ", (%rsp)");
+        code.push_back("movl (%rsp), %eax");
+        for (int l = 1; l < lanes; ++l) {
+            string lane = to_string(4 * l) + "(%rsp)";
+            if (red.kind == "sum") {
+                code.push_back("addl " + lane + ", %eax");
+            } else {
+                code.push_back("movl " + lane + ", %edx");
+                code.push_back("cmpl %edx, %eax");
+                code.push_back((red.kind == "min" ? "cmovg" : "cmovl") + string(" %edx, %eax"));
+            }
+        }
+        code.push_back("addq $" + to_string(spill_bytes) + ", %rsp");
+        code.push_back((red.kind == "sum" ? "addl" : "movl") + string(" %eax, ") + acc_location);
+    } else {
+        /*
+            register 0 holds the best value of each lane, starting from one every element beats,
+            register 5 its index, 6 the index of each lane's element and 7 the lane count
+        */
+        move_immediate_val_into_register(red.kind == "min" ? "2147483647" : "-2147483648", "%eax", f1);
+        broadcast_eax(reg(0), isa, f1);
+        code.push_back(isa.vex ? "vpxor %xmm5, %xmm5, %xmm5" : "pxor %xmm5, %xmm5");
+        broadcast_operand(red.index, reg(6), isa, f1);
+        code.push_back((isa.vex ? "vpaddd .Llane_offsets(%rip), " + reg(6) + ", " : "paddd .Llane_offsets(%rip), ") +
+                       reg(6));
+        lane_offsets_used = true;
+        broadcast_operand(to_string(lanes), reg(7), isa, f1);
+        jump_on_lanes_left(red.index, red.bound, lanes, "jg", done_label, f1);
+
+        /*
+            A < or > takes an element that beats the lane's value, the first of equal ones, and
+            a <= or >= keeps the lane's value only when it beats the element, taking the last
+        */
+        code.push_back(body_label + ":");
+        code.push_back(isa.move + " " + element_address(element, "%rax", f1).operand() + ", " + reg(2));
+        bool element_greater = (red.kind == "max") == red.strict;
+        string mask = element_greater ? compare_lanes(reg(2), reg(0), isa, f1) : compare_lanes(reg(0), reg(2), isa, f1);
+        if (red.strict) {
+            blend_lanes(mask, reg(2), reg(0), reg(0), isa, f1);
+            blend_lanes(mask, reg(6), reg(5), reg(5), isa, f1);
+        } else {
+            blend_lanes(mask, reg(0), reg(2), reg(0), isa, f1);
+            blend_lanes(mask, reg(5), reg(6), reg(5), isa, f1);
+        }
+        code.push_back((isa.vex ? "vpaddd " + reg(7) + ", " + reg(6) + ", " : "paddd %xmm7, ") + reg(6));
+        code.push_back("addl $" + to_string(lanes) + ", " + var_location(red.index, f1));
+        jump_on_lanes_left(red.index, red.bound, lanes, "jle", body_label, f1);
+
+        /*
+            Each lane is the key value << 32 | index, with the index inverted where the smaller one
+            should win a tie of a max or the larger one a tie of a min, so the best lane is the
+            min or max key
+        */
+        bool invert = (red.kind == "max") == red.strict;
+        code.push_back("subq $" + to_string(2 * spill_bytes) + ", %rsp");
+        code.push_back(isa.move + " " + reg(0) + ", (%rsp)");
+        code.push_back(isa.move + " " + reg(5) + ", " + to_string(spill_bytes) + "(%rsp)");
+        for (int l = 0; l < lanes; ++l) {
+            code.push_back("movslq " + to_string(4 * l) + "(%rsp), %rax");
+            code.push_back("shlq $32, %rax");
+            code.push_back("movl " + to_string(spill_bytes + 4 * l) + "(%rsp), %esi");
+            if (invert) {
+                code.push_back("notl %esi");
+            }
+            code.push_back("orq %rsi, %rax");
+            if (l == 0) {
+                code.push_back("movq %rax, %rdx");
+            } else {
+                code.push_back("cmpq %rax, %rdx");
+                code.push_back((red.kind == "min" ? "cmovg" : "cmovl") + string(" %rax, %rdx"));
+            }
+        }
+        code.push_back("addq $" + to_string(2 * spill_bytes) + ", %rsp");
+        code.push_back("movl %edx, %esi");
+        if (invert) {
+            code.push_back("notl %esi");
+        }
+        code.push_back("sarq $32, %rdx");
+
+        // the best lane only replaces the index the loop started with when it beats its element
+        code.push_back("movl " + element_address(red.array + "[" + red.acc + "]", "%rcx", f1).operand() + ", %eax");
+        code.push_back("cmpl %eax, %edx");
+        string keep = red.kind == "min" ? (red.strict ? "jge" : "jg") : (red.strict ? "jle" : "jl");
+        code.push_back(keep + " " + done_label);
+        code.push_back("movl %esi, " + acc_location);
+        code.push_back(done_label + ":");
+    }
+    if (isa.vex) {
+        code.push_back("vzeroupper");
+    }
+    stats.count("vectorized_reductions");
+    return true;
+}
+
+/*
+    Read only data of the vector code: 0 to 15, the offset of each lane of the index reductions
+*/
+vector<string> vector_constant_instructions() {
+    vector<string> out;
+    if (!lane_offsets_used) {
+        return out;
+    }
+    out.push_back(".section .rodata");
+    out.push_back(".align 64");
+    out.push_back(".Llane_offsets:");
+    for (int l = 0; l < 16; ++l) {
+        out.push_back(".long " + to_string(l));
+    }
+    return out;
+}
+
+/*
+    The function a multiversioned function's callers reach: it jumps through name.dispatch, which
+    first points at the resolver below. On the first call the resolver asks .Lisa_level for the
+    best variant this cpu runs, stores its address in name.dispatch and jumps to it with the
+    argument registers and stack untouched, so the variant returns straight to the caller.
+*/
+vector<string> dispatcher_instructions(const string name) {
+    string picked = ".L" + to_string(label_num++);
+    vector<string> out = {name + ":", "jmp *" + name + ".dispatch(%rip)", name + ".resolve:"};
+    vector<string> saved = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
+    for (auto const &reg : saved) {
+        out.push_back("pushq " + reg);
+    }
+    // 6 pushes after the return address leave the stack 8 bytes off a call's 16 byte alignment
+    out.push_back("subq $8, %rsp");
+    out.push_back("call .Lisa_level");
+    out.push_back("leaq " + name + "." + vector_isas[0].name + "(%rip), %r11");
+    for (size_t level = 1; level < vector_isas.size(); ++level) {
+        out.push_back("cmpl $" + to_string(level) + ", %eax");
+        out.push_back("jl " + picked);
+        out.push_back("leaq " + name + "." + vector_isas[level].name + "(%rip), %r11");
+    }
+    out.push_back(picked + ":");
+    out.push_back("movq %r11, " + name + ".dispatch(%rip)");
+    out.push_back("addq $8, %rsp");
+    for (auto it = saved.rbegin(); it != saved.rend(); ++it) {
+        out.push_back("popq " + *it);
+    }
+    out.push_back("jmp *%r11");
+    return out;
+}
+
+/*
+    .Lisa_level returns the index into vector_isas of the best one the cpu and the OS support:
+    avx2 needs cpuid leaf 7 ebx bit 5 and the OS saving the ymm registers (OSXSAVE and AVX in
+    leaf 1 ecx, xgetbv bits 1-2), avx512 needs AVX512F (leaf 7 ebx bit 16) and the opmask and zmm
+    state as well (xgetbv bits 5-7)
+*/
+vector<string> isa_level_instructions() {
+    string done = ".L" + to_string(label_num++);
+    return {".Lisa_level:",
+            "pushq %rbx",
+            "movl $0, %r8d",
+            "movl $0, %eax",
+            "cpuid",
+            "cmpl $7, %eax",
+            "jl " + done,
+            "movl $1, %eax",
+            "cpuid",
+            "andl $0x18000000, %ecx",
+            "cmpl $0x18000000, %ecx",
+            "jne " + done,
+            "movl $0, %ecx",
+            "xgetbv",
+            "movl %eax, %r9d",
+            "movl $7, %eax",
+            "movl $0, %ecx",
+            "cpuid",
+            "movl %r9d, %eax",
+            "andl $0x6, %eax",
+            "cmpl $0x6, %eax",
+            "jne " + done,
+            "testl $0x20, %ebx",
+            "je " + done,
+            "movl $1, %r8d",
+            "andl $0xe6, %r9d",
+            "cmpl $0xe6, %r9d",
+            "jne " + done,
+            "testl $0x10000, %ebx",
+            "je " + done,
+            "movl $2, %r8d",
+            done + ":",
+            "movl %r8d, %eax",
+            "popq %rbx",
+            "ret"};
+}
@@ -0,0 +1,75 @@
+#ifndef VECTORIZE_H
+#define VECTORIZE_H
+
+#include <string>
+#include <vector>
+
+#include "Function.h"
+
+using namespace std;
+
+/*
+    A vector instruction set a function can be translated for
+    sse2 is part of every x86-64 cpu, avx2 and avx512 are picked at run time by the dispatcher
+*/
+class VectorIsa {
+   public:
+    string name;
+    int lanes;      // ints per register
+    string reg;     // register prefix, "%xmm", "%ymm" or "%zmm"
+    string move;    // unaligned load and store
+    bool vex;       // three operand forms, "v" prefixed opcodes
+    bool mulld;     // has a 32 bit lane multiply (pmulld is SSE4.1, not sse2)
+};
+
+/*
+    An element-wise for loop, "for (int i = start; i < bound; i++) { dest[i] = lhs op rhs; }"
+    lhs and rhs are elements of int arrays at i, loop invariant variables or immediates, at least
+    one of them an element. A fill or copy loop, "dest[i] = lhs;", has no op and rhs.
+*/
+class VectorLoop {
+   public:
+    string index;
+    string start;
+    string bound;
+    string dest;
+    string lhs;
+    string op;
+    string rhs;
+};
+
+/*
+    A reduction loop over an int array a, "for (int i = start; i < bound; i++) {" around
+    "s = s + a[i];" (sum), "if (a[i] < m) { m = a[i]; }" (min, max with >) or
+    "if (a[i] < a[k]) { k = i; }" (the index of the min or max)
+*/
+class Reduction {
+   public:
+    string index;
+    string start;
+    string bound;
+    string kind;    // "sum", "min" or "max"
+    string array;
+    string acc;     // s, m or k
+    bool argument;  // acc is the index of the min / max
+    bool strict;    // < or >: the first index of several equal ones, <= or >= the last
+};
+
+extern const vector<VectorIsa> vector_isas;
+extern thread_local bool lane_offsets_used;
+
+const VectorIsa *find_isa(const string name);
+bool is_invariant_operand(const string s, const string index);
+bool match_loop_header(const string line, string &index, string &start, string &bound);
+bool match_vector_loop(const vector<string> &source, int loc, int max_len, VectorLoop &loop);
+bool has_vector_loop(const vector<string> &source);
+bool vector_loop_handler(const VectorLoop &loop, const VectorIsa &isa, Function &f1);
+bool match_fill_copy_loop(const vector<string> &source, int loc, int max_len, VectorLoop &loop);
+bool fill_copy_loop_handler(const VectorLoop &loop, const VectorIsa &isa, Function &f1);
+bool match_reduction_loop(const vector<string> &source, int loc, int max_len, Reduction &red);
+bool reduction_loop_handler(const Reduction &red, const VectorIsa &isa, Function &f1);
+vector<string> vector_constant_instructions();
+vector<string> dispatcher_instructions(const string name);
+vector<string> isa_level_instructions();
+
+#endif